@@ -0,0 +1,868 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "thallium/batch.hpp"
+#include "thallium/lanes.hpp"
+#include "thallium/optimizer.hpp"
+#include "thallium/program_cache.hpp"
+#include "thallium/vm.hpp"
+#include "thallium/error.hpp"
+#include "kernels.hpp"
+
+using namespace thallium;
+using namespace thallium::bench;
+
+/**
+ * Command line options of thalliumvm_bench
+ */
+struct Options
+{
+	std::string output = "thalliumvm_bench.csv";
+	std::string baseline;
+	double threshold = 10.0;
+	size_t repetitions = 5;
+	std::string filter;
+	bool quick = false;
+	std::vector<Engine> engines = {Engine::Switch, Engine::Threaded, Engine::Jit};
+
+	/**
+	 * Whether to run the kernels compiled ahead of time, which are only timed on their own
+	 */
+	bool aot = true;
+};
+
+/**
+ * Timing of one benchmark, for one engine
+ */
+struct Result
+{
+	std::string name;
+	std::string engine;
+	uint64_t instructions;
+	size_t repetitions;
+	double mean_ns;
+	double stddev_ns;
+
+	double ns_per_instruction() const
+	{
+		return mean_ns / instructions;
+	}
+
+	double instructions_per_second() const
+	{
+		return instructions / (mean_ns * 1e-9);
+	}
+};
+
+std::string engine_name(const Engine engine)
+{
+	switch (engine)
+	{
+	case Engine::Switch: return "switch";
+	case Engine::Threaded: return "threaded";
+	case Engine::Jit: return "jit";
+	case Engine::Aot: return "aot";
+	}
+
+	return "?";
+}
+
+template<typename F>
+Result measure(const std::string& name, const std::string& engine, const uint64_t instructions,
+			   const size_t repetitions, F&& timed)
+{
+	// warmup run, not accounted for
+	timed();
+
+	std::vector<double> samples;
+	for (size_t i = 0; i < repetitions; ++i)
+	{
+		samples.push_back(timed());
+	}
+
+	double mean = 0;
+	for (const double s : samples)
+		mean += s;
+	mean /= samples.size();
+
+	double variance = 0;
+	for (const double s : samples)
+		variance += (s - mean) * (s - mean);
+	variance /= samples.size();
+
+	return {name, engine, instructions, repetitions, mean, std::sqrt(variance)};
+}
+
+Result run_kernel(const Kernel& kernel, const Engine engine, const size_t repetitions,
+				  const MemoryMode mode = MemoryMode::Flat)
+{
+	const std::string name = mode == MemoryMode::Guarded ? "guarded/" + kernel.name : kernel.name;
+
+	return measure(name, engine_name(engine), kernel.instructions, repetitions, [&]() {
+		VM vm{kernel.memory_size, mode};
+		bind_host_functions(vm);
+		vm.import_program(kernel.program);
+
+		const auto begin = std::chrono::steady_clock::now();
+		const Trap trap = vm.run(engine);
+		const auto end = std::chrono::steady_clock::now();
+
+		if (trap)
+			error(TimeOfError::Runtime, ErrorType::Fatal, "benchmark '" + kernel.name + "' trapped: " + trap.message());
+
+		const vmreg_t result = vm.registers()[kernel.result_register];
+		tassert(result == kernel.expected,
+				TimeOfError::Runtime, ErrorType::Fatal,
+				"benchmark '" + kernel.name + "' computed " + std::to_string(result)
+				+ " instead of " + std::to_string(kernel.expected) + ".");
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Runs a kernel through the checked interpreters, its verification being voided by rewriting its first instruction
+ * in place, to compare with the certified runs.
+ */
+Result run_unverified(const Kernel& kernel, const Engine engine, const size_t repetitions)
+{
+	return measure("unverified/" + kernel.name, engine_name(engine), kernel.instructions, repetitions, [&]() {
+		VM vm{kernel.memory_size};
+		bind_host_functions(vm);
+		vm.import_program(kernel.program);
+
+		const auto first = kernel.program.front().serialize();
+		vm.write_memory(0, first.data(), first.size());
+
+		const auto begin = std::chrono::steady_clock::now();
+		const Trap trap = vm.run(engine);
+		const auto end = std::chrono::steady_clock::now();
+
+		if (trap || vm.registers()[kernel.result_register] != kernel.expected)
+			error(TimeOfError::Runtime, ErrorType::Fatal, "unverified benchmark '" + kernel.name + "' computed a wrong result.");
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Rewrites a kernel with optimize(), only its result register being read after exit. The instruction count of the
+ * original is kept, so that times per instruction compare with the original run.
+ */
+Kernel optimized_kernel(const Kernel& kernel)
+{
+	const OptimizedProgram optimized = optimize(kernel.program, 0, 0, {kernel.result_register});
+
+	tassert(optimized.stats.diagnostic.empty() && optimized.entry == 0,
+			TimeOfError::Preload, ErrorType::Fatal,
+			"benchmark '" + kernel.name + "' cannot be optimized: " + optimized.stats.diagnostic);
+
+	Kernel result = kernel;
+	result.name = "opt/" + kernel.name;
+	result.program = optimized.program;
+	return result;
+}
+
+/**
+ * Runs a kernel on every lane of a LaneVM at once, counting the instructions of every lane.
+ */
+Result run_lanes(const Kernel& kernel, const size_t repetitions)
+{
+	const auto image = ProgramImage::create(kernel.program);
+	const uint64_t instructions = kernel.instructions * LaneVM<>::lanes();
+
+	return measure("lanes/" + kernel.name, "-", instructions, repetitions, [&]() {
+		LaneVM<> vm{image, kernel.memory_size};
+
+		const auto begin = std::chrono::steady_clock::now();
+		vm.run();
+		const auto end = std::chrono::steady_clock::now();
+
+		for (size_t lane = 0; lane < vm.lanes(); ++lane)
+		{
+			if (vm.trap(lane) || vm.reg(lane, kernel.result_register) != kernel.expected)
+				error(TimeOfError::Runtime, ErrorType::Fatal, "benchmark '" + kernel.name + "' computed a wrong result in lanes.");
+		}
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Runs a kernel on a VM of a given configuration.
+ */
+template<typename Config>
+Result run_config(const std::string& config, const Kernel& kernel, const Engine engine, const size_t repetitions)
+{
+	return measure("cfg/" + config + "/" + kernel.name, engine_name(engine), kernel.instructions, repetitions, [&]() {
+		BasicVM<Config> vm{kernel.memory_size};
+		vm.import_program(kernel.program);
+
+		const auto begin = std::chrono::steady_clock::now();
+		const Trap trap = vm.run(engine);
+		const auto end = std::chrono::steady_clock::now();
+
+		if (trap || vm.registers()[kernel.result_register] != kernel.expected)
+			error(TimeOfError::Runtime, ErrorType::Fatal, "benchmark '" + kernel.name + "' computed a wrong result with configuration " + config + ".");
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Runs a kernel on a VM whose engine is picked at compile time.
+ */
+Result run_fixed_config(const Kernel& kernel, const Engine engine, const size_t repetitions)
+{
+	switch (engine)
+	{
+	case Engine::Threaded:
+		return run_config<VMConfig<VMMemory, 256, true, true, Engine::Threaded, true>>("fixed", kernel, engine, repetitions);
+	case Engine::Jit:
+		return run_config<VMConfig<VMMemory, 256, true, true, Engine::Jit, true>>("fixed", kernel, engine, repetitions);
+	case Engine::Aot:
+		return run_config<VMConfig<VMMemory, 256, true, true, Engine::Aot, true>>("fixed", kernel, engine, repetitions);
+	default:
+		return run_config<VMConfig<VMMemory, 256, true, true, Engine::Switch, true>>("fixed", kernel, engine, repetitions);
+	}
+}
+
+/**
+ * Runs a kernel on every VM configuration of the matrix.
+ */
+std::vector<Result> run_configs(const Kernel& kernel, const Engine engine, const size_t repetitions)
+{
+	return {
+		run_config<VMConfig<>>("default", kernel, engine, repetitions),
+		run_fixed_config(kernel, engine, repetitions),
+		run_config<VMConfig<PagedMemory>>("paged", kernel, engine, repetitions),
+		run_config<VMConfig<VMMemory, 32>>("gp32", kernel, engine, repetitions),
+		run_config<VMConfig<VMMemory, 256, false>>("unchecked", kernel, engine, repetitions),
+		run_config<VMConfig<VMMemory, 256, true, false>>("noprofile", kernel, engine, repetitions),
+		run_config<VMConfig<VMMemory, 32, false, false>>("lean", kernel, engine, repetitions)
+	};
+}
+
+Result run_import(const size_t instructions, const size_t repetitions)
+{
+	const std::vector<Instruction> program = import_program_input(instructions);
+	VM vm{program.size() * Instruction::size()};
+
+	return measure("import_program", "-", program.size(), repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		vm.import_program(program);
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Decodes every instruction of a large program from its serialized code, as translation and fetches of modified
+ * code do.
+ */
+Result run_fetch(const size_t instructions, const size_t repetitions)
+{
+	const std::vector<Instruction> program = import_program_input(instructions);
+	std::vector<uint8_t> code(program.size() * Instruction::size());
+	serialize_instructions(program.data(), program.size(), code.data());
+
+	uint64_t expected = 0;
+	for (const Instruction& i : program)
+		expected += i.opcode == Opcode::imm ? uint32_t(i.argument) : 0;
+
+	return measure("fetch", "-", program.size(), repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		uint64_t sum = 0;
+		for (size_t i = 0; i < program.size(); ++i)
+		{
+			const DecodedInstruction d = VM::decode_instruction(code.data() + i * Instruction::size());
+			sum += d.op == DecodedOp::imm ? d.imm : 0;
+		}
+		const auto end = std::chrono::steady_clock::now();
+
+		if (sum != expected)
+			error(TimeOfError::Runtime, ErrorType::Fatal, "fetch benchmark decoded a wrong immediate.");
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Serializes a large program into its code, as import_program does.
+ */
+Result run_serialize(const size_t instructions, const size_t repetitions)
+{
+	const std::vector<Instruction> program = import_program_input(instructions);
+	std::vector<uint8_t> code(program.size() * Instruction::size());
+
+	return measure("serialize", "-", program.size(), repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		serialize_instructions(program.data(), program.size(), code.data());
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+Result run_batch(const Kernel& kernel, const Engine engine, const size_t threads, const size_t jobs, const size_t repetitions)
+{
+	BatchRunner runner{kernel.program, kernel.memory_size, {kernel.result_register}, threads, engine};
+	const std::vector<BatchInput> inputs(jobs);
+
+	return measure("batch/" + kernel.name + "/" + std::to_string(threads) + "t", engine_name(engine),
+				   kernel.instructions * jobs, repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		const std::vector<BatchResult> results = runner.run(inputs);
+		const auto end = std::chrono::steady_clock::now();
+
+		for (const BatchResult& r : results)
+		{
+			tassert(!r.trap && r.registers[0] == kernel.expected,
+					TimeOfError::Runtime, ErrorType::Fatal,
+					"batch benchmark '" + kernel.name + "' computed a wrong result.");
+		}
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+Result run_fibers(const Kernel& kernel, const Engine engine, const size_t threads, const size_t repetitions)
+{
+	return measure("fibers/" + kernel.name + "/" + std::to_string(threads) + "t", engine_name(engine),
+				   kernel.instructions, repetitions, [&]() {
+		VM vm{kernel.memory_size};
+		vm.set_fiber_threads(threads);
+		vm.import_program(kernel.program);
+
+		const auto begin = std::chrono::steady_clock::now();
+		const Trap trap = vm.run(engine);
+		const auto end = std::chrono::steady_clock::now();
+
+		if (trap || vm.registers()[kernel.result_register] != kernel.expected)
+			error(TimeOfError::Runtime, ErrorType::Fatal, "fiber benchmark '" + kernel.name + "' computed a wrong result.");
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+Result run_import_image(const size_t instructions, const size_t repetitions)
+{
+	const std::shared_ptr<const ProgramImage> image = ProgramImage::create(import_program_input(instructions));
+
+	return measure("import_image", "-", image->count(), repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		VM vm{image->size()};
+		vm.import_program(image);
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Runs many programs which fault right away, as a sandbox rejecting bad guests would.
+ */
+Result run_traps(const size_t runs, const Engine engine, const size_t repetitions)
+{
+	VM vm{64 * 1024};
+	vm.import_program({
+		{Opcode::imm, (uint64_t(10) << 32) | 0xFFFFFFF0}, // imm FFFFFFF0 %r10
+		{Opcode::teq, 0x00000000000A000A},                 // teq %r10 %r10
+		{Opcode::cjmpr, 10}                                // cjmpr %r10, out of memory
+	});
+
+	return measure("traps", engine_name(engine), runs, repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < runs; ++i)
+		{
+			vm.reset();
+			if (vm.run(engine).code != TrapCode::InstructionOutOfBounds)
+				error(TimeOfError::Runtime, ErrorType::Fatal, "the trap benchmark did not trap.");
+		}
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Runs a kernel in slices of a fixed instruction budget, resuming after each one as a scheduler interleaving
+ * many guests would.
+ */
+Result run_fuel(const Kernel& kernel, const Engine engine, const uint64_t slice, const size_t repetitions)
+{
+	return measure("fuel/" + kernel.name, engine_name(engine), kernel.instructions, repetitions, [&]() {
+		VM vm{kernel.memory_size};
+		vm.import_program(kernel.program);
+
+		const auto begin = std::chrono::steady_clock::now();
+		Trap trap = vm.run_for(slice, engine);
+		while (trap.resumable())
+			trap = vm.run_for(slice, engine);
+		const auto end = std::chrono::steady_clock::now();
+
+		if (trap || vm.registers()[kernel.result_register] != kernel.expected)
+			error(TimeOfError::Runtime, ErrorType::Fatal, "fuel benchmark '" + kernel.name + "' computed a wrong result.");
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	});
+}
+
+/**
+ * Compares loading a large program from an in-process vector, from program files in every encoding and from the
+ * program cache. The file rows map a translated file, whose pre-decoded program is checked against the code and
+ * verified again unless trusted, the packed and aligned rows translating the code.
+ */
+std::vector<Result> run_load(const size_t bytes, const size_t repetitions)
+{
+	const std::vector<Instruction> program = import_program_input(bytes / Instruction::size());
+	const size_t memory_size = program.size() * Instruction::size() + 64 * 1024;
+	const std::string path = "thalliumvm_bench_program.thp";
+	const std::string packed_path = "thalliumvm_bench_program_packed.thp";
+	const std::string aligned_path = "thalliumvm_bench_program_aligned.thp";
+	{
+		const std::shared_ptr<const ProgramImage> image = ProgramImage::create(program);
+		image->save(path, ProgramEncoding::Translated);
+		image->save(packed_path, ProgramEncoding::Packed);
+		image->save(aligned_path, ProgramEncoding::Aligned);
+	}
+
+	const std::string name = "load/" + std::to_string(bytes / (1024 * 1024)) + "MB/";
+	std::vector<Result> results;
+
+	results.push_back(measure(name + "vector", "-", program.size(), repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		VM vm{memory_size};
+		vm.import_program(program);
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	}));
+
+	const auto load_file = [&](const std::string& file, const bool trusted) {
+		return [&, file, trusted]() {
+			const auto begin = std::chrono::steady_clock::now();
+			VM vm{memory_size};
+			vm.import_program_file(file, trusted);
+			const auto end = std::chrono::steady_clock::now();
+
+			return std::chrono::duration<double, std::nano>(end - begin).count();
+		};
+	};
+
+	results.push_back(measure(name + "file", "-", program.size(), repetitions, load_file(path, false)));
+	results.push_back(measure(name + "trusted", "-", program.size(), repetitions, load_file(path, true)));
+	results.push_back(measure(name + "packed", "-", program.size(), repetitions, load_file(packed_path, false)));
+	results.push_back(measure(name + "aligned", "-", program.size(), repetitions, load_file(aligned_path, false)));
+
+	// the warmup run adds the program to the cache, so every timed run is a hit
+	ProgramCache cache{ProgramCache::default_directory(), uint64_t(4) << 30};
+	results.push_back(measure(name + "cache", "-", program.size(), repetitions, [&]() {
+		const auto begin = std::chrono::steady_clock::now();
+		VM vm{memory_size};
+		vm.import_program(cache.get(program));
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - begin).count();
+	}));
+
+	std::remove(path.c_str());
+	std::remove(packed_path.c_str());
+	std::remove(aligned_path.c_str());
+	return results;
+}
+
+void print_header()
+{
+	std::cout << std::left << std::setw(20) << "benchmark" << std::setw(10) << "engine"
+			  << std::right << std::setw(14) << "instructions" << std::setw(12) << "mean ms"
+			  << std::setw(10) << "stddev" << std::setw(12) << "Minstr/s" << std::setw(11) << "ns/instr" << '\n';
+}
+
+void print_result(const Result& r)
+{
+	std::cout << std::left << std::setw(20) << r.name << std::setw(10) << r.engine
+			  << std::right << std::setw(14) << r.instructions
+			  << std::fixed << std::setprecision(3) << std::setw(12) << r.mean_ns * 1e-6
+			  << std::setprecision(1) << std::setw(9) << (r.stddev_ns / r.mean_ns * 100.0) << '%'
+			  << std::setprecision(1) << std::setw(12) << r.instructions_per_second() * 1e-6
+			  << std::setprecision(3) << std::setw(11) << r.ns_per_instruction() << std::endl;
+}
+
+void write_csv(const std::vector<Result>& results, const std::string& path)
+{
+	std::ofstream out(path);
+	tassert(out.good(), TimeOfError::Preload, ErrorType::Fatal, "cannot write results to " + path + ".");
+
+	out << "name,engine,instructions,repetitions,mean_ns,stddev_ns,ns_per_instruction,instructions_per_second\n";
+	out << std::setprecision(10);
+	for (const Result& r : results)
+	{
+		out << r.name << ',' << r.engine << ',' << r.instructions << ',' << r.repetitions << ','
+			<< r.mean_ns << ',' << r.stddev_ns << ',' << r.ns_per_instruction() << ','
+			<< r.instructions_per_second() << '\n';
+	}
+}
+
+/**
+ * Compares the results to a CSV file written by a previous run.
+ * \return Number of benchmarks slower than the baseline by more than the threshold
+ */
+size_t compare_baseline(const std::vector<Result>& results, const std::string& path, const double threshold)
+{
+	std::ifstream in(path);
+	tassert(in.good(), TimeOfError::Preload, ErrorType::Fatal, "cannot read baseline " + path + ".");
+
+	// name,engine -> ns per instruction
+	std::map<std::string, double> baseline;
+	std::string line;
+	std::getline(in, line);
+	while (std::getline(in, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream ss(line);
+		std::string field;
+		while (std::getline(ss, field, ','))
+			fields.push_back(field);
+
+		if (fields.size() >= 7)
+			baseline[fields[0] + ',' + fields[1]] = std::atof(fields[6].c_str());
+	}
+
+	size_t regressions = 0;
+	std::cout << "\ncomparison against " << path << " (threshold " << std::defaultfloat << threshold << "%):\n";
+	for (const Result& r : results)
+	{
+		const auto it = baseline.find(r.name + ',' + r.engine);
+		if (it == end(baseline))
+			continue;
+
+		const double delta = (r.ns_per_instruction() / it->second - 1.0) * 100.0;
+		const bool regressed = delta > threshold;
+		regressions += regressed;
+
+		std::cout << std::left << std::setw(20) << r.name << std::setw(10) << r.engine << std::right
+				  << std::showpos << std::fixed << std::setprecision(1) << std::setw(8) << delta << '%'
+				  << std::noshowpos << (regressed ? "  REGRESSION" : "") << '\n';
+	}
+
+	return regressions;
+}
+
+void usage()
+{
+	std::cout << "usage: thalliumvm_bench [options]\n"
+				 "  --output FILE       write results as CSV to FILE (default: thalliumvm_bench.csv)\n"
+				 "  --baseline FILE     compare against a previous CSV, exit with 1 on regressions\n"
+				 "  --threshold PCT     slowdown tolerated against the baseline (default: 10)\n"
+				 "  --repetitions N     timed runs per benchmark (default: 5)\n"
+				 "  --filter TEXT       only run benchmarks whose name contains TEXT\n"
+				 "  --engine NAME       switch, threaded, jit, aot or all (default: all)\n"
+				 "  --quick             smaller workloads, for smoke testing\n";
+}
+
+bool parse_options(const int argc, char** argv, Options& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (arg == "--output" && has_value)
+			options.output = argv[++i];
+		else if (arg == "--baseline" && has_value)
+			options.baseline = argv[++i];
+		else if (arg == "--threshold" && has_value)
+			options.threshold = std::atof(argv[++i]);
+		else if (arg == "--repetitions" && has_value)
+			options.repetitions = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--filter" && has_value)
+			options.filter = argv[++i];
+		else if (arg == "--quick")
+			options.quick = true;
+		else if (arg == "--engine" && has_value)
+		{
+			const std::string name = argv[++i];
+			options.aot = name == "aot" || name == "all";
+			if (name == "switch")
+				options.engines = {Engine::Switch};
+			else if (name == "threaded")
+				options.engines = {Engine::Threaded};
+			else if (name == "jit")
+				options.engines = {Engine::Jit};
+			else if (name == "aot")
+				options.engines.clear();
+			else if (name != "all")
+				return false;
+		}
+		else
+			return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parse_options(argc, argv, options))
+	{
+		usage();
+		return 2;
+	}
+
+	const uint32_t scale = options.quick ? 10 : 1;
+
+	std::vector<Kernel> kernels;
+	for (uint8_t op = 0; op < static_cast<uint8_t>(Opcode::__PLACEHOLDER_EXIT); ++op)
+	{
+		kernels.push_back(opcode_kernel(static_cast<Opcode>(op), 100000 / scale));
+		kernels.back().name = "op/" + kernels.back().name;
+	}
+
+	kernels.push_back(loop_kernel(5000000 / scale));
+	kernels.push_back(self_jump_kernel(1000000 / scale, false));
+	kernels.push_back(self_jump_kernel(1000000 / scale, true));
+	kernels.push_back(fib_kernel(options.quick ? 18 : 25));
+	kernels.push_back(memcpy_kernel(1000000 / scale));
+	for (uint8_t op = static_cast<uint8_t>(Opcode::mcpy); op <= static_cast<uint8_t>(Opcode::vsum); ++op)
+		kernels.push_back(bulk_kernel(static_cast<Opcode>(op), 4096, 10000 / scale));
+	kernels.push_back(sieve_kernel(65536 / scale));
+	kernels.push_back(hash_kernel(2000000 / scale));
+	kernels.push_back(naive_kernel(5000000 / scale));
+	kernels.push_back(host_call_kernel(1000000 / scale));
+	kernels.push_back(host_hash_kernel(2000000 / scale, false));
+	kernels.push_back(host_hash_kernel(2000000 / scale, true));
+	kernels.push_back(fiber_spawn_kernel(200000 / scale));
+	kernels.push_back(fiber_yield_kernel(16, 50000 / scale));
+	kernels.push_back(fiber_work_kernel(64, 50000 / scale));
+	kernels.push_back(fiber_reduce_kernel(64, 65536 / scale));
+
+	const auto selected = [&](const std::string& name) {
+		return options.filter.empty() || name.find(options.filter) != std::string::npos;
+	};
+
+	std::vector<Result> results;
+
+	try {
+		print_header();
+
+		for (const Kernel& kernel : kernels)
+		{
+			if (!selected(kernel.name))
+				continue;
+
+			for (const Engine engine : options.engines)
+			{
+				results.push_back(run_kernel(kernel, engine, options.repetitions));
+				print_result(results.back());
+			}
+		}
+
+#ifdef THALLIUM_HAS_MMAP
+		// memory-bound kernels again behind guard regions, which should cost nothing
+		for (const Kernel& kernel : kernels)
+		{
+			if (kernel.name.compare(0, 3, "op/") == 0 || kernel.name == "loop" || !selected("guarded/" + kernel.name))
+				continue;
+
+			for (const Engine engine : options.engines)
+			{
+				results.push_back(run_kernel(kernel, engine, options.repetitions, MemoryMode::Guarded));
+				print_result(results.back());
+			}
+		}
+#endif
+
+		// the same jobs on one worker and on every core, to check the batch runner scales
+		std::vector<size_t> batch_threads = {1};
+		if (std::thread::hardware_concurrency() > 1)
+			batch_threads.push_back(std::thread::hardware_concurrency());
+
+		const Kernel batch_kernel = loop_kernel(20000 / scale);
+		if (selected("batch/" + batch_kernel.name))
+		{
+			for (const Engine engine : options.engines)
+			{
+				for (const size_t threads : batch_threads)
+				{
+					results.push_back(run_batch(batch_kernel, engine, threads, 512, options.repetitions));
+					print_result(results.back());
+				}
+			}
+		}
+
+		// the fiber kernels on one thread and on every core, to check fibers spread over the threads
+		for (const Kernel& kernel : kernels)
+		{
+			if (kernel.name.compare(0, 6, "fiber/") != 0 || !selected("fibers/" + kernel.name))
+				continue;
+
+			for (const Engine engine : options.engines)
+			{
+				for (const size_t threads : batch_threads)
+				{
+					results.push_back(run_fibers(kernel, engine, threads, options.repetitions));
+					print_result(results.back());
+				}
+			}
+		}
+
+		// budgeted slices of the branchy kernels, to compare with their unbudgeted runs above
+		for (const Kernel& kernel : kernels)
+		{
+			if ((kernel.name != "loop" && kernel.name != "fib") || !selected("fuel/" + kernel.name))
+				continue;
+
+			for (const Engine engine : options.engines)
+			{
+				results.push_back(run_fuel(kernel, engine, 10000, options.repetitions));
+				print_result(results.back());
+			}
+		}
+
+		// the interpreters without the verifier, the JIT not depending on it
+		for (const Kernel& kernel : kernels)
+		{
+			if (kernel.name.compare(0, 3, "op/") == 0 || !selected("unverified/" + kernel.name))
+				continue;
+
+			for (const Engine engine : options.engines)
+			{
+				if (engine == Engine::Jit)
+					continue;
+
+				results.push_back(run_unverified(kernel, engine, options.repetitions));
+				print_result(results.back());
+			}
+		}
+
+		// the branchy kernels on every VM configuration
+		for (const Kernel& kernel : kernels)
+		{
+			if ((kernel.name != "loop" && kernel.name != "fib" && kernel.name != "sieve" && kernel.name != "hash")
+				|| !selected("cfg/"))
+				continue;
+
+			for (const Engine engine : options.engines)
+			{
+				for (const Result& r : run_configs(kernel, engine, options.repetitions))
+				{
+					results.push_back(r);
+					print_result(r);
+				}
+			}
+		}
+
+		// the branchy kernels compiled ahead of time, the module being built before the warmup run if it is not cached
+		for (const Kernel& kernel : kernels)
+		{
+			if ((kernel.name != "loop" && kernel.name != "fib" && kernel.name != "sieve" && kernel.name != "hash")
+				|| !options.aot || !selected(kernel.name))
+				continue;
+
+			if (!AotModule::get(*ProgramImage::create(kernel.program)))
+			{
+				std::cerr << "skipping " << kernel.name << " ahead of time: it cannot be compiled with "
+						  << AotModule::compiler() << '\n';
+				continue;
+			}
+
+			results.push_back(run_kernel(kernel, Engine::Aot, options.repetitions));
+			print_result(results.back());
+		}
+
+		// the branchy kernels with one dispatch for every lane, to compare per instruction with the engines
+		for (const Kernel& kernel : kernels)
+		{
+			if ((kernel.name != "loop" && kernel.name != "fib" && kernel.name != "sieve" && kernel.name != "hash"
+				 && kernel.name.compare(0, 4, "self") != 0) || !selected("lanes/" + kernel.name))
+				continue;
+
+			results.push_back(run_lanes(kernel, options.repetitions));
+			print_result(results.back());
+		}
+
+		// the branchy kernels, the naive one and calls to their own address after the offline optimizer, per instruction
+		// of the original program
+		for (const Kernel& kernel : kernels)
+		{
+			if ((kernel.name != "loop" && kernel.name != "fib" && kernel.name != "sieve" && kernel.name != "hash"
+				 && kernel.name != "naive" && kernel.name != "self") || !selected("opt/" + kernel.name))
+				continue;
+
+			const Kernel optimized = optimized_kernel(kernel);
+
+			for (const Engine engine : options.engines)
+			{
+				results.push_back(run_kernel(optimized, engine, options.repetitions));
+				print_result(results.back());
+			}
+		}
+
+		if (selected("traps"))
+		{
+			for (const Engine engine : options.engines)
+			{
+				results.push_back(run_traps(100000 / scale, engine, options.repetitions));
+				print_result(results.back());
+			}
+		}
+
+		if (selected("import_program"))
+		{
+			results.push_back(run_import(4000000 / scale, options.repetitions));
+			print_result(results.back());
+		}
+
+		if (selected("fetch"))
+		{
+			results.push_back(run_fetch(4000000 / scale, options.repetitions));
+			print_result(results.back());
+		}
+
+		if (selected("serialize"))
+		{
+			results.push_back(run_serialize(4000000 / scale, options.repetitions));
+			print_result(results.back());
+		}
+
+		if (selected("load/"))
+		{
+			for (const Result& r : run_load(100 * 1024 * 1024 / scale, options.repetitions))
+			{
+				results.push_back(r);
+				print_result(r);
+			}
+		}
+
+		if (selected("import_image"))
+		{
+			results.push_back(run_import_image(4000000 / scale, options.repetitions));
+			print_result(results.back());
+		}
+
+		write_csv(results, options.output);
+
+		if (!options.baseline.empty() && compare_baseline(results, options.baseline, options.threshold) > 0)
+			return 1;
+	} catch (const VMException& e)
+	{
+		error(TimeOfError::Runtime, ErrorType::Fatal, "benchmark aborted.", true);
+		return 2;
+	}
+
+	return 0;
+}
@@ -0,0 +1,723 @@
+#include <functional>
+#include "kernels.hpp"
+#include "program.hpp"
+
+namespace thallium
+{
+	namespace bench
+	{
+		Kernel opcode_kernel(const Opcode opcode, const uint32_t iterations)
+		{
+			const uint32_t unroll = 32;
+			const vmreg_t stack_base = 256 * 1024, data = 512 * 1024;
+
+			ProgramBuilder b;
+
+			// return stub for call and callr, jumped over at startup
+			const size_t skip = b.jump_always(8);
+			const vmreg_t ret_stub = b.here();
+			b.ret(17);
+			b.patch(skip, b.here());
+
+			b.imm(0, 8);
+			b.imm(iterations, 9);
+			b.imm(12345, 11);
+			b.imm(7, 12);
+			b.imm(data, 13);
+			b.imm(stack_base, 15);
+			b.imm(stack_base + unroll * sizeof(vmreg_t), 19);
+			b.imm(ret_stub, 18);
+			const uint64_t setup = 2 + 8;
+
+			const vmreg_t loop = b.here();
+
+			uint64_t prologue = 1;
+			switch (opcode)
+			{
+			case Opcode::cjmpr: b.op(Opcode::teq, 11, 12); break; // never taken
+			case Opcode::push: b.op(Opcode::mov, 15, static_cast<uint16_t>(SPRegisters::sp)); break;
+			case Opcode::pop: b.op(Opcode::mov, 19, static_cast<uint16_t>(SPRegisters::sp)); break;
+			default: prologue = 0; break;
+			}
+
+			uint64_t per_copy = 1;
+			for (uint32_t i = 0; i < unroll; ++i)
+			{
+				switch (opcode)
+				{
+				case Opcode::mov: b.op(opcode, 11, 16); break;
+				case Opcode::imm: b.imm(5, 16); break;
+				case Opcode::mget: b.op(opcode, 13, 16); break;
+				case Opcode::mset: b.op(opcode, 13, 11); break;
+				case Opcode::teq:
+				case Opcode::tgt:
+				case Opcode::tlt: b.op(opcode, 11, 12); break;
+				case Opcode::cjmp: b.jump(opcode, b.here() + Instruction::size()); break;
+				case Opcode::cjmpr: b.op(opcode, 11); break;
+				case Opcode::call: b.jump(opcode, ret_stub); per_copy = 4; break;
+				case Opcode::callr: b.op(opcode, 18); per_copy = 4; break;
+				case Opcode::sbit: b.sbit(16, 5, i % 2); break;
+				case Opcode::gbit: b.op(opcode, 11, 16, 3); break;
+				case Opcode::shr:
+				case Opcode::shl: b.op(opcode, 11, 16, 12); break;
+				case Opcode::inc:
+				case Opcode::dec: b.op(opcode, 16); break;
+				case Opcode::push:
+				case Opcode::pop: b.op(opcode, 16); break;
+				default: b.op(opcode, 11, 12, 16); break;
+				}
+			}
+
+			b.op(Opcode::inc, 8);
+			b.op(Opcode::tlt, 8, 9);
+			b.jump(Opcode::cjmp, loop);
+			b.exit();
+
+			return {opcode_string(opcode), b.program(), 1024 * 1024,
+					setup + uint64_t(iterations) * (prologue + unroll * per_copy + 3) + 1,
+					8, iterations};
+		}
+
+		Kernel loop_kernel(const uint32_t n)
+		{
+			ProgramBuilder b;
+			b.imm(0, 8);
+			b.imm(0, 9);
+			b.imm(n, 10);
+			const vmreg_t loop = b.here();
+			b.op(Opcode::inc, 8);
+			b.op(Opcode::uadd, 9, 8, 9);
+			b.op(Opcode::tlt, 8, 10);
+			b.jump(Opcode::cjmp, loop);
+			b.exit();
+
+			vmreg_t sum = 0;
+			for (vmreg_t i = 1; i <= n; ++i)
+				sum += i;
+
+			return {"loop", b.program(), 64 * 1024, 3 + uint64_t(n) * 4 + 1, 9, sum};
+		}
+
+		Kernel self_jump_kernel(const uint32_t n, const bool registers)
+		{
+			ProgramBuilder b;
+			b.imm(0, 8);
+			b.imm(0, 11);
+			b.imm(n, 10);
+			const size_t cjmpr_index = registers ? b.imm(0, 13) : 0;
+			const size_t callr_index = registers ? b.imm(0, 14) : 0;
+
+			// every jump and call targets itself, so the TEST flag being set does not matter and they fall through,
+			// r9 being only read after the call
+			const vmreg_t loop = b.here();
+			b.op(Opcode::inc, 8);
+			b.imm(1, 9);
+			b.jump(Opcode::call, b.here());
+			b.op(Opcode::pop, 12);
+			b.op(Opcode::uadd, 8, 9, 8);
+			b.op(Opcode::teq, 8, 8);
+			b.jump(Opcode::cjmp, b.here());
+
+			if (registers)
+			{
+				b.patch_imm(cjmpr_index, b.here());
+				b.op(Opcode::cjmpr, 13);
+				b.patch_imm(callr_index, b.here());
+				b.op(Opcode::callr, 14);
+				b.op(Opcode::pop, 12);
+			}
+
+			b.op(Opcode::inc, 11);
+			b.op(Opcode::tlt, 11, 10);
+			b.jump(Opcode::cjmp, loop);
+			b.exit();
+
+			const uint64_t instructions = registers ? 5 + uint64_t(n) * 13 + 1 : 3 + uint64_t(n) * 10 + 1;
+			return {registers ? "self/reg" : "self", b.program(), 64 * 1024, instructions, 8, 2 * n};
+		}
+
+		Kernel fib_kernel(const uint32_t n)
+		{
+			ProgramBuilder b;
+			b.imm(2, 30);
+			b.imm(n, 10);
+			const size_t main_call = b.jump(Opcode::call);
+			b.exit();
+
+			// fib(r10) -> r11
+			const vmreg_t fib = b.here();
+			b.patch(main_call, fib);
+			b.op(Opcode::tlt, 10, 30);
+			const size_t to_base = b.jump(Opcode::cjmp);
+			b.op(Opcode::push, 10);
+			b.op(Opcode::dec, 10);
+			b.jump(Opcode::call, fib);
+			b.op(Opcode::pop, 10);
+			b.op(Opcode::push, 10);
+			b.op(Opcode::push, 11);
+			b.op(Opcode::dec, 10);
+			b.op(Opcode::dec, 10);
+			b.jump(Opcode::call, fib);
+			b.op(Opcode::pop, 12);
+			b.op(Opcode::pop, 10);
+			b.op(Opcode::uadd, 11, 12, 11);
+			b.ret(20);
+
+			b.patch(to_base, b.here());
+			b.op(Opcode::mov, 10, 11);
+			b.ret(20);
+
+			std::function<std::pair<vmreg_t, uint64_t>(uint32_t)> reference = [&](const uint32_t k) {
+				if (k < 2)
+					return std::make_pair(static_cast<vmreg_t>(k), uint64_t(6));
+
+				const auto a = reference(k - 1), c = reference(k - 2);
+				return std::make_pair(a.first + c.first, 17 + a.second + c.second);
+			};
+
+			const auto expected = reference(n);
+			return {"fib", b.program(), 64 * 1024, 4 + expected.second, 11, expected.first};
+		}
+
+		Kernel memcpy_kernel(const uint32_t words)
+		{
+			const vmreg_t src = 64 * 1024, dst = src + words * sizeof(vmreg_t);
+
+			ProgramBuilder b;
+			b.imm(src, 8);
+			b.imm(dst, 9);
+			b.imm(sizeof(vmreg_t), 10);
+			b.imm(0, 11);
+			b.imm(words, 12);
+			const vmreg_t loop = b.here();
+			b.op(Opcode::mget, 8, 13);
+			b.op(Opcode::mset, 9, 13);
+			b.op(Opcode::uadd, 8, 10, 8);
+			b.op(Opcode::uadd, 9, 10, 9);
+			b.op(Opcode::inc, 11);
+			b.op(Opcode::tlt, 11, 12);
+			b.jump(Opcode::cjmp, loop);
+			b.exit();
+
+			return {"memcpy", b.program(), dst + words * sizeof(vmreg_t) + 64, 5 + uint64_t(words) * 7 + 1, 11, words};
+		}
+
+		Kernel bulk_kernel(const Opcode opcode, const uint32_t words, const uint32_t iterations)
+		{
+			const vmreg_t size = words * sizeof(vmreg_t);
+			const vmreg_t first = 64 * 1024, second = first + size;
+
+			ProgramBuilder b;
+			b.imm(0, 8);
+			b.imm(iterations, 9);
+			b.imm(first, 10);
+			b.imm(second, 11);
+			b.imm(opcode == Opcode::vadd || opcode == Opcode::vxor || opcode == Opcode::vsum ? words : size, 12);
+			b.imm(1, 13);
+			b.imm(0, 14);
+
+			// memory only holds zeroes, so mcmp and mfind go through the whole region
+			const vmreg_t loop = b.here();
+			switch (opcode)
+			{
+			case Opcode::mcpy:
+			case Opcode::vadd:
+			case Opcode::vxor: b.op(opcode, 11, 10, 12); break;
+			case Opcode::mfill: b.op(opcode, 11, 13, 12); break;
+			case Opcode::mcmp: b.op(opcode, 10, 11, 12, 14); break;
+			case Opcode::mfind: b.op(opcode, 10, 13, 12, 14); break;
+			default: b.op(opcode, 10, 12, 14); break;
+			}
+
+			b.op(Opcode::inc, 8);
+			b.op(Opcode::tlt, 8, 9);
+			b.jump(Opcode::cjmp, loop);
+			b.exit();
+
+			return {"bulk/" + opcode_string(opcode), b.program(), second + size + 64, 7 + uint64_t(iterations) * 4 + 1, 8,
+					iterations};
+		}
+
+		Kernel sieve_kernel(const uint32_t n)
+		{
+			const vmreg_t base = 64 * 1024;
+
+			ProgramBuilder b;
+			b.imm(sizeof(vmreg_t), 8);
+			b.imm(base, 9);
+			b.imm(n, 10);
+			b.imm(2, 11);
+			b.imm(0, 12);
+			b.imm(1, 13);
+			b.imm(0, 14);
+
+			// r11: i, r17: j, r14: prime count
+			const vmreg_t outer = b.here();
+			b.op(Opcode::umul, 11, 8, 15);
+			b.op(Opcode::uadd, 9, 15, 15);
+			b.op(Opcode::mget, 15, 16);
+			b.op(Opcode::teq, 16, 12);
+			const size_t to_prime = b.jump(Opcode::cjmp);
+			const size_t to_next = b.jump_always(12);
+
+			b.patch(to_prime, b.here());
+			b.op(Opcode::inc, 14);
+			b.op(Opcode::umul, 11, 11, 17);
+
+			const vmreg_t inner = b.here();
+			b.op(Opcode::tlt, 17, 10);
+			const size_t to_body = b.jump(Opcode::cjmp);
+			const size_t inner_done = b.jump_always(12);
+
+			b.patch(to_body, b.here());
+			b.op(Opcode::umul, 17, 8, 15);
+			b.op(Opcode::uadd, 9, 15, 15);
+			b.op(Opcode::mset, 15, 13);
+			b.op(Opcode::uadd, 17, 11, 17);
+			b.jump_always(12, inner);
+
+			b.patch(to_next, b.here());
+			b.patch(inner_done, b.here());
+			b.op(Opcode::inc, 11);
+			b.op(Opcode::tlt, 11, 10);
+			b.jump(Opcode::cjmp, outer);
+			b.exit();
+
+			// mirror the control flow to know the instruction count
+			std::vector<bool> composite(n);
+			uint64_t instructions = 7 + 1;
+			vmreg_t primes = 0;
+			for (vmreg_t i = 2;; )
+			{
+				instructions += 5;
+				if (!composite[i])
+				{
+					++primes;
+					instructions += 2;
+					for (vmreg_t j = i * i;; j += i)
+					{
+						if (j >= n)
+						{
+							instructions += 4;
+							break;
+						}
+
+						instructions += 2 + 6;
+						composite[j] = true;
+					}
+				}
+				else
+				{
+					instructions += 2;
+				}
+
+				instructions += 3;
+				if (!(++i < n))
+					break;
+			}
+
+			return {"sieve", b.program(), base + n * sizeof(vmreg_t) + 64, instructions, 14, primes};
+		}
+
+		Kernel hash_kernel(const uint32_t words)
+		{
+			const vmreg_t base = 64 * 1024, region = 16 * 1024;
+
+			ProgramBuilder b;
+			b.imm(0, 8);
+			b.imm(0, 9);
+			b.imm(words, 10);
+			b.imm(33, 11);
+			b.imm(7, 12);
+			b.imm(base, 13);
+			b.imm(sizeof(vmreg_t), 14);
+			b.imm(region, 19);
+
+			// r8: hash, r9: i
+			const vmreg_t loop = b.here();
+			b.op(Opcode::umul, 9, 14, 15);
+			b.op(Opcode::umod, 15, 19, 15);
+			b.op(Opcode::uadd, 13, 15, 15);
+			b.op(Opcode::mget, 15, 16);
+			b.op(Opcode::umul, 8, 11, 8);
+			b.op(Opcode::uadd, 8, 16, 8);
+			b.op(Opcode::uadd, 8, 9, 8);
+			b.op(Opcode::shr, 8, 17, 12);
+			b.op(Opcode::uadd, 8, 17, 8);
+			b.op(Opcode::inc, 9);
+			b.op(Opcode::tlt, 9, 10);
+			b.jump(Opcode::cjmp, loop);
+			b.exit();
+
+			// the hashed region is never written to, so it only holds zeroes
+			vmreg_t hash = 0;
+			for (vmreg_t i = 0; i < words; ++i)
+			{
+				hash = hash * 33 + i;
+				hash += hash >> 7;
+			}
+
+			return {"hash", b.program(), base + region + 64, 8 + uint64_t(words) * 12 + 1, 8, hash};
+		}
+
+		Kernel naive_kernel(const uint32_t n)
+		{
+			ProgramBuilder b;
+			b.imm(0, 8);
+			b.imm(0, 9);
+			b.imm(n, 10);
+			b.imm(1, 20);
+			const vmreg_t loop = b.here();
+			b.imm(n, 10);
+			b.imm(1, 20);
+			b.op(Opcode::uadd, 8, 20, 21);
+			b.op(Opcode::mov, 21, 22);
+			b.op(Opcode::mov, 22, 8);
+			b.op(Opcode::push, 9);
+			b.op(Opcode::pop, 23);
+			b.op(Opcode::uadd, 23, 8, 24);
+			b.op(Opcode::mov, 24, 9);
+			b.op(Opcode::tlt, 8, 10);
+			const size_t to_next = b.jump(Opcode::cjmp);
+			b.exit();
+			b.patch(to_next, b.here());
+			b.jump_always(8, loop);
+
+			vmreg_t sum = 0;
+			for (vmreg_t i = 1; i <= n; ++i)
+				sum += i;
+
+			return {"naive", b.program(), 64 * 1024, 3 + uint64_t(n) * 13, 9, sum};
+		}
+
+		/**
+		 * Hashes words the way the hash kernel does.
+		 * \param i Index of the first word, advanced past the last one
+		 */
+		static void hash_words(const uint8_t* data, const vmreg_t words, vmreg_t& hash, vmreg_t& i)
+		{
+			for (vmreg_t w = 0; w < words; ++w, ++i)
+			{
+				hash = hash * 33 + deserialize_type<vmreg_t>(data + w * sizeof(vmreg_t)) + i;
+				hash += hash >> 7;
+			}
+		}
+
+		static bool nop_function(HostCall&, void*)
+		{
+			return true;
+		}
+
+		static bool hash_function(HostCall& call, void*)
+		{
+			const uint8_t* data = call.read(call[0], uint64_t(call[1]) * sizeof(vmreg_t));
+			if (data == nullptr)
+				return false;
+
+			hash_words(data, call[1], call[2], call[3]);
+			return true;
+		}
+
+		static bool hash_batch_function(HostCall& call, void*)
+		{
+			const size_t record_size = 2 * sizeof(vmreg_t);
+			const uint8_t* records = call.read(call[0], uint64_t(call[1]) * record_size);
+			if (records == nullptr)
+				return false;
+
+			for (vmreg_t r = 0; r < call[1]; ++r)
+			{
+				const vmreg_t address = deserialize_type<vmreg_t>(records + r * record_size);
+				const vmreg_t words = deserialize_type<vmreg_t>(records + r * record_size + sizeof(vmreg_t));
+
+				const uint8_t* data = call.read(address, uint64_t(words) * sizeof(vmreg_t));
+				if (data == nullptr)
+					return false;
+
+				hash_words(data, words, call[2], call[3]);
+			}
+
+			return true;
+		}
+
+		void bind_host_functions(VM& vm)
+		{
+			vm.bind(static_cast<uint32_t>(HostKernelId::Nop), nop_function, 0);
+			vm.bind(static_cast<uint32_t>(HostKernelId::Hash), hash_function, 4);
+			vm.bind(static_cast<uint32_t>(HostKernelId::HashBatch), hash_batch_function, 4);
+		}
+
+		Kernel host_call_kernel(const uint32_t calls)
+		{
+			ProgramBuilder b;
+			b.imm(calls, 10);
+
+			// r9: calls made
+			const vmreg_t loop = b.here();
+			b.hcall(static_cast<uint32_t>(HostKernelId::Nop), 20);
+			b.op(Opcode::inc, 9);
+			b.op(Opcode::tlt, 9, 10);
+			b.jump(Opcode::cjmp, loop);
+			b.exit();
+
+			return {"host/call", b.program(), 64 * 1024, 2 + uint64_t(calls) * 4, 9, calls};
+		}
+
+		Kernel host_hash_kernel(const uint32_t words, const bool batch)
+		{
+			const vmreg_t base = 64 * 1024, region = 16 * 1024, records = base + region;
+			const uint32_t chunk = 64, chunks = words / chunk;
+
+			ProgramBuilder b;
+			b.imm(chunks * chunk, 10);
+			b.imm(sizeof(vmreg_t), 12);
+			b.imm(base, 13);
+			b.imm(chunk, 14);
+			b.imm(region, 19);
+
+			// r20..r23: window of the host function, r22 being the hash, r9: first word of the chunk
+			if (batch)
+			{
+				// r24: next record
+				b.imm(records, 24);
+
+				const vmreg_t loop = b.here();
+				b.op(Opcode::umul, 9, 12, 15);
+				b.op(Opcode::umod, 15, 19, 15);
+				b.op(Opcode::uadd, 13, 15, 15);
+				b.op(Opcode::mset, 24, 15);
+				b.op(Opcode::uadd, 24, 12, 24);
+				b.op(Opcode::mset, 24, 14);
+				b.op(Opcode::uadd, 24, 12, 24);
+				b.op(Opcode::uadd, 9, 14, 9);
+				b.op(Opcode::tlt, 9, 10);
+				b.jump(Opcode::cjmp, loop);
+
+				b.imm(records, 20);
+				b.imm(chunks, 21);
+				b.hcall(static_cast<uint32_t>(HostKernelId::HashBatch), 20);
+			}
+			else
+			{
+				b.op(Opcode::mov, 14, 21);
+
+				const vmreg_t loop = b.here();
+				b.op(Opcode::umul, 23, 12, 15);
+				b.op(Opcode::umod, 15, 19, 15);
+				b.op(Opcode::uadd, 13, 15, 20);
+				b.hcall(static_cast<uint32_t>(HostKernelId::Hash), 20);
+				b.op(Opcode::tlt, 23, 10);
+				b.jump(Opcode::cjmp, loop);
+			}
+
+			b.exit();
+
+			// the hashed region is never written to, so it only holds zeroes
+			vmreg_t hash = 0;
+			for (vmreg_t i = 0; i < chunks * chunk; ++i)
+			{
+				hash = hash * 33 + i;
+				hash += hash >> 7;
+			}
+
+			return {batch ? "host/hash_batch" : "host/hash", b.program(),
+					records + chunks * 2 * sizeof(vmreg_t) + 64, 8 + uint64_t(chunks) * chunk * 12 + 1, 22, hash};
+		}
+
+		/**
+		 * Fibers hashing their id, see fiber_spawn_kernel.
+		 */
+		static Kernel fiber_kernel(const std::string& name, const uint32_t fibers, const uint32_t iterations,
+								   const bool yield)
+		{
+			const vmreg_t results = 64 * 1024, stacks = results + (fibers + 1) * sizeof(vmreg_t), stack_size = 64;
+
+			ProgramBuilder b;
+			b.imm(fibers, 10);
+			b.imm(0, 11);
+			b.imm(stacks, 12);
+			b.imm(stack_size, 13);
+			b.imm(iterations, 21);
+			b.imm(33, 22);
+			b.imm(7, 23);
+			b.imm(sizeof(vmreg_t), 26);
+			b.imm(results, 28);
+			const size_t entry = b.imm(0, 15);
+
+			// r11: fibers spawned, r14: id of the last one
+			const vmreg_t spawn = b.here();
+			b.op(Opcode::fspawn, 15, 12, 14);
+			b.op(Opcode::uadd, 12, 13, 12);
+			b.op(Opcode::inc, 11);
+			b.op(Opcode::tlt, 11, 10);
+			b.jump(Opcode::cjmp, spawn);
+
+			// fibers get the ids 1 to fibers in spawn order
+			b.imm(0, 11);
+			const vmreg_t join = b.here();
+			b.op(Opcode::inc, 11);
+			b.op(Opcode::fjoin, 11);
+			b.op(Opcode::tlt, 11, 10);
+			b.jump(Opcode::cjmp, join);
+
+			// r9: sum of the hashes, the slot of the main fiber holding 0
+			b.op(Opcode::inc, 10);
+			b.op(Opcode::vsum, 28, 10, 9);
+			b.exit();
+
+			// r14: id of the fiber, r24: hash, r20: iterations done
+			const vmreg_t fiber = b.here();
+			b.op(Opcode::mov, 14, 24);
+			b.imm(0, 20);
+
+			const vmreg_t loop = b.here();
+			b.op(Opcode::umul, 24, 22, 24);
+			b.op(Opcode::uadd, 24, 20, 24);
+			b.op(Opcode::shr, 24, 25, 23);
+			b.op(Opcode::uadd, 24, 25, 24);
+			if (yield)
+				b.op(Opcode::fyield);
+			b.op(Opcode::inc, 20);
+			b.op(Opcode::tlt, 20, 21);
+			b.jump(Opcode::cjmp, loop);
+
+			b.op(Opcode::umul, 14, 26, 27);
+			b.op(Opcode::uadd, 28, 27, 27);
+			b.op(Opcode::mset, 27, 24);
+			b.exit();
+
+			std::vector<Instruction> program = b.program();
+			program[entry].argument = fiber | (uint64_t(15) << 32);
+
+			vmreg_t sum = 0;
+			for (vmreg_t id = 1; id <= fibers; ++id)
+			{
+				vmreg_t hash = id;
+				for (vmreg_t i = 0; i < iterations; ++i)
+				{
+					hash = hash * 33 + i;
+					hash += hash >> 7;
+				}
+
+				sum += hash;
+			}
+
+			const uint64_t per_fiber = 2 + uint64_t(iterations) * (yield ? 8 : 7) + 4;
+			const uint64_t instructions = 10 + uint64_t(fibers) * 5 + 1 + uint64_t(fibers) * 4 + 3 + fibers * per_fiber;
+
+			return {name, program, stacks + fibers * stack_size, instructions, 9, sum};
+		}
+
+		Kernel fiber_spawn_kernel(const uint32_t fibers)
+		{
+			return fiber_kernel("fiber/spawn", fibers, 1, false);
+		}
+
+		Kernel fiber_yield_kernel(const uint32_t fibers, const uint32_t iterations)
+		{
+			return fiber_kernel("fiber/yield", fibers, iterations, true);
+		}
+
+		Kernel fiber_work_kernel(const uint32_t fibers, const uint32_t iterations)
+		{
+			return fiber_kernel("fiber/work", fibers, iterations, false);
+		}
+
+		Kernel fiber_reduce_kernel(const uint32_t fibers, const uint32_t words)
+		{
+			const vmreg_t total = 64 * 1024, data = total + 64, chunk_bytes = words * sizeof(vmreg_t);
+			const vmreg_t size = fibers * chunk_bytes;
+
+			// every word of the array holds 0x5A5A5A5A
+			ProgramBuilder b;
+			b.imm(data, 12);
+			b.imm(0x5A, 13);
+			b.imm(size, 14);
+			b.op(Opcode::mfill, 12, 13, 14);
+
+			b.imm(fibers, 10);
+			b.imm(0, 11);
+			b.imm(chunk_bytes, 18);
+			b.imm(0, 19);
+			b.imm(words, 21);
+			b.imm(sizeof(vmreg_t), 26);
+			b.imm(total, 28);
+			const size_t entry = b.imm(0, 15);
+
+			// r12: address of the chunk of the next fiber, r19: index of its first word. The fibers do not use
+			// their stack, which is left at 0.
+			const vmreg_t spawn = b.here();
+			b.op(Opcode::fspawn, 15, 16, 14);
+			b.op(Opcode::uadd, 12, 18, 12);
+			b.op(Opcode::uadd, 19, 21, 19);
+			b.op(Opcode::inc, 11);
+			b.op(Opcode::tlt, 11, 10);
+			b.jump(Opcode::cjmp, spawn);
+
+			b.imm(0, 11);
+			const vmreg_t join = b.here();
+			b.op(Opcode::inc, 11);
+			b.op(Opcode::fjoin, 11);
+			b.op(Opcode::tlt, 11, 10);
+			b.jump(Opcode::cjmp, join);
+
+			// joins order the additions of the fibers before this load
+			b.op(Opcode::mget, 28, 9);
+			b.exit();
+
+			// r24: sum of the chunk, each word weighted by its index, r20: words done
+			const vmreg_t fiber = b.here();
+			b.imm(0, 24);
+			b.imm(0, 20);
+
+			const vmreg_t loop = b.here();
+			b.op(Opcode::mget, 12, 25);
+			b.op(Opcode::umul, 25, 19, 25);
+			b.op(Opcode::uadd, 24, 25, 24);
+			b.op(Opcode::uadd, 12, 26, 12);
+			b.op(Opcode::inc, 19);
+			b.op(Opcode::inc, 20);
+			b.op(Opcode::tlt, 20, 21);
+			b.jump(Opcode::cjmp, loop);
+
+			b.op(Opcode::aadd, 28, 24, 27);
+			b.exit();
+
+			std::vector<Instruction> program = b.program();
+			program[entry].argument = fiber | (uint64_t(15) << 32);
+
+			vmreg_t sum = 0;
+			for (vmreg_t i = 0; i < fibers * words; ++i)
+			{
+				sum += 0x5A5A5A5Au * i;
+			}
+
+			const uint64_t per_fiber = 2 + uint64_t(words) * 8 + 2;
+			const uint64_t instructions = 12 + uint64_t(fibers) * 6 + 1 + uint64_t(fibers) * 4 + 2
+										  + fibers * per_fiber;
+
+			return {"fiber/reduce", program, data + size, instructions, 9, sum};
+		}
+
+		std::vector<Instruction> import_program_input(const size_t instructions)
+		{
+			std::vector<Instruction> program;
+			program.reserve(instructions);
+
+			for (size_t i = 0; program.size() + 1 < instructions; ++i)
+			{
+				const uint64_t r = 8 + i % 200;
+				switch (i % 4)
+				{
+				case 0: program.push_back({Opcode::imm, uint64_t(i) | (r << 32)}); break;
+				case 1: program.push_back({Opcode::uadd, r | (r << 16) | ((r + 1) << 32)}); break;
+				case 2: program.push_back({Opcode::tlt, r | ((r + 1) << 16)}); break;
+				case 3: program.push_back({Opcode::cjmp, (i + 1) * Instruction::size()}); break;
+				}
+			}
+
+			program.push_back({Opcode::__PLACEHOLDER_EXIT, 0});
+			return program;
+		}
+	}
+}
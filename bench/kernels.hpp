@@ -0,0 +1,168 @@
+#ifndef THALLIUMVM_BENCH_KERNELS_HPP
+#define THALLIUMVM_BENCH_KERNELS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "thallium/instruction.hpp"
+#include "thallium/register.hpp"
+#include "thallium/vm.hpp"
+
+namespace thallium
+{
+	namespace bench
+	{
+		/**
+		 * Guest program used as a benchmark, along with what running it is expected to do.
+		 */
+		struct Kernel
+		{
+			std::string name;
+			std::vector<Instruction> program;
+			size_t memory_size;
+
+			/**
+			 * Number of instructions executed by one run, superinstructions counting as two
+			 */
+			uint64_t instructions;
+
+			/**
+			 * Register holding the result once the program exited, and its expected value
+			 */
+			uint16_t result_register;
+			vmreg_t expected;
+		};
+
+		/**
+		 * Microbenchmark of a single opcode: a loop running the instruction unrolled many times.
+		 * \param opcode Opcode to benchmark, anything but Opcode::__PLACEHOLDER_EXIT
+		 * \param iterations Loop iterations
+		 */
+		Kernel opcode_kernel(const Opcode opcode, const uint32_t iterations);
+
+		/**
+		 * Counted loop summing integers.
+		 */
+		Kernel loop_kernel(const uint32_t n);
+
+		/**
+		 * Counted loop whose jumps and calls target their own address, which makes them fall through.
+		 * \param n Loop iterations
+		 * \param registers Whether cjmpr and callr are also used, rather than only cjmp and call
+		 */
+		Kernel self_jump_kernel(const uint32_t n, const bool registers);
+
+		/**
+		 * Naive recursive Fibonacci, stressing call and the stack.
+		 */
+		Kernel fib_kernel(const uint32_t n);
+
+		/**
+		 * Word by word memory copy.
+		 */
+		Kernel memcpy_kernel(const uint32_t words);
+
+		/**
+		 * Loop running a bulk memory instruction over a whole region.
+		 * \param opcode Bulk memory opcode, from Opcode::mcpy to Opcode::vsum
+		 * \param words Size of the region, in words
+		 * \param iterations Loop iterations
+		 */
+		Kernel bulk_kernel(const Opcode opcode, const uint32_t words, const uint32_t iterations);
+
+		/**
+		 * Sieve of Eratosthenes counting the primes below n.
+		 */
+		Kernel sieve_kernel(const uint32_t n);
+
+		/**
+		 * Multiplicative hash over a memory region.
+		 */
+		Kernel hash_kernel(const uint32_t words);
+
+		/**
+		 * The loop kernel as a naive code generator would emit it: constants reloaded on every iteration, copies
+		 * through temporaries, a value spilled to the stack and back, and a branch over an unconditional jump.
+		 */
+		Kernel naive_kernel(const uint32_t n);
+
+		/**
+		 * Ids of the host functions the host kernels call
+		 */
+		enum class HostKernelId : uint32_t
+		{
+			/**
+			 * Does nothing
+			 */
+			Nop,
+
+			/**
+			 * Hashes a range of words like the hash kernel, registers holding the address, the word count, the hash
+			 * and the index of the first word, the last two being updated
+			 */
+			Hash,
+
+			/**
+			 * Hashes the ranges of an array of (address, word count) records, registers holding the address of the
+			 * records, their count, the hash and the index of the first word
+			 */
+			HashBatch
+		};
+
+		/**
+		 * Binds the host functions of HostKernelId to a VM.
+		 */
+		void bind_host_functions(VM& vm);
+
+		/**
+		 * Loop calling a host function which does nothing, measuring the cost of a host call.
+		 */
+		Kernel host_call_kernel(const uint32_t calls);
+
+		/**
+		 * The hash kernel with the hashing done by host functions, 64 words per call or every word in a single
+		 * batched call. The instruction count is the one of the hash kernel, so that times per instruction compare
+		 * with it.
+		 * \param words Number of words to hash, rounded down to a multiple of 64
+		 * \param batch Whether to hash every range in one call
+		 */
+		Kernel host_hash_kernel(const uint32_t words, const bool batch);
+
+		/**
+		 * Main fiber spawning many fibers which hash their id once, each with a stack of its own, then joining them
+		 * and summing their hashes, measuring the cost of spawning and joining a fiber.
+		 * \param fibers Number of fibers spawned
+		 */
+		Kernel fiber_spawn_kernel(const uint32_t fibers);
+
+		/**
+		 * The spawn kernel with fibers yielding on every iteration of their hash loop, measuring the cost of a fiber
+		 * switch.
+		 * \param fibers Number of fibers spawned
+		 * \param iterations Hash loop iterations of every fiber
+		 */
+		Kernel fiber_yield_kernel(const uint32_t fibers, const uint32_t iterations);
+
+		/**
+		 * The spawn kernel with long hash loops and no yield, whose fibers run in parallel on several threads.
+		 * \param fibers Number of fibers spawned
+		 * \param iterations Hash loop iterations of every fiber
+		 */
+		Kernel fiber_work_kernel(const uint32_t fibers, const uint32_t iterations);
+
+		/**
+		 * Parallel reduction of an array: the main fiber splits it in one chunk per fiber, each fiber sums its chunk
+		 * and adds its sum to a shared total with aadd, and the main fiber reads the total once it joined them all.
+		 * \param fibers Number of fibers spawned
+		 * \param words Number of words of every chunk
+		 */
+		Kernel fiber_reduce_kernel(const uint32_t fibers, const uint32_t words);
+
+		/**
+		 * Large straight-line program, used to measure import_program.
+		 */
+		std::vector<Instruction> import_program_input(const size_t instructions);
+	}
+}
+
+#endif
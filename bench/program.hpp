@@ -0,0 +1,136 @@
+#ifndef THALLIUMVM_BENCH_PROGRAM_HPP
+#define THALLIUMVM_BENCH_PROGRAM_HPP
+
+#include <cstdint>
+#include <vector>
+#include "thallium/instruction.hpp"
+#include "thallium/register.hpp"
+
+namespace thallium
+{
+	namespace bench
+	{
+		/**
+		 * Helper to write ThalliumVM programs by hand, encoding the arguments as documented in Opcode.
+		 */
+		class ProgramBuilder
+		{
+		public:
+			/**
+			 * \return Address of the next instruction to be emitted
+			 */
+			vmreg_t here() const
+			{
+				return static_cast<vmreg_t>(_program.size() * Instruction::size());
+			}
+
+			/**
+			 * <code>op r1 r2 r3 r4</code>, with each register taking 16 bits of the argument
+			 * \return Index of the emitted instruction
+			 */
+			size_t op(const Opcode opcode, const uint16_t r1 = 0, const uint16_t r2 = 0, const uint16_t r3 = 0,
+					  const uint16_t r4 = 0)
+			{
+				return emit(opcode, uint64_t(r1) | (uint64_t(r2) << 16) | (uint64_t(r3) << 32) | (uint64_t(r4) << 48));
+			}
+
+			/**
+			 * <code>imm i rdst</code>
+			 * \return Index of the emitted instruction
+			 */
+			size_t imm(const uint32_t value, const uint16_t rdst)
+			{
+				return emit(Opcode::imm, uint64_t(value) | (uint64_t(rdst) << 32));
+			}
+
+			/**
+			 * <code>hcall i rbase</code>
+			 * \return Index of the emitted instruction
+			 */
+			size_t hcall(const uint32_t id, const uint16_t rbase)
+			{
+				return emit(Opcode::hcall, uint64_t(id) | (uint64_t(rbase) << 32));
+			}
+
+			/**
+			 * <code>sbit r i v</code>
+			 * \return Index of the emitted instruction
+			 */
+			size_t sbit(const uint16_t r, const uint8_t index, const bool value)
+			{
+				return emit(Opcode::sbit, uint64_t(r) | (uint64_t(index) << 16) | (uint64_t(value) << 24));
+			}
+
+			/**
+			 * <code>cjmp i</code> or <code>call i</code>
+			 * \return Index of the emitted instruction, for patch()
+			 */
+			size_t jump(const Opcode opcode, const vmreg_t target = 0)
+			{
+				return emit(opcode, target);
+			}
+
+			/**
+			 * Unconditional jump, clobbering the TEST flag
+			 * \param rany Any register
+			 * \return Index of the cjmp instruction, for patch()
+			 */
+			size_t jump_always(const uint16_t rany, const vmreg_t target = 0)
+			{
+				op(Opcode::teq, rany, rany);
+				return jump(Opcode::cjmp, target);
+			}
+
+			/**
+			 * Returns from a call, by popping the return address into a scratch register.
+			 */
+			void ret(const uint16_t rscratch)
+			{
+				op(Opcode::pop, rscratch);
+				op(Opcode::teq, rscratch, rscratch);
+				op(Opcode::cjmpr, rscratch);
+			}
+
+			/**
+			 * Sets the immediate address of a previously emitted jump.
+			 * \param index Index of the jump instruction
+			 * \param target Target address
+			 */
+			void patch(const size_t index, const vmreg_t target)
+			{
+				_program[index].argument = target;
+			}
+
+			/**
+			 * Sets the value of a previously emitted imm, keeping its destination register.
+			 * \param index Index of the imm instruction
+			 * \param value Immediate value
+			 */
+			void patch_imm(const size_t index, const uint32_t value)
+			{
+				_program[index].argument = (_program[index].argument & ~uint64_t(0xFFFFFFFF)) | value;
+			}
+
+			size_t exit()
+			{
+				return emit(Opcode::__PLACEHOLDER_EXIT, 0);
+			}
+
+			const std::vector<Instruction>& program() const
+			{
+				return _program;
+			}
+
+		private:
+			size_t emit(const Opcode opcode, const uint64_t argument)
+			{
+				_program.push_back({opcode, argument});
+				return _program.size() - 1;
+			}
+
+			std::vector<Instruction> _program;
+		};
+	}
+}
+
+#endif
@@ -20,10 +20,10 @@ int main()
 		error(TimeOfError::Preload, ErrorType::Fatal, "VM initialization failed");
 	}
 
-	try {
-		vm.run();
-	} catch (const VMException& e)
+	const Trap trap = vm.run();
+	if (trap)
 	{
+		trap.report();
 		error(TimeOfError::Runtime, ErrorType::Fatal, "the VM cannot recover.");
 	}
 	return 0;
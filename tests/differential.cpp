@@ -0,0 +1,444 @@
+#include <random>
+#include <string>
+#include <vector>
+#include "tests/test.hpp"
+#include "bench/program.hpp"
+#include "thallium/image.hpp"
+#include "thallium/serializer.hpp"
+
+using namespace thallium;
+using namespace thallium::tests;
+using bench::ProgramBuilder;
+
+/**
+ * Registers of the generated programs: random operations only write to the data registers, the others holding
+ * addresses and counters
+ */
+const uint16_t first_data_register = 3;
+const uint16_t data_registers = 7;
+const uint16_t rzero = 10;
+const uint16_t rcount = 11;
+const uint16_t rdata = 12;
+const uint16_t rcode = 13;
+const uint16_t rvalue = 14;
+const uint16_t rsum = 15;
+
+/**
+ * Layout of memory past the code
+ */
+const vmreg_t data_size = 256;
+const vmreg_t stack_size = 8192;
+
+/**
+ * Times the body of a generated program runs, so that code it rewrites runs again
+ */
+const uint32_t iterations = 3;
+
+/**
+ * Instruction a generated program may rewrite while running, always into another valid instruction.
+ */
+struct Slot
+{
+	enum Kind
+	{
+		/**
+		 * imm, whose value is rewritten
+		 */
+		Value,
+
+		/**
+		 * inc, dec, push or pop, rewritten into any of them on any data register
+		 */
+		Unary,
+
+		/**
+		 * cjmp, whose target is rewritten to another item following it
+		 */
+		Target
+	};
+
+	Kind kind;
+	size_t index;
+
+	/**
+	 * Item the instruction belongs to
+	 */
+	size_t item;
+};
+
+/**
+ * Instruction whose immediate is set once every item is emitted.
+ */
+struct Patch
+{
+	enum Kind
+	{
+		/**
+		 * cjmp to the address of an item
+		 */
+		Jump,
+
+		/**
+		 * imm of an address in the data
+		 */
+		Data,
+
+		/**
+		 * imm of the value then imm of the address of a code store
+		 */
+		Store
+	};
+
+	Kind kind;
+	size_t index;
+
+	/**
+	 * Target item of a jump, or offset in the data
+	 */
+	size_t target;
+};
+
+/**
+ * Random programs of straight-line items run a few times in a loop. Items compute on the data registers, compare
+ * them to jump forward to another item, load and store data, and store over the code of the program: over the
+ * value of an imm, the operation of a unary instruction or the target of a cjmp, the first instructions of
+ * superinstructions included.
+ */
+class Generator
+{
+public:
+	explicit Generator(const uint32_t seed) :
+		_random(seed),
+		_memory_size(0)
+	{}
+
+	std::vector<Instruction> program(const size_t items)
+	{
+		ProgramBuilder b;
+		const size_t stack_imm = b.imm(0, static_cast<uint16_t>(SPRegisters::sp));
+		b.imm(0, rzero);
+		b.imm(iterations, rcount);
+
+		for (uint16_t r = 0; r < data_registers; ++r)
+			b.imm(value(), first_data_register + r);
+
+		const vmreg_t loop = b.here();
+		std::vector<vmreg_t> addresses;
+
+		for (size_t item = 0; item < items; ++item)
+		{
+			addresses.push_back(b.here());
+			emit_item(b, item, items);
+		}
+
+		// the loop, then a checksum of the whole memory but the stack into rsum
+		addresses.push_back(b.here());
+		b.op(Opcode::dec, rcount);
+		b.op(Opcode::tgt, rcount, rzero);
+		b.jump(Opcode::cjmp, loop);
+
+		b.imm(0, rdata);
+		b.imm(0, rsum);
+		b.imm(31, rzero);
+		b.imm(4, rvalue);
+		const size_t end_imm = b.imm(0, rcount);
+		const vmreg_t checksum = b.here();
+		b.op(Opcode::mget, rdata, rcode);
+		b.op(Opcode::umul, rsum, rzero, rsum);
+		b.op(Opcode::uadd, rsum, rcode, rsum);
+		b.op(Opcode::uadd, rdata, rvalue, rdata);
+		b.op(Opcode::tlt, rdata, rcount);
+		b.jump(Opcode::cjmp, checksum);
+		b.exit();
+
+		const vmreg_t data = b.here() + (4 - b.here() % 4) % 4;
+		b.patch_imm(stack_imm, data + data_size + stack_size / 2);
+		b.patch_imm(end_imm, data + data_size);
+		_memory_size = data + data_size + stack_size;
+
+		for (const Patch& p : _patches)
+		{
+			switch (p.kind)
+			{
+			case Patch::Jump: b.patch(p.index, addresses[p.target]); break;
+			case Patch::Data: b.patch_imm(p.index, static_cast<uint32_t>(data + p.target)); break;
+			case Patch::Store: complete_store(b, p.index, data, addresses); break;
+			}
+		}
+
+		return b.program();
+	}
+
+	size_t memory_size() const
+	{
+		return _memory_size;
+	}
+
+private:
+	uint32_t value()
+	{
+		// small values often, so that comparisons go both ways
+		return _random() % 2 ? _random() % 8 : static_cast<uint32_t>(_random());
+	}
+
+	uint16_t data_register()
+	{
+		return static_cast<uint16_t>(first_data_register + _random() % data_registers);
+	}
+
+	void emit_item(ProgramBuilder& b, const size_t item, const size_t items)
+	{
+		const Opcode unary[] = {Opcode::inc, Opcode::dec, Opcode::push, Opcode::pop};
+		const Opcode binary[] = {Opcode::uadd, Opcode::usub, Opcode::umul, Opcode::shl, Opcode::shr};
+		const Opcode tests[] = {Opcode::teq, Opcode::tgt, Opcode::tlt};
+
+		switch (_random() % 8)
+		{
+		case 0:
+			b.op(binary[_random() % 5], data_register(), data_register(), data_register());
+			break;
+
+		case 1: {
+			// imm then uadd, fused
+			const uint16_t r = data_register();
+			_slots.push_back(Slot{Slot::Value, b.imm(value(), r), item});
+			b.op(Opcode::uadd, r, data_register(), data_register());
+		} break;
+
+		case 2:
+			_slots.push_back(Slot{Slot::Unary, b.op(unary[_random() % 4], data_register()), item});
+			break;
+
+		case 3: {
+			// pairs of pushes or pops, fused
+			const Opcode op = _random() % 2 ? Opcode::push : Opcode::pop;
+			_slots.push_back(Slot{Slot::Unary, b.op(op, data_register()), item});
+			_slots.push_back(Slot{Slot::Unary, b.op(op, data_register()), item});
+		} break;
+
+		case 4: {
+			// a test then a forward jump, fused
+			b.op(tests[_random() % 3], data_register(), data_register());
+			const size_t jump = b.jump(Opcode::cjmp);
+			_patches.push_back(Patch{Patch::Jump, jump, item + 1 + _random() % (items - item)});
+			_slots.push_back(Slot{Slot::Target, jump, item});
+		} break;
+
+		case 5:
+			_patches.push_back(Patch{Patch::Data, b.imm(0, rdata), _random() % (data_size / 4) * 4});
+			b.op(_random() % 2 ? Opcode::mset : Opcode::mget, rdata, data_register());
+			break;
+
+		default:
+			// a code store, completed once every slot is known
+			_patches.push_back(Patch{Patch::Store, b.imm(0, rvalue), 0});
+			b.imm(0, rcode);
+			b.op(Opcode::mset, rcode, rvalue);
+			break;
+		}
+	}
+
+	/**
+	 * Picks the instruction a code store rewrites, and what it rewrites it into.
+	 * \param b Program
+	 * \param index Index of the imm of the value stored, followed by the imm of the address
+	 * \param data Address of the data, stored to when there is nothing to rewrite
+	 * \param addresses Addresses of the items, and of the end of the loop
+	 */
+	void complete_store(ProgramBuilder& b, const size_t index, const vmreg_t data, const std::vector<vmreg_t>& addresses)
+	{
+		const Opcode unary[] = {Opcode::inc, Opcode::dec, Opcode::push, Opcode::pop};
+
+		if (_slots.empty())
+		{
+			b.patch_imm(index + 1, data);
+			return;
+		}
+
+		const Slot& slot = _slots[_random() % _slots.size()];
+		const vmreg_t address = static_cast<vmreg_t>(slot.index * Instruction::size());
+		uint32_t word = 0;
+		vmreg_t offset = 1;
+
+		switch (slot.kind)
+		{
+		case Slot::Value:
+			word = value();
+			break;
+
+		case Slot::Unary:
+			word = static_cast<uint32_t>(unary[_random() % 4]) | uint32_t(data_register()) << 8;
+			offset = 0;
+			break;
+
+		case Slot::Target:
+			word = addresses[slot.item + 1 + _random() % (addresses.size() - slot.item - 1)];
+			break;
+		}
+
+		b.patch_imm(index, word);
+		b.patch_imm(index + 1, address + offset);
+	}
+
+	std::mt19937 _random;
+	std::vector<Slot> _slots;
+	std::vector<Patch> _patches;
+	size_t _memory_size;
+};
+
+/**
+ * Interpreter of the instructions the generated programs use, written straight from the documentation of Opcode
+ * and independent of the VM: it fetches every instruction from memory as it runs.
+ */
+class Reference
+{
+public:
+	Reference(const std::vector<Instruction>& program, const size_t memory_size) :
+		_memory(memory_size, 0),
+		_registers(16, 0)
+	{
+		serialize_instructions(program.data(), program.size(), _memory.data());
+	}
+
+	/**
+	 * \return false if the program used an instruction or an address the reference does not support
+	 */
+	bool run()
+	{
+		vmreg_t& ip = _registers[static_cast<uint16_t>(SPRegisters::ip)];
+		vmreg_t& sp = _registers[static_cast<uint16_t>(SPRegisters::sp)];
+		bool test = false;
+
+		for (uint64_t steps = 0; steps < 1000000; ++steps)
+		{
+			if (ip + Instruction::size() > _memory.size())
+				return false;
+
+			const Opcode opcode = static_cast<Opcode>(_memory[ip]);
+			const uint64_t argument = deserialize_type<uint64_t>(_memory.data() + ip + 1);
+			const auto reg = [&](const unsigned field) -> vmreg_t& {
+				return _registers.at((argument >> (16 * field)) & 0xFFFF);
+			};
+
+			vmreg_t next = ip + Instruction::size();
+
+			switch (opcode)
+			{
+			case Opcode::mov: reg(1) = reg(0); break;
+			case Opcode::imm: _registers.at((argument >> 32) & 0xFFFF) = static_cast<vmreg_t>(argument); break;
+			case Opcode::mget: if (!load(reg(0), reg(1))) return false; break;
+			case Opcode::mset: if (!store(reg(0), reg(1))) return false; break;
+			case Opcode::teq: test = reg(0) == reg(1); break;
+			case Opcode::tgt: test = reg(0) > reg(1); break;
+			case Opcode::tlt: test = reg(0) < reg(1); break;
+			case Opcode::cjmp: if (test) next = static_cast<vmreg_t>(argument); break;
+			case Opcode::shr: reg(1) = reg(0) >> (reg(2) & 31); break;
+			case Opcode::shl: reg(1) = reg(0) << (reg(2) & 31); break;
+			case Opcode::inc: ++reg(0); break;
+			case Opcode::dec: --reg(0); break;
+			case Opcode::uadd: reg(2) = reg(0) + reg(1); break;
+			case Opcode::usub: reg(2) = reg(0) - reg(1); break;
+			case Opcode::umul: reg(2) = reg(0) * reg(1); break;
+
+			case Opcode::push:
+				sp += 4;
+				if (!store(sp, reg(0)))
+					return false;
+				break;
+
+			case Opcode::pop:
+				if (!load(sp, reg(0)))
+					return false;
+				sp -= 4;
+				break;
+
+			case Opcode::__PLACEHOLDER_EXIT:
+				return true;
+
+			default:
+				return false;
+			}
+
+			ip = next;
+		}
+
+		return false;
+	}
+
+	const std::vector<vmreg_t>& registers() const
+	{
+		return _registers;
+	}
+
+private:
+	bool load(const vmreg_t address, vmreg_t& value) const
+	{
+		if (uint64_t(address) + 4 > _memory.size())
+			return false;
+
+		value = deserialize_type<vmreg_t>(_memory.data() + address);
+		return true;
+	}
+
+	bool store(const vmreg_t address, const vmreg_t value)
+	{
+		if (uint64_t(address) + 4 > _memory.size())
+			return false;
+
+		serialize_type(value, _memory.data() + address);
+		return true;
+	}
+
+	std::vector<uint8_t> _memory;
+	std::vector<vmreg_t> _registers;
+};
+
+static void check_registers(VM& vm, const Reference& reference, const std::string& what)
+{
+	for (uint16_t r = static_cast<uint16_t>(SPRegisters::sp); r < reference.registers().size(); ++r)
+	{
+		if (r != static_cast<uint16_t>(SPRegisters::fl))
+			check_equal(vm.registers()[r], reference.registers()[r], what + " r" + std::to_string(r));
+	}
+}
+
+int main()
+{
+	const size_t programs = 64;
+
+	for (uint32_t seed = 1; seed <= programs; ++seed)
+	{
+		Generator generator{seed};
+		const std::vector<Instruction> program = generator.program(24 + seed % 40);
+		const std::string name = "program " + std::to_string(seed);
+
+		Reference reference{program, generator.memory_size()};
+		check(reference.run(), name + " runs on the reference interpreter");
+
+		const std::shared_ptr<const ProgramImage> image = ProgramImage::create(program);
+
+		for (const Engine engine : engines)
+		{
+			// a VM of its own, then a VM sharing the image and running twice, the second run after a reset
+			const std::string what = name + " " + engine_name(engine);
+
+			VM vm{generator.memory_size()};
+			vm.import_program(program);
+			const Trap trap = vm.run(engine);
+			check(!trap, what + ": " + trap.message());
+			check_registers(vm, reference, what);
+
+			VM shared{generator.memory_size()};
+			shared.import_program(image);
+			for (int run = 0; run < 2; ++run)
+			{
+				const Trap shared_trap = shared.run(engine);
+				check(!shared_trap, what + " shared image: " + shared_trap.message());
+				check_registers(shared, reference, what + " shared image, run " + std::to_string(run));
+				shared.reset();
+			}
+		}
+	}
+
+	return failures() == 0 ? 0 : 1;
+}
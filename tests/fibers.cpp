@@ -0,0 +1,101 @@
+#include <string>
+#include <vector>
+#include "tests/test.hpp"
+#include "bench/kernels.hpp"
+#include "bench/program.hpp"
+
+using namespace thallium;
+using namespace thallium::tests;
+using bench::ProgramBuilder;
+
+using PagedVM = BasicVM<VMConfig<PagedMemory>>;
+
+template<typename VMType>
+static void check_kernel(const bench::Kernel& kernel, const size_t threads, const Engine engine,
+						 const std::string& what)
+{
+	VMType vm{kernel.memory_size};
+	vm.set_fiber_threads(threads);
+	vm.import_program(kernel.program);
+
+	// the second run starts over from reset(), dropping the fibers of the first one
+	for (int run = 0; run < 2; ++run)
+	{
+		const Trap trap = vm.run(engine);
+		check(!trap, what + ": " + trap.message());
+		check_equal(vm.registers()[kernel.result_register], kernel.expected, what + " result");
+		vm.reset();
+	}
+}
+
+/**
+ * The main fiber joins a fiber, then writes "inc r200" over an exit and runs it. r200 is past the registers of the
+ * fibers, which only have those the program named.
+ */
+static std::vector<Instruction> register_past_the_fibers()
+{
+	const vmreg_t size = static_cast<vmreg_t>(Instruction::size());
+
+	ProgramBuilder b;
+	b.imm(9 * size, 4);
+	b.imm(0, 5);
+	b.op(Opcode::fspawn, 4, 5, 6);
+	b.op(Opcode::fjoin, 6);
+	b.imm(static_cast<vmreg_t>(Opcode::inc) | (200u << 8), 7);
+	b.imm(7 * size, 8);
+	b.op(Opcode::mset, 8, 7);
+
+	// overwritten with inc r200
+	b.exit();
+	b.exit();
+
+	// the spawned fiber
+	b.exit();
+
+	return b.program();
+}
+
+int main()
+{
+	const bench::Kernel kernels[] = {
+		bench::fiber_spawn_kernel(1000),
+		bench::fiber_yield_kernel(16, 100),
+		bench::fiber_work_kernel(8, 200),
+		bench::fiber_reduce_kernel(8, 1024)
+	};
+
+	const size_t thread_counts[] = {1, 4};
+
+	for (const bench::Kernel& kernel : kernels)
+	{
+		for (const size_t threads : thread_counts)
+		{
+			for (const Engine engine : engines)
+			{
+				const std::string what = kernel.name + " " + std::to_string(threads) + "t " + engine_name(engine);
+				check_kernel<VM>(kernel, threads, engine, what);
+			}
+
+			// paged memory cannot be shared between threads, its fibers run on the calling thread
+			check_kernel<PagedVM>(kernel, threads, Engine::Threaded, "paged " + kernel.name + " " + std::to_string(threads) + "t");
+		}
+	}
+
+	{
+		const std::vector<Instruction> program = register_past_the_fibers();
+		const vmreg_t size = static_cast<vmreg_t>(Instruction::size());
+
+		for (const Engine engine : engines)
+		{
+			VM vm{4096};
+			vm.import_program(program);
+
+			const Trap trap = vm.run(engine);
+			check(trap.code == TrapCode::InvalidInstruction, std::string("register past the fibers, ") + engine_name(engine));
+			check_equal(trap.ip, 7 * size, std::string("register past the fibers ip, ") + engine_name(engine));
+			check_equal(vm.registers().size(), size_t(9), std::string("registers of the fibers, ") + engine_name(engine));
+		}
+	}
+
+	return failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "tests/test.hpp"
+#include "bench/kernels.hpp"
+#include "thallium/program_cache.hpp"
+
+#ifdef THALLIUM_HAS_MMAP
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace thallium;
+using namespace thallium::tests;
+
+#ifdef THALLIUM_HAS_MMAP
+/**
+ * Offsets of header fields in a cache entry
+ */
+const std::streamoff fusions_offset = 104;
+const std::streamoff register_span_offset = 112;
+
+/**
+ * \return Paths of the entries of a cache directory
+ */
+static std::vector<std::string> entries(const std::string& directory)
+{
+	std::vector<std::string> paths;
+
+	DIR* dir = opendir(directory.c_str());
+	if (dir == nullptr)
+		return paths;
+
+	while (const dirent* e = readdir(dir))
+	{
+		const std::string name = e->d_name;
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".thc") == 0)
+			paths.push_back(directory + "/" + name);
+	}
+
+	closedir(dir);
+	return paths;
+}
+
+static void overwrite(const std::string& path, const std::streamoff offset, const uint8_t value)
+{
+	std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+	file.seekp(offset);
+	file.put(static_cast<char>(value));
+}
+
+static void truncate_to(const std::string& path, const off_t size)
+{
+	check(truncate(path.c_str(), size) == 0, "truncating " + path);
+}
+
+/**
+ * Runs the image of a kernel and checks its result.
+ */
+static void check_runs(const bench::Kernel& kernel, const std::shared_ptr<const ProgramImage>& image,
+					   const std::string& what)
+{
+	VM vm{kernel.memory_size};
+	vm.import_program(image);
+
+	const Trap trap = vm.run();
+	check(!trap, what + ": " + trap.message());
+	check_equal(vm.registers()[kernel.result_register], kernel.expected, what + " result");
+}
+
+/**
+ * Gets a kernel from a cache whose entry was tampered with, which has to be translated again and replace the entry.
+ * \param tamper Changes the entry
+ */
+template<typename Tamper>
+static void check_rejected(const std::string& directory, const bench::Kernel& kernel,
+						   const std::shared_ptr<const ProgramImage>& reference, const std::string& what,
+						   const Tamper& tamper)
+{
+	tamper(entries(directory).at(0));
+
+	ProgramCache cache{directory};
+	const std::shared_ptr<const ProgramImage> image = cache.get(kernel.program);
+	check_equal(cache.stats().misses, uint64_t(1), what + " misses");
+	check_equal(image->register_span(), reference->register_span(), what + " register span");
+	check_equal(image->fusions(), reference->fusions(), what + " fusions");
+	check_runs(kernel, image, what);
+
+	// the entry written back is used again
+	ProgramCache again{directory};
+	again.get(kernel.program);
+	check_equal(again.stats().hits, uint64_t(1), what + " hits once replaced");
+}
+
+int main()
+{
+	char root_template[] = "/tmp/thallium-test-XXXXXX";
+	const char* root = mkdtemp(root_template);
+	if (root == nullptr)
+		return 1;
+
+	const std::string directory = std::string(root) + "/programs";
+	const bench::Kernel kernel = bench::fib_kernel(20);
+	const std::shared_ptr<const ProgramImage> reference = ProgramImage::create(kernel.program);
+
+	// a warm start restores the image with its verification
+	{
+		ProgramCache cold{directory};
+		check_runs(kernel, cold.get(kernel.program), "cold");
+		check_equal(cold.stats().misses, uint64_t(1), "cold misses");
+		check_equal(entries(directory).size(), size_t(1), "entries");
+
+		ProgramCache warm{directory};
+		const std::shared_ptr<const ProgramImage> image = warm.get(kernel.program);
+		check_equal(warm.stats().hits, uint64_t(1), "warm hits");
+		check(image->verification().certified() == reference->verification().certified(), "warm certification");
+		check_equal(image->verification().blocks().size(), reference->verification().blocks().size(), "warm blocks");
+		check_equal(image->register_span(), reference->register_span(), "warm register span");
+		check_runs(kernel, image, "warm");
+	}
+
+	// corrupted entries, header fields outside of the metadata included
+	check_rejected(directory, kernel, reference, "register span", [](const std::string& path) {
+		overwrite(path, register_span_offset, 1);
+	});
+	check_rejected(directory, kernel, reference, "fusions", [](const std::string& path) {
+		overwrite(path, fusions_offset, 0xFF);
+	});
+	check_rejected(directory, kernel, reference, "metadata", [](const std::string& path) {
+		struct stat st;
+		stat(path.c_str(), &st);
+		overwrite(path, st.st_size - 1, 0xFF);
+	});
+	check_rejected(directory, kernel, reference, "truncated", [](const std::string& path) {
+		truncate_to(path, 64);
+	});
+
+	// entries and directories other users could write to are not trusted
+	check_rejected(directory, kernel, reference, "group-writable entry", [](const std::string& path) {
+		chmod(path.c_str(), S_IRUSR | S_IWUSR | S_IWGRP);
+	});
+
+	chmod(directory.c_str(), S_IRWXU | S_IWGRP | S_IXGRP);
+	{
+		ProgramCache shared{directory};
+		check_runs(kernel, shared.get(kernel.program), "shared directory");
+		check_runs(kernel, shared.get(kernel.program), "shared directory, again");
+		check_equal(shared.stats().hits, uint64_t(0), "shared directory hits");
+		check_equal(shared.stats().misses, uint64_t(0), "shared directory misses");
+	}
+
+	for (const std::string& path : entries(directory))
+	{
+		std::remove(path.c_str());
+	}
+
+	rmdir(directory.c_str());
+	rmdir(root);
+
+	return failures() == 0 ? 0 : 1;
+}
+#else
+int main()
+{
+	return 0;
+}
+#endif
@@ -0,0 +1,151 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "tests/test.hpp"
+#include "bench/kernels.hpp"
+#include "thallium/error.hpp"
+#include "thallium/image.hpp"
+
+#ifdef THALLIUM_HAS_MMAP
+#include <unistd.h>
+#endif
+
+using namespace thallium;
+using namespace thallium::tests;
+
+/**
+ * Offsets in a translated program file: of the translation offset in the header, and of the pre-decoded program
+ * in the translation
+ */
+const std::streamoff translation_offset_field = 56;
+const std::streamoff decoded_offset = 88;
+
+static uint64_t translation_offset(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	in.seekg(translation_offset_field);
+
+	uint8_t bytes[8] = {};
+	in.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+
+	uint64_t offset = 0;
+	for (size_t i = 0; i < sizeof(bytes); ++i)
+	{
+		offset |= uint64_t(bytes[i]) << (8 * i);
+	}
+
+	return offset;
+}
+
+static void flip(const std::string& path, const std::streamoff offset)
+{
+	std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+	file.seekg(offset);
+	const int value = file.get();
+	file.seekp(offset);
+	file.put(static_cast<char>(value ^ 0x01));
+}
+
+/**
+ * Runs the image of a kernel and checks its result.
+ */
+static void check_runs(const bench::Kernel& kernel, const std::shared_ptr<const ProgramImage>& image,
+					   const std::string& what)
+{
+	for (const Engine engine : engines)
+	{
+		VM vm{kernel.memory_size};
+		vm.import_program(image);
+
+		const Trap trap = vm.run(engine);
+		check(!trap, what + " " + engine_name(engine) + ": " + trap.message());
+		check_equal(vm.registers()[kernel.result_register], kernel.expected, what + " " + engine_name(engine) + " result");
+	}
+}
+
+static void check_same_translation(const std::shared_ptr<const ProgramImage>& image,
+								   const std::shared_ptr<const ProgramImage>& reference, const std::string& what)
+{
+	check_equal(image->count(), reference->count(), what + " instructions");
+	check_equal(image->fusions(), reference->fusions(), what + " fusions");
+	check_equal(image->register_span(), reference->register_span(), what + " register span");
+	check(image->verification().certified() == reference->verification().certified(), what + " certification");
+	check_equal(image->verification().blocks().size(), reference->verification().blocks().size(), what + " blocks");
+}
+
+/**
+ * \return Whether loading a program file fails
+ */
+static bool rejected(const std::string& path, const bool verify, const bool trusted)
+{
+	try {
+		ProgramImage::load(path, verify, trusted);
+	} catch (const VMException&)
+	{
+		return true;
+	}
+
+	return false;
+}
+
+int main()
+{
+#ifdef THALLIUM_HAS_MMAP
+	char root_template[] = "/tmp/thallium-test-XXXXXX";
+	const char* root = mkdtemp(root_template);
+	if (root == nullptr)
+		return 1;
+
+	const std::string path = std::string(root) + "/program.thp";
+#else
+	const std::string path = "thalliumvm_test_program.thp";
+#endif
+
+	const bench::Kernel kernels[] = {bench::fib_kernel(20), bench::sieve_kernel(1000)};
+	const ProgramEncoding encodings[] = {ProgramEncoding::Packed, ProgramEncoding::Aligned, ProgramEncoding::Translated};
+
+	for (const bench::Kernel& kernel : kernels)
+	{
+		const std::shared_ptr<const ProgramImage> reference = ProgramImage::create(kernel.program);
+
+		for (const ProgramEncoding encoding : encodings)
+		{
+			const std::string what = kernel.name + " encoding " + std::to_string(static_cast<uint32_t>(encoding));
+			reference->save(path, encoding);
+
+			const std::shared_ptr<const ProgramImage> image = ProgramImage::load(path);
+			check_same_translation(image, reference, what);
+			check_runs(kernel, image, what);
+
+			const std::shared_ptr<const ProgramImage> trusted = ProgramImage::load(path, true, true);
+			check_same_translation(trusted, reference, what + " trusted");
+			check_runs(kernel, trusted, what + " trusted");
+		}
+
+#ifdef THALLIUM_HAS_MMAP
+		// a pre-decoded program which does not match the code is caught by its checksum, and by decoding the code
+		// when the checksums are not checked
+		reference->save(path, ProgramEncoding::Translated);
+		const uint64_t translation = translation_offset(path);
+
+		flip(path, static_cast<std::streamoff>(translation) + decoded_offset + 4);
+		check(rejected(path, true, false), kernel.name + " corrupted translation");
+		check(rejected(path, false, false), kernel.name + " corrupted translation, unchecked");
+
+		reference->save(path, ProgramEncoding::Translated);
+		flip(path, static_cast<std::streamoff>(ProgramFileHeader::default_code_offset()) + 1);
+		check(rejected(path, true, false), kernel.name + " corrupted code");
+		check(rejected(path, false, false), kernel.name + " corrupted code, unchecked");
+#endif
+	}
+
+	std::remove(path.c_str());
+
+#ifdef THALLIUM_HAS_MMAP
+	rmdir(root);
+#endif
+
+	return failures() == 0 ? 0 : 1;
+}
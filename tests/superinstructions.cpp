@@ -0,0 +1,65 @@
+#include <vector>
+#include "tests/test.hpp"
+#include "bench/program.hpp"
+#include "thallium/image.hpp"
+#include "thallium/profiler.hpp"
+
+using namespace thallium;
+using namespace thallium::tests;
+using bench::ProgramBuilder;
+
+/**
+ * push r8 ; push r9 fused, the first push storing over the second one and turning it into inc r9:
+ * r9 ends up as 6 and sp as 36 if the rewritten instruction runs, as 5 and 40 if the stale one does.
+ */
+static std::vector<Instruction> self_overwriting_push()
+{
+	ProgramBuilder b;
+	b.imm(0x90F, 8);
+	b.imm(5, 9);
+	b.imm(32, static_cast<uint16_t>(SPRegisters::sp));
+	b.op(Opcode::push, 8);
+	b.op(Opcode::push, 9);
+	b.exit();
+
+	return b.program();
+}
+
+static void check_rewritten(VM& vm, const Trap& trap, const std::string& what)
+{
+	check(!trap, what + ": " + trap.message());
+	check_equal(vm.registers()[9], vmreg_t(6), what + " r9");
+	check_equal(vm.registers()[SPRegisters::sp], vmreg_t(36), what + " sp");
+}
+
+int main()
+{
+	const std::shared_ptr<const ProgramImage> image = ProgramImage::create(self_overwriting_push());
+
+	for (const Engine engine : engines)
+	{
+		const std::string name = engine_name(engine);
+
+		VM vm{4096};
+		vm.import_program(self_overwriting_push());
+		check_rewritten(vm, vm.run(engine), name);
+
+		// the first code write copies the decoded program out of the shared image, the second half included
+		VM first{4096};
+		first.import_program(image);
+		check_rewritten(first, first.run(engine), name + " shared image");
+
+		VM second{4096};
+		second.import_program(image);
+		check_rewritten(second, second.run(engine), name + " shared image, second VM");
+
+		Profiler profiler;
+		VM profiled{4096};
+		profiled.import_program(image);
+		check_rewritten(profiled, profiled.run(profiler, engine), name + " profiled");
+		check_equal(profiler.opcode_count(Opcode::push), uint64_t(1), name + " profiled pushes");
+		check_equal(profiler.opcode_count(Opcode::inc), uint64_t(1), name + " profiled incs");
+	}
+
+	return failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#ifndef THALLIUMVM_TESTS_TEST_HPP
+#define THALLIUMVM_TESTS_TEST_HPP
+
+#include <iostream>
+#include <string>
+#include "thallium/vm.hpp"
+
+namespace thallium
+{
+	namespace tests
+	{
+		/**
+		 * Number of failed checks of the running test, which its main() returns
+		 */
+		inline int& failures()
+		{
+			static int count = 0;
+			return count;
+		}
+
+		/**
+		 * Reports a check which does not hold.
+		 * \param holds Whether the check holds
+		 * \param what Description of the check
+		 */
+		inline void check(const bool holds, const std::string& what)
+		{
+			if (holds)
+				return;
+
+			std::cerr << "FAILED: " << what << std::endl;
+			++failures();
+		}
+
+		/**
+		 * Reports a value different from the expected one.
+		 * \param actual Value computed
+		 * \param expected Expected value
+		 * \param what Description of the value
+		 */
+		template<typename T>
+		void check_equal(const T& actual, const T& expected, const std::string& what)
+		{
+			check(actual == expected, what + ": got " + std::to_string(actual) + ", expected " + std::to_string(expected));
+		}
+
+		/**
+		 * \return Name of an engine, for the descriptions of checks
+		 */
+		inline const char* engine_name(const Engine engine)
+		{
+			switch (engine)
+			{
+			case Engine::Switch: return "switch";
+			case Engine::Threaded: return "threaded";
+			case Engine::Jit: return "jit";
+			case Engine::Aot: return "aot";
+			}
+
+			return "unknown";
+		}
+
+		/**
+		 * Every execution engine, those unavailable falling back to Engine::Switch
+		 */
+		const Engine engines[] = {Engine::Switch, Engine::Threaded, Engine::Jit, Engine::Aot};
+	}
+}
+
+#endif
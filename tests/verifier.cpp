@@ -0,0 +1,199 @@
+#include <string>
+#include <vector>
+#include "tests/test.hpp"
+#include "bench/program.hpp"
+#include "thallium/error.hpp"
+#include "thallium/image.hpp"
+
+using namespace thallium;
+using namespace thallium::tests;
+using bench::ProgramBuilder;
+
+const uint16_t ip = static_cast<uint16_t>(SPRegisters::ip);
+
+/**
+ * VM running certified programs without checks
+ */
+using UncheckedVM = BasicVM<VMConfig<VMMemory, Registers::gp_count(), false>>;
+
+static void invalid_opcode(ProgramBuilder& b)
+{
+	b.op(static_cast<Opcode>(0xEE));
+}
+
+/**
+ * Verifies a program and checks its certification and diagnostic.
+ */
+static void check_verification(const ProgramBuilder& b, const bool certified, const std::string& diagnostic,
+							   const std::string& what)
+{
+	const std::shared_ptr<const ProgramImage> image = ProgramImage::create(b.program());
+	const Verification& verification = image->verification();
+	check(verification.certified() == certified, what + " certification");
+	check(verification.diagnostic() == diagnostic, what + " diagnostic: got \"" + verification.diagnostic() + "\"");
+}
+
+static void check_rejected(const ProgramBuilder& b, const vmreg_t faulty, const std::string& problem,
+						   const std::string& what)
+{
+	check_verification(b, false, "the instruction at %ip = " + std::to_string(faulty) + " " + problem, what);
+}
+
+int main()
+{
+	const vmreg_t size = static_cast<vmreg_t>(Instruction::size());
+
+	{
+		ProgramBuilder b;
+		b.imm(1, 3);
+		b.exit();
+		check_verification(b, true, "", "well-formed program");
+	}
+
+	check_verification(ProgramBuilder{}, false, "the program is empty", "empty program");
+
+	{
+		ProgramBuilder b;
+		b.imm(1, 3);
+		invalid_opcode(b);
+		b.exit();
+		check_rejected(b, size, "has an invalid opcode", "invalid opcode");
+	}
+
+	{
+		ProgramBuilder b;
+		b.op(Opcode::inc, 60000);
+		b.exit();
+		check_rejected(b, 0, "names a register which does not exist", "register out of range");
+	}
+
+	// ip is only written by jumps and calls
+	{
+		ProgramBuilder b;
+		b.imm(0, ip);
+		b.exit();
+		check_rejected(b, 0, "writes to %ip outside of a jump", "imm to ip");
+	}
+
+	{
+		ProgramBuilder b;
+		b.op(Opcode::mov, 3, ip);
+		b.exit();
+		check_rejected(b, 0, "writes to %ip outside of a jump", "mov to ip");
+	}
+
+	{
+		ProgramBuilder b;
+		b.op(Opcode::pop, 3);
+		b.op(Opcode::pop, ip);
+		b.exit();
+		check_rejected(b, size, "writes to %ip outside of a jump", "pop to ip after a pop");
+	}
+
+	// static jumps land on instructions of the program
+	{
+		ProgramBuilder b;
+		b.jump_always(3, 4);
+		b.exit();
+		check_rejected(b, size, "jumps outside of the program or into the middle of an instruction",
+					   "jump into an instruction");
+	}
+
+	{
+		ProgramBuilder b;
+		b.jump(Opcode::call, 100 * size);
+		b.exit();
+		check_rejected(b, 0, "jumps outside of the program or into the middle of an instruction",
+					   "call outside of the program");
+	}
+
+	{
+		ProgramBuilder b;
+		b.imm(1, 3);
+		check_rejected(b, 0, "falls past the end of the program", "no exit");
+	}
+
+	// "teq r r" makes the jump following it unconditional, so what comes next is only reached by other jumps
+	{
+		ProgramBuilder b;
+		b.jump_always(3, 3 * size);
+		invalid_opcode(b);
+		b.exit();
+		check_verification(b, true, "", "unreachable invalid instruction");
+
+		const std::shared_ptr<const ProgramImage> image = ProgramImage::create(b.program());
+		check(!image->verification().safe_target(2 * size), "unreachable invalid instruction unsafe");
+		check(image->verification().safe_target(3 * size), "exit safe");
+		check(!image->verification().safe_target(3 * size + 1), "middle of an instruction unsafe");
+	}
+
+	{
+		ProgramBuilder b;
+		b.op(Opcode::teq, 3, 4);
+		b.jump(Opcode::cjmp, 3 * size);
+		invalid_opcode(b);
+		b.exit();
+		check_rejected(b, 2 * size, "has an invalid opcode", "conditional jump over an invalid instruction");
+	}
+
+	// the first problem by address among the reachable blocks is reported
+	{
+		ProgramBuilder b;
+		b.op(Opcode::teq, 3, 4);
+		b.jump(Opcode::cjmp, 4 * size);
+		b.imm(0, ip);
+		b.exit();
+		invalid_opcode(b);
+		check_rejected(b, 2 * size, "writes to %ip outside of a jump", "first of two problems");
+	}
+
+	{
+		ProgramBuilder b;
+		b.exit();
+		const std::shared_ptr<const ProgramImage> image = ProgramImage::create(b.program(), 4, 0);
+		check(!image->verification().certified(), "entry point inside an instruction");
+		check(image->verification().diagnostic() == "the entry point %ip = 4 is not an instruction of the program",
+			  "entry point inside an instruction diagnostic");
+	}
+
+	// VMs without checks only import certified programs, and stop where dynamic jumps leave certified code
+	{
+		ProgramBuilder b;
+		b.imm(1, 3);
+		invalid_opcode(b);
+
+		bool rejected = false;
+		try {
+			UncheckedVM vm{4096};
+			vm.import_program(b.program());
+		} catch (const VMException&)
+		{
+			rejected = true;
+		}
+
+		check(rejected, "unchecked VM importing an uncertified program");
+	}
+
+	{
+		ProgramBuilder b;
+		b.imm(4 * size, 3);
+		b.op(Opcode::teq, 3, 3);
+		b.op(Opcode::cjmpr, 3);
+		b.exit();
+		invalid_opcode(b);
+		b.exit();
+		check_verification(b, true, "", "dynamic jump");
+
+		for (const Engine engine : engines)
+		{
+			UncheckedVM vm{4096};
+			vm.import_program(b.program());
+
+			const Trap trap = vm.run(engine);
+			check(trap.code == TrapCode::UncertifiedCode, std::string("dynamic jump to an unsafe block, ") + engine_name(engine));
+			check_equal(trap.ip, 4 * size, std::string("dynamic jump to an unsafe block ip, ") + engine_name(engine));
+		}
+	}
+
+	return failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,450 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include "aot.hpp"
+#include "program_file.hpp"
+
+#ifdef THALLIUM_HAS_AOT
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+namespace thallium
+{
+	// Symbols defined by every translated program
+	const char aot_entry_symbol[] = "thallium_aot_run";
+	const char aot_version_symbol[] = "thallium_aot_version";
+	const char aot_program_entry_symbol[] = "thallium_aot_entry";
+	const char aot_code_symbol[] = "thallium_aot_code";
+	const char aot_code_size_symbol[] = "thallium_aot_code_size";
+
+	// Helpers of the translation unit, which does not include any ThalliumVM header
+	const char aot_prologue[] =
+		"// Generated by thallium::AotModule::translate\n"
+		"#include <cstdint>\n"
+		"#include <cstring>\n"
+		"\n"
+		"static inline uint32_t thallium_load(const uint8_t* m, const uint32_t a)\n"
+		"{\n"
+		"\tuint32_t v;\n"
+		"\tstd::memcpy(&v, m + a, sizeof(v));\n"
+		"#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__\n"
+		"\tv = __builtin_bswap32(v);\n"
+		"#endif\n"
+		"\treturn v;\n"
+		"}\n"
+		"\n"
+		"static inline void thallium_store(uint8_t* m, const uint32_t a, uint32_t v)\n"
+		"{\n"
+		"#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__\n"
+		"\tv = __builtin_bswap32(v);\n"
+		"#endif\n"
+		"\tstd::memcpy(m + a, &v, sizeof(v));\n"
+		"}\n"
+		"\n";
+
+	/**
+	 * \return Operand naming a register of the VM
+	 */
+	static std::string reg(const uint16_t r)
+	{
+		return "r[" + std::to_string(r) + "]";
+	}
+
+	/**
+	 * \return Whether translated code may run an instruction, which must not read nor write ip since it is only
+	 *         kept up to date when returning to the VM
+	 */
+	static bool translatable(const DecodedInstruction& d)
+	{
+		const auto reg = [](const uint16_t r) {
+			return r != static_cast<uint16_t>(SPRegisters::ip);
+		};
+
+		switch (d.op)
+		{
+		case DecodedOp::cjmp:
+		case DecodedOp::call:
+			return true;
+
+		case DecodedOp::imm:
+			return reg(d.b);
+
+		case DecodedOp::cjmpr:
+		case DecodedOp::callr:
+		case DecodedOp::sbit:
+		case DecodedOp::inc:
+		case DecodedOp::dec:
+		case DecodedOp::push:
+		case DecodedOp::pop:
+			return reg(d.a);
+
+		case DecodedOp::mov:
+		case DecodedOp::mget:
+		case DecodedOp::mset:
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+		case DecodedOp::gbit:
+			return reg(d.a) && reg(d.b);
+
+		case DecodedOp::shr:
+		case DecodedOp::shl:
+		case DecodedOp::uadd:
+		case DecodedOp::usub:
+		case DecodedOp::umul:
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+			return reg(d.a) && reg(d.b) && reg(d.c);
+
+		default:
+			return false;
+		}
+	}
+
+	std::string AotModule::translate(const ProgramImage& image)
+	{
+		const DecodedInstruction* code = image.decoded();
+		const Verification& verification = image.verification();
+		const size_t count = image.count();
+		const vmreg_t size = static_cast<vmreg_t>(Instruction::size());
+
+		const std::string sp = reg(static_cast<uint16_t>(SPRegisters::sp));
+		const std::string fl = reg(static_cast<uint16_t>(SPRegisters::fl));
+		const std::string test = "((" + fl + " >> " + std::to_string(static_cast<uint32_t>(Flags::Test)) + ") & 1u)";
+
+		// blocks are charged on entry for the instructions left in them
+		std::vector<size_t> block_end(count, 0);
+		std::vector<uint8_t> leader(count, 0);
+		for (const BasicBlock& block : verification.blocks())
+		{
+			leader[block.first] = 1;
+			for (size_t i = block.first; i < block.end; ++i)
+				block_end[i] = block.end;
+		}
+
+		std::ostringstream out;
+		out << aot_prologue;
+
+		out << "extern \"C\" const uint32_t " << aot_version_symbol << " = " << version() << "u;\n";
+		out << "extern \"C\" const uint32_t " << aot_program_entry_symbol << " = " << image.entry() << "u;\n";
+		out << "extern \"C\" const uint64_t " << aot_code_size_symbol << " = " << image.size() << "u;\n";
+		out << "extern \"C\" const unsigned char " << aot_code_symbol << "[] = {";
+		for (size_t i = 0; i < image.size(); ++i)
+			out << (i % 32 == 0 ? "\n\t" : " ") << unsigned(image.code()[i]) << ",";
+		out << (image.size() == 0 ? "0" : "") << "\n};\n\n";
+
+		// exits: 0 continue, 1 interpret the instruction at r[0], 2 out of fuel before the block at r[0]
+		out << "extern \"C\" uint32_t " << aot_entry_symbol
+			<< "(uint32_t* __restrict r, uint8_t* __restrict m, int64_t* __restrict fuel, const uint64_t size)\n"
+			<< "{\n"
+			<< "\tint64_t f = *fuel;\n"
+			<< "\n"
+			<< "#define THALLIUM_EXIT(exit) do { *fuel = f; return exit; } while (0)\n"
+			<< "#define THALLIUM_LEAVE(address) do { r[0] = address; THALLIUM_EXIT(1); } while (0)\n"
+			<< "#define THALLIUM_INTERPRET(address, refund) do { f += refund; THALLIUM_LEAVE(address); } while (0)\n"
+			<< "#define THALLIUM_CHARGE(address, length) do { if (f <= 0) { r[0] = address; THALLIUM_EXIT(2); } f -= length; } while (0)\n"
+			<< "#define THALLIUM_LOADABLE(a) (uint64_t(a) + 4 <= size)\n"
+			<< "#define THALLIUM_STORABLE(a) (a >= " << count * size << "u && uint64_t(a) + 4 <= size)\n"
+			<< "\n"
+			<< "\tgoto dispatch;\n";
+
+		// instructions of unsafe blocks are left to the interpreter, which checks them
+		const auto translated = [&](const size_t slot) {
+			return slot < count && verification.safe_target(static_cast<vmreg_t>(slot * size));
+		};
+
+		// static jumps stay in translated code, whose targets are all block leaders. Like in the interpreter, a
+		// jump to itself goes on with the next instruction.
+		const auto jump = [&](const vmreg_t address, vmreg_t target) -> std::string {
+			if (target == address)
+				target += size;
+
+			if (translated(target / size) && target % size == 0)
+				return "goto i" + std::to_string(target / size) + ";";
+
+			return "THALLIUM_LEAVE(" + std::to_string(target) + "u);";
+		};
+
+		const auto dynamic_jump = [&](const vmreg_t address, const std::string& target) -> std::string {
+			return "if (" + target + " != " + std::to_string(address) + "u) { r[0] = " + target + "; goto dispatch; }";
+		};
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!translated(i))
+				continue;
+
+			DecodedInstruction d = code[i];
+			d.op = unfused(d.op);
+
+			const vmreg_t address = static_cast<vmreg_t>(i * size);
+			const std::string next = std::to_string(address + size) + "u";
+			const std::string interpret = "THALLIUM_INTERPRET(" + std::to_string(address) + "u, " + std::to_string(block_end[i] - i) + ");";
+			const std::string a = reg(d.a), b = reg(d.b), c = reg(d.c);
+
+			out << "\n";
+			if (leader[i])
+				out << "i" << i << ":\n\tTHALLIUM_CHARGE(" << address << "u, " << block_end[i] - i << ");\n";
+			out << "e" << i << ":\n\t";
+
+			if (!translatable(d))
+			{
+				out << interpret << "\n";
+				continue;
+			}
+
+			switch (d.op)
+			{
+			case DecodedOp::mov: out << b << " = " << a << ";"; break;
+			case DecodedOp::imm: out << b << " = " << d.imm << "u;"; break;
+
+			case DecodedOp::mget:
+				out << "if (!THALLIUM_LOADABLE(" << a << ")) " << interpret << " " << b << " = thallium_load(m, " << a << ");";
+				break;
+
+			case DecodedOp::mset:
+				out << "if (!THALLIUM_STORABLE(" << a << ")) " << interpret << " thallium_store(m, " << a << ", " << b << ");";
+				break;
+
+			case DecodedOp::teq: out << fl << " = uint32_t(" << a << " == " << b << ") << " << static_cast<uint32_t>(Flags::Test) << ";"; break;
+			case DecodedOp::tgt: out << fl << " = uint32_t(" << a << " > " << b << ") << " << static_cast<uint32_t>(Flags::Test) << ";"; break;
+			case DecodedOp::tlt: out << fl << " = uint32_t(" << a << " < " << b << ") << " << static_cast<uint32_t>(Flags::Test) << ";"; break;
+
+			case DecodedOp::cjmp: out << "if (" << test << ") " << jump(address, d.imm); break;
+			case DecodedOp::cjmpr: out << "if (" << test << ") " << dynamic_jump(address, a); break;
+
+			// call and callr read their target once sp was incremented, like the interpreter
+			case DecodedOp::call:
+				out << "if (!THALLIUM_STORABLE(" << sp << " + 4u)) " << interpret << "\n\t"
+					<< sp << " += 4u; thallium_store(m, " << sp << ", " << next << "); " << jump(address, d.imm);
+				break;
+
+			case DecodedOp::callr:
+				out << "if (!THALLIUM_STORABLE(" << sp << " + 4u)) " << interpret << "\n\t"
+					<< sp << " += 4u; thallium_store(m, " << sp << ", " << next << "); " << dynamic_jump(address, a);
+				break;
+
+			case DecodedOp::sbit:
+				if (d.c)
+					out << a << " |= " << (1u << d.b) << "u;";
+				else
+					out << a << " &= ~" << (1u << d.b) << "u;";
+				break;
+
+			case DecodedOp::gbit: out << b << " = (" << a << " >> " << d.c << ") & 1u;"; break;
+
+			// shift amounts are taken modulo 32, as in the interpreter and the JIT
+			case DecodedOp::shr: out << b << " = " << a << " >> (" << c << " & 31u);"; break;
+			case DecodedOp::shl: out << b << " = " << a << " << (" << c << " & 31u);"; break;
+
+			case DecodedOp::inc: out << "++" << a << ";"; break;
+			case DecodedOp::dec: out << "--" << a << ";"; break;
+			case DecodedOp::uadd: out << c << " = " << a << " + " << b << ";"; break;
+			case DecodedOp::usub: out << c << " = " << a << " - " << b << ";"; break;
+			case DecodedOp::umul: out << c << " = " << a << " * " << b << ";"; break;
+			case DecodedOp::udiv: out << "if (" << b << " != 0) " << c << " = " << a << " / " << b << ";"; break;
+			case DecodedOp::umod: out << "if (" << b << " != 0) " << c << " = " << a << " % " << b << ";"; break;
+
+			case DecodedOp::push:
+				out << "if (!THALLIUM_STORABLE(" << sp << " + 4u)) " << interpret << "\n\t"
+					<< sp << " += 4u; thallium_store(m, " << sp << ", " << a << ");";
+				break;
+
+			case DecodedOp::pop:
+				out << "if (!THALLIUM_LOADABLE(" << sp << ")) " << interpret << "\n\t"
+					<< a << " = thallium_load(m, " << sp << "); " << sp << " -= 4u;";
+				break;
+
+			default:
+				out << interpret;
+				break;
+			}
+
+			out << "\n";
+
+			// control never falls into unsafe code from safe code, but the interpreter would handle it
+			if (!translated(i + 1))
+				out << "\tTHALLIUM_LEAVE(" << next << ");\n";
+		}
+
+		// dynamic jumps and entries from the VM, charging what is left of the block they land in
+		out << "\ndispatch:\n\tswitch (r[0])\n\t{\n";
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (translated(i))
+				out << "\tcase " << i * size << "u: THALLIUM_CHARGE(" << i * size << "u, " << block_end[i] - i << "); goto e" << i << ";\n";
+		}
+		out << "\tdefault: THALLIUM_EXIT(1);\n\t}\n}\n";
+
+		return out.str();
+	}
+
+	std::string AotModule::cache_directory()
+	{
+		if (const char* directory = std::getenv("THALLIUM_AOT_CACHE"))
+			return directory;
+
+		return cache_root();
+	}
+
+	std::string AotModule::compiler()
+	{
+		if (const char* cxx = std::getenv("THALLIUM_AOT_CXX"))
+			return cxx;
+
+		return "clang++";
+	}
+
+	std::string AotModule::cache_path(const ProgramImage& image)
+	{
+		std::ostringstream name;
+		name << cache_directory() << "/aot-v" << version() << "-" << std::hex << std::setfill('0')
+			 << std::setw(16) << program_checksum(image.code(), image.size()) << "-" << std::setw(8) << image.entry() << ".so";
+
+		return name.str();
+	}
+
+#ifdef THALLIUM_HAS_AOT
+	/**
+	 * \return Path quoted for the shell
+	 */
+	static std::string quote(const std::string& path)
+	{
+		std::string quoted = "'";
+		for (const char c : path)
+			quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+
+		return quoted + "'";
+	}
+
+	AotModule::AotModule(void* handle, const Entry entry) :
+		_handle(handle),
+		_entry(entry)
+	{}
+
+	AotModule::~AotModule()
+	{
+		dlclose(_handle);
+	}
+
+	bool AotModule::build(const ProgramImage& image, const std::string& path)
+	{
+		// other processes may build the same program, so the module is moved in place once complete
+		const std::string stem = path + "." + std::to_string(getpid());
+		const std::string source = stem + ".cpp";
+		const std::string object = stem + ".tmp";
+
+		{
+			std::ofstream out(source);
+			out << translate(image);
+			if (!out)
+			{
+				std::remove(source.c_str());
+				return false;
+			}
+		}
+
+		const std::string command = compiler() + " -std=c++14 -O2 -fPIC -shared -w -o " + quote(object) + " " + quote(source);
+		const bool built = std::system(command.c_str()) == 0;
+
+		std::remove(source.c_str());
+		if (built && std::rename(object.c_str(), path.c_str()) == 0)
+			return true;
+
+		std::remove(object.c_str());
+		return false;
+	}
+
+	std::shared_ptr<const AotModule> AotModule::open(const std::string& path, const ProgramImage& image)
+	{
+		// loading a shared object runs its code, so it has to have been written by this user
+		if (!owned_privately(path))
+			return nullptr;
+
+		void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (handle == nullptr)
+			return nullptr;
+
+		const auto version = static_cast<const uint32_t*>(dlsym(handle, aot_version_symbol));
+		const auto entry = static_cast<const vmreg_t*>(dlsym(handle, aot_program_entry_symbol));
+		const auto code_size = static_cast<const uint64_t*>(dlsym(handle, aot_code_size_symbol));
+		const auto code = static_cast<const uint8_t*>(dlsym(handle, aot_code_symbol));
+		const auto run = reinterpret_cast<Entry>(dlsym(handle, aot_entry_symbol));
+
+		// the checksum naming the file could collide, the code cannot
+		const bool matches = version != nullptr && entry != nullptr && code_size != nullptr && code != nullptr
+							 && run != nullptr && *version == AotModule::version() && *entry == image.entry()
+							 && *code_size == image.size() && std::memcmp(code, image.code(), image.size()) == 0;
+
+		if (!matches)
+		{
+			dlclose(handle);
+			return nullptr;
+		}
+
+		return std::shared_ptr<const AotModule>(new AotModule(handle, run));
+	}
+
+	std::shared_ptr<const AotModule> AotModule::get(const ProgramImage& image)
+	{
+		// modules stay loaded for the lifetime of the process, and programs which failed to build are not retried
+		static std::mutex mutex;
+		static std::map<std::string, std::shared_ptr<const AotModule>> modules;
+
+		const std::string path = cache_path(image);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		const auto it = modules.find(path);
+		if (it != end(modules))
+			return it->second;
+
+		// nothing is loaded from or built into a directory other users could write to
+		const std::string directory = cache_directory();
+		std::shared_ptr<const AotModule> module;
+
+		if (make_directories(directory) && owned_privately(directory))
+		{
+			module = open(path, image);
+			if (!module && build(image, path))
+				module = open(path, image);
+		}
+
+		modules[path] = module;
+		return module;
+	}
+#else
+	AotModule::AotModule(void* handle, const Entry entry) :
+		_handle(handle),
+		_entry(entry)
+	{}
+
+	AotModule::~AotModule() {}
+
+	bool AotModule::build(const ProgramImage&, const std::string&)
+	{
+		return false;
+	}
+
+	std::shared_ptr<const AotModule> AotModule::open(const std::string&, const ProgramImage&)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<const AotModule> AotModule::get(const ProgramImage&)
+	{
+		return nullptr;
+	}
+#endif
+
+	AotModule::Entry AotModule::entry() const
+	{
+		return _entry;
+	}
+}
@@ -0,0 +1,133 @@
+#ifndef THALLIUMVM_AOT_HPP
+#define THALLIUMVM_AOT_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include "image.hpp"
+#include "jit.hpp"
+#include "register.hpp"
+
+#if defined(__unix__)
+#define THALLIUM_HAS_AOT 1
+#endif
+
+namespace thallium
+{
+	/**
+	 * Program translated ahead of time to C++, compiled to a shared object and loaded into the process.
+	 *
+	 * The translation unit holds one label per instruction of the safe blocks of the program (see Verification),
+	 * static jumps being gotos and dynamic jumps going through a switch over the instruction addresses. The code
+	 * of the program is embedded in the shared object, which is only used for an image with the same code and
+	 * entry point.<br>
+	 * Compiled code works on the register storage and on the VM memory like the JIT, with the same calling
+	 * convention and fuel accounting: every basic block entry charges what is left of the block, and returns
+	 * Jit::Exit::OutOfFuel without executing anything once the counter is not positive anymore. Whatever the
+	 * translated code does not handle is returned to the interpreter with Jit::Exit::Interpret, the charge of the
+	 * instructions it did not run being refunded: exit, bulk memory instructions, instructions naming ip, jumps
+	 * out of the translated code, and loads and stores out of memory or into the code region.<br>
+	 * Shared objects are cached on disk by program checksum, see cache_directory(), and built with compiler(). They
+	 * are only loaded from a directory and files owned by the current user and writable by no one else.
+	 */
+	class AotModule
+	{
+	public:
+		/**
+		 * Native entry point of a module
+		 * \param registers Pointer to the register storage
+		 * \param memory Pointer to the VM memory
+		 * \param fuel Fuel counter, in instructions
+		 * \param memory_size Memory size in bytes
+		 */
+		typedef Jit::Exit (*Entry)(vmreg_t* registers, uint8_t* memory, int64_t* fuel, uint64_t memory_size);
+
+		AotModule(const AotModule&) = delete;
+		AotModule& operator=(const AotModule&) = delete;
+		~AotModule();
+
+		/**
+		 * Returns the compiled module of an image, building it on the first request.
+		 *
+		 * Modules are shared by every VM of the process. A module missing from the process is loaded from the
+		 * cache directory, and only compiled if it is not there either.
+		 * \param image Image of the program
+		 * \return Module of the program, or nullptr if it could not be built or loaded
+		 */
+		static std::shared_ptr<const AotModule> get(const ProgramImage& image);
+
+		/**
+		 * Translates a program to a C++ translation unit.
+		 * \param image Image of the program
+		 * \return Source of the translation unit, which only needs the standard library
+		 */
+		static std::string translate(const ProgramImage& image);
+
+		/**
+		 * Compiles a program to a shared object.
+		 * \param image Image of the program
+		 * \param path Path of the shared object, which is replaced atomically
+		 * \return Whether the compiler succeeded
+		 */
+		static bool build(const ProgramImage& image, const std::string& path);
+
+		/**
+		 * \param image Image of the program
+		 * \return Path of the shared object of a program in the cache directory
+		 */
+		static std::string cache_path(const ProgramImage& image);
+
+		/**
+		 * \return Directory of the compiled programs: $THALLIUM_AOT_CACHE, else cache_root(), modules not being
+		 *         cached nor built if it is empty
+		 */
+		static std::string cache_directory();
+
+		/**
+		 * \return C++ compiler building the modules: $THALLIUM_AOT_CXX, else clang++
+		 */
+		static std::string compiler();
+
+		/**
+		 * \return Native entry point of the program
+		 */
+		Entry entry() const;
+
+		/**
+		 * \return Whether modules can be loaded on this platform
+		 */
+		constexpr static bool available()
+		{
+#ifdef THALLIUM_HAS_AOT
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		/**
+		 * \return Version of the translation, part of the name of cached modules so that stale ones are ignored
+		 */
+		constexpr static uint32_t version()
+		{
+			return 1;
+		}
+
+	private:
+		AotModule(void* handle, const Entry entry);
+
+		/**
+		 * Loads a compiled program.
+		 * \param path Path of the shared object
+		 * \param image Image the module has to match
+		 * \return Module, or nullptr if the file cannot be loaded or was built for another program
+		 */
+		static std::shared_ptr<const AotModule> open(const std::string& path, const ProgramImage& image);
+
+		void* _handle;
+		Entry _entry;
+	};
+}
+
+#endif
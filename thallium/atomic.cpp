@@ -0,0 +1,74 @@
+#include "atomic.hpp"
+#include "serializer.hpp"
+
+#ifndef THALLIUM_HAS_ATOMIC_BUILTINS
+#include <atomic>
+#endif
+
+namespace thallium
+{
+#ifdef THALLIUM_HAS_ATOMIC_BUILTINS
+	static vmreg_t* host_word(uint8_t* word)
+	{
+		return reinterpret_cast<vmreg_t*>(word);
+	}
+#else
+	static std::atomic<vmreg_t>* host_word(uint8_t* word)
+	{
+		static_assert(sizeof(std::atomic<vmreg_t>) == sizeof(vmreg_t), "atomic words must have the layout of plain ones");
+		return reinterpret_cast<std::atomic<vmreg_t>*>(word);
+	}
+#endif
+
+	vmreg_t atomic_compare_exchange(uint8_t* word, const vmreg_t expected, const vmreg_t desired)
+	{
+		vmreg_t current = little_endian(expected);
+#ifdef THALLIUM_HAS_ATOMIC_BUILTINS
+		__atomic_compare_exchange_n(host_word(word), &current, little_endian(desired), false, __ATOMIC_SEQ_CST,
+									__ATOMIC_SEQ_CST);
+#else
+		host_word(word)->compare_exchange_strong(current, little_endian(desired));
+#endif
+		return little_endian(current);
+	}
+
+	vmreg_t atomic_fetch_add(uint8_t* word, const vmreg_t value)
+	{
+#ifdef THALLIUM_LITTLE_ENDIAN
+#ifdef THALLIUM_HAS_ATOMIC_BUILTINS
+		return __atomic_fetch_add(host_word(word), value, __ATOMIC_SEQ_CST);
+#else
+		return host_word(word)->fetch_add(value);
+#endif
+#else
+		// the carries of a byte-swapped word do not propagate the right way
+		vmreg_t current = deserialize_type<vmreg_t>(word);
+		for (;;)
+		{
+			const vmreg_t seen = atomic_compare_exchange(word, current, current + value);
+			if (seen == current)
+				return current;
+
+			current = seen;
+		}
+#endif
+	}
+
+	vmreg_t atomic_exchange(uint8_t* word, const vmreg_t value)
+	{
+#ifdef THALLIUM_HAS_ATOMIC_BUILTINS
+		return little_endian(__atomic_exchange_n(host_word(word), little_endian(value), __ATOMIC_SEQ_CST));
+#else
+		return little_endian(host_word(word)->exchange(little_endian(value)));
+#endif
+	}
+
+	void atomic_fence()
+	{
+#ifdef THALLIUM_HAS_ATOMIC_BUILTINS
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#else
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+	}
+}
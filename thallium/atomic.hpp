@@ -0,0 +1,54 @@
+#ifndef THALLIUMVM_ATOMIC_HPP
+#define THALLIUMVM_ATOMIC_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include "register.hpp"
+
+#if defined(__GNUC__)
+#define THALLIUM_HAS_ATOMIC_BUILTINS 1
+#endif
+
+namespace thallium
+{
+	/**
+	 * Host operations behind the atomic instructions, see Opcode::acas.
+	 *
+	 * Words are vmreg_t values stored little-endian, aligned to their size in host memory, and every operation is
+	 * sequentially consistent. With GCC and Clang they map to the __atomic builtins, which work on plain memory as
+	 * std::atomic_ref does, other compilers view the word as a std::atomic.<br>
+	 * On big-endian hosts, additions go through a compare-and-swap loop since the word is stored byte-swapped.
+	 */
+
+	/**
+	 * Replaces a word if it holds an expected value.
+	 * \param word Word to update
+	 * \param expected Value the word must hold
+	 * \param desired Value to store
+	 * \return Value the word held, equal to expected if it was replaced
+	 */
+	vmreg_t atomic_compare_exchange(uint8_t* word, const vmreg_t expected, const vmreg_t desired);
+
+	/**
+	 * Adds a value to a word, wrapping around.
+	 * \param word Word to update
+	 * \param value Value to add
+	 * \return Value the word held before
+	 */
+	vmreg_t atomic_fetch_add(uint8_t* word, const vmreg_t value);
+
+	/**
+	 * Replaces a word.
+	 * \param word Word to update
+	 * \param value Value to store
+	 * \return Value the word held before
+	 */
+	vmreg_t atomic_exchange(uint8_t* word, const vmreg_t value);
+
+	/**
+	 * Orders the memory accesses before and after it, as the atomic operations do.
+	 */
+	void atomic_fence();
+}
+
+#endif
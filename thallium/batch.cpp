@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <exception>
+#include <string>
+#include "batch.hpp"
+#include "error.hpp"
+
+namespace thallium
+{
+	BatchRunner::BatchRunner(const std::vector<Instruction>& program, const size_t memory_size,
+							 const std::vector<uint16_t>& result_registers,
+							 const size_t threads, const Engine engine) :
+		_image(ProgramImage::create(program)),
+		_memory_size(memory_size),
+		_result_registers(result_registers),
+		_engine(engine),
+		_pool(threads),
+		_vms(_pool.size()),
+		_lane_vms(_pool.size())
+	{
+		for (const uint16_t r : _result_registers)
+		{
+			tassert(r < Registers::size(),
+					TimeOfError::Preload, ErrorType::Fatal,
+					"result register " + std::to_string(r) + " does not exist.");
+		}
+	}
+
+	size_t BatchRunner::threads() const
+	{
+		return _pool.size();
+	}
+
+	std::vector<BatchResult> BatchRunner::run(const std::vector<BatchInput>& inputs)
+	{
+		std::vector<BatchResult> results(inputs.size());
+
+		_pool.parallel_for(inputs.size(), [&](const size_t worker, const size_t index) {
+			std::unique_ptr<VM>& vm = _vms[worker];
+			if (!vm)
+			{
+				std::unique_ptr<VM> created{new VM{_memory_size}};
+				created->import_program(_image);
+				vm = std::move(created);
+			}
+			else
+			{
+				vm->reset();
+			}
+
+			run_job(*vm, inputs[index], results[index]);
+		});
+
+		return results;
+	}
+
+	std::vector<BatchResult> BatchRunner::run_lanes(const std::vector<BatchInput>& inputs)
+	{
+		tassert(_image->verification().certified(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program cannot run in lanes: " + _image->verification().diagnostic() + ".");
+
+		const size_t lanes = LaneVM<>::lanes();
+		std::vector<BatchResult> results(inputs.size());
+
+		_pool.parallel_for((inputs.size() + lanes - 1) / lanes, [&](const size_t worker, const size_t group) {
+			std::unique_ptr<LaneVM<>>& vm = _lane_vms[worker];
+			if (!vm)
+				vm.reset(new LaneVM<>{_image, _memory_size});
+			else
+				vm->reset();
+
+			// the last group may not fill every lane
+			const size_t first = group * lanes;
+			const size_t count = std::min(lanes, inputs.size() - first);
+
+			for (size_t lane = 0; lane < lanes; ++lane)
+			{
+				if (lane < count)
+					load_lane(*vm, lane, inputs[first + lane]);
+				else
+					vm->stop(lane, TrapCode::None);
+			}
+
+			vm->run();
+
+			for (size_t lane = 0; lane < count; ++lane)
+			{
+				BatchResult& result = results[first + lane];
+				result.trap = vm->trap(lane);
+
+				result.registers.resize(_result_registers.size());
+				for (size_t i = 0; i < _result_registers.size(); ++i)
+				{
+					result.registers[i] = vm->reg(lane, _result_registers[i]);
+				}
+			}
+		});
+
+		return results;
+	}
+
+	void BatchRunner::load_lane(LaneVM<>& vm, const size_t lane, const BatchInput& input)
+	{
+		try {
+			for (const auto& r : input.registers)
+			{
+				tassert(r.first < Registers::size(),
+						TimeOfError::Preload, ErrorType::Fatal,
+						"input register " + std::to_string(r.first) + " does not exist.");
+
+				vm.reg(lane, r.first) = r.second;
+			}
+
+			vm.write_memory(lane, input.memory_address, input.memory.data(), input.memory.size());
+		} catch (const std::exception&)
+		{
+			vm.stop(lane, TrapCode::Aborted);
+		}
+	}
+
+	void BatchRunner::run_job(VM& vm, const BatchInput& input, BatchResult& result)
+	{
+		try {
+			RegisterBinding& regs = vm.registers();
+			for (const auto& r : input.registers)
+			{
+				tassert(r.first < regs.size(),
+						TimeOfError::Preload, ErrorType::Fatal,
+						"input register " + std::to_string(r.first) + " does not exist.");
+
+				regs[r.first] = r.second;
+			}
+
+			vm.write_memory(input.memory_address, input.memory.data(), input.memory.size());
+			result.trap = vm.run(_engine);
+		} catch (const std::exception&)
+		{
+			result.trap = Trap{};
+			result.trap.code = TrapCode::Aborted;
+		}
+
+		result.registers.resize(_result_registers.size());
+		for (size_t i = 0; i < _result_registers.size(); ++i)
+		{
+			result.registers[i] = vm.registers()[_result_registers[i]];
+		}
+	}
+}
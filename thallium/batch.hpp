@@ -0,0 +1,128 @@
+#ifndef THALLIUMVM_BATCH_HPP
+#define THALLIUMVM_BATCH_HPP
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "image.hpp"
+#include "instruction.hpp"
+#include "lanes.hpp"
+#include "register.hpp"
+#include "thread_pool.hpp"
+#include "vm.hpp"
+
+namespace thallium
+{
+	/**
+	 * Initial state of one job of a batch
+	 */
+	struct BatchInput
+	{
+		/**
+		 * Registers to set before running, as (register index, value)
+		 */
+		std::vector<std::pair<uint16_t, vmreg_t>> registers;
+
+		/**
+		 * Bytes to write to memory before running, starting at memory_address
+		 */
+		vmreg_t memory_address = 0;
+		std::vector<uint8_t> memory;
+	};
+
+	/**
+	 * Outcome of one job of a batch
+	 */
+	struct BatchResult
+	{
+		/**
+		 * Values of the result registers requested from BatchRunner, in the same order
+		 */
+		std::vector<vmreg_t> registers;
+
+		/**
+		 * Why the job stopped, TrapCode::Aborted if its input was rejected
+		 */
+		Trap trap;
+	};
+
+	/**
+	 * Runs one program against many independent inputs, across a work-stealing thread pool.
+	 *
+	 * Every worker thread owns a VM which it resets between jobs, so memory is allocated once per worker rather
+	 * than once per job. The program is translated once into a ProgramImage shared by every worker.
+	 */
+	class BatchRunner
+	{
+	public:
+		/**
+		 * \param program Program every job runs
+		 * \param memory_size Memory size of each VM
+		 * \param result_registers Registers copied to BatchResult::registers once a job ends
+		 * \param threads Number of worker threads, 0 meaning one per hardware thread
+		 * \param engine Execution engine of the VMs
+		 */
+		BatchRunner(const std::vector<Instruction>& program, const size_t memory_size,
+					const std::vector<uint16_t>& result_registers,
+					const size_t threads = 0, const Engine engine = Engine::Switch);
+
+		/**
+		 * \return Number of worker threads
+		 */
+		size_t threads() const;
+
+		/**
+		 * Runs the program once per input.
+		 * \param inputs Initial state of every job
+		 * \return Result of every job, in the order of inputs
+		 */
+		std::vector<BatchResult> run(const std::vector<BatchInput>& inputs);
+
+		/**
+		 * Runs the program once per input, LaneVM::lanes() inputs at a time in lockstep.
+		 *
+		 * Every worker owns a LaneVM, so each instruction is dispatched once for a whole group of inputs. The
+		 * program has to be certified by the verifier, and inputs may not write to its code region.
+		 * \param inputs Initial state of every job
+		 * \return Result of every job, in the order of inputs
+		 */
+		std::vector<BatchResult> run_lanes(const std::vector<BatchInput>& inputs);
+
+	private:
+		/**
+		 * Runs a single job on a worker VM.
+		 * \param vm VM of the worker, freshly reset
+		 * \param input Initial state of the job
+		 * \param result Result to fill
+		 */
+		void run_job(VM& vm, const BatchInput& input, BatchResult& result);
+
+		/**
+		 * Sets the initial state of a job on a lane, stopping the lane with TrapCode::Aborted if it is rejected.
+		 * \param vm LaneVM of the worker, freshly reset
+		 * \param lane Lane of the job
+		 * \param input Initial state of the job
+		 */
+		void load_lane(LaneVM<>& vm, const size_t lane, const BatchInput& input);
+
+		std::shared_ptr<const ProgramImage> _image;
+		size_t _memory_size;
+		std::vector<uint16_t> _result_registers;
+		Engine _engine;
+
+		ThreadPool _pool;
+
+		/**
+		 * VM of every worker, created on the first job the worker runs
+		 */
+		std::vector<std::unique_ptr<VM>> _vms;
+
+		/**
+		 * LaneVM of every worker, created on the first group of jobs the worker runs
+		 */
+		std::vector<std::unique_ptr<LaneVM<>>> _lane_vms;
+	};
+}
+
+#endif
@@ -0,0 +1,319 @@
+#include "bulk.hpp"
+#include "serializer.hpp"
+
+#ifdef THALLIUM_HAS_SIMD
+#include <immintrin.h>
+
+// AVX2 kernels are compiled for their own target, the rest of the library staying on the SSE2 baseline
+#define THALLIUM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace thallium
+{
+	// Portable kernels, also handling what the vector loops leave over
+
+	static size_t compare_scalar(const uint8_t* a, const uint8_t* b, const size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (a[i] != b[i])
+				return i;
+		}
+
+		return size;
+	}
+
+	static size_t find_scalar(const uint8_t* data, const uint8_t value, const size_t size)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (data[i] == value)
+				return i;
+		}
+
+		return size;
+	}
+
+	static void add_scalar(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		for (size_t i = 0; i < words; ++i)
+		{
+			const size_t offset = i * sizeof(vmreg_t);
+			const vmreg_t sum = deserialize_type<vmreg_t>(dst + offset) + deserialize_type<vmreg_t>(src + offset);
+			serialize_type(sum, dst + offset);
+		}
+	}
+
+	static void xor_scalar(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		for (size_t i = 0; i < words; ++i)
+		{
+			const size_t offset = i * sizeof(vmreg_t);
+			const vmreg_t value = deserialize_type<vmreg_t>(dst + offset) ^ deserialize_type<vmreg_t>(src + offset);
+			serialize_type(value, dst + offset);
+		}
+	}
+
+	static vmreg_t sum_scalar(const uint8_t* data, const size_t words)
+	{
+		vmreg_t sum = 0;
+		for (size_t i = 0; i < words; ++i)
+		{
+			sum += deserialize_type<vmreg_t>(data + i * sizeof(vmreg_t));
+		}
+
+		return sum;
+	}
+
+#ifdef THALLIUM_HAS_SIMD
+	// SSE2 kernels, always available on x86-64
+
+	static size_t compare_sse2(const uint8_t* a, const uint8_t* b, const size_t size)
+	{
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16)
+		{
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			const unsigned different = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) ^ 0xFFFFu;
+			if (different != 0)
+				return i + __builtin_ctz(different);
+		}
+
+		return i + compare_scalar(a + i, b + i, size - i);
+	}
+
+	static size_t find_sse2(const uint8_t* data, const uint8_t value, const size_t size)
+	{
+		const __m128i needle = _mm_set1_epi8(static_cast<char>(value));
+
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16)
+		{
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			const unsigned found = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, needle)));
+			if (found != 0)
+				return i + __builtin_ctz(found);
+		}
+
+		return i + find_scalar(data + i, value, size - i);
+	}
+
+	static void add_sse2(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		size_t i = 0;
+		for (; i + 4 <= words; i += 4)
+		{
+			__m128i* d = reinterpret_cast<__m128i*>(dst + i * sizeof(vmreg_t));
+			const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * sizeof(vmreg_t)));
+			_mm_storeu_si128(d, _mm_add_epi32(_mm_loadu_si128(d), s));
+		}
+
+		add_scalar(dst + i * sizeof(vmreg_t), src + i * sizeof(vmreg_t), words - i);
+	}
+
+	static void xor_sse2(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		size_t i = 0;
+		for (; i + 4 <= words; i += 4)
+		{
+			__m128i* d = reinterpret_cast<__m128i*>(dst + i * sizeof(vmreg_t));
+			const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * sizeof(vmreg_t)));
+			_mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), s));
+		}
+
+		xor_scalar(dst + i * sizeof(vmreg_t), src + i * sizeof(vmreg_t), words - i);
+	}
+
+	static vmreg_t sum_sse2(const uint8_t* data, const size_t words)
+	{
+		__m128i sums = _mm_setzero_si128();
+
+		size_t i = 0;
+		for (; i + 4 <= words; i += 4)
+		{
+			sums = _mm_add_epi32(sums, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * sizeof(vmreg_t))));
+		}
+
+		alignas(16) vmreg_t lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes), sums);
+
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(data + i * sizeof(vmreg_t), words - i);
+	}
+
+	// AVX2 kernels, picked when the CPU supports them
+
+	THALLIUM_TARGET_AVX2
+	static size_t compare_avx2(const uint8_t* a, const uint8_t* b, const size_t size)
+	{
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32)
+		{
+			const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+			const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+			const unsigned different = ~static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+			if (different != 0)
+				return i + __builtin_ctz(different);
+		}
+
+		return i + compare_sse2(a + i, b + i, size - i);
+	}
+
+	THALLIUM_TARGET_AVX2
+	static size_t find_avx2(const uint8_t* data, const uint8_t value, const size_t size)
+	{
+		const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32)
+		{
+			const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			const unsigned found = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle)));
+			if (found != 0)
+				return i + __builtin_ctz(found);
+		}
+
+		return i + find_sse2(data + i, value, size - i);
+	}
+
+	THALLIUM_TARGET_AVX2
+	static void add_avx2(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		size_t i = 0;
+		for (; i + 8 <= words; i += 8)
+		{
+			__m256i* d = reinterpret_cast<__m256i*>(dst + i * sizeof(vmreg_t));
+			const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * sizeof(vmreg_t)));
+			_mm256_storeu_si256(d, _mm256_add_epi32(_mm256_loadu_si256(d), s));
+		}
+
+		add_sse2(dst + i * sizeof(vmreg_t), src + i * sizeof(vmreg_t), words - i);
+	}
+
+	THALLIUM_TARGET_AVX2
+	static void xor_avx2(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		size_t i = 0;
+		for (; i + 8 <= words; i += 8)
+		{
+			__m256i* d = reinterpret_cast<__m256i*>(dst + i * sizeof(vmreg_t));
+			const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * sizeof(vmreg_t)));
+			_mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), s));
+		}
+
+		xor_sse2(dst + i * sizeof(vmreg_t), src + i * sizeof(vmreg_t), words - i);
+	}
+
+	THALLIUM_TARGET_AVX2
+	static vmreg_t sum_avx2(const uint8_t* data, const size_t words)
+	{
+		__m256i sums = _mm256_setzero_si256();
+
+		size_t i = 0;
+		for (; i + 8 <= words; i += 8)
+		{
+			sums = _mm256_add_epi32(sums, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i * sizeof(vmreg_t))));
+		}
+
+		alignas(32) vmreg_t lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums);
+
+		vmreg_t sum = sum_sse2(data + i * sizeof(vmreg_t), words - i);
+		for (const vmreg_t lane : lanes)
+		{
+			sum += lane;
+		}
+
+		return sum;
+	}
+#endif
+
+	/**
+	 * Set of kernels for one instruction set
+	 */
+	struct BulkKernels
+	{
+		size_t (*compare)(const uint8_t*, const uint8_t*, size_t);
+		size_t (*find)(const uint8_t*, uint8_t, size_t);
+		void (*add)(uint8_t*, const uint8_t*, size_t);
+		void (*exclusive_or)(uint8_t*, const uint8_t*, size_t);
+		vmreg_t (*sum)(const uint8_t*, size_t);
+		const char* isa;
+	};
+
+	static BulkKernels select_kernels()
+	{
+#ifdef THALLIUM_HAS_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return {compare_avx2, find_avx2, add_avx2, xor_avx2, sum_avx2, "avx2"};
+
+		return {compare_sse2, find_sse2, add_sse2, xor_sse2, sum_sse2, "sse2"};
+#else
+		return {compare_scalar, find_scalar, add_scalar, xor_scalar, sum_scalar, "scalar"};
+#endif
+	}
+
+	static const BulkKernels& kernels()
+	{
+		static const BulkKernels selected = select_kernels();
+		return selected;
+	}
+
+	/**
+	 * \return Whether writing dst in ascending order would overwrite source words before they are read
+	 */
+	static bool overwrites_source(const uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		return dst > src && dst < src + words * sizeof(vmreg_t);
+	}
+
+	size_t bulk_compare(const uint8_t* a, const uint8_t* b, const size_t size)
+	{
+		return kernels().compare(a, b, size);
+	}
+
+	size_t bulk_find(const uint8_t* data, const uint8_t value, const size_t size)
+	{
+		return kernels().find(data, value, size);
+	}
+
+	void bulk_add(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		if (!overwrites_source(dst, src, words))
+		{
+			kernels().add(dst, src, words);
+			return;
+		}
+
+		// the destination runs ahead of the source, so it is walked backwards
+		for (size_t i = words; i-- > 0; )
+		{
+			add_scalar(dst + i * sizeof(vmreg_t), src + i * sizeof(vmreg_t), 1);
+		}
+	}
+
+	void bulk_xor(uint8_t* dst, const uint8_t* src, const size_t words)
+	{
+		if (!overwrites_source(dst, src, words))
+		{
+			kernels().exclusive_or(dst, src, words);
+			return;
+		}
+
+		for (size_t i = words; i-- > 0; )
+		{
+			xor_scalar(dst + i * sizeof(vmreg_t), src + i * sizeof(vmreg_t), 1);
+		}
+	}
+
+	vmreg_t bulk_sum(const uint8_t* data, const size_t words)
+	{
+		return kernels().sum(data, words);
+	}
+
+	const char* bulk_isa()
+	{
+		return kernels().isa;
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef THALLIUMVM_BULK_HPP
+#define THALLIUMVM_BULK_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include "register.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define THALLIUM_HAS_SIMD 1
+#endif
+
+namespace thallium
+{
+	/**
+	 * Host kernels behind the bulk memory instructions, working on contiguous host memory.
+	 *
+	 * On x86-64, SSE2 and AVX2 versions are compiled side by side and the widest one the CPU supports is picked
+	 * once, on first use. Other hosts get portable scalar loops.<br>
+	 * Words are vmreg_t values stored little-endian and do not need to be aligned.
+	 */
+
+	/**
+	 * Finds the first byte where two ranges differ.
+	 * \param a First range
+	 * \param b Second range
+	 * \param size Size of both ranges
+	 * \return Offset of the first difference, or size if the ranges are equal
+	 */
+	size_t bulk_compare(const uint8_t* a, const uint8_t* b, const size_t size);
+
+	/**
+	 * Finds the first occurrence of a byte.
+	 * \param data Range to search
+	 * \param value Byte to look for
+	 * \param size Size of the range
+	 * \return Offset of the first occurrence, or size if there is none
+	 */
+	size_t bulk_find(const uint8_t* data, const uint8_t value, const size_t size);
+
+	/**
+	 * Adds a range of words to another one, element-wise and wrapping around.
+	 *
+	 * The ranges may overlap, the result being the one of reading every source word before writing any.
+	 * \param dst Words to add to
+	 * \param src Words to add
+	 * \param words Number of words
+	 */
+	void bulk_add(uint8_t* dst, const uint8_t* src, const size_t words);
+
+	/**
+	 * Exclusive-ors a range of words into another one, with the same overlap rules as bulk_add.
+	 * \param dst Words to modify
+	 * \param src Words to combine them with
+	 * \param words Number of words
+	 */
+	void bulk_xor(uint8_t* dst, const uint8_t* src, const size_t words);
+
+	/**
+	 * Sums a range of words, wrapping around.
+	 * \param data Words to sum
+	 * \param words Number of words
+	 * \return Sum of the words
+	 */
+	vmreg_t bulk_sum(const uint8_t* data, const size_t words);
+
+	/**
+	 * \return Name of the instruction set the kernels were picked for: "avx2", "sse2" or "scalar"
+	 */
+	const char* bulk_isa();
+}
+
+#endif
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include "decoded.hpp"
+#include "register.hpp"
+
+namespace thallium
+{
+	size_t register_span(const DecodedInstruction& d)
+	{
+		switch (unfused(d.op))
+		{
+		// the registers of a host call past its base register depend on the function, and are checked when calling it
+		case DecodedOp::imm:
+		case DecodedOp::hcall:
+			return d.b + size_t(1);
+
+		case DecodedOp::cjmpr:
+		case DecodedOp::callr:
+		case DecodedOp::fjoin:
+		case DecodedOp::sbit:
+		case DecodedOp::inc:
+		case DecodedOp::dec:
+		case DecodedOp::push:
+		case DecodedOp::pop:
+			return d.a + size_t(1);
+
+		case DecodedOp::mov:
+		case DecodedOp::mget:
+		case DecodedOp::mset:
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+		case DecodedOp::gbit:
+			return std::max(d.a, d.b) + size_t(1);
+
+		case DecodedOp::shr:
+		case DecodedOp::shl:
+		case DecodedOp::uadd:
+		case DecodedOp::usub:
+		case DecodedOp::umul:
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+		case DecodedOp::mcpy:
+		case DecodedOp::mfill:
+		case DecodedOp::vadd:
+		case DecodedOp::vxor:
+		case DecodedOp::vsum:
+		case DecodedOp::fspawn:
+		case DecodedOp::acas:
+		case DecodedOp::aadd:
+		case DecodedOp::axchg:
+			return std::max({d.a, d.b, d.c}) + size_t(1);
+
+		case DecodedOp::mcmp:
+		case DecodedOp::mfind:
+			return std::max<size_t>(std::max({d.a, d.b, d.c}), d.imm) + 1;
+
+		default:
+			return 0;
+		}
+	}
+
+	bool writes_register(const DecodedInstruction& d, const uint16_t r)
+	{
+		switch (unfused(d.op))
+		{
+		case DecodedOp::mov:
+		case DecodedOp::imm:
+		case DecodedOp::mget:
+		case DecodedOp::gbit:
+		case DecodedOp::acas:
+			return d.b == r;
+
+		case DecodedOp::sbit:
+		case DecodedOp::inc:
+		case DecodedOp::dec:
+		case DecodedOp::pop:
+			return d.a == r;
+
+		case DecodedOp::shr:
+		case DecodedOp::shl:
+		case DecodedOp::uadd:
+		case DecodedOp::usub:
+		case DecodedOp::umul:
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+		case DecodedOp::vsum:
+		case DecodedOp::fspawn:
+		case DecodedOp::aadd:
+		case DecodedOp::axchg:
+			return d.c == r;
+
+		case DecodedOp::mcmp:
+		case DecodedOp::mfind:
+			return d.imm == r;
+
+		// host functions may write any register of their window
+		case DecodedOp::hcall:
+			return r >= d.b;
+
+		default:
+			return false;
+		}
+	}
+
+	DecodedOp fused_op(const DecodedInstruction& first, const DecodedOp second)
+	{
+		const uint16_t ip = static_cast<uint16_t>(SPRegisters::ip);
+
+		switch (first.op)
+		{
+		case DecodedOp::teq:
+			if (second == DecodedOp::cjmp)
+				return DecodedOp::teq_cjmp;
+			break;
+
+		case DecodedOp::tgt:
+			if (second == DecodedOp::cjmp)
+				return DecodedOp::tgt_cjmp;
+			break;
+
+		case DecodedOp::tlt:
+			if (second == DecodedOp::cjmp)
+				return DecodedOp::tlt_cjmp;
+			break;
+
+		case DecodedOp::imm:
+			if (second == DecodedOp::uadd && first.b != ip)
+				return DecodedOp::imm_uadd;
+			break;
+
+		case DecodedOp::push:
+			if (second == DecodedOp::push)
+				return DecodedOp::push_push;
+			break;
+
+		case DecodedOp::pop:
+			if (second == DecodedOp::pop && first.a != ip)
+				return DecodedOp::pop_pop;
+			break;
+
+		default:
+			break;
+		}
+
+		return first.op;
+	}
+
+	size_t fuse(std::vector<DecodedInstruction>& code)
+	{
+		size_t fusions = 0;
+
+		for (size_t i = 0; i + 1 < code.size(); ++i)
+		{
+			DecodedInstruction& first = code[i];
+			const DecodedOp fused = fused_op(first, code[i + 1].op);
+
+			if (fused != first.op)
+			{
+				first.op = fused;
+				++fusions;
+
+				// the second instruction keeps its own entry for jumps, but does not start another pair
+				++i;
+			}
+		}
+
+		return fusions;
+	}
+}
@@ -0,0 +1,169 @@
+#ifndef THALLIUMVM_DECODED_HPP
+#define THALLIUMVM_DECODED_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "instruction.hpp"
+
+namespace thallium
+{
+	/**
+	 * Typed class enum of the operations the interpreter dispatches on.
+	 *
+	 * The first entries match Opcode one to one, the remaining ones are internal to the VM
+	 * and can never be observed by a ThalliumVM program.
+	 */
+	enum class DecodedOp : uint8_t
+	{
+		mov = static_cast<uint8_t>(Opcode::mov),
+		imm = static_cast<uint8_t>(Opcode::imm),
+		mget = static_cast<uint8_t>(Opcode::mget),
+		mset = static_cast<uint8_t>(Opcode::mset),
+		teq = static_cast<uint8_t>(Opcode::teq),
+		tgt = static_cast<uint8_t>(Opcode::tgt),
+		tlt = static_cast<uint8_t>(Opcode::tlt),
+		cjmp = static_cast<uint8_t>(Opcode::cjmp),
+		cjmpr = static_cast<uint8_t>(Opcode::cjmpr),
+		call = static_cast<uint8_t>(Opcode::call),
+		callr = static_cast<uint8_t>(Opcode::callr),
+		sbit = static_cast<uint8_t>(Opcode::sbit),
+		gbit = static_cast<uint8_t>(Opcode::gbit),
+		shr = static_cast<uint8_t>(Opcode::shr),
+		shl = static_cast<uint8_t>(Opcode::shl),
+		inc = static_cast<uint8_t>(Opcode::inc),
+		dec = static_cast<uint8_t>(Opcode::dec),
+		uadd = static_cast<uint8_t>(Opcode::uadd),
+		usub = static_cast<uint8_t>(Opcode::usub),
+		umul = static_cast<uint8_t>(Opcode::umul),
+		udiv = static_cast<uint8_t>(Opcode::udiv),
+		umod = static_cast<uint8_t>(Opcode::umod),
+		push = static_cast<uint8_t>(Opcode::push),
+		pop = static_cast<uint8_t>(Opcode::pop),
+		exit = static_cast<uint8_t>(Opcode::__PLACEHOLDER_EXIT),
+		mcpy = static_cast<uint8_t>(Opcode::mcpy),
+		mfill = static_cast<uint8_t>(Opcode::mfill),
+		mcmp = static_cast<uint8_t>(Opcode::mcmp),
+		mfind = static_cast<uint8_t>(Opcode::mfind),
+		vadd = static_cast<uint8_t>(Opcode::vadd),
+		vxor = static_cast<uint8_t>(Opcode::vxor),
+		vsum = static_cast<uint8_t>(Opcode::vsum),
+		hcall = static_cast<uint8_t>(Opcode::hcall),
+		fspawn = static_cast<uint8_t>(Opcode::fspawn),
+		fyield = static_cast<uint8_t>(Opcode::fyield),
+		fjoin = static_cast<uint8_t>(Opcode::fjoin),
+		acas = static_cast<uint8_t>(Opcode::acas),
+		aadd = static_cast<uint8_t>(Opcode::aadd),
+		axchg = static_cast<uint8_t>(Opcode::axchg),
+		fence = static_cast<uint8_t>(Opcode::fence),
+
+		// Superinstructions created by fuse(), executing an instruction and the next one in a single dispatch.
+		// Their operands are the ones of the first instruction, the second one stays decoded in the next entry.
+
+		teq_cjmp,
+		tgt_cjmp,
+		tlt_cjmp,
+		imm_uadd,
+		push_push,
+		pop_pop,
+
+		/**
+		 * The cached entry was invalidated by a write to code memory and has to be decoded again.
+		 */
+		stale,
+
+		/**
+		 * The opcode does not name a valid instruction, a register operand does not exist, or the instruction does not
+		 * fit in memory.
+		 */
+		invalid,
+
+		_total
+	};
+
+	/**
+	 * Structure which holds a ThalliumVM instruction with its operands already unpacked.
+	 *
+	 * Operand meaning depends on the operation, following the argument layout documented in Opcode:<br>
+	 * - a, b, c : register operands (or bit index / bit value for sbit and gbit) in argument order<br>
+	 * - imm : 32-bit immediate value, jump target or host function id, or the fourth register operand of mcmp and
+	 *   mfind
+	 */
+	struct DecodedInstruction
+	{
+		DecodedOp op;
+
+		/**
+		 * Raw opcode byte, kept around for diagnostics.
+		 */
+		uint8_t opcode;
+
+		uint16_t a, b, c;
+		uint32_t imm;
+	};
+
+	/**
+	 * Returns the operation of the first instruction executed by a superinstruction.
+	 * \param op Operation to look at
+	 * \return op itself if it is not a superinstruction
+	 */
+	inline DecodedOp unfused(const DecodedOp op)
+	{
+		switch (op)
+		{
+		case DecodedOp::teq_cjmp: return DecodedOp::teq;
+		case DecodedOp::tgt_cjmp: return DecodedOp::tgt;
+		case DecodedOp::tlt_cjmp: return DecodedOp::tlt;
+		case DecodedOp::imm_uadd: return DecodedOp::imm;
+		case DecodedOp::push_push: return DecodedOp::push;
+		case DecodedOp::pop_pop: return DecodedOp::pop;
+		default: return op;
+		}
+	}
+
+	/**
+	 * Returns the number of registers a decoded instruction needs.
+	 * \param d Decoded instruction, superinstructions being looked at as their first instruction
+	 * \return One past the highest register read or written by the instruction, 0 if it names none
+	 */
+	size_t register_span(const DecodedInstruction& d);
+
+	/**
+	 * Checks that the register operands of a decoded instruction exist.
+	 * \param d Decoded instruction, superinstructions being checked as their first instruction
+	 * \param register_count Number of registers available
+	 * \return Whether every register read or written by the instruction is below register_count
+	 */
+	inline bool registers_in_range(const DecodedInstruction& d, const size_t register_count)
+	{
+		return register_span(d) <= register_count;
+	}
+
+	/**
+	 * Checks whether a decoded instruction writes to a register, jumps and calls writing to ip aside.
+	 * \param d Decoded instruction, superinstructions being checked as their first instruction
+	 * \param r Register index
+	 * \return Whether r is the destination of the instruction
+	 */
+	bool writes_register(const DecodedInstruction& d, const uint16_t r);
+
+	/**
+	 * Returns the superinstruction executing a pair of instructions, see fuse().
+	 * \param first First instruction of the pair, not fused yet
+	 * \param second Operation of the second instruction
+	 * \return The superinstruction, or the operation of first if the pair is not fused
+	 */
+	DecodedOp fused_op(const DecodedInstruction& first, const DecodedOp second);
+
+	/**
+	 * Fuses common instruction pairs of a pre-decoded program into superinstructions.
+	 *
+	 * Only the first entry of a pair is rewritten, so jumping to the second instruction keeps working.
+	 * Pairs are never fused when the first instruction writes to ip.
+	 * \param code Pre-decoded program, indexed by instruction
+	 * \return Number of fused pairs
+	 */
+	size_t fuse(std::vector<DecodedInstruction>& code);
+}
+
+#endif
@@ -1,15 +1,18 @@
+#include <array>
+#include <atomic>
 #include <iostream>
 #include <map>
+#include <utility>
 #include <vector>
 #include "error.hpp"
 
 namespace thallium
 {
-	VMException::VMException(const char *s) : _swhat(s) {}
+	VMException::VMException(std::string s) : _swhat(std::move(s)) {}
 
 	const char* VMException::what() const noexcept
 	{
-		return _swhat;
+		return _swhat.c_str();
 	}
 
 #ifdef _WIN32
@@ -19,7 +22,7 @@ namespace thallium
 		 "runtime"}
 	};
 
-	const std::array<std::string, 3> errortype_match =
+	const std::array<std::string, 4> errortype_match =
 	{
 		{"internal",
 		 "error",
@@ -61,23 +64,86 @@ namespace thallium
 		return etype == ErrorType::Internal || etype == ErrorType::Fatal;
 	}
 
-	bool tassert(const bool condition, const TimeOfError etime, const ErrorType etype, const std::string estring, const bool ignore_fatal)
+	bool tassert(const bool condition, const TimeOfError etime, const ErrorType etype, const std::string& estring, const bool ignore_fatal)
 	{
 		if (!condition && !ignore_fatal)
 		{
-			error(etime, etype, estring.c_str());
+			error(etime, etype, estring);
 		}
 
 		return condition;
 	}
 
-	void error(const TimeOfError etime, const ErrorType etype, const std::string estring, const bool ignore_fatal)
+	void error(const TimeOfError etime, const ErrorType etype, const std::string& estring, const bool ignore_fatal)
 	{
-		const std::string etype_str = errortype_string(etype);
-		std::cout << errortime_string(etime) << errortype_string(etype) << ' ' << estring << std::endl;
-		if (is_fatal(etype) && !ignore_fatal)
+		LogSink& sink = log_sink();
+		sink.write(etime, etype, estring);
+
+		if (is_fatal(etype))
 		{
-			throw VMException(estring.c_str());
+			sink.flush();
+
+			if (!ignore_fatal)
+				throw VMException(estring);
 		}
 	}
+
+	LogSink::~LogSink() {}
+
+	void LogSink::flush() {}
+
+	StreamLogSink::StreamLogSink(std::ostream& out, const size_t buffer_size) :
+		_out(out),
+		_buffer_size(buffer_size)
+	{
+		_buffer.reserve(buffer_size);
+	}
+
+	StreamLogSink::~StreamLogSink()
+	{
+		flush();
+	}
+
+	void StreamLogSink::write(const TimeOfError etime, const ErrorType etype, const std::string& message)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_buffer += errortime_match[static_cast<size_t>(etime)];
+		_buffer += errortype_match[static_cast<size_t>(etype)];
+		_buffer += ' ';
+		_buffer += message;
+		_buffer += '\n';
+
+		if (_buffer.size() >= _buffer_size)
+			flush_buffer();
+	}
+
+	void StreamLogSink::flush()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		flush_buffer();
+	}
+
+	void StreamLogSink::flush_buffer()
+	{
+		_out.write(_buffer.data(), static_cast<std::streamsize>(_buffer.size()));
+		_out.flush();
+		_buffer.clear();
+	}
+
+	static std::atomic<LogSink*> current_sink{nullptr};
+
+	void set_log_sink(LogSink* sink)
+	{
+		log_sink().flush();
+		current_sink = sink;
+	}
+
+	LogSink& log_sink()
+	{
+		static StreamLogSink default_sink{std::cout};
+
+		LogSink* sink = current_sink;
+		return sink != nullptr ? *sink : default_sink;
+	}
 }
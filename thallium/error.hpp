@@ -1,6 +1,9 @@
 #ifndef THALLIUMVM_ERROR_HPP
 #define THALLIUMVM_ERROR_HPP
 
+#include <cstddef>
+#include <iosfwd>
+#include <mutex>
 #include <string>
 
 namespace thallium
@@ -8,16 +11,16 @@ namespace thallium
 	/**
 	 * ThalliumVM exception class
 	 *
-	 * Thrown by tassert on fatal errors.
+	 * Thrown by tassert on fatal errors. Programs failing at runtime do not throw, see Trap.
 	 */
 	class VMException : public std::exception
 	{
 	public:
 		/**
 		 * Default constructor of VMException
-		 * \param s what() string
+		 * \param s what() string, copied
 		 */
-		VMException(const char* s);
+		VMException(std::string s);
 
 		/**
 		 * Returns the exception string for the VM exception.
@@ -26,7 +29,7 @@ namespace thallium
 		const char* what() const noexcept override;
 
 	private:
-		const char* _swhat;
+		std::string _swhat;
 	};
 
 	/**
@@ -107,7 +110,7 @@ namespace thallium
 	 */
 	bool tassert(const bool condition,
 				  const TimeOfError etime, const ErrorType etype,
-				  const std::string estring,
+				  const std::string& estring,
 				  const bool ignore_fatal = false);
 
 	/**
@@ -118,8 +121,70 @@ namespace thallium
 	 * \param ignore_fatal Defines whether a fatal error should throw a VMException or not.
 	 */
 	void error(const TimeOfError etime, const ErrorType etype,
-				const std::string estring,
+				const std::string& estring,
 				const bool ignore_fatal = false);
+
+	/**
+	 * Destination of the messages of error() and tassert()
+	 */
+	class LogSink
+	{
+	public:
+		virtual ~LogSink();
+
+		/**
+		 * Writes one message, possibly from several threads at once.
+		 * \param etime Time of error
+		 * \param etype Severity
+		 * \param message Message, without a trailing newline
+		 */
+		virtual void write(const TimeOfError etime, const ErrorType etype, const std::string& message) = 0;
+
+		/**
+		 * Makes buffered messages visible. Called after every fatal error.
+		 */
+		virtual void flush();
+	};
+
+	/**
+	 * Log sink formatting messages to a stream through its own buffer, which is written out when full, on
+	 * flush() and on destruction.
+	 */
+	class StreamLogSink : public LogSink
+	{
+	public:
+		/**
+		 * \param out Stream to write to, which must outlive the sink
+		 * \param buffer_size Bytes buffered before writing to the stream
+		 */
+		StreamLogSink(std::ostream& out, const size_t buffer_size = 4096);
+		~StreamLogSink() override;
+
+		void write(const TimeOfError etime, const ErrorType etype, const std::string& message) override;
+		void flush() override;
+
+	private:
+		/**
+		 * Writes the buffer to the stream, with _mutex held.
+		 */
+		void flush_buffer();
+
+		std::ostream& _out;
+		std::string _buffer;
+		size_t _buffer_size;
+		std::mutex _mutex;
+	};
+
+	/**
+	 * Replaces the log sink of the process.
+	 * \param sink New sink, which must outlive its use, or nullptr for the default sink writing to std::cout
+	 */
+	void set_log_sink(LogSink* sink);
+
+	/**
+	 * \return Current log sink of the process
+	 */
+	LogSink& log_sink();
 }
 
 #endif
@@ -0,0 +1,91 @@
+#include <mutex>
+#include "fault.hpp"
+#include "error.hpp"
+
+#ifdef THALLIUM_HAS_MMAP
+#include <signal.h>
+#include <ucontext.h>
+
+namespace thallium
+{
+	static thread_local FaultRegion* current_region = nullptr;
+
+	static struct sigaction previous_segv;
+	static struct sigaction previous_bus;
+
+	/**
+	 * Forwards a signal which is not ours to the handler installed before.
+	 */
+	static void forward_signal(const int signal, siginfo_t* info, void* context)
+	{
+		const struct sigaction& previous = signal == SIGBUS ? previous_bus : previous_segv;
+
+		if (previous.sa_flags & SA_SIGINFO)
+		{
+			previous.sa_sigaction(signal, info, context);
+			return;
+		}
+
+		if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+		{
+			previous.sa_handler(signal);
+			return;
+		}
+
+		// returning re-executes the faulting access, which now gets the default action
+		struct sigaction action = {};
+		action.sa_handler = SIG_DFL;
+		sigaction(signal, &action, nullptr);
+	}
+
+	static void handle_fault(const int signal, siginfo_t* info, void* context)
+	{
+		FaultRegion* region = current_region;
+		const uint8_t* address = static_cast<const uint8_t*>(info->si_addr);
+
+		if (region == nullptr || address < region->begin || address >= region->end)
+		{
+			forward_signal(signal, info, context);
+			return;
+		}
+
+		region->address = address;
+		region->pc = nullptr;
+
+#if defined(__linux__) && defined(__x86_64__)
+		region->pc = reinterpret_cast<const void*>(static_cast<ucontext_t*>(context)->uc_mcontext.gregs[REG_RIP]);
+#endif
+
+		// the handler runs with SA_NODEFER, so the signal mask needs no restoring
+		siglongjmp(region->env, 1);
+	}
+
+	static void install_handlers()
+	{
+		struct sigaction action = {};
+		action.sa_sigaction = handle_fault;
+		action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+		sigemptyset(&action.sa_mask);
+
+		tassert(sigaction(SIGSEGV, &action, &previous_segv) == 0 && sigaction(SIGBUS, &action, &previous_bus) == 0,
+				TimeOfError::Preload, ErrorType::Internal,
+				"could not install the memory fault handlers.");
+	}
+
+	void enter_fault_region(FaultRegion& region)
+	{
+		static std::once_flag installed;
+		std::call_once(installed, install_handlers);
+
+		region.address = nullptr;
+		region.pc = nullptr;
+		region.previous = current_region;
+		current_region = &region;
+	}
+
+	void leave_fault_region(FaultRegion& region)
+	{
+		current_region = region.previous;
+	}
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef THALLIUMVM_FAULT_HPP
+#define THALLIUMVM_FAULT_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include "memory.hpp"
+
+#ifdef THALLIUM_HAS_MMAP
+#include <setjmp.h>
+
+namespace thallium
+{
+	/**
+	 * Range of host memory in which access violations are recovered from rather than fatal to the process.
+	 *
+	 * While a region is entered on a thread, a SIGSEGV or SIGBUS raised by that thread inside [begin, end)
+	 * records the faulting address and host instruction pointer, then jumps back to env. Faults outside the
+	 * region go to whichever handler was installed before. Regions nest, the innermost one wins.
+	 */
+	struct FaultRegion
+	{
+		const uint8_t* begin;
+		const uint8_t* end;
+
+		/**
+		 * Jump buffer set with sigsetjmp(env, 0) before entering the region
+		 */
+		sigjmp_buf env;
+
+		/**
+		 * Faulting host address, set by the signal handler
+		 */
+		const uint8_t* volatile address;
+
+		/**
+		 * Host instruction pointer of the faulting access if the platform reports it, nullptr otherwise
+		 */
+		const void* volatile pc;
+
+		FaultRegion* previous;
+	};
+
+	/**
+	 * Makes a region the innermost one of the calling thread, installing the signal handlers on first use.
+	 * \param region Region to enter, with begin, end and env set
+	 */
+	void enter_fault_region(FaultRegion& region);
+
+	/**
+	 * Leaves the innermost region of the calling thread, after a normal return or after a fault.
+	 * \param region Region to leave
+	 */
+	void leave_fault_region(FaultRegion& region);
+}
+#endif
+
+#endif
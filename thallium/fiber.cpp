@@ -0,0 +1,235 @@
+#include <algorithm>
+#include "fiber.hpp"
+
+namespace thallium
+{
+	FiberScheduler::FiberScheduler(const size_t span, const vmreg_t* registers) :
+		_span(std::max<size_t>(span, static_cast<size_t>(SPRegisters::total))),
+		_fibers(1, FiberRecord{FiberState::Running, none(), none()}),
+		_ready_head(none()),
+		_ready_tail(none()),
+		_free_head(none()),
+		_used(1),
+		_running(1),
+		_idle(0),
+		_stopped(false)
+	{
+		_registers.emplace_back(new vmreg_t[chunk_fibers() * _span]());
+		std::copy(registers, registers + _span, main_registers());
+	}
+
+	size_t FiberScheduler::span() const
+	{
+		return _span;
+	}
+
+	vmreg_t* FiberScheduler::main_registers()
+	{
+		return _registers[0].get();
+	}
+
+	size_t FiberScheduler::size()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _used;
+	}
+
+	bool FiberScheduler::spawn(const vmreg_t* registers, const vmreg_t entry, const vmreg_t stack,
+							   const uint16_t id_register, uint32_t& id)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_used >= max_fibers())
+			return false;
+
+		if (_free_head != none())
+		{
+			id = _free_head;
+			_free_head = _fibers[id].next;
+		}
+		else
+		{
+			id = static_cast<uint32_t>(_fibers.size());
+			_fibers.push_back(FiberRecord{FiberState::Free, none(), none()});
+
+			if (id % chunk_fibers() == 0)
+				_registers.emplace_back(new vmreg_t[chunk_fibers() * _span]());
+		}
+
+		vmreg_t* spawned = slot(id);
+		std::copy(registers, registers + _span, spawned);
+		spawned[static_cast<size_t>(SPRegisters::ip)] = entry;
+		spawned[static_cast<size_t>(SPRegisters::sp)] = stack;
+		spawned[static_cast<size_t>(SPRegisters::fl)] = 0;
+		spawned[id_register] = id;
+
+		_fibers[id] = FiberRecord{FiberState::Ready, none(), none()};
+		++_used;
+		push(id);
+		return true;
+	}
+
+	FiberStatus FiberScheduler::yield(uint32_t& fiber, vmreg_t*& registers)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_ready_head == none())
+			return FiberStatus::Continue;
+
+		_fibers[fiber].state = FiberState::Ready;
+		push(fiber);
+
+		fiber = pop(registers);
+		return FiberStatus::Continue;
+	}
+
+	FiberStatus FiberScheduler::join(uint32_t& fiber, vmreg_t*& registers, const vmreg_t target)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (target >= _fibers.size() || target == fiber || _fibers[target].state == FiberState::Free
+			|| _fibers[target].joiner != none())
+			return FiberStatus::Failed;
+
+		if (_fibers[target].state == FiberState::Finished)
+		{
+			reclaim(target);
+			return FiberStatus::Continue;
+		}
+
+		// blocking the last running fiber with nothing ready would leave no one to wake it
+		if (_ready_head == none() && _running == 1)
+			return FiberStatus::Failed;
+
+		_fibers[fiber].state = FiberState::Blocked;
+		_fibers[target].joiner = fiber;
+
+		return next(fiber, registers);
+	}
+
+	FiberStatus FiberScheduler::exit(uint32_t& fiber, vmreg_t*& registers)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		const uint32_t joiner = _fibers[fiber].joiner;
+		if (_ready_head == none() && joiner == none() && _running == 1)
+			return FiberStatus::Failed;
+
+		if (joiner != none())
+		{
+			_fibers[joiner].state = FiberState::Ready;
+			push(joiner);
+			reclaim(fiber);
+		}
+		else
+		{
+			_fibers[fiber].state = FiberState::Finished;
+		}
+
+		return next(fiber, registers);
+	}
+
+	bool FiberScheduler::acquire(uint32_t& fiber, vmreg_t*& registers)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		++_idle;
+		_ready.wait(lock, [this]() { return _ready_head != none() || _stopped.load(std::memory_order_relaxed); });
+		--_idle;
+
+		if (_stopped.load(std::memory_order_relaxed))
+			return false;
+
+		fiber = pop(registers);
+		++_running;
+		return true;
+	}
+
+	void FiberScheduler::release(const uint32_t fiber)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_fibers[fiber] = FiberRecord{FiberState::Ready, _ready_head, _fibers[fiber].joiner};
+		_ready_head = fiber;
+		if (_ready_tail == none())
+			_ready_tail = fiber;
+
+		--_running;
+	}
+
+	bool FiberScheduler::stop()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_stopped.load(std::memory_order_relaxed))
+			return false;
+
+		_stopped.store(true, std::memory_order_relaxed);
+		_ready.notify_all();
+		return true;
+	}
+
+	bool FiberScheduler::stopped() const
+	{
+		return _stopped.load(std::memory_order_relaxed);
+	}
+
+	void FiberScheduler::resume()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopped.store(false, std::memory_order_relaxed);
+	}
+
+	void FiberScheduler::push(const uint32_t fiber)
+	{
+		_fibers[fiber].next = none();
+
+		if (_ready_tail == none())
+			_ready_head = fiber;
+		else
+			_fibers[_ready_tail].next = fiber;
+
+		_ready_tail = fiber;
+
+		if (_idle != 0)
+			_ready.notify_one();
+	}
+
+	uint32_t FiberScheduler::pop(vmreg_t*& registers)
+	{
+		const uint32_t fiber = _ready_head;
+
+		_ready_head = _fibers[fiber].next;
+		if (_ready_head == none())
+			_ready_tail = none();
+
+		_fibers[fiber].state = FiberState::Running;
+		registers = slot(fiber);
+		return fiber;
+	}
+
+	FiberStatus FiberScheduler::next(uint32_t& fiber, vmreg_t*& registers)
+	{
+		if (_ready_head != none())
+		{
+			fiber = pop(registers);
+			return FiberStatus::Continue;
+		}
+
+		--_running;
+		fiber = none();
+		return FiberStatus::Idle;
+	}
+
+	vmreg_t* FiberScheduler::slot(const uint32_t fiber)
+	{
+		return _registers[fiber / chunk_fibers()].get() + size_t(fiber % chunk_fibers()) * _span;
+	}
+
+	void FiberScheduler::reclaim(const uint32_t fiber)
+	{
+		_fibers[fiber] = FiberRecord{FiberState::Free, _free_head, none()};
+		_free_head = fiber;
+		--_used;
+	}
+}
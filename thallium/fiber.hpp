@@ -0,0 +1,274 @@
+#ifndef THALLIUMVM_FIBER_HPP
+#define THALLIUMVM_FIBER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "register.hpp"
+
+namespace thallium
+{
+	/**
+	 * Typed class enum of the states of a fiber
+	 */
+	enum class FiberState : uint8_t
+	{
+		/**
+		 * The id is not in use
+		 */
+		Free,
+
+		/**
+		 * Waiting in the ready queue
+		 */
+		Ready,
+
+		/**
+		 * Running on an executor, which holds its registers
+		 */
+		Running,
+
+		/**
+		 * Waiting for the fiber it joins to exit
+		 */
+		Blocked,
+
+		/**
+		 * Exited, and not joined yet
+		 */
+		Finished
+	};
+
+	/**
+	 * Outcome of a fiber operation which may switch fibers
+	 */
+	enum class FiberStatus
+	{
+		/**
+		 * The executor keeps running a fiber, the same one or the one whose registers were loaded
+		 */
+		Continue,
+
+		/**
+		 * The fiber of the executor stopped running and no other one was ready, the executor has to acquire one
+		 */
+		Idle,
+
+		/**
+		 * The operation was refused and nothing changed
+		 */
+		Failed
+	};
+
+	/**
+	 * Scheduler entry of a fiber
+	 */
+	struct FiberRecord
+	{
+		FiberState state;
+
+		/**
+		 * Next fiber in the ready queue, or in the free list
+		 */
+		uint32_t next;
+
+		/**
+		 * Fiber blocked joining this one, if any
+		 */
+		uint32_t joiner;
+	};
+
+	/**
+	 * Fibers of a VM: the registers of every fiber, a FIFO queue of the ready ones, and what blocked ones wait for.
+	 *
+	 * Each fiber owns span() registers, which executors, the VM and the host threads it runs fibers on, run in
+	 * place: switching fibers hands the executor a pointer to the registers of the fiber entering, so switches
+	 * neither copy registers nor allocate. Registers live in chunks of chunk_fibers() slots which never move, and
+	 * a new chunk is only allocated when a spawn needs a new id.<br>
+	 * Every operation takes the scheduler lock, which also orders the memory accesses of fibers running on
+	 * different threads: what a fiber wrote before it yields or exits is visible to the fibers switched in after.
+	 */
+	class FiberScheduler
+	{
+	public:
+		/**
+		 * Creates the scheduler of a running main fiber, of id 0.
+		 * \param span Number of registers of a fiber
+		 * \param registers Registers of the main fiber, span() of them being copied
+		 */
+		FiberScheduler(const size_t span, const vmreg_t* registers);
+
+		FiberScheduler(const FiberScheduler&) = delete;
+		FiberScheduler& operator=(const FiberScheduler&) = delete;
+
+		/**
+		 * \return Number of fibers which may exist at once, including those which exited but were not joined
+		 */
+		constexpr static uint32_t max_fibers()
+		{
+			return 1u << 20;
+		}
+
+		/**
+		 * \return Number of fibers whose registers are allocated at once
+		 */
+		constexpr static uint32_t chunk_fibers()
+		{
+			return 256;
+		}
+
+		/**
+		 * \return Fiber id of an executor which has none
+		 */
+		constexpr static uint32_t none()
+		{
+			return std::numeric_limits<uint32_t>::max();
+		}
+
+		/**
+		 * \return Number of registers of a fiber
+		 */
+		size_t span() const;
+
+		/**
+		 * \return Registers of the main fiber, for the VM which created the scheduler
+		 */
+		vmreg_t* main_registers();
+
+		/**
+		 * \return Number of fibers in use, running, ready, blocked or exited but not joined
+		 */
+		size_t size();
+
+		/**
+		 * Creates a ready fiber, with the registers of the spawning one but ip, sp, fl and its id register.
+		 * \param registers Registers of the spawning fiber
+		 * \param entry Initial ip
+		 * \param stack Initial sp
+		 * \param id_register Register receiving the id, written last
+		 * \param id Id of the new fiber
+		 * \return false if max_fibers() fibers already exist
+		 */
+		bool spawn(const vmreg_t* registers, const vmreg_t entry, const vmreg_t stack, const uint16_t id_register,
+				   uint32_t& id);
+
+		/**
+		 * Moves the running fiber to the back of the ready queue and loads the first ready one, if any.
+		 * \param fiber Id of the running fiber, replaced by the one loaded
+		 * \param registers Registers of the running fiber, replaced by those of the fiber loaded
+		 * \return FiberStatus::Continue
+		 */
+		FiberStatus yield(uint32_t& fiber, vmreg_t*& registers);
+
+		/**
+		 * Blocks the running fiber until another one exits, and loads the first ready one. Joining a fiber which
+		 * already exited frees its id right away.
+		 * \param fiber Id of the running fiber, replaced by the one loaded, or none() when idle
+		 * \param registers Registers of the running fiber, replaced by those of the fiber loaded
+		 * \param target Id of the fiber to join
+		 * \return FiberStatus::Failed if target cannot be joined or no fiber could run anymore
+		 */
+		FiberStatus join(uint32_t& fiber, vmreg_t*& registers, const vmreg_t target);
+
+		/**
+		 * Ends the running fiber, which is not the main one, waking the fiber joining it, and loads the first
+		 * ready one.
+		 * \param fiber Id of the running fiber, replaced by the one loaded, or none() when idle
+		 * \param registers Registers of the running fiber, replaced by those of the fiber loaded
+		 * \return FiberStatus::Failed if no fiber could run anymore
+		 */
+		FiberStatus exit(uint32_t& fiber, vmreg_t*& registers);
+
+		/**
+		 * Waits for a ready fiber and loads it, for an idle executor.
+		 * \param fiber Id of the loaded fiber
+		 * \param registers Set to the registers of the fiber loaded
+		 * \return false if the scheduler was stopped first
+		 */
+		bool acquire(uint32_t& fiber, vmreg_t*& registers);
+
+		/**
+		 * Puts a running fiber at the front of the ready queue, for an executor leaving the run.
+		 * \param fiber Id of the running fiber
+		 */
+		void release(const uint32_t fiber);
+
+		/**
+		 * Stops the run, waking idle executors.
+		 * \return Whether this call stopped it, rather than an earlier one
+		 */
+		bool stop();
+
+		/**
+		 * \return Whether the run was stopped
+		 */
+		bool stopped() const;
+
+		/**
+		 * Clears the stop of the last run.
+		 */
+		void resume();
+
+	private:
+		/**
+		 * Appends a fiber to the ready queue, waking an idle executor.
+		 */
+		void push(const uint32_t fiber);
+
+		/**
+		 * Removes the first fiber of the ready queue and loads its registers.
+		 * \return Id of the fiber
+		 */
+		uint32_t pop(vmreg_t*& registers);
+
+		/**
+		 * Hands the executor of a fiber which stopped running the next ready one, if any.
+		 */
+		FiberStatus next(uint32_t& fiber, vmreg_t*& registers);
+
+		/**
+		 * \return Registers of a fiber
+		 */
+		vmreg_t* slot(const uint32_t fiber);
+
+		/**
+		 * Frees the id of a joined fiber.
+		 */
+		void reclaim(const uint32_t fiber);
+
+		size_t _span;
+
+		std::vector<FiberRecord> _fibers;
+
+		/**
+		 * Registers of the fibers, _span words per fiber id in chunks of chunk_fibers() ids
+		 */
+		std::vector<std::unique_ptr<vmreg_t[]>> _registers;
+
+		uint32_t _ready_head;
+		uint32_t _ready_tail;
+		uint32_t _free_head;
+
+		/**
+		 * Number of fibers in use, and of fibers held by an executor
+		 */
+		size_t _used;
+		size_t _running;
+
+		/**
+		 * Number of executors waiting in acquire()
+		 */
+		size_t _idle;
+
+		std::mutex _mutex;
+		std::condition_variable _ready;
+		std::atomic<bool> _stopped;
+	};
+}
+
+#endif
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <utility>
+#include "host.hpp"
+
+namespace thallium
+{
+	HostCall::HostCall(const uint32_t id, vmreg_t* registers, const size_t size, uint8_t* memory,
+					   const size_t memory_size, void* backend, const CopyIn copy_in, const CopyOut copy_out) :
+		_id(id),
+		_registers(registers),
+		_size(size),
+		_memory(memory),
+		_memory_size(memory_size),
+		_backend(backend),
+		_copy_in(copy_in),
+		_copy_out(copy_out),
+		_written_begin(0),
+		_written_end(0),
+		_fault(false),
+		_fault_address(0),
+		_empty(0)
+	{}
+
+	uint32_t HostCall::id() const
+	{
+		return _id;
+	}
+
+	size_t HostCall::size() const
+	{
+		return _size;
+	}
+
+	size_t HostCall::memory_size() const
+	{
+		return _memory_size;
+	}
+
+	const uint8_t* HostCall::read(const vmreg_t address, const uint64_t size)
+	{
+		return view(address, size, false);
+	}
+
+	uint8_t* HostCall::write(const vmreg_t address, const uint64_t size)
+	{
+		return view(address, size, true);
+	}
+
+	uint8_t* HostCall::view(const vmreg_t address, const uint64_t size, const bool writable)
+	{
+		if (size == 0)
+			return &_empty;
+
+		if (uint64_t(address) + size > _memory_size)
+		{
+			if (!_fault)
+			{
+				_fault = true;
+				_fault_address = std::max<uint64_t>(address, _memory_size);
+			}
+
+			return nullptr;
+		}
+
+		if (writable)
+		{
+			_written_begin = _written_end == 0 ? address : std::min<uint64_t>(_written_begin, address);
+			_written_end = std::max<uint64_t>(_written_end, address + size);
+		}
+
+		if (_memory != nullptr)
+			return _memory + address;
+
+		HostStagedRange staged{address, std::vector<uint8_t>(static_cast<size_t>(size)), writable};
+		_copy_in(_backend, address, staged.bytes.data(), staged.bytes.size());
+
+		// moving the buffer keeps its bytes where they are
+		_staged.push_back(std::move(staged));
+		return _staged.back().bytes.data();
+	}
+
+	void HostCall::finish()
+	{
+		for (const HostStagedRange& staged : _staged)
+		{
+			if (staged.writable)
+				_copy_out(_backend, staged.address, staged.bytes.data(), staged.bytes.size());
+		}
+	}
+}
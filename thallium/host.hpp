@@ -0,0 +1,177 @@
+#ifndef THALLIUMVM_HOST_HPP
+#define THALLIUMVM_HOST_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "register.hpp"
+
+namespace thallium
+{
+	class HostCall;
+
+	/**
+	 * Native function programs call with hcall, see BasicVM::bind.
+	 *
+	 * A function handling many items should take the address and count of an array of records in memory rather
+	 * than one item per call, so that one dispatch covers the whole batch.
+	 * \param call Registers and memory of the calling program
+	 * \param context Pointer given when the function was bound
+	 * \return Whether the call succeeded, the program trapping with TrapCode::HostCallFailed otherwise
+	 */
+	typedef bool (*HostFunction)(HostCall& call, void* context);
+
+	/**
+	 * Host function bound to an id of a VM
+	 */
+	struct HostBinding
+	{
+		HostFunction function;
+		void* context;
+
+		/**
+		 * Number of registers the function reads and writes, from the base register of hcall on
+		 */
+		uint16_t registers;
+	};
+
+	/**
+	 * Range of memory a host function asked for on a memory which is not contiguous, copied in when asked for and
+	 * copied back once the function returned if it is writable
+	 */
+	struct HostStagedRange
+	{
+		vmreg_t address;
+		std::vector<uint8_t> bytes;
+		bool writable;
+	};
+
+	/**
+	 * What a host function sees of the program calling it: a window of registers and bounds-checked views of
+	 * memory.
+	 *
+	 * Views of contiguous memory point right into the VM memory, so nothing is copied whatever their size. On a
+	 * memory which is not contiguous, such as PagedMemory, views are staged in buffers of the call instead, and
+	 * writable ones are written back once the function returns; overlapping views do not see each other's writes
+	 * then. Views are valid until the function returns.<br>
+	 * A view of a range which does not fit in memory is null, and the program traps with
+	 * TrapCode::MemoryOutOfBounds once the function returns, whatever it returned. Writes to the code region of the
+	 * program through writable views invalidate it, like stores from the program would.
+	 */
+	class HostCall
+	{
+	public:
+		HostCall(const HostCall&) = delete;
+		HostCall& operator=(const HostCall&) = delete;
+
+		/**
+		 * \return Id the function was called with
+		 */
+		uint32_t id() const;
+
+		/**
+		 * \return Number of registers of the window, the one the function was bound with
+		 */
+		size_t size() const;
+
+		/**
+		 * Subscript operator for the registers of the window, the first one being the base register of hcall.
+		 * \param index Register index within the window, below size()
+		 * \return Reference to the register
+		 */
+		vmreg_t& operator[](const size_t index)
+		{
+			return _registers[index];
+		}
+
+		/**
+		 * \return Memory size of the VM in bytes
+		 */
+		size_t memory_size() const;
+
+		/**
+		 * Returns a read-only view of a memory range.
+		 * \param address First address of the range
+		 * \param size Size of the range in bytes, empty ranges always fitting
+		 * \return Pointer to the bytes of the range, or nullptr if it does not fit in memory
+		 */
+		const uint8_t* read(const vmreg_t address, const uint64_t size);
+
+		/**
+		 * Returns a writable view of a memory range, which also holds what memory holds.
+		 * \param address First address of the range
+		 * \param size Size of the range in bytes, empty ranges always fitting
+		 * \return Pointer to the bytes of the range, or nullptr if it does not fit in memory
+		 */
+		uint8_t* write(const vmreg_t address, const uint64_t size);
+
+	private:
+		template<typename Config>
+		friend class BasicVM;
+
+		/**
+		 * Copies a range of a memory which is not contiguous to a buffer.
+		 */
+		typedef void (*CopyIn)(void* memory, const vmreg_t address, uint8_t* out, const size_t size);
+
+		/**
+		 * Copies a buffer to a range of a memory which is not contiguous.
+		 */
+		typedef void (*CopyOut)(void* memory, const vmreg_t address, const uint8_t* data, const size_t size);
+
+		/**
+		 * HostCall constructor, for the VM running the call.
+		 * \param id Id of the called function
+		 * \param registers First register of the window
+		 * \param size Number of registers of the window
+		 * \param memory First byte of memory if it is contiguous, nullptr otherwise
+		 * \param memory_size Memory size in bytes
+		 * \param backend Memory backend, handed to copy_in and copy_out when memory is not contiguous
+		 * \param copy_in Copies a range of the backend to a buffer
+		 * \param copy_out Copies a buffer to a range of the backend
+		 */
+		HostCall(const uint32_t id, vmreg_t* registers, const size_t size, uint8_t* memory, const size_t memory_size,
+				 void* backend, const CopyIn copy_in, const CopyOut copy_out);
+
+		/**
+		 * Returns a view of a memory range, recording the fault if it does not fit in memory.
+		 * \return Pointer to the bytes of the range, or nullptr
+		 */
+		uint8_t* view(const vmreg_t address, const uint64_t size, const bool writable);
+
+		/**
+		 * Writes the writable staged ranges back to memory, once the function returned.
+		 */
+		void finish();
+
+		uint32_t _id;
+		vmreg_t* _registers;
+		size_t _size;
+
+		uint8_t* _memory;
+		size_t _memory_size;
+		void* _backend;
+		CopyIn _copy_in;
+		CopyOut _copy_out;
+		std::vector<HostStagedRange> _staged;
+
+		/**
+		 * Range covering every writable view, empty if there is none
+		 */
+		uint64_t _written_begin;
+		uint64_t _written_end;
+
+		/**
+		 * Whether a view did not fit in memory, and the first address out of memory of the first such view
+		 */
+		bool _fault;
+		uint64_t _fault_address;
+
+		/**
+		 * What views of empty ranges point to
+		 */
+		uint8_t _empty;
+	};
+}
+
+#endif
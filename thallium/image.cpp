@@ -0,0 +1,647 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include "image.hpp"
+#include "error.hpp"
+#include "memory.hpp"
+#include "program_file.hpp"
+#include "vm.hpp"
+
+#ifdef THALLIUM_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace thallium
+{
+	/**
+	 * Header of the translation of a translated program file, stored as laid out in memory at the translation offset
+	 * of the file.
+	 *
+	 * Offsets are from the beginning of the translation. The header is followed by the pre-decoded program, the
+	 * blocks, their successors and the diagnostic of the verification, up to the end of the file.
+	 */
+	struct TranslationHeader
+	{
+		/**
+		 * Layout of the records on the host which wrote the file, see translation_layout()
+		 */
+		uint32_t layout;
+		uint32_t reserved;
+
+		uint64_t decoded_offset;
+		uint64_t blocks_offset;
+		uint64_t block_count;
+		uint64_t successors_offset;
+		uint64_t successor_count;
+		uint64_t diagnostic_offset;
+		uint64_t diagnostic_size;
+
+		uint64_t fusions;
+		uint64_t register_span;
+
+		/**
+		 * Checksum of the header, this field being zero, and of the records, see translation_checksum()
+		 */
+		uint64_t checksum;
+	};
+
+	/**
+	 * \return Checksum of a translation: of its header, without the checksum itself, and of its records
+	 */
+	static uint64_t translation_checksum(TranslationHeader header, const uint8_t* records, const size_t size)
+	{
+		header.checksum = 0;
+
+		const uint64_t prime = 0x9E3779B97F4A7C15ull;
+		return program_checksum(records, size)
+			   ^ program_checksum(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) * prime;
+	}
+
+	static uint64_t round_up(const uint64_t value, const uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	static bool same_instruction(const DecodedInstruction& x, const DecodedInstruction& y)
+	{
+		return x.op == y.op && x.opcode == y.opcode && x.a == y.a && x.b == y.b && x.c == y.c && x.imm == y.imm;
+	}
+
+	/**
+	 * Checks a pre-decoded program against the code it was translated from, decoding and fusing the code one
+	 * instruction ahead rather than building another pre-decoded program.
+	 * \param code Serialized code
+	 * \param decoded Pre-decoded program
+	 * \param count Number of instructions
+	 * \param fusions Number of superinstructions of the pre-decoded program
+	 * \param span Register span of the pre-decoded program
+	 * \return Whether decoded is what ProgramImage::translate builds from code
+	 */
+	static bool matches_code(const uint8_t* code, const DecodedInstruction* decoded, const size_t count,
+							 size_t& fusions, size_t& span)
+	{
+		fusions = 0;
+		span = 0;
+
+		if (count == 0)
+			return true;
+
+		DecodedInstruction next = VM::decode_instruction(code);
+		bool second = false;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			DecodedInstruction d = next;
+			if (i + 1 < count)
+				next = VM::decode_instruction(code + (i + 1) * Instruction::size());
+
+			span = std::max(span, thallium::register_span(d));
+
+			// the second instruction of a pair does not start another one, as in fuse()
+			const DecodedOp fused = second || i + 1 == count ? d.op : fused_op(d, next.op);
+			second = fused != d.op;
+			if (second)
+			{
+				d.op = fused;
+				++fusions;
+			}
+
+			if (!same_instruction(d, decoded[i]))
+				return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Checks the header of a program file.
+	 */
+	static ProgramFileHeader read_header(const uint8_t* data, const std::string& path)
+	{
+		ProgramFileHeader header;
+
+		tassert(ProgramFileHeader::deserialize(data, header),
+				TimeOfError::Preload, ErrorType::Fatal,
+				path + " is not a ThalliumVM program file.");
+
+		tassert(header.version >= 1 && header.version <= ProgramFileHeader::current_version(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				path + " uses program file version " + std::to_string(header.version) + ", only versions 1 to "
+				+ std::to_string(ProgramFileHeader::current_version()) + " are supported.");
+
+		// aligned code takes one or two words per instruction, and a translation follows translated code
+		const bool aligned = header.version == static_cast<uint32_t>(ProgramEncoding::Aligned);
+		const bool translated = header.version == static_cast<uint32_t>(ProgramEncoding::Translated);
+		const uint64_t max_count = std::numeric_limits<vmreg_t>::max() / Instruction::size();
+		const bool valid_code = aligned
+			? header.code_size % sizeof(uint64_t) == 0 && header.instruction_count <= max_count
+			  && header.code_size / sizeof(uint64_t) >= header.instruction_count
+			  && header.code_size / sizeof(uint64_t) <= 2 * header.instruction_count
+			: header.code_size % Instruction::size() == 0 && header.code_size <= std::numeric_limits<vmreg_t>::max()
+			  && (!translated || (header.instruction_count == header.code_size / Instruction::size()
+								  && header.translation_offset >= header.code_offset + header.code_size));
+
+		tassert(header.header_size >= ProgramFileHeader::size() && header.code_offset >= header.header_size
+				&& valid_code,
+				TimeOfError::Preload, ErrorType::Fatal,
+				path + " has an invalid program file header.");
+
+		return header;
+	}
+
+	ProgramImage::ProgramImage() :
+		_code(nullptr),
+		_size(0),
+		_mapped_size(0),
+		_fd(-1),
+		_fd_offset(0),
+		_entry(0),
+		_initial_sp(0),
+		_decoded(nullptr),
+		_translation(nullptr),
+		_translation_size(0),
+		_fusions(0),
+		_register_span(0)
+	{}
+
+	ProgramImage::~ProgramImage()
+	{
+#ifdef THALLIUM_HAS_MMAP
+		if (_mapped_size != 0)
+			munmap(const_cast<uint8_t*>(_code), _mapped_size);
+
+		if (_translation != nullptr)
+			munmap(const_cast<uint8_t*>(_translation), _translation_size);
+
+		if (_fd >= 0)
+			close(_fd);
+#endif
+	}
+
+	std::shared_ptr<const ProgramImage> ProgramImage::create(const std::vector<Instruction>& program)
+	{
+		const vmreg_t size = static_cast<vmreg_t>(program.size() * Instruction::size());
+		return create(program, 0, size);
+	}
+
+	std::shared_ptr<const ProgramImage> ProgramImage::create(const std::vector<Instruction>& program,
+															 const vmreg_t entry, const vmreg_t initial_sp)
+	{
+		std::shared_ptr<ProgramImage> image{new ProgramImage};
+		image->_size = program.size() * Instruction::size();
+		image->_entry = entry;
+		image->_initial_sp = initial_sp;
+
+		uint8_t* code = image->allocate();
+		serialize_instructions(program.data(), program.size(), code);
+		image->seal(code);
+
+		image->translate();
+
+		return image;
+	}
+
+	std::shared_ptr<const ProgramImage> ProgramImage::load(const std::string& path, const bool verify,
+														   const bool trusted)
+	{
+		std::shared_ptr<ProgramImage> image{new ProgramImage};
+		uint8_t raw_header[ProgramFileHeader::size()];
+
+#ifdef THALLIUM_HAS_MMAP
+		// the image owns the descriptor from now on, and closes it if loading fails
+		image->_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		tassert(image->_fd >= 0,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"cannot open program file " + path + ".");
+
+		struct stat st;
+		tassert(fstat(image->_fd, &st) == 0
+				&& pread(image->_fd, raw_header, sizeof(raw_header), 0) == static_cast<ssize_t>(sizeof(raw_header)),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"cannot read the header of program file " + path + ".");
+
+		const ProgramFileHeader header = read_header(raw_header, path);
+		const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+		const uint64_t code_end = header.code_offset + header.code_size;
+
+		tassert(code_end <= file_size,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is truncated.");
+
+		// aligned code is expanded into a memory file of its own
+		if (header.version == static_cast<uint32_t>(ProgramEncoding::Aligned))
+		{
+			std::vector<uint8_t> encoded(header.code_size);
+			tassert(pread(image->_fd, encoded.data(), encoded.size(), static_cast<off_t>(header.code_offset))
+					== static_cast<ssize_t>(encoded.size()),
+					TimeOfError::Preload, ErrorType::Fatal,
+					"cannot read program file " + path + ".");
+
+			close(image->_fd);
+			image->_fd = -1;
+
+			image->expand(header, encoded, path, verify);
+			return image;
+		}
+
+		// VMs map whole pages of the file, so whatever follows the code in its last page has to be zero
+		const uint64_t page = Memory::page_size();
+		bool mappable = header.code_offset % page == 0;
+		if (mappable && code_end % page != 0 && code_end < file_size)
+		{
+			std::vector<uint8_t> tail(std::min(file_size, (code_end + page - 1) / page * page) - code_end);
+			mappable = pread(image->_fd, tail.data(), tail.size(), static_cast<off_t>(code_end)) == static_cast<ssize_t>(tail.size())
+					   && std::all_of(begin(tail), end(tail), [](const uint8_t b) { return b == 0; });
+		}
+
+		if (header.code_size == 0)
+		{
+			image->_code = image->_copy.data();
+		}
+		else if (mappable)
+		{
+			void* data = mmap(nullptr, header.code_size, PROT_READ, MAP_PRIVATE, image->_fd, static_cast<off_t>(header.code_offset));
+			tassert(data != MAP_FAILED,
+					TimeOfError::Preload, ErrorType::Fatal,
+					"cannot map program file " + path + ".");
+
+			image->_code = static_cast<uint8_t*>(data);
+			image->_mapped_size = header.code_size;
+			image->_fd_offset = header.code_offset;
+		}
+		else
+		{
+			image->_copy.resize(header.code_size);
+			tassert(pread(image->_fd, image->_copy.data(), header.code_size, static_cast<off_t>(header.code_offset))
+					== static_cast<ssize_t>(header.code_size),
+					TimeOfError::Preload, ErrorType::Fatal,
+					"cannot read program file " + path + ".");
+
+			image->_code = image->_copy.data();
+		}
+#else
+		std::ifstream in(path, std::ios::binary);
+		tassert(in.read(reinterpret_cast<char*>(raw_header), sizeof(raw_header)).good(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"cannot read the header of program file " + path + ".");
+
+		const ProgramFileHeader header = read_header(raw_header, path);
+
+		std::vector<uint8_t> stored(header.code_size);
+		tassert(in.seekg(header.code_offset).read(reinterpret_cast<char*>(stored.data()), header.code_size).good(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is truncated.");
+
+		if (header.version == static_cast<uint32_t>(ProgramEncoding::Aligned))
+		{
+			image->expand(header, stored, path, verify);
+			return image;
+		}
+
+		image->_copy = std::move(stored);
+		image->_code = image->_copy.data();
+#endif
+
+		image->_size = header.code_size;
+		image->_entry = header.entry;
+		image->_initial_sp = header.initial_sp;
+
+		tassert(!verify || program_checksum(image->_code, image->_size) == header.checksum,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is corrupted: checksum mismatch.");
+
+#ifdef THALLIUM_HAS_MMAP
+		const bool restored = header.version == static_cast<uint32_t>(ProgramEncoding::Translated)
+							  && image->map_translation(header, file_size, path, verify, trusted);
+
+		// VMs only map the file if the code is
+		if (image->_mapped_size == 0)
+		{
+			close(image->_fd);
+			image->_fd = -1;
+		}
+
+		if (restored)
+			return image;
+#else
+		static_cast<void>(trusted);
+#endif
+
+		image->translate();
+
+		return image;
+	}
+
+	void ProgramImage::save(const std::string& path, const ProgramEncoding encoding) const
+	{
+		const bool aligned = encoding == ProgramEncoding::Aligned;
+		const bool translated = encoding == ProgramEncoding::Translated;
+		const std::vector<uint8_t> encoded = aligned ? encode_aligned(_code, _size) : std::vector<uint8_t>();
+		const uint8_t* code = aligned ? encoded.data() : _code;
+		const size_t size = aligned ? encoded.size() : _size;
+
+		ProgramFileHeader header;
+		header.version = static_cast<uint32_t>(encoding);
+		header.header_size = ProgramFileHeader::size();
+		header.entry = _entry;
+		header.initial_sp = _initial_sp;
+		header.code_offset = ProgramFileHeader::default_code_offset();
+		header.code_size = size;
+		header.checksum = program_checksum(code, size);
+		header.instruction_count = aligned || translated ? _size / Instruction::size() : 0;
+
+		// the translation starts at a page boundary for the common page sizes, like the code
+		header.translation_offset = translated
+			? round_up(header.code_offset + header.code_size, ProgramFileHeader::default_code_offset()) : 0;
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		tassert(out.good(), TimeOfError::Preload, ErrorType::Fatal, "cannot write program file " + path + ".");
+
+		const auto serialized = header.serialize();
+		const std::vector<char> padding(ProgramFileHeader::default_code_offset());
+
+		out.write(reinterpret_cast<const char*>(serialized.data()), serialized.size());
+		out.write(padding.data(), header.code_offset - serialized.size());
+		out.write(reinterpret_cast<const char*>(code), size);
+
+		if (translated)
+		{
+			out.write(padding.data(), header.translation_offset - header.code_offset - header.code_size);
+			save_translation(out);
+		}
+
+		tassert(out.flush().good(), TimeOfError::Preload, ErrorType::Fatal, "cannot write program file " + path + ".");
+	}
+
+	uint8_t* ProgramImage::allocate()
+	{
+		uint8_t* code = nullptr;
+
+#ifdef __linux__
+		// the code goes to a memory file so that VMs can map it copy-on-write
+		const size_t page = Memory::page_size();
+		const size_t mapped_size = (_size + page - 1) / page * page;
+
+		if (mapped_size != 0)
+		{
+			const int fd = memfd_create("thallium-image", MFD_CLOEXEC);
+			if (fd >= 0)
+			{
+				void* data = MAP_FAILED;
+				if (ftruncate(fd, static_cast<off_t>(mapped_size)) == 0)
+					data = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+				if (data != MAP_FAILED)
+				{
+					code = static_cast<uint8_t*>(data);
+					_mapped_size = mapped_size;
+					_fd = fd;
+				}
+				else
+				{
+					close(fd);
+				}
+			}
+		}
+#endif
+
+		if (code == nullptr)
+		{
+			_copy.resize(_size);
+			code = _copy.data();
+		}
+
+		return code;
+	}
+
+	void ProgramImage::seal(uint8_t* code)
+	{
+#ifdef __linux__
+		if (_mapped_size != 0)
+			mprotect(code, _mapped_size, PROT_READ);
+#endif
+
+		_code = code;
+	}
+
+	void ProgramImage::expand(const ProgramFileHeader& header, const std::vector<uint8_t>& encoded,
+							  const std::string& path, const bool verify)
+	{
+		tassert(!verify || program_checksum(encoded.data(), encoded.size()) == header.checksum,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is corrupted: checksum mismatch.");
+
+		_size = header.instruction_count * Instruction::size();
+		_entry = header.entry;
+		_initial_sp = header.initial_sp;
+
+		uint8_t* code = allocate();
+		tassert(decode_aligned(encoded.data(), encoded.size(), code, header.instruction_count),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is corrupted: malformed aligned code.");
+		seal(code);
+
+		translate();
+	}
+
+	void ProgramImage::translate()
+	{
+		// translate the program once for every VM importing it
+		const size_t count = _size / Instruction::size();
+		_decoded_copy.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			_decoded_copy.push_back(VM::decode_instruction(_code + i * Instruction::size()));
+			_register_span = std::max(_register_span, thallium::register_span(_decoded_copy.back()));
+		}
+
+		_fusions = fuse(_decoded_copy);
+		_decoded = _decoded_copy.data();
+		_verification = Verification(_decoded, count, _entry, Registers::size());
+	}
+
+#ifdef THALLIUM_HAS_MMAP
+	bool ProgramImage::map_translation(const ProgramFileHeader& header, const uint64_t file_size,
+									   const std::string& path, const bool verify, const bool trusted)
+	{
+		tassert(header.translation_offset <= file_size && file_size - header.translation_offset >= sizeof(TranslationHeader),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is truncated.");
+
+		// a translation which cannot be mapped is built again from the code
+		if (_fd < 0 || header.translation_offset % Memory::page_size() != 0)
+			return false;
+
+		const size_t size = file_size - header.translation_offset;
+		void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, _fd, static_cast<off_t>(header.translation_offset));
+		tassert(data != MAP_FAILED,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"cannot map program file " + path + ".");
+
+		_translation = static_cast<const uint8_t*>(data);
+		_translation_size = size;
+
+		TranslationHeader translation;
+		std::memcpy(&translation, _translation, sizeof(translation));
+
+		if (translation.layout != translation_layout(sizeof(translation)))
+		{
+			munmap(data, size);
+			_translation = nullptr;
+			_translation_size = 0;
+			return false;
+		}
+
+		const auto fits = [&](const uint64_t offset, const uint64_t count, const uint64_t record) {
+			return offset >= sizeof(translation) && offset <= size && count <= (size - offset) / record;
+		};
+
+		const size_t count = _size / Instruction::size();
+		tassert(translation.decoded_offset % alignof(DecodedInstruction) == 0
+				&& fits(translation.decoded_offset, count, sizeof(DecodedInstruction))
+				&& fits(translation.blocks_offset, translation.block_count, sizeof(StoredBlock))
+				&& fits(translation.successors_offset, translation.successor_count, sizeof(uint64_t))
+				&& fits(translation.diagnostic_offset, translation.diagnostic_size, 1),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " has an invalid translation header.");
+
+		tassert(!verify || translation_checksum(translation, _translation + sizeof(translation), size - sizeof(translation))
+						   == translation.checksum,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is corrupted: translation checksum mismatch.");
+
+		_decoded = reinterpret_cast<const DecodedInstruction*>(_translation + translation.decoded_offset);
+
+		if (!trusted)
+		{
+			tassert(matches_code(_code, _decoded, count, _fusions, _register_span),
+					TimeOfError::Preload, ErrorType::Fatal,
+					"program file " + path + " is corrupted: the translation does not match the code.");
+
+			_verification = Verification(_decoded, count, _entry, Registers::size());
+			return true;
+		}
+
+		// the VM dispatches on the operations, which have to be valid even in a trusted translation
+		bool valid = std::none_of(_decoded, _decoded + count, [](const DecodedInstruction& d) {
+			return d.op == DecodedOp::stale || d.op >= DecodedOp::_total;
+		});
+
+		std::vector<BasicBlock> blocks;
+		valid = valid && restore_blocks(_translation + translation.blocks_offset, translation.block_count,
+										_translation + translation.successors_offset, translation.successor_count,
+										count, blocks);
+
+		tassert(valid,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"program file " + path + " is corrupted: invalid translation.");
+
+		_fusions = translation.fusions;
+		_register_span = translation.register_span;
+		_verification = Verification(std::move(blocks), _entry,
+									 std::string(reinterpret_cast<const char*>(_translation + translation.diagnostic_offset),
+												 translation.diagnostic_size));
+		return true;
+	}
+#else
+	bool ProgramImage::map_translation(const ProgramFileHeader&, const uint64_t, const std::string&, const bool,
+									   const bool)
+	{
+		return false;
+	}
+#endif
+
+	void ProgramImage::save_translation(std::ostream& out) const
+	{
+		const size_t count = _size / Instruction::size();
+
+		std::vector<StoredBlock> blocks;
+		std::vector<uint64_t> successors;
+		store_blocks(_verification, blocks, successors);
+
+		const std::string& diagnostic = _verification.diagnostic();
+
+		TranslationHeader translation{};
+		translation.layout = translation_layout(sizeof(translation));
+		translation.decoded_offset = round_up(sizeof(translation), sizeof(uint64_t));
+		translation.blocks_offset = translation.decoded_offset + round_up(count * sizeof(DecodedInstruction), sizeof(uint64_t));
+		translation.block_count = blocks.size();
+		translation.successors_offset = translation.blocks_offset + blocks.size() * sizeof(StoredBlock);
+		translation.successor_count = successors.size();
+		translation.diagnostic_offset = translation.successors_offset + successors.size() * sizeof(uint64_t);
+		translation.diagnostic_size = diagnostic.size();
+		translation.fusions = _fusions;
+		translation.register_span = _register_span;
+
+		// the records are laid out as they are mapped back, the checksum covering them all
+		std::vector<uint8_t> records(translation.diagnostic_offset + translation.diagnostic_size - sizeof(translation), 0);
+		const auto record = [&](const uint64_t offset) { return records.data() + (offset - sizeof(translation)); };
+		std::memcpy(record(translation.decoded_offset), _decoded, count * sizeof(DecodedInstruction));
+		std::memcpy(record(translation.blocks_offset), blocks.data(), blocks.size() * sizeof(StoredBlock));
+		std::memcpy(record(translation.successors_offset), successors.data(), successors.size() * sizeof(uint64_t));
+		std::memcpy(record(translation.diagnostic_offset), diagnostic.data(), diagnostic.size());
+		translation.checksum = translation_checksum(translation, records.data(), records.size());
+
+		out.write(reinterpret_cast<const char*>(&translation), sizeof(translation));
+		out.write(reinterpret_cast<const char*>(records.data()), records.size());
+	}
+
+	const uint8_t* ProgramImage::code() const
+	{
+		return _code;
+	}
+
+	size_t ProgramImage::size() const
+	{
+		return _size;
+	}
+
+	const DecodedInstruction* ProgramImage::decoded() const
+	{
+		return _decoded;
+	}
+
+	size_t ProgramImage::count() const
+	{
+		return _size / Instruction::size();
+	}
+
+	size_t ProgramImage::fusions() const
+	{
+		return _fusions;
+	}
+
+	size_t ProgramImage::register_span() const
+	{
+		return _register_span;
+	}
+
+	const Verification& ProgramImage::verification() const
+	{
+		return _verification;
+	}
+
+	vmreg_t ProgramImage::entry() const
+	{
+		return _entry;
+	}
+
+	vmreg_t ProgramImage::initial_sp() const
+	{
+		return _initial_sp;
+	}
+
+	int ProgramImage::fd() const
+	{
+		return _fd;
+	}
+
+	uint64_t ProgramImage::fd_offset() const
+	{
+		return _fd_offset;
+	}
+}
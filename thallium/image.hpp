@@ -0,0 +1,228 @@
+#ifndef THALLIUMVM_IMAGE_HPP
+#define THALLIUMVM_IMAGE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "decoded.hpp"
+#include "instruction.hpp"
+#include "program_file.hpp"
+#include "register.hpp"
+#include "verifier.hpp"
+
+namespace thallium
+{
+	/**
+	 * Immutable, translated form of a ThalliumVM program, shared by every VM importing it.
+	 *
+	 * Holds the serialized code once, along with its pre-decoded and fused form and its Verification. On Linux, the
+	 * code lives in an anonymous memory file that VMs map copy-on-write at the beginning of their memory, so importing
+	 * it costs the same whatever the program size and only the pages a program writes to get duplicated.<br>
+	 * Images can be saved to a program file (see ProgramFileHeader), whose packed code is mapped in place when loaded.
+	 * Translated program files also hold the pre-decoded program, which is mapped in place too rather than decoded
+	 * again.
+	 */
+	class ProgramImage
+	{
+	public:
+		/**
+		 * Serializes and translates a program.
+		 * \param program The ThalliumVM program
+		 * \return Shared image of the program
+		 */
+		static std::shared_ptr<const ProgramImage> create(const std::vector<Instruction>& program);
+
+		/**
+		 * Serializes and translates a program, with a given initial state.
+		 * \param program The ThalliumVM program
+		 * \param entry Address of the first instruction to run
+		 * \param initial_sp Initial value of sp
+		 * \return Shared image of the program
+		 */
+		static std::shared_ptr<const ProgramImage> create(const std::vector<Instruction>& program,
+														  const vmreg_t entry, const vmreg_t initial_sp);
+
+		/**
+		 * Loads a program file written by save(), in any encoding.
+		 *
+		 * Packed and translated code is mapped from the file rather than read where the platform allows it, and VMs
+		 * importing the image map the file pages copy-on-write. Aligned code is expanded as create() serializes
+		 * programs.<br>
+		 * The pre-decoded program of a translated file is mapped in place as well, once checked against the code in a
+		 * single pass which decodes it without storing it. The program is then verified again, unless the file is
+		 * trusted: its verification is restored as is, certified programs running without checks, so only files
+		 * written by the current user to a location no one else can write to should be trusted, as the checksums only
+		 * catch corruption.
+		 * \param path Path of the program file
+		 * \param verify Whether to check the code and the translation against the checksums of the file
+		 * \param trusted Whether to trust the pre-decoded program and the verification of a translated file
+		 * \return Shared image of the program
+		 */
+		static std::shared_ptr<const ProgramImage> load(const std::string& path, const bool verify = true,
+														const bool trusted = false);
+
+		/**
+		 * Writes the image to a program file.
+		 * \param path Path of the program file
+		 * \param encoding Encoding of the code: packed files are mapped in place when loaded, aligned ones are
+		 *        smaller and translated ones are not decoded again
+		 */
+		void save(const std::string& path, const ProgramEncoding encoding = ProgramEncoding::Packed) const;
+
+		ProgramImage(const ProgramImage&) = delete;
+		ProgramImage& operator=(const ProgramImage&) = delete;
+		~ProgramImage();
+
+		/**
+		 * \return Serialized code
+		 */
+		const uint8_t* code() const;
+
+		/**
+		 * \return Size of the serialized code in bytes
+		 */
+		size_t size() const;
+
+		/**
+		 * \return Pre-decoded program, one entry per instruction
+		 */
+		const DecodedInstruction* decoded() const;
+
+		/**
+		 * \return Number of instructions, and of entries of decoded()
+		 */
+		size_t count() const;
+
+		/**
+		 * \return Number of superinstructions in the pre-decoded program
+		 */
+		size_t fusions() const;
+
+		/**
+		 * \return Number of registers the program needs, one past the highest register operand of its valid
+		 *         instructions
+		 */
+		size_t register_span() const;
+
+		/**
+		 * \return Verification of the pre-decoded program, from the entry point
+		 */
+		const Verification& verification() const;
+
+		/**
+		 * \return Address of the first instruction to run
+		 */
+		vmreg_t entry() const;
+
+		/**
+		 * \return Initial value of sp
+		 */
+		vmreg_t initial_sp() const;
+
+		/**
+		 * \return File descriptor of the file holding the code, padded to whole pages, or -1 when the
+		 *         code can only be copied
+		 */
+		int fd() const;
+
+		/**
+		 * \return Offset of the code in fd(), a multiple of the page size
+		 */
+		uint64_t fd_offset() const;
+
+	private:
+		friend class ProgramCache;
+
+		ProgramImage();
+
+		/**
+		 * Allocates storage for _size bytes of code, in a memory file where the platform allows it.
+		 * \return Writable storage, to pass to seal() once the code is written
+		 */
+		uint8_t* allocate();
+
+		/**
+		 * Makes the code written to the storage returned by allocate() read-only, and points _code to it.
+		 * \param code Storage returned by allocate()
+		 */
+		void seal(uint8_t* code);
+
+		/**
+		 * Builds the code from the aligned code of a program file, then translates it.
+		 * \param header Header of the program file
+		 * \param encoded Aligned code
+		 * \param path Path of the program file, for diagnostics
+		 * \param verify Whether to check the aligned code against the checksum of the header
+		 */
+		void expand(const ProgramFileHeader& header, const std::vector<uint8_t>& encoded, const std::string& path,
+					const bool verify);
+
+		/**
+		 * Builds the pre-decoded program from the code, and verifies it.
+		 */
+		void translate();
+
+		/**
+		 * Maps the translation of a translated program file, once the code is.
+		 * \param header Header of the program file
+		 * \param file_size Size of the program file
+		 * \param path Path of the program file, for diagnostics
+		 * \param verify Whether to check the translation against its checksum
+		 * \param trusted Whether to restore the verification rather than verifying the program again
+		 * \return false if the translation was written on a host with another layout, the code having to be
+		 *         translated again
+		 */
+		bool map_translation(const ProgramFileHeader& header, const uint64_t file_size, const std::string& path,
+							 const bool verify, const bool trusted);
+
+		/**
+		 * Writes the translation of a translated program file.
+		 * \param out Program file, at the offset of the translation
+		 */
+		void save_translation(std::ostream& out) const;
+
+		const uint8_t* _code;
+		size_t _size;
+
+		/**
+		 * Size of the read-only mapping of _fd pointed by _code, 0 if _code points to _copy
+		 */
+		size_t _mapped_size;
+		int _fd;
+		uint64_t _fd_offset;
+
+		vmreg_t _entry;
+		vmreg_t _initial_sp;
+
+		/**
+		 * Code storage where memory files are not available
+		 */
+		std::vector<uint8_t> _copy;
+
+		/**
+		 * Pre-decoded program, pointing to _decoded_copy or into _translation
+		 */
+		const DecodedInstruction* _decoded;
+
+		/**
+		 * Pre-decoded program built by translate()
+		 */
+		std::vector<DecodedInstruction> _decoded_copy;
+
+		/**
+		 * Read-only mapping of the translation of a translated program file or of a cache entry, nullptr if none
+		 */
+		const uint8_t* _translation;
+		size_t _translation_size;
+
+		size_t _fusions;
+		size_t _register_span;
+
+		Verification _verification;
+	};
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include <array>
+#include <string>
+#include "instruction.hpp"
+
+namespace thallium
+{
+	const std::array<std::string, static_cast<size_t>(Opcode::_total)> opcode_match =
+	{
+		{"mov", "imm", "mget", "mset", "teq", "tgt", "tlt", "cjmp", "cjmpr", "call", "callr", "sbit", "gbit",
+		 "shr", "shl", "inc", "dec", "uadd", "usub", "umul", "udiv", "umod", "push", "pop", "exit",
+		 "mcpy", "mfill", "mcmp", "mfind", "vadd", "vxor", "vsum", "hcall", "fspawn", "fyield", "fjoin",
+		 "acas", "aadd", "axchg", "fence"}
+	};
+
+	std::string opcode_string(const Opcode op)
+	{
+		const size_t index = static_cast<size_t>(op);
+		return index < opcode_match.size() ? opcode_match[index] : "invalid";
+	}
+
+	void serialize_instructions(const Instruction* instructions, const size_t count, uint8_t* out)
+	{
+		for (size_t i = 0; i < count; ++i, out += Instruction::size())
+		{
+			out[0] = static_cast<uint8_t>(instructions[i].opcode);
+			serialize_type(instructions[i].argument, out + 1);
+		}
+	}
+
+	void deserialize_instructions(const uint8_t* code, const size_t count, Instruction* out)
+	{
+		for (size_t i = 0; i < count; ++i, code += Instruction::size())
+		{
+			out[i].opcode = static_cast<Opcode>(code[0]);
+			out[i].argument = deserialize_type<uint64_t>(code + 1);
+		}
+	}
+}
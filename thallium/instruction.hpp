@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <array>
+#include <string>
 #include "serializer.hpp"
 
 namespace thallium
@@ -148,7 +149,7 @@ namespace thallium
 		/**
 		 * <code>shr rsrc rdst roff</code>
 		 *
-		 * bitshifts rsrc by roff bits to the right and stores the result in rdst
+		 * bitshifts rsrc by roff bits to the right and stores the result in rdst, roff being taken modulo 32
 		 * <i>argument</i>:<br>
 		 * - 0..15 : source register
 		 * - 16..31 : destination register
@@ -159,7 +160,7 @@ namespace thallium
 		/**
 		 * <code>shl rsrc rdst roff</code>
 		 *
-		 * bitshifts rsrc by roff bits to the left and stores the result in rdst
+		 * bitshifts rsrc by roff bits to the left and stores the result in rdst, roff being taken modulo 32
 		 * <i>argument</i>:<br>
 		 * - 0..15 : source register
 		 * - 16..31 : destination register
@@ -271,9 +272,220 @@ namespace thallium
 		  */
 		pop = 23,
 
-		__PLACEHOLDER_EXIT
+		__PLACEHOLDER_EXIT,
+
+		// Bulk memory instructions, working on whole ranges at once.
+		// A range which does not fit in memory traps with TrapCode::MemoryOutOfBounds before anything is done,
+		// whatever the memory mode. Empty ranges do nothing. Words are 32-bit little-endian values and do not
+		// need to be aligned.
+
+		/**
+		 * <code>mcpy rdst rsrc rlen</code>
+		 *
+		 * copies rlen bytes from the address in rsrc to the address in rdst, the ranges may overlap<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : destination address register<br>
+		 * - 16..31 : source address register<br>
+		 * - 32..47 : length register, in bytes
+		 */
+		mcpy = 25,
+
+		/**
+		 * <code>mfill rdst rval rlen</code>
+		 *
+		 * sets rlen bytes from the address in rdst to the low byte of rval<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : destination address register<br>
+		 * - 16..31 : value register<br>
+		 * - 32..47 : length register, in bytes
+		 */
+		mfill = 26,
+
+		/**
+		 * <code>mcmp r1 r2 rlen rdst</code>
+		 *
+		 * compares rlen bytes from the addresses in r1 and r2<br>
+		 * stores the offset of the first differing byte in rdst, or rlen if there is none, and sets the TEST flag
+		 * if the ranges are equal<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : address register #1<br>
+		 * - 16..31 : address register #2<br>
+		 * - 32..47 : length register, in bytes<br>
+		 * - 48..63 : destination register
+		 */
+		mcmp = 27,
+
+		/**
+		 * <code>mfind raddr rval rlen rdst</code>
+		 *
+		 * searches rlen bytes from the address in raddr for the low byte of rval<br>
+		 * stores the offset of its first occurrence in rdst, or rlen if there is none, and sets the TEST flag if
+		 * it was found<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : address register<br>
+		 * - 16..31 : value register<br>
+		 * - 32..47 : length register, in bytes<br>
+		 * - 48..63 : destination register
+		 */
+		mfind = 28,
+
+		/**
+		 * <code>vadd rdst rsrc rcount</code>
+		 *
+		 * adds rcount words from the address in rsrc to the ones at the address in rdst, element-wise<br>
+		 * overlapping ranges behave as if every source word was read before any was written<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : destination address register<br>
+		 * - 16..31 : source address register<br>
+		 * - 32..47 : word count register
+		 */
+		vadd = 29,
+
+		/**
+		 * <code>vxor rdst rsrc rcount</code>
+		 *
+		 * exclusive-ors rcount words from the address in rsrc into the ones at the address in rdst, element-wise<br>
+		 * overlapping ranges behave as for vadd<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : destination address register<br>
+		 * - 16..31 : source address register<br>
+		 * - 32..47 : word count register
+		 */
+		vxor = 30,
+
+		/**
+		 * <code>vsum raddr rcount rdst</code>
+		 *
+		 * sums rcount words from the address in raddr and stores the result in rdst<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : address register<br>
+		 * - 16..31 : word count register<br>
+		 * - 32..47 : destination register
+		 */
+		vsum = 31,
+
+		/**
+		 * <code>hcall i rbase</code>
+		 *
+		 * calls the host function bound to id i, see BasicVM::bind<br>
+		 * the function reads its arguments from and writes its results to the registers from rbase on, as many as
+		 * it was bound with, and may access memory ranges through bounds-checked views. Batches of work are passed
+		 * as the address and count of an array of records in memory, so that one call handles all of them.<br>
+		 * traps with TrapCode::HostCallFailed if no function is bound to i, if its registers do not fit in the
+		 * general purpose registers, or if it fails, and with TrapCode::MemoryOutOfBounds if it asked for a range
+		 * which does not fit in memory<br>
+		 * <i>argument</i>:<br>
+		 * - 0..31 : host function id<br>
+		 * - 32..47 : base register
+		 */
+		hcall = 32,
+
+		// Fibers: lightweight threads of the program, sharing its memory and switched cooperatively.
+		// The fiber running when the first one is spawned is the main fiber, of id 0, and its exit ends the program.
+		// Each fiber has its own copy of the registers the program names, which a fiber switch hands over without
+		// copying them, see BasicVM::set_fiber_threads for running fibers on several host threads.
+
+		/**
+		 * <code>fspawn rentry rsp rdst</code>
+		 *
+		 * creates a fiber starting at the address in rentry, with sp set to rsp, fl cleared and every other
+		 * register copied from the spawning fiber, stores its id in rdst of both fibers and appends it to the
+		 * ready fibers<br>
+		 * stacks are regions of memory the program sets aside, one per fiber<br>
+		 * traps with TrapCode::FiberFailed if FiberScheduler::max_fibers() fibers already exist<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : entry point register<br>
+		 * - 16..31 : stack pointer register<br>
+		 * - 32..47 : destination register
+		 */
+		fspawn = 33,
+
+		/**
+		 * <code>fyield</code>
+		 *
+		 * appends the running fiber to the ready fibers and switches to the first one, doing nothing if none is
+		 * ready
+		 */
+		fyield = 34,
+
+		/**
+		 * <code>fjoin rid</code>
+		 *
+		 * waits for the fiber whose id is in rid to exit, switching to the first ready fiber meanwhile, then frees
+		 * its id<br>
+		 * the exit of a fiber other than the main one switches to the first ready fiber. Fibers which exited keep
+		 * their id until they are joined, and each fiber may only be joined once.<br>
+		 * traps with TrapCode::FiberFailed if rid is not the id of another fiber, if that fiber is already being
+		 * joined, or if no fiber could ever run again<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : fiber id register
+		 */
+		fjoin = 35,
+
+		// Atomic instructions, on a 32-bit little-endian word of memory, for fibers running on several host threads.
+		// The address must be a multiple of 4, otherwise the instruction traps with TrapCode::UnalignedAtomic, and the
+		// word must fit in memory, otherwise it traps with TrapCode::MemoryOutOfBounds, whatever the memory mode.
+		//
+		// Memory model: atomic instructions and fence are sequentially consistent, they take effect in a single
+		// order all threads agree on, which keeps the order of the instructions of each fiber. Other memory
+		// accesses are plain ones: a plain write is seen by a fiber of another thread once the writing fiber
+		// executed an atomic instruction or fence after it, and the reading fiber saw the effect of that atomic
+		// instruction, or of a later one, with an atomic instruction before its read. Plain accesses racing with a
+		// write of another thread may see part of the write. Fiber switches also order memory, see FiberScheduler.
+		// A fiber runs until it switches, so loops waiting for another fiber should fyield, which may need the
+		// thread to run.
+
+		/**
+		 * <code>acas raddr rexp rnew</code>
+		 *
+		 * compares the word at the address in raddr with rexp, and replaces it with rnew if they are equal<br>
+		 * stores the word read in rexp, and sets the TEST flag if it was replaced<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : address register<br>
+		 * - 16..31 : expected value register, receiving the word read<br>
+		 * - 32..47 : new value register
+		 */
+		acas = 36,
+
+		/**
+		 * <code>aadd raddr rval rdst</code>
+		 *
+		 * adds rval to the word at the address in raddr, and stores the word read before in rdst<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : address register<br>
+		 * - 16..31 : value register<br>
+		 * - 32..47 : destination register
+		 */
+		aadd = 37,
+
+		/**
+		 * <code>axchg raddr rval rdst</code>
+		 *
+		 * replaces the word at the address in raddr with rval, and stores the word read before in rdst<br>
+		 * <i>argument</i>:<br>
+		 * - 0..15 : address register<br>
+		 * - 16..31 : value register<br>
+		 * - 32..47 : destination register
+		 */
+		axchg = 38,
+
+		/**
+		 * <code>fence</code>
+		 *
+		 * orders the memory accesses of the fiber before it with those after it, as an atomic instruction would
+		 */
+		fence = 39,
+
+		_total
 	};
 
+	/**
+	 * Returns the mnemonic of an opcode
+	 * \param op Opcode
+	 * \return Opcode mnemonic, or "invalid"
+	 */
+	std::string opcode_string(const Opcode op);
+
 	/**
 	 * Structure which holds a Thallium instruction
 	 *
@@ -311,11 +523,27 @@ namespace thallium
 		auto serialize() const
 		{
 			std::array<uint8_t, size()> serialized;
-			serialize_type(static_cast<uint8_t>(opcode), begin(serialized));
-			serialize_type(argument, begin(serialized) + 1);
+			serialized[0] = static_cast<uint8_t>(opcode);
+			serialize_type(argument, serialized.data() + 1);
 			return serialized;
 		}
 	};
+
+	/**
+	 * Serializes consecutive instructions, as laid out in VM memory
+	 * \param instructions First instruction
+	 * \param count Number of instructions
+	 * \param out Destination of the count * Instruction::size() bytes
+	 */
+	void serialize_instructions(const Instruction* instructions, const size_t count, uint8_t* out);
+
+	/**
+	 * Deserializes consecutive instructions, as laid out in VM memory
+	 * \param code First serialized instruction
+	 * \param count Number of instructions
+	 * \param out Destination of the count instructions
+	 */
+	void deserialize_instructions(const uint8_t* code, const size_t count, Instruction* out);
 }
 
 #endif
@@ -0,0 +1,591 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "jit.hpp"
+#include "error.hpp"
+#include "instruction.hpp"
+
+#ifdef THALLIUM_HAS_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace thallium
+{
+#ifdef THALLIUM_HAS_JIT
+	// x86-64 registers used by the compiled code.
+	// rdi holds the register storage, rsi the VM memory and r8 the fuel counter for the whole lifetime of the block.
+	const uint8_t eax = 0, ecx = 1, edx = 2;
+
+	// Entry prologue of every block, skipped by chained jumps: mov r8, rdx
+	const uint8_t block_prologue[] = {0x49, 0x89, 0xD0};
+
+	// Instructions per block before it gets split, so the worst case block size is known in advance
+	const size_t max_block_instructions = 128;
+	const size_t max_instruction_bytes = 64;
+
+	// Shared epilogue at the beginning of the buffer: xor eax, eax ; ret
+	const uint8_t epilogue[] = {0x31, 0xC0, 0xC3};
+
+	/**
+	 * Makes a code buffer without a separate writable view writable for its lifetime, and executable again
+	 * afterwards, even if compiling throws.
+	 */
+	struct WritableBuffer
+	{
+		WritableBuffer(uint8_t* code, const uint8_t* writable, const size_t size) :
+			buffer(code == writable ? code : nullptr),
+			capacity(size)
+		{
+			tassert(buffer == nullptr || mprotect(buffer, capacity, PROT_READ | PROT_WRITE) == 0,
+					TimeOfError::Runtime, ErrorType::Internal,
+					"could not make the JIT code buffer writable.");
+		}
+
+		~WritableBuffer()
+		{
+			if (buffer != nullptr)
+				mprotect(buffer, capacity, PROT_READ | PROT_EXEC);
+		}
+
+		uint8_t* buffer;
+		size_t capacity;
+	};
+
+	// Superinstructions are compiled as the individual instructions they are made of
+	DecodedInstruction unfused_at(const DecodedInstruction* code, const size_t slot)
+	{
+		DecodedInstruction d = code[slot];
+		d.op = unfused(d.op);
+		return d;
+	}
+
+	Jit::Jit(const size_t capacity) :
+		_buffer(nullptr),
+		_writable(nullptr),
+		_capacity(capacity),
+		_used(0),
+		_code_end(0)
+	{
+#ifdef __linux__
+		// the code is written through a view of a memory file and run from another one, so that no page is ever
+		// both writable and executable, without changing protections on every compilation
+		const int fd = memfd_create("thallium-jit", MFD_CLOEXEC);
+		if (fd >= 0)
+		{
+			void* writable = MAP_FAILED;
+			void* executable = MAP_FAILED;
+
+			if (ftruncate(fd, static_cast<off_t>(_capacity)) == 0)
+			{
+				writable = mmap(nullptr, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				executable = mmap(nullptr, _capacity, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+			}
+
+			if (writable != MAP_FAILED && executable != MAP_FAILED)
+			{
+				_writable = static_cast<uint8_t*>(writable);
+				_buffer = static_cast<uint8_t*>(executable);
+			}
+			else
+			{
+				if (writable != MAP_FAILED)
+					munmap(writable, _capacity);
+				if (executable != MAP_FAILED)
+					munmap(executable, _capacity);
+			}
+
+			// the mappings keep the file alive
+			close(fd);
+		}
+#endif
+
+		// otherwise the buffer is only made writable, and not executable, while it is written to
+		if (_buffer == nullptr)
+		{
+			void* buffer = mmap(nullptr, _capacity, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			tassert(buffer != MAP_FAILED,
+					TimeOfError::Preload, ErrorType::Internal,
+					"could not map the JIT code buffer.");
+
+			_buffer = static_cast<uint8_t*>(buffer);
+			_writable = _buffer;
+		}
+
+		// the epilogue stays in place across flushes
+		{
+			const WritableBuffer writable{_buffer, _writable, _capacity};
+			std::memcpy(_writable, epilogue, sizeof(epilogue));
+		}
+
+		flush();
+	}
+
+	Jit::~Jit()
+	{
+		if (_writable != _buffer)
+			munmap(_writable, _capacity);
+
+		munmap(_buffer, _capacity);
+	}
+
+	Jit::Block Jit::block(const vmreg_t address, const DecodedInstruction* code, const size_t code_size, const size_t register_count)
+	{
+		const auto it = _blocks.find(address);
+		if (it != end(_blocks))
+			return it->second;
+
+		const size_t worst_case = (max_block_instructions + 2) * max_instruction_bytes;
+		if (_capacity - _used < worst_case)
+			flush();
+
+		// compiling a block also patches the jumps of the blocks waiting for it
+		const WritableBuffer writable{_buffer, _writable, _capacity};
+		return compile(address, code, code_size, register_count);
+	}
+
+	void Jit::flush()
+	{
+		_used = sizeof(epilogue);
+
+		_blocks.clear();
+		_pending_links.clear();
+		_instruction_starts.clear();
+	}
+
+	bool Jit::guest_address(const void* pc, vmreg_t& address) const
+	{
+		const uint8_t* native = static_cast<const uint8_t*>(pc);
+		if (native < _buffer || native >= _buffer + _used)
+			return false;
+
+		const size_t offset = native - _buffer;
+		const auto it = std::upper_bound(begin(_instruction_starts), end(_instruction_starts), offset,
+										 [](const size_t o, const std::pair<size_t, vmreg_t>& start) { return o < start.first; });
+		if (it == begin(_instruction_starts))
+			return false;
+
+		address = std::prev(it)->second;
+		return true;
+	}
+
+	Jit::Block Jit::compile(const vmreg_t address, const DecodedInstruction* code, const size_t code_size, const size_t register_count)
+	{
+		_code_end = code_size * Instruction::size();
+
+		const size_t first_slot = address / Instruction::size();
+		if (first_slot >= code_size || first_slot * Instruction::size() != address)
+			return nullptr;
+
+		// stale entries have to go through the interpreter first, they may be compilable afterwards
+		if (code[first_slot].op == DecodedOp::stale)
+			return nullptr;
+
+		if (!compilable(unfused_at(code, first_slot), register_count))
+		{
+			_blocks[address] = nullptr;
+			return nullptr;
+		}
+
+		const Block block = reinterpret_cast<Block>(_buffer + _used);
+		_blocks[address] = block;
+
+		for (const uint8_t b : block_prologue)
+		{
+			emit8(b);
+		}
+
+		// chained jumps land here, right before the fuel check
+		const size_t entry = _used;
+
+		emit8(0x49); emit8(0x83); emit8(0x38); emit8(0); // cmp qword [r8], 0
+		emit8(0x0F); emit8(0x8E); // jle out_of_fuel
+		_stubs.push_back(Stub{_used, address, Exit::OutOfFuel});
+		emit32(0);
+		emit8(0x49); emit8(0x81); emit8(0x28); // sub qword [r8], length
+		const size_t length = _used;
+		emit32(0);
+
+		// instructions of the block, including its terminating branch
+		size_t count = 0;
+
+		vmreg_t ip = address;
+		for (size_t slot = first_slot;; ++slot, ++count, ip += Instruction::size())
+		{
+			if (slot >= code_size || count >= max_block_instructions || !compilable(unfused_at(code, slot), register_count))
+			{
+				emit_exit(ip);
+				break;
+			}
+
+			const DecodedInstruction d = unfused_at(code, slot);
+			const vmreg_t next = ip + Instruction::size();
+			_instruction_starts.emplace_back(_used, ip);
+
+			if (d.op == DecodedOp::cjmp || d.op == DecodedOp::cjmpr || d.op == DecodedOp::call || d.op == DecodedOp::callr)
+				++count;
+
+			if (d.op == DecodedOp::cjmp)
+			{
+				if (d.imm == ip)
+				{
+					// jumping to itself is the same as not jumping
+					emit_exit(next);
+					break;
+				}
+
+				emit_guest_modrm({0xF6}, 0, static_cast<size_t>(SPRegisters::fl)); // test byte [fl], 1
+				emit8(1);
+				emit8(0x0F); emit8(0x84); // jz not_taken
+				const size_t not_taken = _used;
+				emit32(0);
+				emit_exit(d.imm);
+				patch32(not_taken, static_cast<uint32_t>(_used - (not_taken + 4)));
+				emit_exit(next);
+				break;
+			}
+
+			if (d.op == DecodedOp::cjmpr)
+			{
+				emit_guest_modrm({0xF6}, 0, static_cast<size_t>(SPRegisters::fl)); // test byte [fl], 1
+				emit8(1);
+				emit8(0x0F); emit8(0x84); // jz not_taken
+				const size_t not_taken = _used;
+				emit32(0);
+				emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+				emit8(0x3D); emit32(ip); // cmp eax, ip
+				emit8(0x0F); emit8(0x84); // je not_taken
+				const size_t self_jump = _used;
+				emit32(0);
+				emit8(0x89); emit8(0x07); // mov [rdi], eax
+				emit8(0x31); emit8(0xC0); // xor eax, eax
+				emit8(0xC3); // ret
+				patch32(not_taken, static_cast<uint32_t>(_used - (not_taken + 4)));
+				patch32(self_jump, static_cast<uint32_t>(_used - (self_jump + 4)));
+				emit_exit(next);
+				break;
+			}
+
+			if (d.op == DecodedOp::call || d.op == DecodedOp::callr)
+			{
+				// push the return address
+				emit_guest_modrm({0x8B}, eax, static_cast<size_t>(SPRegisters::sp)); // mov eax, [sp]
+				emit8(0x83); emit8(0xC0); emit8(sizeof(vmreg_t)); // add eax, 4
+				emit_code_write_check(ip);
+				emit_guest_modrm({0x89}, eax, static_cast<size_t>(SPRegisters::sp)); // mov [sp], eax
+				emit8(0xC7); emit8(0x04); emit8(0x06); emit32(next); // mov dword [rsi + rax], next
+
+				if (d.op == DecodedOp::call)
+				{
+					emit_exit(d.imm == ip ? next : d.imm);
+					break;
+				}
+
+				emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+				emit8(0x3D); emit32(ip); // cmp eax, ip
+				emit8(0x0F); emit8(0x84); // je self_call
+				const size_t self_call = _used;
+				emit32(0);
+				emit8(0x89); emit8(0x07); // mov [rdi], eax
+				emit8(0x31); emit8(0xC0); // xor eax, eax
+				emit8(0xC3); // ret
+				patch32(self_call, static_cast<uint32_t>(_used - (self_call + 4)));
+				emit_exit(next);
+				break;
+			}
+
+			emit_instruction(d, ip);
+		}
+
+		patch32(length, static_cast<uint32_t>(count));
+		emit_stubs();
+
+		// resolve the blocks which were waiting for this one
+		const auto links = _pending_links.equal_range(address);
+		for (auto it = links.first; it != links.second; ++it)
+		{
+			patch32(it->second, static_cast<uint32_t>(entry - (it->second + 4)));
+		}
+		_pending_links.erase(address);
+
+		return block;
+	}
+
+	bool Jit::compilable(const DecodedInstruction& d, const size_t register_count) const
+	{
+		// ip may not be read nor written by native code, as it is only kept up to date on block exits
+		const auto reg = [register_count](const uint16_t r) {
+			return r != static_cast<uint16_t>(SPRegisters::ip) && r < register_count;
+		};
+
+		switch (d.op)
+		{
+		case DecodedOp::cjmp:
+		case DecodedOp::call:
+			return true;
+
+		case DecodedOp::imm:
+			return reg(d.b);
+
+		case DecodedOp::cjmpr:
+		case DecodedOp::callr:
+		case DecodedOp::sbit:
+		case DecodedOp::inc:
+		case DecodedOp::dec:
+		case DecodedOp::push:
+		case DecodedOp::pop:
+			return reg(d.a);
+
+		case DecodedOp::mov:
+		case DecodedOp::mget:
+		case DecodedOp::mset:
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+		case DecodedOp::gbit:
+			return reg(d.a) && reg(d.b);
+
+		case DecodedOp::shr:
+		case DecodedOp::shl:
+		case DecodedOp::uadd:
+		case DecodedOp::usub:
+		case DecodedOp::umul:
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+			return reg(d.a) && reg(d.b) && reg(d.c);
+
+		default:
+			return false;
+		}
+	}
+
+	void Jit::emit_instruction(const DecodedInstruction& d, const vmreg_t address)
+	{
+		const size_t fl = static_cast<size_t>(SPRegisters::fl);
+		const size_t sp = static_cast<size_t>(SPRegisters::sp);
+
+		switch (d.op)
+		{
+		case DecodedOp::mov:
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit_guest_modrm({0x89}, eax, d.b); // mov [b], eax
+			break;
+
+		case DecodedOp::imm:
+			emit_guest_modrm({0xC7}, 0, d.b); // mov dword [b], imm
+			emit32(d.imm);
+			break;
+
+		case DecodedOp::mget:
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit8(0x8B); emit8(0x04); emit8(0x06); // mov eax, [rsi + rax]
+			emit_guest_modrm({0x89}, eax, d.b); // mov [b], eax
+			break;
+
+		case DecodedOp::mset:
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit_code_write_check(address);
+			emit_guest_modrm({0x8B}, ecx, d.b); // mov ecx, [b]
+			emit8(0x89); emit8(0x0C); emit8(0x06); // mov [rsi + rax], ecx
+			break;
+
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt: {
+			const uint8_t setcc = d.op == DecodedOp::teq ? 0x94 : d.op == DecodedOp::tgt ? 0x97 : 0x92;
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit_guest_modrm({0x3B}, eax, d.b); // cmp eax, [b]
+			emit8(0x0F); emit8(setcc); emit8(0xC0); // sete / seta / setb al
+			emit8(0x0F); emit8(0xB6); emit8(0xC0); // movzx eax, al
+			emit_guest_modrm({0x89}, eax, fl); // mov [fl], eax
+		} break;
+
+		case DecodedOp::sbit:
+			if (d.c)
+			{
+				emit_guest_modrm({0x81}, 1, d.a); // or dword [a], mask
+				emit32(1u << d.b);
+			}
+			else
+			{
+				emit_guest_modrm({0x81}, 4, d.a); // and dword [a], ~mask
+				emit32(~(1u << d.b));
+			}
+			break;
+
+		case DecodedOp::gbit:
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit8(0xC1); emit8(0xE8); emit8(static_cast<uint8_t>(d.c)); // shr eax, c
+			emit8(0x83); emit8(0xE0); emit8(0x01); // and eax, 1
+			emit_guest_modrm({0x89}, eax, d.b); // mov [b], eax
+			break;
+
+		case DecodedOp::shr:
+		case DecodedOp::shl:
+			emit_guest_modrm({0x8B}, ecx, d.c); // mov ecx, [c]
+			emit8(0x83); emit8(0xE1); emit8(0x1F); // and ecx, 31, as the shift amount is taken modulo 32
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit8(0xD3); emit8(d.op == DecodedOp::shr ? 0xE8 : 0xE0); // shr / shl eax, cl
+			emit_guest_modrm({0x89}, eax, d.b); // mov [b], eax
+			break;
+
+		case DecodedOp::inc:
+			emit_guest_modrm({0x83}, 0, d.a); // add dword [a], 1
+			emit8(1);
+			break;
+
+		case DecodedOp::dec:
+			emit_guest_modrm({0x83}, 5, d.a); // sub dword [a], 1
+			emit8(1);
+			break;
+
+		case DecodedOp::uadd:
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit_guest_modrm({0x03}, eax, d.b); // add eax, [b]
+			emit_guest_modrm({0x89}, eax, d.c); // mov [c], eax
+			break;
+
+		case DecodedOp::usub:
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit_guest_modrm({0x2B}, eax, d.b); // sub eax, [b]
+			emit_guest_modrm({0x89}, eax, d.c); // mov [c], eax
+			break;
+
+		case DecodedOp::umul:
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit_guest_modrm({0x0F, 0xAF}, eax, d.b); // imul eax, [b]
+			emit_guest_modrm({0x89}, eax, d.c); // mov [c], eax
+			break;
+
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+			emit_guest_modrm({0x8B}, ecx, d.b); // mov ecx, [b]
+			emit8(0x85); emit8(0xC9); // test ecx, ecx
+			emit8(0x74); emit8(16); // jz past the store
+			emit_guest_modrm({0x8B}, eax, d.a); // mov eax, [a]
+			emit8(0x31); emit8(0xD2); // xor edx, edx
+			emit8(0xF7); emit8(0xF1); // div ecx
+			emit_guest_modrm({0x89}, d.op == DecodedOp::udiv ? eax : edx, d.c); // mov [c], eax / edx
+			break;
+
+		case DecodedOp::push:
+			emit_guest_modrm({0x8B}, eax, sp); // mov eax, [sp]
+			emit8(0x83); emit8(0xC0); emit8(sizeof(vmreg_t)); // add eax, 4
+			emit_code_write_check(address);
+			emit_guest_modrm({0x89}, eax, sp); // mov [sp], eax
+			emit_guest_modrm({0x8B}, ecx, d.a); // mov ecx, [a]
+			emit8(0x89); emit8(0x0C); emit8(0x06); // mov [rsi + rax], ecx
+			break;
+
+		case DecodedOp::pop:
+			emit_guest_modrm({0x8B}, eax, sp); // mov eax, [sp]
+			emit8(0x8B); emit8(0x04); emit8(0x06); // mov eax, [rsi + rax]
+			emit_guest_modrm({0x89}, eax, d.a); // mov [a], eax
+			emit_guest_modrm({0x83}, 5, sp); // sub dword [sp], 4
+			emit8(sizeof(vmreg_t));
+			break;
+
+		default:
+			error(TimeOfError::Runtime, ErrorType::Internal, "the JIT tried to compile an unsupported instruction.");
+		}
+	}
+
+	void Jit::emit_exit(const vmreg_t target)
+	{
+		emit8(0xC7); emit8(0x07); emit32(target); // mov dword [rdi], target
+		emit8(0xE9); // jmp rel32
+		const size_t link = _used;
+		emit32(0);
+
+		const auto it = _blocks.find(target);
+		if (it != end(_blocks) && it->second != nullptr)
+		{
+			const size_t target_entry = reinterpret_cast<uint8_t*>(it->second) - _buffer + sizeof(block_prologue);
+			patch32(link, static_cast<uint32_t>(target_entry - (link + 4)));
+		}
+		else
+		{
+			// go back to the VM through the epilogue until the target gets compiled
+			patch32(link, static_cast<uint32_t>(0 - (link + 4)));
+
+			if (it == end(_blocks))
+				_pending_links.emplace(target, link);
+		}
+	}
+
+	void Jit::emit_code_write_check(const vmreg_t address)
+	{
+		if (_code_end == 0)
+			return;
+
+		emit8(0x3D); emit32(static_cast<uint32_t>(_code_end)); // cmp eax, code_end
+		emit8(0x0F); emit8(0x82); // jb stub
+		_stubs.push_back(Stub{_used, address, Exit::Interpret});
+		emit32(0);
+	}
+
+	void Jit::emit_stubs()
+	{
+		for (const Stub& stub : _stubs)
+		{
+			patch32(stub.link, static_cast<uint32_t>(_used - (stub.link + 4)));
+			emit8(0xC7); emit8(0x07); emit32(stub.address); // mov dword [rdi], address
+			emit8(0xB8); emit32(static_cast<uint32_t>(stub.exit)); // mov eax, exit
+			emit8(0xC3); // ret
+		}
+
+		_stubs.clear();
+	}
+
+	void Jit::emit8(const uint8_t v)
+	{
+		_writable[_used++] = v;
+	}
+
+	void Jit::emit32(const uint32_t v)
+	{
+		serialize_type(v, _writable + _used);
+		_used += sizeof(v);
+	}
+
+	void Jit::patch32(const size_t offset, const uint32_t v)
+	{
+		serialize_type(v, _writable + offset);
+	}
+
+	void Jit::emit_guest_modrm(std::initializer_list<uint8_t> opcode, const uint8_t reg, const size_t guest)
+	{
+		for (const uint8_t b : opcode)
+		{
+			emit8(b);
+		}
+
+		// mod = 10 (disp32), rm = 111 (rdi)
+		emit8(static_cast<uint8_t>(0x80 | (reg << 3) | 0x07));
+		emit32(static_cast<uint32_t>(guest * sizeof(vmreg_t)));
+	}
+#else
+	Jit::Jit(const size_t capacity) :
+		_buffer(nullptr),
+		_writable(nullptr),
+		_capacity(capacity),
+		_used(0),
+		_code_end(0)
+	{}
+
+	Jit::~Jit() {}
+
+	Jit::Block Jit::block(const vmreg_t, const DecodedInstruction*, const size_t, const size_t)
+	{
+		return nullptr;
+	}
+
+	void Jit::flush() {}
+
+	bool Jit::guest_address(const void*, vmreg_t&) const
+	{
+		return false;
+	}
+#endif
+}
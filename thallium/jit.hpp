@@ -0,0 +1,210 @@
+#ifndef THALLIUMVM_JIT_HPP
+#define THALLIUMVM_JIT_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+#include <unordered_map>
+#include <vector>
+#include "decoded.hpp"
+#include "register.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define THALLIUM_HAS_JIT 1
+#endif
+
+namespace thallium
+{
+	/**
+	 * x86-64 just-in-time compiler for ThalliumVM basic blocks.
+	 *
+	 * Blocks are compiled from the pre-decoded program and end on cjmp, cjmpr, call and callr, or right before
+	 * an instruction the JIT cannot run natively (exit, bulk memory instructions, invalid instructions, anything
+	 * touching ip).<br>
+	 * Compiled code works directly on the Registers storage and on the VM memory. Blocks jumping to a known
+	 * address are chained directly to the compiled target, and patched in when the target gets compiled later.
+	 *
+	 * Stores that would land in the code region are not performed natively: the block returns Exit::Interpret
+	 * so the interpreter executes that instruction, which invalidates the decoded program and flushes the JIT.
+	 *
+	 * Every block entry, chained or not, charges the length of the block to the fuel counter, and returns
+	 * Exit::OutOfFuel without executing anything once the counter is not positive anymore.
+	 *
+	 * No page of the code buffer is ever writable and executable at once: code is written through a writable view
+	 * of a memory file and run from an executable one, or, where memory files are not available, the buffer is
+	 * only made writable, and not executable, while a block is compiled.
+	 */
+	class Jit
+	{
+	public:
+		/**
+		 * Enum of the reasons for compiled code to return to the VM
+		 */
+		enum class Exit : uint32_t
+		{
+			/**
+			 * ip was updated and execution may continue from it
+			 */
+			Continue = 0,
+
+			/**
+			 * The instruction at ip has to be executed by the interpreter
+			 */
+			Interpret = 1,
+
+			/**
+			 * The fuel counter ran out before the block at ip
+			 */
+			OutOfFuel = 2
+		};
+
+		/**
+		 * Native entry point of a compiled block
+		 * \param registers Pointer to the register storage
+		 * \param memory Pointer to the VM memory
+		 * \param fuel Fuel counter, in instructions
+		 */
+		typedef Exit (*Block)(vmreg_t* registers, uint8_t* memory, int64_t* fuel);
+
+		/**
+		 * Jit constructor, which maps the executable code buffer.
+		 * \param capacity Size of the code buffer in bytes
+		 */
+		Jit(const size_t capacity = 16 * 1024 * 1024);
+		~Jit();
+
+		Jit(const Jit&) = delete;
+		Jit& operator=(const Jit&) = delete;
+
+		/**
+		 * Returns the compiled block starting at a given address, compiling it on the first request.
+		 * \param address Address of the first instruction of the block
+		 * \param code Pre-decoded program
+		 * \param code_size Number of instructions of the pre-decoded program
+		 * \param register_count Number of registers available, operands above it are never compiled
+		 * \return Native entry point, or nullptr if the instruction at address cannot be compiled
+		 */
+		Block block(const vmreg_t address, const DecodedInstruction* code, const size_t code_size, const size_t register_count);
+
+		/**
+		 * Throws away every compiled block.
+		 */
+		void flush();
+
+		/**
+		 * Finds the guest instruction a native instruction of compiled code belongs to.
+		 * \param pc Host instruction pointer
+		 * \param address Address of the guest instruction
+		 * \return false if pc is not in compiled code
+		 */
+		bool guest_address(const void* pc, vmreg_t& address) const;
+
+		/**
+		 * \return Whether the JIT is supported on this platform
+		 */
+		constexpr static bool available()
+		{
+#ifdef THALLIUM_HAS_JIT
+			return true;
+#else
+			return false;
+#endif
+		}
+
+	private:
+		/**
+		 * Compiles the block starting at a given address.
+		 * \return Native entry point, or nullptr if the first instruction cannot be compiled
+		 */
+		Block compile(const vmreg_t address, const DecodedInstruction* code, const size_t code_size, const size_t register_count);
+
+		/**
+		 * Determines whether an instruction can be compiled natively.
+		 */
+		bool compilable(const DecodedInstruction& d, const size_t register_count) const;
+
+		/**
+		 * Emits the native code of a non-terminating instruction.
+		 * \param address Address of the instruction
+		 */
+		void emit_instruction(const DecodedInstruction& d, const vmreg_t address);
+
+		/**
+		 * Emits a jump to the compiled block at target, going through the VM when it is not compiled yet.
+		 * ip is set to target either way.
+		 */
+		void emit_exit(const vmreg_t target);
+
+		/**
+		 * Emits a conditional branch to an out of line stub which returns Exit::Interpret for the instruction at
+		 * address, taken when eax is below the end of the code region.
+		 */
+		void emit_code_write_check(const vmreg_t address);
+
+		/**
+		 * Emits the out of line stubs requested by emit_code_write_check() and by the fuel check.
+		 */
+		void emit_stubs();
+
+		void emit8(const uint8_t v);
+		void emit32(const uint32_t v);
+		void patch32(const size_t offset, const uint32_t v);
+
+		/**
+		 * Emits an instruction of the form <code>op reg, [rdi + 4 * guest]</code> (or the reverse direction).
+		 * \param opcode x86 opcode bytes
+		 * \param reg x86 register or opcode extension of the ModRM byte
+		 * \param guest Guest register index
+		 */
+		void emit_guest_modrm(std::initializer_list<uint8_t> opcode, const uint8_t reg, const size_t guest);
+
+		/**
+		 * Executable view of the code buffer
+		 */
+		uint8_t* _buffer;
+
+		/**
+		 * Writable view of the code buffer, the same as _buffer when it has to be made writable to be written to
+		 */
+		uint8_t* _writable;
+
+		size_t _capacity;
+		size_t _used;
+
+		size_t _code_end;
+
+		std::unordered_map<vmreg_t, Block> _blocks;
+
+		/**
+		 * Locations of the rel32 jumps waiting for a block to be compiled, by target address
+		 */
+		std::unordered_multimap<vmreg_t, size_t> _pending_links;
+
+		/**
+		 * Out of line exit to emit at the end of the block being compiled
+		 */
+		struct Stub
+		{
+			/**
+			 * Location of the rel32 jumping to the stub
+			 */
+			size_t link;
+
+			/**
+			 * ip to return with
+			 */
+			vmreg_t address;
+
+			Exit exit;
+		};
+
+		std::vector<Stub> _stubs;
+
+		/**
+		 * Offset in the buffer and guest address of every compiled instruction, in emission order
+		 */
+		std::vector<std::pair<size_t, vmreg_t>> _instruction_starts;
+	};
+}
+
+#endif
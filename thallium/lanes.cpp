@@ -0,0 +1,7 @@
+#include "lanes.hpp"
+
+namespace thallium
+{
+	// the default lane count is compiled once here, see the extern declaration in lanes.hpp
+	template class LaneVM<>;
+}
@@ -0,0 +1,214 @@
+#ifndef THALLIUMVM_LANES_HPP
+#define THALLIUMVM_LANES_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "decoded.hpp"
+#include "image.hpp"
+#include "register.hpp"
+#include "trap.hpp"
+
+namespace thallium
+{
+	/**
+	 * Lockstep VM running one program over several independent lanes, each with its own registers and memory.
+	 *
+	 * A single instruction stream drives every lane: each instruction is dispatched once for the whole group of
+	 * lanes at its address, and registers are stored as one row of Lanes values per register so that arithmetic,
+	 * shifts and tests run over the lanes as vector loops.<br>
+	 * Lanes diverge when a jump does not go the same way for all of them. The lanes at the lowest address always
+	 * run first, the others waiting until the running group reaches them, so that lanes which went ahead on an
+	 * if/else or left a loop early are picked up again where control flow reconverges.
+	 *
+	 * Programs run as in a VM without checks (see VMConfig): the image has to be certified by the verifier, and a
+	 * lane which writes to the code region or jumps dynamically out of its safe blocks stops with
+	 * TrapCode::UncertifiedCode. Every memory access is checked, out of bounds ones stopping their lane with
+	 * TrapCode::MemoryOutOfBounds. There are no host functions nor fibers, lanes reaching hcall stop with
+	 * TrapCode::HostCallFailed and lanes reaching a fiber instruction with TrapCode::FiberFailed. Atomic
+	 * instructions only see the memory of their lane.
+	 * \param Lanes Number of lanes, at most 64
+	 */
+	template<size_t Lanes = 16>
+	class LaneVM
+	{
+		static_assert(Lanes > 0 && Lanes <= 64, "lane masks are 64-bit");
+
+	public:
+		/**
+		 * LaneVM constructor, which imports a program into the memory of every lane.
+		 * \param image Image of the program, which must be certified
+		 * \param memory_size Memory size of each lane in bytes
+		 */
+		LaneVM(std::shared_ptr<const ProgramImage> image, const size_t memory_size);
+
+		/**
+		 * \return Number of lanes
+		 */
+		constexpr static size_t lanes()
+		{
+			return Lanes;
+		}
+
+		/**
+		 * Restores every lane to the state right after construction: registers are cleared, memory past the
+		 * program is zeroed and every lane is ready to run again.
+		 */
+		void reset();
+
+		/**
+		 * \param lane Lane index
+		 * \param index Register index, below Registers::size()
+		 * \return Reference to the register of a lane
+		 */
+		vmreg_t& reg(const size_t lane, const size_t index);
+
+		/**
+		 * Copies bytes to the memory of a lane, past the code region.
+		 * \param lane Lane index
+		 * \param address Destination address
+		 * \param data Bytes to copy
+		 * \param size Number of bytes
+		 */
+		void write_memory(const size_t lane, const vmreg_t address, const uint8_t* data, const size_t size);
+
+		/**
+		 * \param lane Lane index
+		 * \return Memory of a lane, memory_size bytes
+		 */
+		const uint8_t* memory(const size_t lane) const;
+
+		/**
+		 * Stops a lane before the next run, for instance because there is no input for it.
+		 * \param lane Lane index
+		 * \param code Trap reported for the lane
+		 */
+		void stop(const size_t lane, const TrapCode code);
+
+		/**
+		 * Runs every lane which was not stopped until it exits or traps.
+		 */
+		void run();
+
+		/**
+		 * \param lane Lane index
+		 * \return Why the lane stopped
+		 */
+		const Trap& trap(const size_t lane) const;
+
+		/**
+		 * \return Number of instructions dispatched by the last run, each one counting once for all its lanes
+		 */
+		uint64_t dispatches() const;
+
+		/**
+		 * \return Number of instructions executed by the lanes during the last run
+		 */
+		uint64_t lane_instructions() const;
+
+	private:
+		/**
+		 * \return Mask of every lane
+		 */
+		constexpr static uint64_t all_lanes()
+		{
+			return Lanes == 64 ? ~uint64_t(0) : (uint64_t(1) << Lanes) - 1;
+		}
+
+		/**
+		 * \return Row of a register, holding its value in every lane
+		 */
+		vmreg_t* row(const size_t index);
+
+		/**
+		 * Stores a value computed per lane into a register row, for the lanes of a group.
+		 * \param group Mask of the lanes to write
+		 * \param dst Destination row
+		 * \param f Function of the lane index
+		 */
+		template<typename F>
+		void apply(const uint64_t group, vmreg_t* dst, F&& f);
+
+		/**
+		 * Executes one instruction for a group of lanes at the same address.
+		 * \param d Decoded instruction
+		 * \param pc Address of the instruction
+		 * \param group Mask of the lanes executing it, lanes which stop being removed from it
+		 * \return false if the instruction is a jump, the ip of every lane of the group being set, true if the
+		 *         group continues at the next instruction with its ip left to the caller
+		 */
+		bool execute(const DecodedInstruction& d, const vmreg_t pc, uint64_t& group);
+
+		/**
+		 * Executes a bulk memory instruction for one lane.
+		 * \return false if the lane stopped
+		 */
+		bool execute_bulk(const DecodedInstruction& d, const vmreg_t pc, const size_t lane);
+
+		/**
+		 * Executes an atomic instruction for one lane.
+		 * \return false if the lane stopped
+		 */
+		bool execute_atomic(const DecodedInstruction& d, const vmreg_t pc, const size_t lane);
+
+		/**
+		 * Checks a memory access of a lane, stopping it if the access is out of bounds or writes to the code.
+		 * \param lane Lane index
+		 * \param d Decoded instruction doing the access
+		 * \param pc Address of the instruction
+		 * \param address First address accessed
+		 * \param size Number of bytes accessed
+		 * \param write Whether the access writes
+		 * \return Whether the access may be done
+		 */
+		bool access(const size_t lane, const DecodedInstruction& d, const vmreg_t pc, const vmreg_t address,
+					const uint64_t size, const bool write);
+
+		/**
+		 * Stops a lane on a trap.
+		 * \param lane Lane index
+		 * \param code Trap code
+		 * \param opcode Opcode of the instruction at ip
+		 * \param ip Address the lane stopped at
+		 * \param address Faulting memory address, if any
+		 */
+		void stop_lane(const size_t lane, const TrapCode code, const uint8_t opcode, const vmreg_t ip,
+					   const uint64_t address);
+
+		/**
+		 * \return Memory of a lane
+		 */
+		uint8_t* lane_memory(const size_t lane);
+
+		std::shared_ptr<const ProgramImage> _image;
+		const DecodedInstruction* _decoded;
+		size_t _memory_size;
+
+		/**
+		 * Registers, one row of Lanes values per register
+		 */
+		std::vector<vmreg_t> _regs;
+
+		/**
+		 * Memory of every lane, one after the other
+		 */
+		std::vector<uint8_t> _memory;
+
+		/**
+		 * Lanes which did not stop yet
+		 */
+		uint64_t _live;
+
+		std::vector<Trap> _traps;
+
+		uint64_t _dispatches;
+		uint64_t _lane_instructions;
+	};
+
+	extern template class LaneVM<>;
+}
+
+#include "lanes.tpp"
+
+#endif
@@ -0,0 +1,679 @@
+#ifndef THALLIUMVM_LANES_TPP
+#define THALLIUMVM_LANES_TPP
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <limits>
+#include <string>
+#include "lanes.hpp"
+#include "bulk.hpp"
+#include "error.hpp"
+#include "serializer.hpp"
+
+namespace thallium
+{
+	template<size_t Lanes>
+	LaneVM<Lanes>::LaneVM(std::shared_ptr<const ProgramImage> image, const size_t memory_size) :
+		_image(std::move(image)),
+		_decoded(nullptr),
+		_memory_size(memory_size),
+		_regs(Registers::size() * Lanes, 0),
+		_memory(memory_size * Lanes, 0),
+		_live(0),
+		_traps(Lanes),
+		_dispatches(0),
+		_lane_instructions(0)
+	{
+		tassert(_image->size() <= _memory_size,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program may not fit in memory.");
+
+		tassert(_image->verification().certified(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program cannot run in lanes: " + _image->verification().diagnostic() + ".");
+
+		_decoded = _image->decoded();
+
+		// lanes never write to their code, so it is only copied once
+		for (size_t lane = 0; lane < Lanes; ++lane)
+		{
+			std::memcpy(lane_memory(lane), _image->code(), _image->size());
+		}
+
+		reset();
+	}
+
+	template<size_t Lanes>
+	void LaneVM<Lanes>::reset()
+	{
+		std::fill(begin(_regs), end(_regs), 0);
+
+		for (size_t lane = 0; lane < Lanes; ++lane)
+		{
+			std::memset(lane_memory(lane) + _image->size(), 0, _memory_size - _image->size());
+
+			reg(lane, static_cast<size_t>(SPRegisters::ip)) = _image->entry();
+			reg(lane, static_cast<size_t>(SPRegisters::sp)) = _image->initial_sp();
+			_traps[lane] = Trap{};
+		}
+
+		_live = all_lanes();
+		_dispatches = 0;
+		_lane_instructions = 0;
+	}
+
+	template<size_t Lanes>
+	inline vmreg_t& LaneVM<Lanes>::reg(const size_t lane, const size_t index)
+	{
+		return _regs[index * Lanes + lane];
+	}
+
+	template<size_t Lanes>
+	void LaneVM<Lanes>::write_memory(const size_t lane, const vmreg_t address, const uint8_t* data, const size_t size)
+	{
+		tassert(lane < Lanes,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"lane " + std::to_string(lane) + " does not exist.");
+
+		tassert(size == 0 || (address >= _image->size() && size_t(address) + size <= _memory_size),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the written data does not fit in memory past the code.");
+
+		if (size != 0)
+			std::memcpy(lane_memory(lane) + address, data, size);
+	}
+
+	template<size_t Lanes>
+	const uint8_t* LaneVM<Lanes>::memory(const size_t lane) const
+	{
+		return _memory.data() + lane * _memory_size;
+	}
+
+	template<size_t Lanes>
+	inline uint8_t* LaneVM<Lanes>::lane_memory(const size_t lane)
+	{
+		return _memory.data() + lane * _memory_size;
+	}
+
+	template<size_t Lanes>
+	void LaneVM<Lanes>::stop(const size_t lane, const TrapCode code)
+	{
+		tassert(lane < Lanes,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"lane " + std::to_string(lane) + " does not exist.");
+
+		stop_lane(lane, code, 0, reg(lane, static_cast<size_t>(SPRegisters::ip)), 0);
+	}
+
+	template<size_t Lanes>
+	const Trap& LaneVM<Lanes>::trap(const size_t lane) const
+	{
+		return _traps[lane];
+	}
+
+	template<size_t Lanes>
+	uint64_t LaneVM<Lanes>::dispatches() const
+	{
+		return _dispatches;
+	}
+
+	template<size_t Lanes>
+	uint64_t LaneVM<Lanes>::lane_instructions() const
+	{
+		return _lane_instructions;
+	}
+
+	template<size_t Lanes>
+	inline vmreg_t* LaneVM<Lanes>::row(const size_t index)
+	{
+		return _regs.data() + index * Lanes;
+	}
+
+	template<size_t Lanes>
+	template<typename F>
+	inline void LaneVM<Lanes>::apply(const uint64_t group, vmreg_t* dst, F&& f)
+	{
+		// a whole group writes every lane, which leaves a plain loop over the row
+		if (group == all_lanes())
+		{
+			for (size_t lane = 0; lane < Lanes; ++lane)
+				dst[lane] = f(lane);
+
+			return;
+		}
+
+		for (size_t lane = 0; lane < Lanes; ++lane)
+		{
+			if ((group >> lane) & 1)
+				dst[lane] = f(lane);
+		}
+	}
+
+	template<size_t Lanes>
+	void LaneVM<Lanes>::stop_lane(const size_t lane, const TrapCode code, const uint8_t opcode, const vmreg_t ip,
+								  const uint64_t address)
+	{
+		_traps[lane].code = code;
+		_traps[lane].opcode = opcode;
+		_traps[lane].ip = ip;
+		_traps[lane].address = address;
+
+		reg(lane, static_cast<size_t>(SPRegisters::ip)) = ip;
+		_live &= ~(uint64_t(1) << lane);
+	}
+
+	template<size_t Lanes>
+	inline bool LaneVM<Lanes>::access(const size_t lane, const DecodedInstruction& d, const vmreg_t pc,
+									  const vmreg_t address, const uint64_t size, const bool write)
+	{
+		if (size == 0)
+			return true;
+
+		if (address + size > _memory_size)
+		{
+			stop_lane(lane, TrapCode::MemoryOutOfBounds, d.opcode, pc, std::max<uint64_t>(address, _memory_size));
+			return false;
+		}
+
+		// the code is shared by every lane, and stays the certified one
+		if (write && address < _image->size())
+		{
+			stop_lane(lane, TrapCode::UncertifiedCode, d.opcode, pc, 0);
+			return false;
+		}
+
+		return true;
+	}
+
+	template<size_t Lanes>
+	void LaneVM<Lanes>::run()
+	{
+		vmreg_t* const ip = row(static_cast<size_t>(SPRegisters::ip));
+		const Verification& verification = _image->verification();
+		const vmreg_t none = std::numeric_limits<vmreg_t>::max();
+
+		_dispatches = 0;
+		_lane_instructions = 0;
+
+		// the host may have moved lanes anywhere
+		for (size_t lane = 0; lane < Lanes; ++lane)
+		{
+			if (((_live >> lane) & 1) && !verification.safe_target(ip[lane]))
+			{
+				const uint8_t opcode = ip[lane] < _memory_size ? lane_memory(lane)[ip[lane]] : 0;
+				stop_lane(lane, TrapCode::UncertifiedCode, opcode, ip[lane], 0);
+			}
+		}
+
+		while (_live != 0)
+		{
+			// the lanes at the lowest address run, the others wait for them to catch up
+			vmreg_t pc = none;
+			for (size_t lane = 0; lane < Lanes; ++lane)
+			{
+				if ((_live >> lane) & 1)
+					pc = std::min(pc, ip[lane]);
+			}
+
+			uint64_t group = 0;
+			vmreg_t waiting = none;
+			for (size_t lane = 0; lane < Lanes; ++lane)
+			{
+				if (!((_live >> lane) & 1))
+					continue;
+
+				if (ip[lane] == pc)
+					group |= uint64_t(1) << lane;
+				else
+					waiting = std::min(waiting, ip[lane]);
+			}
+
+			// run the group until it diverges, stops, or reaches waiting lanes
+			for (;;)
+			{
+				++_dispatches;
+				_lane_instructions += std::bitset<64>(group).count();
+
+				if (execute(_decoded[pc / Instruction::size()], pc, group))
+				{
+					if (group == 0)
+						break;
+
+					pc += Instruction::size();
+					if (pc < waiting)
+						continue;
+
+					for (size_t lane = 0; lane < Lanes; ++lane)
+					{
+						if ((group >> lane) & 1)
+							ip[lane] = pc;
+					}
+
+					break;
+				}
+
+				if (group == 0)
+					break;
+
+				// the group stays together if every lane jumped to the same address, below the waiting lanes
+				vmreg_t target = none;
+				bool uniform = true;
+				for (size_t lane = 0; lane < Lanes; ++lane)
+				{
+					if (!((group >> lane) & 1))
+						continue;
+
+					if (target == none)
+						target = ip[lane];
+					else
+						uniform = uniform && ip[lane] == target;
+				}
+
+				if (!uniform || target >= waiting)
+					break;
+
+				pc = target;
+			}
+		}
+	}
+
+	template<size_t Lanes>
+	bool LaneVM<Lanes>::execute(const DecodedInstruction& d, const vmreg_t pc, uint64_t& group)
+	{
+		vmreg_t* const ip = row(static_cast<size_t>(SPRegisters::ip));
+		vmreg_t* const sp = row(static_cast<size_t>(SPRegisters::sp));
+		vmreg_t* const fl = row(static_cast<size_t>(SPRegisters::fl));
+		const vmreg_t next = pc + Instruction::size();
+
+		// the second half of a superinstruction keeps its own entry, which the group dispatches next
+		switch (unfused(d.op))
+		{
+		case DecodedOp::mov: {
+			const vmreg_t* const a = row(d.a);
+			apply(group, row(d.b), [a](const size_t l) { return a[l]; });
+		} return true;
+
+		case DecodedOp::imm: {
+			const vmreg_t value = d.imm;
+			apply(group, row(d.b), [value](const size_t) { return value; });
+		} return true;
+
+		case DecodedOp::mget: {
+			const vmreg_t* const a = row(d.a);
+			vmreg_t* const b = row(d.b);
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if (!((group >> l) & 1))
+					continue;
+
+				const vmreg_t address = a[l];
+				if (access(l, d, pc, address, sizeof(vmreg_t), false))
+					b[l] = deserialize_type<vmreg_t>(lane_memory(l) + address);
+				else
+					group &= ~(uint64_t(1) << l);
+			}
+		} return true;
+
+		case DecodedOp::mset: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if (!((group >> l) & 1))
+					continue;
+
+				const vmreg_t address = a[l];
+				if (access(l, d, pc, address, sizeof(vmreg_t), true))
+					serialize_type(b[l], lane_memory(l) + address);
+				else
+					group &= ~(uint64_t(1) << l);
+			}
+		} return true;
+
+		case DecodedOp::teq: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			apply(group, fl, [a, b](const size_t l) { return vmreg_t(a[l] == b[l]); });
+		} return true;
+
+		case DecodedOp::tgt: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			apply(group, fl, [a, b](const size_t l) { return vmreg_t(a[l] > b[l]); });
+		} return true;
+
+		case DecodedOp::tlt: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			apply(group, fl, [a, b](const size_t l) { return vmreg_t(a[l] < b[l]); });
+		} return true;
+
+		// jumps and calls to their own address fall through, as ip is left unchanged in the VM
+		case DecodedOp::cjmp: {
+			const vmreg_t target = d.imm != pc ? d.imm : next;
+			apply(group, ip, [fl, target, next](const size_t l) { return (fl[l] & 1) ? target : next; });
+		} return false;
+
+		case DecodedOp::cjmpr: {
+			const vmreg_t* const a = row(d.a);
+			apply(group, ip, [fl, a, pc, next](const size_t l) { return (fl[l] & 1) && a[l] != pc ? a[l] : next; });
+
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if (((group >> l) & 1) && !_image->verification().safe_target(ip[l]))
+				{
+					const uint8_t opcode = ip[l] < _memory_size ? lane_memory(l)[ip[l]] : 0;
+					stop_lane(l, TrapCode::UncertifiedCode, opcode, ip[l], 0);
+					group &= ~(uint64_t(1) << l);
+				}
+			}
+		} return false;
+
+		case DecodedOp::call:
+		case DecodedOp::callr:
+		case DecodedOp::push: {
+			const vmreg_t* const a = row(d.a);
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if (!((group >> l) & 1))
+					continue;
+
+				sp[l] += sizeof(vmreg_t);
+				if (!access(l, d, pc, sp[l], sizeof(vmreg_t), true))
+				{
+					group &= ~(uint64_t(1) << l);
+					continue;
+				}
+
+				if (d.op == DecodedOp::push || d.op == DecodedOp::push_push)
+				{
+					serialize_type(a[l], lane_memory(l) + sp[l]);
+					continue;
+				}
+
+				serialize_type(next, lane_memory(l) + sp[l]);
+				ip[l] = d.op == DecodedOp::call ? d.imm : a[l];
+				if (ip[l] == pc)
+					ip[l] = next;
+
+				if (!_image->verification().safe_target(ip[l]))
+				{
+					const uint8_t opcode = ip[l] < _memory_size ? lane_memory(l)[ip[l]] : 0;
+					stop_lane(l, TrapCode::UncertifiedCode, opcode, ip[l], 0);
+					group &= ~(uint64_t(1) << l);
+				}
+			}
+		} return unfused(d.op) == DecodedOp::push;
+
+		case DecodedOp::pop: {
+			vmreg_t* const a = row(d.a);
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if (!((group >> l) & 1))
+					continue;
+
+				if (!access(l, d, pc, sp[l], sizeof(vmreg_t), false))
+				{
+					group &= ~(uint64_t(1) << l);
+					continue;
+				}
+
+				a[l] = deserialize_type<vmreg_t>(lane_memory(l) + sp[l]);
+				sp[l] -= sizeof(vmreg_t);
+			}
+		} return true;
+
+		case DecodedOp::sbit: {
+			const vmreg_t bit = vmreg_t(1) << d.b;
+			const vmreg_t v = d.c ? 1 : 0;
+			vmreg_t* const a = row(d.a);
+			apply(group, a, [a, bit, v](const size_t l) { return a[l] ^ ((-v ^ a[l]) & bit); });
+		} return true;
+
+		case DecodedOp::gbit: {
+			const vmreg_t* const a = row(d.a);
+			const uint16_t index = d.c;
+			apply(group, row(d.b), [a, index](const size_t l) { return (a[l] >> index) & 0b1; });
+		} return true;
+
+		// shift amounts are taken modulo 32, as in the VM
+		case DecodedOp::shr: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const c = row(d.c);
+			apply(group, row(d.b), [a, c](const size_t l) { return a[l] >> (c[l] & 31); });
+		} return true;
+
+		case DecodedOp::shl: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const c = row(d.c);
+			apply(group, row(d.b), [a, c](const size_t l) { return a[l] << (c[l] & 31); });
+		} return true;
+
+		case DecodedOp::inc: {
+			vmreg_t* const a = row(d.a);
+			apply(group, a, [a](const size_t l) { return a[l] + 1; });
+		} return true;
+
+		case DecodedOp::dec: {
+			vmreg_t* const a = row(d.a);
+			apply(group, a, [a](const size_t l) { return a[l] - 1; });
+		} return true;
+
+		case DecodedOp::uadd: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			apply(group, row(d.c), [a, b](const size_t l) { return a[l] + b[l]; });
+		} return true;
+
+		case DecodedOp::usub: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			apply(group, row(d.c), [a, b](const size_t l) { return a[l] - b[l]; });
+		} return true;
+
+		case DecodedOp::umul: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			apply(group, row(d.c), [a, b](const size_t l) { return a[l] * b[l]; });
+		} return true;
+
+		case DecodedOp::udiv: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			vmreg_t* const c = row(d.c);
+			apply(group, c, [a, b, c](const size_t l) { return b[l] != 0 ? a[l] / b[l] : c[l]; });
+		} return true;
+
+		case DecodedOp::umod: {
+			const vmreg_t* const a = row(d.a);
+			const vmreg_t* const b = row(d.b);
+			vmreg_t* const c = row(d.c);
+			apply(group, c, [a, b, c](const size_t l) { return b[l] != 0 ? a[l] % b[l] : c[l]; });
+		} return true;
+
+		case DecodedOp::mcpy:
+		case DecodedOp::mfill:
+		case DecodedOp::mcmp:
+		case DecodedOp::mfind:
+		case DecodedOp::vadd:
+		case DecodedOp::vxor:
+		case DecodedOp::vsum:
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if (((group >> l) & 1) && !execute_bulk(d, pc, l))
+					group &= ~(uint64_t(1) << l);
+			}
+			return true;
+
+		case DecodedOp::acas:
+		case DecodedOp::aadd:
+		case DecodedOp::axchg:
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if (((group >> l) & 1) && !execute_atomic(d, pc, l))
+					group &= ~(uint64_t(1) << l);
+			}
+			return true;
+
+		// lanes run on a single thread, their memories being their own
+		case DecodedOp::fence:
+			return true;
+
+		case DecodedOp::hcall:
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if ((group >> l) & 1)
+					stop_lane(l, TrapCode::HostCallFailed, d.opcode, pc, d.imm);
+			}
+
+			group = 0;
+			return true;
+
+		case DecodedOp::fspawn:
+		case DecodedOp::fyield:
+		case DecodedOp::fjoin:
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if ((group >> l) & 1)
+					stop_lane(l, TrapCode::FiberFailed, d.opcode, pc, 0);
+			}
+
+			group = 0;
+			return true;
+
+		case DecodedOp::exit:
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if ((group >> l) & 1)
+				{
+					// exiting leaves ip at exit, with the empty trap of a VM
+					stop_lane(l, TrapCode::None, 0, pc, 0);
+					_traps[l] = Trap{};
+				}
+			}
+
+			group = 0;
+			return true;
+
+		default:
+			// certified code only holds valid instructions
+			for (size_t l = 0; l < Lanes; ++l)
+			{
+				if ((group >> l) & 1)
+					stop_lane(l, TrapCode::InvalidInstruction, d.opcode, pc, 0);
+			}
+
+			group = 0;
+			return true;
+		}
+	}
+
+	template<size_t Lanes>
+	bool LaneVM<Lanes>::execute_bulk(const DecodedInstruction& d, const vmreg_t pc, const size_t lane)
+	{
+		// operands and ranges as in BasicVM::execute_bulk
+		const DecodedOp op = d.op;
+		const vmreg_t count = reg(lane, op == DecodedOp::vsum ? d.b : d.c);
+		const bool words = op == DecodedOp::vadd || op == DecodedOp::vxor || op == DecodedOp::vsum;
+		const uint64_t size = words ? uint64_t(count) * sizeof(vmreg_t) : count;
+
+		const bool writes = op == DecodedOp::mcpy || op == DecodedOp::mfill || op == DecodedOp::vadd || op == DecodedOp::vxor;
+		const bool second_range = op == DecodedOp::mcpy || op == DecodedOp::mcmp || op == DecodedOp::vadd || op == DecodedOp::vxor;
+
+		const vmreg_t first = reg(lane, d.a);
+		const vmreg_t second = reg(lane, d.b);
+		if (!access(lane, d, pc, first, size, writes) || (second_range && !access(lane, d, pc, second, size, false)))
+			return false;
+
+		uint8_t* const memory = lane_memory(lane);
+		vmreg_t& flags = reg(lane, static_cast<size_t>(SPRegisters::fl));
+
+		switch (op)
+		{
+		case DecodedOp::mcpy:
+			std::memmove(memory + first, memory + second, size);
+			break;
+
+		case DecodedOp::mfill:
+			std::memset(memory + first, static_cast<uint8_t>(second), size);
+			break;
+
+		case DecodedOp::mcmp: {
+			const size_t offset = bulk_compare(memory + first, memory + second, size);
+			reg(lane, d.imm) = static_cast<vmreg_t>(offset);
+			flags = offset == size;
+		} break;
+
+		case DecodedOp::mfind: {
+			const size_t offset = bulk_find(memory + first, static_cast<uint8_t>(second), size);
+			reg(lane, d.imm) = static_cast<vmreg_t>(offset);
+			flags = offset != size;
+		} break;
+
+		case DecodedOp::vadd:
+			bulk_add(memory + first, memory + second, count);
+			break;
+
+		case DecodedOp::vxor:
+			bulk_xor(memory + first, memory + second, count);
+			break;
+
+		case DecodedOp::vsum:
+			reg(lane, d.c) = bulk_sum(memory + first, count);
+			break;
+
+		default:
+			break;
+		}
+
+		return true;
+	}
+
+	template<size_t Lanes>
+	bool LaneVM<Lanes>::execute_atomic(const DecodedInstruction& d, const vmreg_t pc, const size_t lane)
+	{
+		// operands and traps as in BasicVM::execute_atomic, without other threads to synchronize with
+		const vmreg_t address = reg(lane, d.a);
+		if (address % sizeof(vmreg_t) != 0)
+		{
+			stop_lane(lane, TrapCode::UnalignedAtomic, d.opcode, pc, address);
+			return false;
+		}
+
+		if (!access(lane, d, pc, address, sizeof(vmreg_t), true))
+			return false;
+
+		uint8_t* const word = lane_memory(lane) + address;
+		const vmreg_t old = deserialize_type<vmreg_t>(word);
+
+		switch (d.op)
+		{
+		case DecodedOp::acas: {
+			const bool equal = old == reg(lane, d.b);
+			if (equal)
+				serialize_type(reg(lane, d.c), word);
+
+			reg(lane, d.b) = old;
+			reg(lane, static_cast<size_t>(SPRegisters::fl)) = equal;
+		} break;
+
+		case DecodedOp::aadd:
+			serialize_type(vmreg_t(old + reg(lane, d.b)), word);
+			reg(lane, d.c) = old;
+			break;
+
+		case DecodedOp::axchg:
+			serialize_type(reg(lane, d.b), word);
+			reg(lane, d.c) = old;
+			break;
+
+		default:
+			break;
+		}
+
+		return true;
+	}
+}
+
+#endif
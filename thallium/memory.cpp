@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "memory.hpp"
+#include "error.hpp"
+
+#ifdef THALLIUM_HAS_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace thallium
+{
+	static size_t round_up(const size_t value, const size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+#ifdef THALLIUM_HAS_MMAP
+	Memory::Memory(const size_t size, const MemoryMode mode) :
+		_data(nullptr),
+		_size(size),
+		_capacity(round_up(size, page_size()) + page_size()),
+		_guarded(mode == MemoryMode::Guarded),
+		_owner(true)
+	{
+		const uint64_t address_space = uint64_t(1) << (sizeof(vmreg_t) * 8);
+
+		if (_guarded)
+		{
+			tassert(sizeof(void*) > sizeof(vmreg_t) && size <= address_space,
+					TimeOfError::Preload, ErrorType::Fatal,
+					"guarded memory needs a 64-bit host and at most 4 GiB of VM memory.");
+
+			// any 32-bit address plus the size of an access lands in the reservation
+			_capacity = static_cast<size_t>(address_space) + page_size();
+		}
+
+		void* data = mmap(nullptr, _capacity, _guarded ? PROT_NONE : PROT_READ | PROT_WRITE,
+						  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+		tassert(data != MAP_FAILED,
+				TimeOfError::Preload, ErrorType::Internal,
+				"could not map " + std::to_string(size) + " bytes of VM memory.");
+
+		_data = static_cast<uint8_t*>(data);
+
+		if (_guarded && size != 0 && mprotect(_data, round_up(size, page_size()), PROT_READ | PROT_WRITE) != 0)
+		{
+			munmap(_data, _capacity);
+			_data = nullptr;
+			error(TimeOfError::Preload, ErrorType::Internal, "could not map " + std::to_string(size) + " bytes of VM memory.");
+		}
+	}
+
+	Memory::~Memory()
+	{
+		if (_data != nullptr && _owner)
+			munmap(_data, _capacity);
+	}
+
+	void Memory::share(Memory& memory)
+	{
+		if (_data != nullptr && _owner)
+			munmap(_data, _capacity);
+
+		_data = memory._data;
+		_size = memory._size;
+		_capacity = memory._capacity;
+		_guarded = memory._guarded;
+		_owner = false;
+	}
+
+	void Memory::map(const ProgramImage& image)
+	{
+		tassert(image.size() <= _size,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program may not fit in memory.");
+
+		size_t mapped = 0;
+		if (image.fd() >= 0)
+		{
+			// replaces the pages at the beginning of memory, dropping whatever was written to them
+			mapped = round_up(image.size(), page_size());
+			void* data = mmap(_data, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image.fd(), static_cast<off_t>(image.fd_offset()));
+
+			tassert(data != MAP_FAILED,
+					TimeOfError::Preload, ErrorType::Internal,
+					"could not map the program image.");
+		}
+		else if (image.size() != 0)
+		{
+			std::memcpy(_data, image.code(), image.size());
+			mapped = image.size();
+		}
+
+		zero(mapped, _size);
+	}
+
+	void Memory::zero(const size_t begin, const size_t end)
+	{
+		if (begin >= end)
+			return;
+
+		const size_t page_begin = round_up(begin, page_size());
+		const size_t page_end = end != _size ? end / page_size() * page_size()
+							  : _guarded ? round_up(_size, page_size()) : _capacity;
+
+		if (page_begin >= page_end)
+		{
+			std::memset(_data + begin, 0, end - begin);
+			return;
+		}
+
+		std::memset(_data + begin, 0, page_begin - begin);
+
+		// private anonymous pages read as zero again once dropped
+		madvise(_data + page_begin, page_end - page_begin, MADV_DONTNEED);
+
+		if (end > page_end)
+			std::memset(_data + page_end, 0, end - page_end);
+	}
+
+	bool Memory::guarded() const
+	{
+		return _guarded;
+	}
+
+	size_t Memory::resident_pages() const
+	{
+		// guard regions are never backed
+		const size_t length = _guarded ? round_up(_size, page_size()) : _capacity;
+
+		std::vector<unsigned char> residency(length / page_size());
+		if (length != 0 && mincore(_data, length, residency.data()) != 0)
+			return 0;
+
+		size_t pages = 0;
+		for (const unsigned char r : residency)
+			pages += r & 1;
+
+		return pages;
+	}
+
+	size_t Memory::page_size()
+	{
+		static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		return size;
+	}
+#else
+	Memory::Memory(const size_t size, const MemoryMode mode) :
+		_data(nullptr),
+		_size(size),
+		_capacity(size + page_size()),
+		_guarded(false),
+		_owner(true)
+	{
+		tassert(mode == MemoryMode::Flat,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"guarded memory is not supported on this platform.");
+
+		_data = new uint8_t[_capacity]();
+	}
+
+	Memory::~Memory()
+	{
+		if (_owner)
+			delete[] _data;
+	}
+
+	void Memory::share(Memory& memory)
+	{
+		if (_owner)
+			delete[] _data;
+
+		_data = memory._data;
+		_size = memory._size;
+		_capacity = memory._capacity;
+		_guarded = memory._guarded;
+		_owner = false;
+	}
+
+	void Memory::map(const ProgramImage& image)
+	{
+		tassert(image.size() <= _size,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program may not fit in memory.");
+
+		if (image.size() != 0)
+			std::memcpy(_data, image.code(), image.size());
+
+		zero(image.size(), _size);
+	}
+
+	void Memory::zero(const size_t begin, const size_t end)
+	{
+		if (begin < end)
+			std::memset(_data + begin, 0, end - begin);
+	}
+
+	bool Memory::guarded() const
+	{
+		return false;
+	}
+
+	size_t Memory::resident_pages() const
+	{
+		return _capacity / page_size();
+	}
+
+	size_t Memory::page_size()
+	{
+		return 4096;
+	}
+#endif
+
+	uint8_t* Memory::data()
+	{
+		return _data;
+	}
+
+	size_t Memory::size() const
+	{
+		return _size;
+	}
+
+	size_t Memory::reserved() const
+	{
+		return _capacity;
+	}
+}
@@ -0,0 +1,247 @@
+#ifndef THALLIUMVM_MEMORY_HPP
+#define THALLIUMVM_MEMORY_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "bulk.hpp"
+#include "image.hpp"
+#include "register.hpp"
+#include "serializer.hpp"
+
+#if defined(__unix__)
+#define THALLIUM_HAS_MMAP 1
+#endif
+
+namespace thallium
+{
+	/**
+	 * Typed class enum of the ways out of bounds accesses to VM memory are handled
+	 */
+	enum class MemoryMode
+	{
+		/**
+		 * No checks: programs are trusted to stay in bounds
+		 */
+		Flat,
+
+		/**
+		 * The whole 32-bit address space is reserved, and what lies past the memory is mapped without access
+		 * rights. Out of bounds accesses fault in hardware and are turned into a trap by VM::run, at no cost
+		 * for accesses in bounds. Requires anonymous mappings and a 64-bit host.
+		 */
+		Guarded
+	};
+
+	/**
+	 * Flat, zero-initialized VM memory.
+	 *
+	 * On Unix it is an anonymous mapping reserved without backing, so pages are only committed when first touched
+	 * and a whole 32-bit address space costs nothing up front. A ProgramImage can be mapped onto it copy-on-write.
+	 * Other platforms get a heap allocation and a copy of the image.<br>
+	 * One spare page follows the memory, so that accesses straddling its end stay inside the mapping. In
+	 * MemoryMode::Guarded, a guard region covers everything from the end of memory to 4 GiB and one page beyond.
+	 */
+	class Memory
+	{
+	public:
+		/**
+		 * Memory constructor, which allocates zeroed memory.
+		 * \param size Memory size in bytes
+		 * \param mode Handling of out of bounds accesses
+		 */
+		Memory(const size_t size, const MemoryMode mode = MemoryMode::Flat);
+		~Memory();
+
+		Memory(const Memory&) = delete;
+		Memory& operator=(const Memory&) = delete;
+
+		/**
+		 * \return Pointer to the first byte of memory
+		 */
+		uint8_t* data();
+
+		/**
+		 * \return Memory size in bytes
+		 */
+		size_t size() const;
+
+		/**
+		 * Turns the memory into a view of another one, giving up its own mapping. Both then address the same
+		 * bytes, and the view does not unmap them when destroyed.
+		 * \param memory Memory to view, which must outlive the view
+		 */
+		void share(Memory& memory);
+
+		/**
+		 * Maps the code of an image at address 0, without copying it when possible, and zeroes the rest of memory.
+		 * \param image Image to map, which must fit in memory and outlive the mapping
+		 */
+		void map(const ProgramImage& image);
+
+		/**
+		 * Zeroes a range of memory. Whole pages are handed back to the system rather than written to.
+		 * \param begin First address of the range
+		 * \param end Address past the range
+		 */
+		void zero(const size_t begin, const size_t end);
+
+		/**
+		 * Reads a register-sized value.
+		 * \param address Address to read from, below size()
+		 * \return Value in memory
+		 */
+		vmreg_t load(const vmreg_t address) const
+		{
+			return deserialize_type<vmreg_t>(_data + address);
+		}
+
+		/**
+		 * Writes a register-sized value.
+		 * \param address Address to write to, below size()
+		 * \param value Value to write
+		 */
+		void store(const vmreg_t address, const vmreg_t value)
+		{
+			serialize_type(value, _data + address);
+		}
+
+		/**
+		 * Returns a range of memory as contiguous bytes.
+		 * \param address First address of the range, which must fit in memory
+		 * \param size Size of the range
+		 * \param scratch Buffer of at least size bytes for memories which are not contiguous, unused here
+		 * \return Pointer to the bytes, valid until the next write
+		 */
+		const uint8_t* bytes(const vmreg_t address, const size_t, uint8_t*) const
+		{
+			return _data + address;
+		}
+
+		/**
+		 * Copies bytes to memory.
+		 * \param address Destination address, the range must fit in memory
+		 * \param data Bytes to copy
+		 * \param size Number of bytes
+		 */
+		void write(const vmreg_t address, const uint8_t* data, const size_t size)
+		{
+			if (size != 0)
+				std::memcpy(_data + address, data, size);
+		}
+
+		/**
+		 * Returns a word for the atomic instructions, see Opcode::acas.
+		 * \param address Address of the word, aligned to its size and below size()
+		 * \return Pointer to the bytes of the word, valid as long as the memory
+		 */
+		uint8_t* word(const vmreg_t address)
+		{
+			return _data + address;
+		}
+
+		// Range operations of the bulk memory instructions, see Opcode::mcpy and the following ones.
+		// Ranges must fit in memory, words are counted in vmreg_t.
+
+		/**
+		 * Copies a range of memory, which may overlap the destination.
+		 * \param dst Destination address
+		 * \param src Source address
+		 * \param size Number of bytes
+		 */
+		void move(const vmreg_t dst, const vmreg_t src, const size_t size)
+		{
+			std::memmove(_data + dst, _data + src, size);
+		}
+
+		/**
+		 * Sets a range of memory to a byte value.
+		 * \param dst Destination address
+		 * \param value Byte value
+		 * \param size Number of bytes
+		 */
+		void fill(const vmreg_t dst, const uint8_t value, const size_t size)
+		{
+			std::memset(_data + dst, value, size);
+		}
+
+		/**
+		 * \return Offset of the first byte differing between two ranges, or size if they are equal
+		 */
+		size_t compare(const vmreg_t a, const vmreg_t b, const size_t size) const
+		{
+			return bulk_compare(_data + a, _data + b, size);
+		}
+
+		/**
+		 * \return Offset of the first occurrence of value in a range, or size if there is none
+		 */
+		size_t find(const vmreg_t address, const uint8_t value, const size_t size) const
+		{
+			return bulk_find(_data + address, value, size);
+		}
+
+		/**
+		 * Adds a range of words to another one, see bulk_add.
+		 */
+		void add(const vmreg_t dst, const vmreg_t src, const size_t words)
+		{
+			bulk_add(_data + dst, _data + src, words);
+		}
+
+		/**
+		 * Exclusive-ors a range of words into another one, see bulk_xor.
+		 */
+		void exclusive_or(const vmreg_t dst, const vmreg_t src, const size_t words)
+		{
+			bulk_xor(_data + dst, _data + src, words);
+		}
+
+		/**
+		 * \return Sum of a range of words
+		 */
+		vmreg_t sum(const vmreg_t address, const size_t words) const
+		{
+			return bulk_sum(_data + address, words);
+		}
+
+		/**
+		 * \return Whether out of bounds accesses fault, see MemoryMode::Guarded
+		 */
+		bool guarded() const;
+
+		/**
+		 * \return Size of the host address range reserved from data(), guard regions included
+		 */
+		size_t reserved() const;
+
+		/**
+		 * \return Number of pages currently backed by physical memory, including the code pages shared with the
+		 *         imported image which are in the page cache
+		 */
+		size_t resident_pages() const;
+
+		/**
+		 * \return Size of a memory page
+		 */
+		static size_t page_size();
+
+	private:
+		uint8_t* _data;
+		size_t _size;
+
+		/**
+		 * Size of the mapping or allocation behind _data, a multiple of the page size including the spare page
+		 */
+		size_t _capacity;
+
+		bool _guarded;
+
+		/**
+		 * Whether _data is released with the memory, rather than viewed from another one
+		 */
+		bool _owner;
+	};
+}
+
+#endif
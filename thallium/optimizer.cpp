@@ -0,0 +1,1294 @@
+#include <algorithm>
+#include <bitset>
+#include "optimizer.hpp"
+#include "vm.hpp"
+
+namespace thallium
+{
+	typedef std::bitset<Registers::size()> RegisterSet;
+
+	// slot of a KnownState telling that fl was written by a comparison, and is 0 or 1
+	const size_t boolean_slot = Registers::size();
+	const uint16_t ip_register = static_cast<uint16_t>(SPRegisters::ip);
+	const uint16_t sp_register = static_cast<uint16_t>(SPRegisters::sp);
+	const uint16_t fl_register = static_cast<uint16_t>(SPRegisters::fl);
+	const vmreg_t test_mask = vmreg_t(1) << static_cast<vmreg_t>(Flags::Test);
+
+	// passes stop once the program does not change anymore, or after that many rounds
+	const size_t max_rounds = 8;
+
+	// jumps followed when threading a jump
+	const size_t max_hops = 16;
+
+	// above that many block entry states, constants are only propagated within blocks
+	const size_t max_global_states = size_t(1) << 22;
+
+	/**
+	 * Registers read and written by an instruction
+	 */
+	struct RegisterAccess
+	{
+		RegisterSet reads;
+		RegisterSet writes;
+
+		/**
+		 * Whether the instruction only writes registers, so that it can be removed when they are not read
+		 */
+		bool pure;
+	};
+
+	/**
+	 * Value of a register at some point of the program, if it is the same on every path
+	 */
+	struct KnownValue
+	{
+		bool known;
+		vmreg_t value;
+	};
+
+	/**
+	 * Values of the registers, followed by the boolean slot, empty for code not reached yet
+	 */
+	typedef std::vector<KnownValue> KnownState;
+
+	/**
+	 * Basic block, as a range of instruction indices
+	 */
+	struct OptimizerBlock
+	{
+		size_t first;
+		size_t end;
+	};
+
+	/**
+	 * Program being optimized
+	 */
+	struct OptimizerCode
+	{
+		std::vector<Instruction> instructions;
+		std::vector<DecodedInstruction> decoded;
+
+		/**
+		 * Index of the first instruction to run
+		 */
+		size_t entry;
+
+		std::vector<OptimizerBlock> blocks;
+
+		/**
+		 * Block of each instruction
+		 */
+		std::vector<size_t> block_of;
+	};
+
+	static vmreg_t address(const size_t index)
+	{
+		return static_cast<vmreg_t>(index * Instruction::size());
+	}
+
+	static size_t target(const DecodedInstruction& d)
+	{
+		return d.imm / Instruction::size();
+	}
+
+	static DecodedInstruction decode(const Instruction& instruction)
+	{
+		uint8_t serialized[Instruction::size()];
+		serialize_instructions(&instruction, 1, serialized);
+		return VM::decode_instruction(serialized);
+	}
+
+	/**
+	 * Encodes a decoded instruction back, the inverse of VM::decode_instruction for valid instructions.
+	 */
+	static Instruction encode(const DecodedInstruction& d)
+	{
+		const uint64_t a = d.a, b = d.b, c = d.c, imm = d.imm;
+		uint64_t argument = 0;
+
+		switch (d.op)
+		{
+		case DecodedOp::imm:
+		case DecodedOp::hcall:
+			argument = imm | b << 32;
+			break;
+
+		case DecodedOp::mov:
+		case DecodedOp::mget:
+		case DecodedOp::mset:
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+			argument = a | b << 16;
+			break;
+
+		case DecodedOp::cjmp:
+		case DecodedOp::call:
+			argument = imm;
+			break;
+
+		case DecodedOp::cjmpr:
+		case DecodedOp::callr:
+		case DecodedOp::inc:
+		case DecodedOp::dec:
+		case DecodedOp::push:
+		case DecodedOp::pop:
+			argument = a;
+			break;
+
+		case DecodedOp::sbit:
+			argument = a | b << 16 | c << 24;
+			break;
+
+		case DecodedOp::mcmp:
+		case DecodedOp::mfind:
+			argument = a | b << 16 | c << 32 | imm << 48;
+			break;
+
+		case DecodedOp::exit:
+			break;
+
+		default:
+			argument = a | b << 16 | c << 32;
+			break;
+		}
+
+		return Instruction{static_cast<Opcode>(d.opcode), argument};
+	}
+
+	static DecodedInstruction make_imm(const vmreg_t value, const uint16_t destination)
+	{
+		return DecodedInstruction{DecodedOp::imm, static_cast<uint8_t>(Opcode::imm), 0, destination, 0, value};
+	}
+
+	static DecodedInstruction make_mov(const uint16_t source, const uint16_t destination)
+	{
+		return DecodedInstruction{DecodedOp::mov, static_cast<uint8_t>(Opcode::mov), source, destination, 0, 0};
+	}
+
+	static RegisterAccess access(const DecodedInstruction& d)
+	{
+		RegisterAccess x{RegisterSet(), RegisterSet(), false};
+
+		switch (d.op)
+		{
+		case DecodedOp::mov:
+		case DecodedOp::gbit:
+			x.reads.set(d.a);
+			x.writes.set(d.b);
+			x.pure = true;
+			break;
+
+		case DecodedOp::imm:
+			x.writes.set(d.b);
+			x.pure = true;
+			break;
+
+		case DecodedOp::mget:
+			x.reads.set(d.a);
+			x.writes.set(d.b);
+			break;
+
+		case DecodedOp::mset:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			break;
+
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			x.writes.set(fl_register);
+			x.pure = true;
+			break;
+
+		case DecodedOp::cjmp:
+			x.reads.set(fl_register);
+			break;
+
+		case DecodedOp::cjmpr:
+			x.reads.set(d.a);
+			x.reads.set(fl_register);
+			break;
+
+		case DecodedOp::callr:
+			x.reads.set(d.a);
+			x.reads.set(sp_register);
+			x.writes.set(sp_register);
+			break;
+
+		case DecodedOp::push:
+			x.reads.set(d.a);
+			x.reads.set(sp_register);
+			x.writes.set(sp_register);
+			break;
+
+		case DecodedOp::call:
+			x.reads.set(sp_register);
+			x.writes.set(sp_register);
+			break;
+
+		case DecodedOp::pop:
+			x.reads.set(sp_register);
+			x.writes.set(d.a);
+			x.writes.set(sp_register);
+			break;
+
+		case DecodedOp::sbit:
+		case DecodedOp::inc:
+		case DecodedOp::dec:
+			x.reads.set(d.a);
+			x.writes.set(d.a);
+			x.pure = true;
+			break;
+
+		case DecodedOp::shr:
+		case DecodedOp::shl:
+			x.reads.set(d.a);
+			x.reads.set(d.c);
+			x.writes.set(d.b);
+			x.pure = true;
+			break;
+
+		case DecodedOp::uadd:
+		case DecodedOp::usub:
+		case DecodedOp::umul:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			x.writes.set(d.c);
+			x.pure = true;
+			break;
+
+		// the destination is left as is when dividing by zero
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			x.reads.set(d.c);
+			x.writes.set(d.c);
+			x.pure = true;
+			break;
+
+		case DecodedOp::mcpy:
+		case DecodedOp::mfill:
+		case DecodedOp::vadd:
+		case DecodedOp::vxor:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			x.reads.set(d.c);
+			break;
+
+		case DecodedOp::mcmp:
+		case DecodedOp::mfind:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			x.reads.set(d.c);
+			x.writes.set(static_cast<uint16_t>(d.imm));
+			x.writes.set(fl_register);
+			break;
+
+		case DecodedOp::vsum:
+		case DecodedOp::aadd:
+		case DecodedOp::axchg:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			x.writes.set(d.c);
+			break;
+
+		case DecodedOp::acas:
+			x.reads.set(d.a);
+			x.reads.set(d.b);
+			x.reads.set(d.c);
+			x.writes.set(d.b);
+			x.writes.set(fl_register);
+			break;
+
+		// the window of a host function is only known once it is bound
+		case DecodedOp::hcall:
+			for (size_t r = d.b; r < x.reads.size(); ++r)
+			{
+				x.reads.set(r);
+				x.writes.set(r);
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		return x;
+	}
+
+	/**
+	 * \return Whether an instruction is the last one of its block
+	 */
+	static bool ends_block(const DecodedInstruction& d)
+	{
+		switch (d.op)
+		{
+		case DecodedOp::cjmp:
+		case DecodedOp::cjmpr:
+		case DecodedOp::call:
+		case DecodedOp::callr:
+		case DecodedOp::exit:
+		case DecodedOp::invalid:
+			return true;
+
+		case DecodedOp::pop:
+			return d.a == ip_register;
+
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Checks the rules of optimize() that can be checked.
+	 * \return Why the program cannot be optimized, empty if it can
+	 */
+	static std::string check(const OptimizerCode& code)
+	{
+		const size_t count = code.decoded.size();
+		std::vector<bool> targeted(count, false);
+		targeted[code.entry] = true;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const DecodedInstruction& d = code.decoded[i];
+			const RegisterAccess x = access(d);
+			const std::string where = "instruction " + std::to_string(address(i));
+
+			if (d.op == DecodedOp::callr)
+				return where + " calls through a register.";
+
+			// fibers start at computed addresses, and switch the registers and stack
+			if (d.op == DecodedOp::fspawn || d.op == DecodedOp::fyield || d.op == DecodedOp::fjoin)
+				return where + " uses fibers.";
+
+			if (x.reads[ip_register] || (x.writes[ip_register] && d.op != DecodedOp::pop))
+				return where + " names ip.";
+
+			if (d.op == DecodedOp::cjmp || d.op == DecodedOp::call)
+			{
+				if (d.imm % Instruction::size() != 0 || target(d) >= count)
+					return where + " jumps outside of the program.";
+
+				if (d.imm != address(i))
+					targeted[target(d)] = true;
+			}
+		}
+
+		// computed jumps have to be returns, the return address being popped right before in the same block
+		for (size_t i = 0; i < count; ++i)
+		{
+			const DecodedInstruction& d = code.decoded[i];
+
+			if (d.op != DecodedOp::cjmpr)
+				continue;
+
+			bool popped = false;
+
+			for (size_t j = i; j-- > 0 && !targeted[j + 1] && !ends_block(code.decoded[j]);)
+			{
+				if (writes_register(code.decoded[j], d.a))
+				{
+					popped = code.decoded[j].op == DecodedOp::pop;
+					break;
+				}
+			}
+
+			if (!popped)
+				return "instruction " + std::to_string(address(i)) + " jumps to a register which is not a popped return "
+					   "address.";
+		}
+
+		return "";
+	}
+
+	/**
+	 * Splits a program into basic blocks, leaders being the entry point, jump and call targets, and the instructions
+	 * following the end of a block.
+	 */
+	static void split(OptimizerCode& code)
+	{
+		const size_t count = code.decoded.size();
+		std::vector<bool> leader(count, false);
+		leader[0] = true;
+		leader[code.entry] = true;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const DecodedInstruction& d = code.decoded[i];
+
+			if ((d.op == DecodedOp::cjmp || d.op == DecodedOp::call) && d.imm != address(i))
+				leader[target(d)] = true;
+
+			if (ends_block(d) && i + 1 < count)
+				leader[i + 1] = true;
+		}
+
+		code.blocks.clear();
+		code.block_of.resize(count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (leader[i])
+				code.blocks.push_back(OptimizerBlock{i, i});
+
+			code.blocks.back().end = i + 1;
+			code.block_of[i] = code.blocks.size() - 1;
+		}
+	}
+
+	static void set(KnownState& state, const uint16_t r, const KnownValue value)
+	{
+		state[r] = value;
+
+		if (r == fl_register)
+			state[boolean_slot] = KnownValue{value.known && value.value <= 1, 0};
+	}
+
+	/**
+	 * \return TEST flag, if fl is known
+	 */
+	static KnownValue test(const KnownState& state)
+	{
+		const KnownValue& fl = state[fl_register];
+		return KnownValue{fl.known, (fl.value & test_mask) != 0};
+	}
+
+	/**
+	 * Computes the TEST flag a comparison sets, which is the whole of fl.
+	 */
+	static KnownValue compare(const KnownState& state, const DecodedInstruction& d)
+	{
+		if (d.a == d.b)
+			return KnownValue{true, d.op == DecodedOp::teq};
+
+		const KnownValue& a = state[d.a];
+		const KnownValue& b = state[d.b];
+
+		if (!a.known || !b.known)
+			return KnownValue{false, 0};
+
+		switch (d.op)
+		{
+		case DecodedOp::teq: return KnownValue{true, a.value == b.value};
+		case DecodedOp::tgt: return KnownValue{true, a.value > b.value};
+		default: return KnownValue{true, a.value < b.value};
+		}
+	}
+
+	/**
+	 * Computes the result of an instruction which only writes one register, when its operands are known.
+	 * \param state Values before the instruction
+	 * \param d Instruction
+	 * \param destination Register written
+	 * \param value Value written
+	 * \return Whether the result is known
+	 */
+	static bool fold(const KnownState& state, const DecodedInstruction& d, uint16_t& destination, vmreg_t& value)
+	{
+		const KnownValue a = state[d.a];
+		const KnownValue b = state[d.b];
+		const KnownValue c = state[d.c];
+
+		switch (d.op)
+		{
+		case DecodedOp::mov:
+			destination = d.b;
+			value = a.value;
+			return a.known;
+
+		case DecodedOp::imm:
+			destination = d.b;
+			value = d.imm;
+			return true;
+
+		case DecodedOp::sbit:
+			destination = d.a;
+			value = (a.value & ~(vmreg_t(1) << d.b)) | vmreg_t(d.c) << d.b;
+			return a.known;
+
+		case DecodedOp::gbit:
+			destination = d.b;
+			value = (a.value >> d.c) & 1;
+			return a.known;
+
+		// shift amounts are taken modulo 32
+		case DecodedOp::shr:
+			destination = d.b;
+			value = a.value >> (c.value & 31);
+			return a.known && c.known;
+
+		case DecodedOp::shl:
+			destination = d.b;
+			value = a.value << (c.value & 31);
+			return a.known && c.known;
+
+		case DecodedOp::inc:
+			destination = d.a;
+			value = a.value + 1;
+			return a.known;
+
+		case DecodedOp::dec:
+			destination = d.a;
+			value = a.value - 1;
+			return a.known;
+
+		case DecodedOp::uadd:
+			destination = d.c;
+			value = a.value + b.value;
+			return a.known && b.known;
+
+		case DecodedOp::usub:
+			destination = d.c;
+			value = a.value - b.value;
+			return a.known && b.known;
+
+		case DecodedOp::umul:
+			destination = d.c;
+			value = a.value * b.value;
+			return a.known && b.known;
+
+		case DecodedOp::udiv:
+			destination = d.c;
+			value = b.value != 0 ? a.value / b.value : 0;
+			return a.known && b.known && b.value != 0;
+
+		case DecodedOp::umod:
+			destination = d.c;
+			value = b.value != 0 ? a.value % b.value : 0;
+			return a.known && b.known && b.value != 0;
+
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Updates the known values with the effect of an instruction.
+	 */
+	static void step(KnownState& state, const DecodedInstruction& d)
+	{
+		uint16_t destination;
+		vmreg_t value;
+
+		if (fold(state, d, destination, value))
+		{
+			set(state, destination, KnownValue{true, value});
+			return;
+		}
+
+		const KnownValue sp = state[sp_register];
+
+		switch (d.op)
+		{
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+			set(state, fl_register, compare(state, d));
+			state[boolean_slot] = KnownValue{true, 0};
+			return;
+
+		case DecodedOp::mcmp:
+		case DecodedOp::mfind:
+			state[d.imm] = KnownValue{false, 0};
+			state[fl_register] = KnownValue{false, 0};
+			state[boolean_slot] = KnownValue{true, 0};
+			return;
+
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+			if (state[d.b].known && state[d.b].value == 0)
+				return;
+			break;
+
+		case DecodedOp::call:
+		case DecodedOp::push:
+			set(state, sp_register, KnownValue{sp.known, static_cast<vmreg_t>(sp.value + sizeof(vmreg_t))});
+			return;
+
+		case DecodedOp::pop:
+			set(state, d.a, KnownValue{false, 0});
+			set(state, sp_register, KnownValue{state[sp_register].known,
+											   static_cast<vmreg_t>(state[sp_register].value - sizeof(vmreg_t))});
+			return;
+
+		default:
+			break;
+		}
+
+		const RegisterSet writes = access(d).writes;
+
+		for (size_t r = 0; r < writes.size(); ++r)
+		{
+			if (writes[r])
+				set(state, static_cast<uint16_t>(r), KnownValue{false, 0});
+		}
+	}
+
+	/**
+	 * Merges the values reaching a block from another path.
+	 * \return Whether the values at the entry of the block changed
+	 */
+	static bool meet(KnownState& state, const KnownState& incoming)
+	{
+		if (state.empty())
+		{
+			state = incoming;
+			return true;
+		}
+
+		bool changed = false;
+
+		for (size_t r = 0; r < state.size(); ++r)
+		{
+			if (state[r].known && (!incoming[r].known || incoming[r].value != state[r].value))
+			{
+				state[r].known = false;
+				changed = true;
+			}
+		}
+
+		return changed;
+	}
+
+	/**
+	 * Propagates constants through the control flow graph from the entry point, return sites being reached with
+	 * unknown values. Jumps whose TEST flag is known are only followed the way they go.
+	 * \return Values at the entry of each block, empty for unreachable blocks
+	 */
+	static std::vector<KnownState> propagate_constants(const OptimizerCode& code)
+	{
+		const size_t count = code.decoded.size();
+		const KnownState unknown(Registers::size() + 1, KnownValue{false, 0});
+		const bool global = code.blocks.size() * unknown.size() <= max_global_states;
+
+		std::vector<KnownState> states(code.blocks.size());
+		std::vector<bool> queued(code.blocks.size(), false);
+		std::vector<size_t> work;
+
+		const auto reach = [&](const size_t first, const KnownState& state) {
+			const size_t b = code.block_of[first];
+
+			if (meet(states[b], global ? state : unknown) && !queued[b])
+			{
+				queued[b] = true;
+				work.push_back(b);
+			}
+		};
+
+		reach(code.entry, unknown);
+
+		while (!work.empty())
+		{
+			const size_t b = work.back();
+			work.pop_back();
+			queued[b] = false;
+
+			const OptimizerBlock& block = code.blocks[b];
+			KnownState state = states[b];
+
+			for (size_t i = block.first; i < block.end; ++i)
+				step(state, code.decoded[i]);
+
+			const size_t last = block.end - 1;
+			const DecodedInstruction& d = code.decoded[last];
+			const bool falls = block.end < count;
+			const KnownValue flag = test(state);
+			const bool taken = !flag.known || flag.value != 0;
+			const bool not_taken = !flag.known || flag.value == 0;
+
+			switch (d.op)
+			{
+			case DecodedOp::cjmp:
+				if (d.imm != address(last) && taken)
+					reach(target(d), state);
+				if (falls && (d.imm == address(last) || not_taken))
+					reach(block.end, state);
+				break;
+
+			case DecodedOp::cjmpr:
+				if (falls && not_taken)
+					reach(block.end, state);
+				break;
+
+			case DecodedOp::call:
+				if (d.imm != address(last))
+					reach(target(d), state);
+				if (falls)
+					reach(block.end, unknown);
+				break;
+
+			case DecodedOp::exit:
+			case DecodedOp::invalid:
+				break;
+
+			default:
+				if (falls && !(d.op == DecodedOp::pop && d.a == ip_register))
+					reach(block.end, state);
+				break;
+			}
+		}
+
+		return states;
+	}
+
+	/**
+	 * Replaces the operands of an instruction only read from by the register they are a copy of.
+	 * \return Number of operands replaced
+	 */
+	static size_t propagate_copies(DecodedInstruction& d, const std::vector<uint16_t>& copy_of)
+	{
+		size_t replaced = 0;
+
+		const auto use = [&](uint16_t& r) {
+			if (r < copy_of.size() && copy_of[r] != r)
+			{
+				r = copy_of[r];
+				++replaced;
+			}
+		};
+
+		switch (d.op)
+		{
+		case DecodedOp::mov:
+		case DecodedOp::mget:
+		case DecodedOp::gbit:
+		case DecodedOp::push:
+			use(d.a);
+			break;
+
+		case DecodedOp::mset:
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+		case DecodedOp::uadd:
+		case DecodedOp::usub:
+		case DecodedOp::umul:
+		case DecodedOp::udiv:
+		case DecodedOp::umod:
+		case DecodedOp::vsum:
+		case DecodedOp::aadd:
+		case DecodedOp::axchg:
+			use(d.a);
+			use(d.b);
+			break;
+
+		// the expected value of acas is also its destination
+		case DecodedOp::acas:
+			use(d.a);
+			use(d.c);
+			break;
+
+		case DecodedOp::shr:
+		case DecodedOp::shl:
+			use(d.a);
+			use(d.c);
+			break;
+
+		case DecodedOp::mcpy:
+		case DecodedOp::mfill:
+		case DecodedOp::vadd:
+		case DecodedOp::vxor:
+		case DecodedOp::mcmp:
+		case DecodedOp::mfind:
+			use(d.a);
+			use(d.b);
+			use(d.c);
+			break;
+
+		default:
+			break;
+		}
+
+		return replaced;
+	}
+
+	/**
+	 * Updates the copies known within a block after an instruction. Only general purpose registers are tracked.
+	 */
+	static void track_copies(std::vector<uint16_t>& copy_of, const DecodedInstruction& d)
+	{
+		const RegisterSet writes = access(d).writes;
+
+		for (uint16_t w = Registers::sp_count(); w < copy_of.size(); ++w)
+		{
+			if (!writes[w])
+				continue;
+
+			for (uint16_t& source : copy_of)
+			{
+				if (source == w)
+					source = static_cast<uint16_t>(&source - copy_of.data());
+			}
+
+			copy_of[w] = w;
+		}
+
+		if (d.op == DecodedOp::mov && d.a != d.b && d.a >= Registers::sp_count() && d.b >= Registers::sp_count())
+			copy_of[d.b] = copy_of[d.a];
+	}
+
+	/**
+	 * Follows a taken jump through the jumps it lands on which are taken as well: jumps, and jumps preceded by a
+	 * teq of a register with itself, which sets fl to 1.
+	 * \param decoded Program
+	 * \param jump Index of the jump
+	 * \param first Index of its target
+	 * \param exact Whether fl is 1 when the jump is taken, rather than any odd value
+	 * \return Index of the last target of the chain
+	 */
+	static size_t thread_jump(const std::vector<DecodedInstruction>& decoded, const size_t jump, const size_t first,
+							  const bool exact)
+	{
+		const size_t count = decoded.size();
+
+		const auto follow = [&](const size_t i) {
+			return decoded[i].imm == address(i) ? i + 1 : target(decoded[i]);
+		};
+
+		size_t current = first;
+
+		for (size_t hops = 0; hops < max_hops; ++hops)
+		{
+			const DecodedInstruction& d = decoded[current];
+			size_t next = count;
+
+			if (d.op == DecodedOp::cjmp)
+				next = follow(current);
+			else if (exact && d.op == DecodedOp::teq && d.a == d.b && current + 1 < count
+					 && decoded[current + 1].op == DecodedOp::cjmp)
+				next = follow(current + 1);
+
+			// landing on the jump itself would turn it into a fall through
+			if (next >= count || next == jump)
+				break;
+
+			current = next;
+		}
+
+		return current;
+	}
+
+	/**
+	 * Removes instructions and relocates the targets of jumps and calls and the entry point, a removed target
+	 * becoming the next instruction kept.
+	 *
+	 * A jump or call whose target would become itself, which falls through, gets the instruction it targeted
+	 * back. The last instruction is always kept, so that the code keeps ending at the same place relative to its
+	 * last instruction.
+	 * \param code Program
+	 * \param removed Instructions to remove
+	 * \param partner Other instruction rewritten along with an instruction, restored with it, or the number of
+	 *        instructions
+	 * \param original Instructions before the rewrite
+	 */
+	static void compact(OptimizerCode& code, std::vector<bool>& removed, const std::vector<size_t>& partner,
+						const std::vector<Instruction>& original)
+	{
+		const size_t count = code.instructions.size();
+
+		const auto restore = [&](const size_t i) {
+			for (const size_t j : {i, partner[i]})
+			{
+				if (j < count)
+				{
+					removed[j] = false;
+					code.instructions[j] = original[j];
+					code.decoded[j] = decode(original[j]);
+				}
+			}
+		};
+
+		if (removed[count - 1])
+			restore(count - 1);
+
+		// kept[i] is the new index of the first instruction kept from i on
+		std::vector<size_t> kept(count + 1);
+		bool stable = false;
+
+		while (!stable)
+		{
+			stable = true;
+			kept[0] = 0;
+
+			for (size_t i = 0; i < count; ++i)
+				kept[i + 1] = kept[i] + (removed[i] ? 0 : 1);
+
+			for (size_t i = 0; i < count && stable; ++i)
+			{
+				const DecodedInstruction& d = code.decoded[i];
+
+				if (!removed[i] && (d.op == DecodedOp::cjmp || d.op == DecodedOp::call) && d.imm != address(i)
+					&& kept[target(d)] == kept[i])
+				{
+					restore(target(d));
+					stable = false;
+				}
+			}
+		}
+
+		std::vector<Instruction> instructions;
+		std::vector<DecodedInstruction> decoded;
+		instructions.reserve(kept[count]);
+		decoded.reserve(kept[count]);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (removed[i])
+				continue;
+
+			DecodedInstruction d = code.decoded[i];
+			Instruction instruction = code.instructions[i];
+
+			if ((d.op == DecodedOp::cjmp || d.op == DecodedOp::call) && address(kept[target(d)]) != d.imm)
+			{
+				d.imm = address(kept[target(d)]);
+				instruction = encode(d);
+			}
+
+			instructions.push_back(instruction);
+			decoded.push_back(d);
+		}
+
+		code.instructions.swap(instructions);
+		code.decoded.swap(decoded);
+		code.entry = kept[code.entry];
+		split(code);
+	}
+
+	/**
+	 * Folds constants, propagates copies, threads jumps and removes unreachable code and jumps never taken.
+	 * \return Whether the program changed
+	 */
+	static bool simplify(OptimizerCode& code, OptimizerStats& stats)
+	{
+		const size_t count = code.decoded.size();
+		const std::vector<KnownState> states = propagate_constants(code);
+		const std::vector<Instruction> original = code.instructions;
+		const std::vector<DecodedInstruction> decoded = code.decoded;
+
+		std::vector<bool> removed(count, false);
+		std::vector<size_t> partner(count, count);
+		std::vector<uint16_t> copy_of(Registers::size());
+		bool changed = false;
+
+		const auto rewrite = [&](const size_t i, const DecodedInstruction& d) {
+			code.decoded[i] = d;
+			code.instructions[i] = encode(d);
+			changed = true;
+		};
+
+		// the last instruction is kept, see compact()
+		const auto remove = [&](const size_t i, size_t& counter) {
+			if (i + 1 == count)
+				return;
+
+			removed[i] = true;
+			++counter;
+			changed = true;
+		};
+
+		for (size_t b = 0; b < code.blocks.size(); ++b)
+		{
+			const OptimizerBlock& block = code.blocks[b];
+
+			if (states[b].empty())
+			{
+				for (size_t i = block.first; i < block.end; ++i)
+					remove(i, stats.unreachable);
+
+				continue;
+			}
+
+			KnownState state = states[b];
+
+			for (size_t r = 0; r < copy_of.size(); ++r)
+				copy_of[r] = static_cast<uint16_t>(r);
+
+			for (size_t i = block.first; i < block.end; ++i)
+			{
+				DecodedInstruction d = code.decoded[i];
+				const size_t replaced = propagate_copies(d, copy_of);
+
+				if (replaced != 0)
+				{
+					stats.propagated += replaced;
+					rewrite(i, d);
+				}
+
+				// a push popped right away only copies a register, leaving a stale value above sp
+				if (d.op == DecodedOp::push && i + 1 < block.end && i + 2 < count && decoded[i + 1].op == DecodedOp::pop)
+				{
+					const uint16_t destination = decoded[i + 1].a;
+
+					if (d.a != sp_register && destination != sp_register && destination != ip_register)
+					{
+						if (d.a == destination)
+							removed[i] = true;
+						else
+							rewrite(i, make_mov(d.a, destination));
+
+						removed[i + 1] = true;
+						partner[i] = i + 1;
+						partner[i + 1] = i;
+						++stats.pairs;
+						changed = true;
+
+						step(state, make_mov(d.a, destination));
+						track_copies(copy_of, make_mov(d.a, destination));
+						++i;
+						continue;
+					}
+				}
+
+				uint16_t destination;
+				vmreg_t value;
+
+				if (access(d).pure && fold(state, d, destination, value))
+				{
+					if (state[destination].known && state[destination].value == value)
+					{
+						remove(i, stats.folded);
+						continue;
+					}
+
+					if (d.op != DecodedOp::imm)
+					{
+						d = make_imm(value, destination);
+						rewrite(i, d);
+						++stats.folded;
+					}
+				}
+
+				switch (d.op)
+				{
+				case DecodedOp::teq:
+				case DecodedOp::tgt:
+				case DecodedOp::tlt: {
+					const KnownValue flag = compare(state, d);
+
+					if (flag.known && state[fl_register].known && state[fl_register].value == flag.value)
+					{
+						remove(i, stats.folded);
+						continue;
+					}
+				} break;
+
+				case DecodedOp::udiv:
+				case DecodedOp::umod:
+					if (state[d.b].known && state[d.b].value == 0)
+					{
+						remove(i, stats.folded);
+						continue;
+					}
+					break;
+
+				case DecodedOp::mov:
+					if (d.a == d.b || (d.b < copy_of.size() && copy_of[d.b] == d.a))
+					{
+						remove(i, stats.folded);
+						continue;
+					}
+					break;
+
+				case DecodedOp::cjmp: {
+					const KnownValue flag = test(state);
+
+					if (d.imm == address(i) || target(d) == i + 1 || (flag.known && flag.value == 0))
+					{
+						remove(i, stats.jumps);
+						continue;
+					}
+
+					// fl is 1 when a comparison result is taken, so following a teq of a register with itself is
+					// harmless
+					const bool exact = state[boolean_slot].known || (flag.known && state[fl_register].value == 1);
+					const size_t threaded = thread_jump(decoded, i, target(d), exact);
+
+					if (threaded != target(d))
+					{
+						d.imm = address(threaded);
+						rewrite(i, d);
+						++stats.threaded;
+					}
+				} break;
+
+				case DecodedOp::cjmpr:
+					if (test(state).known && test(state).value == 0)
+					{
+						remove(i, stats.jumps);
+						continue;
+					}
+					break;
+
+				default:
+					break;
+				}
+
+				step(state, d);
+				track_copies(copy_of, d);
+			}
+		}
+
+		if (changed)
+			compact(code, removed, partner, original);
+
+		return changed;
+	}
+
+	/**
+	 * Removes pure instructions whose results are not read on any path, registers being all live after computed
+	 * jumps and the outputs after exit and traps.
+	 * \return Whether the program changed
+	 */
+	static bool eliminate_dead(OptimizerCode& code, const RegisterSet& outputs, OptimizerStats& stats)
+	{
+		const size_t count = code.decoded.size();
+		RegisterSet all;
+		all.set();
+
+		std::vector<RegisterSet> live_in(code.blocks.size());
+
+		const auto live_out = [&](const OptimizerBlock& block) {
+			const size_t last = block.end - 1;
+			const DecodedInstruction& d = code.decoded[last];
+			const RegisterSet next = block.end < count ? live_in[code.block_of[block.end]] : all;
+
+			switch (d.op)
+			{
+			case DecodedOp::cjmp:
+				return d.imm == address(last) ? next : next | live_in[code.block_of[target(d)]];
+
+			case DecodedOp::call:
+				return d.imm == address(last) ? next : live_in[code.block_of[target(d)]];
+
+			case DecodedOp::cjmpr:
+				return all;
+
+			case DecodedOp::exit:
+			case DecodedOp::invalid:
+				return outputs;
+
+			default:
+				return d.op == DecodedOp::pop && d.a == ip_register ? all : next;
+			}
+		};
+
+		// instructions are visited backwards, removed is only filled in once liveness is stable
+		const auto transfer = [&](const OptimizerBlock& block, RegisterSet live, std::vector<bool>* removed) {
+			for (size_t i = block.end; i-- > block.first;)
+			{
+				const RegisterAccess x = access(code.decoded[i]);
+
+				if (x.pure && (x.writes & live).none() && i + 1 < count)
+				{
+					if (removed != nullptr)
+						(*removed)[i] = true;
+
+					continue;
+				}
+
+				live &= ~x.writes;
+				live |= x.reads;
+			}
+
+			return live;
+		};
+
+		bool stable = false;
+
+		while (!stable)
+		{
+			stable = true;
+
+			for (size_t b = code.blocks.size(); b-- > 0;)
+			{
+				const RegisterSet live = transfer(code.blocks[b], live_out(code.blocks[b]), nullptr);
+
+				if (live != live_in[b])
+				{
+					live_in[b] = live;
+					stable = false;
+				}
+			}
+		}
+
+		std::vector<bool> removed(count, false);
+
+		for (const OptimizerBlock& block : code.blocks)
+			transfer(block, live_out(block), &removed);
+
+		const size_t dead = static_cast<size_t>(std::count(removed.begin(), removed.end(), true));
+
+		if (dead == 0)
+			return false;
+
+		stats.dead += dead;
+		compact(code, removed, std::vector<size_t>(count, count), code.instructions);
+		return true;
+	}
+
+	OptimizedProgram optimize(const std::vector<Instruction>& program, const vmreg_t entry, const vmreg_t initial_sp,
+							  const std::vector<uint16_t>& outputs)
+	{
+		OptimizedProgram result{program, entry, initial_sp,
+								OptimizerStats{program.size(), program.size(), 0, 0, 0, 0, 0, 0, 0, ""}};
+
+		if (program.empty() || entry % Instruction::size() != 0 || entry / Instruction::size() >= program.size())
+		{
+			result.stats.diagnostic = "the entry point is not an instruction of the program.";
+			return result;
+		}
+
+		OptimizerCode code;
+		code.instructions = program;
+		code.decoded.reserve(program.size());
+		code.entry = entry / Instruction::size();
+
+		for (const Instruction& instruction : program)
+			code.decoded.push_back(decode(instruction));
+
+		result.stats.diagnostic = check(code);
+
+		if (!result.stats.diagnostic.empty())
+			return result;
+
+		RegisterSet observed;
+
+		if (outputs.empty())
+			observed.set();
+
+		for (const uint16_t r : outputs)
+		{
+			if (r < Registers::size())
+				observed.set(r);
+		}
+
+		split(code);
+
+		for (size_t round = 0; round < max_rounds; ++round)
+		{
+			const bool simplified = simplify(code, result.stats);
+			const bool eliminated = eliminate_dead(code, observed, result.stats);
+
+			if (!simplified && !eliminated)
+				break;
+		}
+
+		result.program.swap(code.instructions);
+		result.entry = address(code.entry);
+		result.stats.instructions_after = result.program.size();
+		return result;
+	}
+
+	OptimizedProgram optimize(const ProgramImage& image, const std::vector<uint16_t>& outputs)
+	{
+		std::vector<Instruction> program(image.size() / Instruction::size());
+		deserialize_instructions(image.code(), program.size(), program.data());
+		return optimize(program, image.entry(), image.initial_sp(), outputs);
+	}
+}
@@ -0,0 +1,131 @@
+#ifndef THALLIUMVM_OPTIMIZER_HPP
+#define THALLIUMVM_OPTIMIZER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "image.hpp"
+#include "instruction.hpp"
+#include "register.hpp"
+
+namespace thallium
+{
+	/**
+	 * What optimize() did to a program
+	 */
+	struct OptimizerStats
+	{
+		/**
+		 * Number of instructions of the original program
+		 */
+		size_t instructions_before;
+
+		/**
+		 * Number of instructions of the optimized program
+		 */
+		size_t instructions_after;
+
+		/**
+		 * Instructions whose result was known, replaced by an imm or removed when they did not change anything
+		 */
+		size_t folded;
+
+		/**
+		 * Operands replaced by the register they were a copy of
+		 */
+		size_t propagated;
+
+		/**
+		 * Instructions removed because nothing read what they wrote
+		 */
+		size_t dead;
+
+		/**
+		 * Instructions removed because no path from the entry point reached them
+		 */
+		size_t unreachable;
+
+		/**
+		 * Jumps retargeted past a chain of jumps
+		 */
+		size_t threaded;
+
+		/**
+		 * Jumps removed because they were never taken or went to the next instruction
+		 */
+		size_t jumps;
+
+		/**
+		 * Adjacent push and pop pairs replaced by a mov
+		 */
+		size_t pairs;
+
+		/**
+		 * Why the program was left as is, empty if it was optimized
+		 */
+		std::string diagnostic;
+	};
+
+	/**
+	 * Program rewritten by optimize()
+	 */
+	struct OptimizedProgram
+	{
+		/**
+		 * Optimized instructions
+		 */
+		std::vector<Instruction> program;
+
+		/**
+		 * Address of the first instruction to run, relocated
+		 */
+		vmreg_t entry;
+
+		/**
+		 * Initial value of sp, unchanged
+		 */
+		vmreg_t initial_sp;
+
+		OptimizerStats stats;
+	};
+
+	/**
+	 * Optimizes a program offline: constant propagation, copy propagation, dead code elimination and jump threading,
+	 * followed by the relocation of every static jump and call.
+	 *
+	 * Constants are propagated across basic blocks from the entry point, jumps whose TEST flag is known being only
+	 * followed one way, then pure instructions whose result is known are replaced by an imm. Registers copied by a mov
+	 * are replaced by their source within a block, a push immediately popped becomes a mov, and pure instructions
+	 * whose results are not read anymore are removed, as well as unreachable blocks and jumps never taken. Jumps to
+	 * another jump taken whatever the registers are retargeted to the end of the chain. Passes repeat until the
+	 * program stops changing.<br>
+	 * The program has to follow a few rules for the rewrite to be valid:
+	 * - it does not read or write its own code, as it moves
+	 * - static jumps and calls target the beginning of an instruction, or the jump itself to fall through
+	 * - computed jumps only go to return addresses pushed by call, through a cjmpr on a register popped in the same
+	 *   block or a pop into ip, and there is no callr
+	 * - no other instruction reads ip or writes to it
+	 * - memory above sp is not read back after a pop
+	 * Programs breaking one of the rules that can be checked are returned unchanged with a diagnostic. The rewrite
+	 * keeps the registers and memory at exit, but not ip, the number of instructions run, nor the state at a trap or
+	 * when the fuel runs out.
+	 * \param program The ThalliumVM program
+	 * \param entry Address of the first instruction to run
+	 * \param initial_sp Initial value of sp
+	 * \param outputs Registers read by the host after exit, every register if empty
+	 * \return Optimized program and what was done
+	 */
+	OptimizedProgram optimize(const std::vector<Instruction>& program, const vmreg_t entry, const vmreg_t initial_sp,
+							  const std::vector<uint16_t>& outputs = {});
+
+	/**
+	 * Optimizes the program of an image, with its entry point and initial sp, see the overload taking instructions.
+	 * \param image Image of the program
+	 * \param outputs Registers read by the host after exit, every register if empty
+	 * \return Optimized program and what was done
+	 */
+	OptimizedProgram optimize(const ProgramImage& image, const std::vector<uint16_t>& outputs = {});
+}
+
+#endif
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cstring>
+#include "paged_memory.hpp"
+#include "error.hpp"
+
+namespace thallium
+{
+	PagedMemory::Table::Table()
+	{
+		pages.fill(nullptr);
+		owned.fill(false);
+	}
+
+	PagedMemory::Table::~Table()
+	{
+		for (size_t i = 0; i < pages.size(); ++i)
+		{
+			if (owned[i])
+				delete[] pages[i];
+		}
+	}
+
+	PagedMemory::PagedMemory(const size_t size, const MemoryMode) :
+		_size(size),
+		_tables((size + page_size() * table_pages() - 1) / (page_size() * table_pages())),
+		_resident(0)
+	{}
+
+	uint8_t* PagedMemory::data()
+	{
+		return nullptr;
+	}
+
+	size_t PagedMemory::size() const
+	{
+		return _size;
+	}
+
+	void PagedMemory::map(const ProgramImage& image)
+	{
+		tassert(image.size() <= _size,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program may not fit in memory.");
+
+		zero(0, _size);
+
+		const size_t full_pages = image.size() / page_size();
+		for (size_t index = 0; index < full_pages; ++index)
+		{
+			auto& table = _tables[index / table_pages()];
+			if (!table)
+				table.reset(new Table);
+
+			table->pages[index % table_pages()] = image.code() + index * page_size();
+		}
+
+		const size_t mapped = full_pages * page_size();
+		write(static_cast<vmreg_t>(mapped), image.code() + mapped, image.size() - mapped);
+	}
+
+	void PagedMemory::zero(const size_t begin, const size_t end)
+	{
+		if (begin >= end)
+			return;
+
+		const size_t page_begin = (begin + page_size() - 1) / page_size();
+		const size_t page_end = end >= _size ? (_size + page_size() - 1) / page_size() : end / page_size();
+
+		if (page_begin >= page_end)
+		{
+			// the range is inside a single page, only clear it if it was ever written to
+			uint8_t* p = page(begin) != nullptr ? writable_page(begin) : nullptr;
+			if (p != nullptr)
+				std::memset(p + begin % page_size(), 0, end - begin);
+			return;
+		}
+
+		if (begin % page_size() != 0 && page(begin) != nullptr)
+			std::memset(writable_page(begin) + begin % page_size(), 0, page_size() - begin % page_size());
+
+		for (size_t index = page_begin; index < page_end; ++index)
+		{
+			if (!_tables[index / table_pages()])
+			{
+				// skip the rest of an unallocated table
+				index = (index / table_pages() + 1) * table_pages() - 1;
+				continue;
+			}
+
+			release(index);
+		}
+
+		if (end < _size && end % page_size() != 0 && page(end) != nullptr)
+			std::memset(writable_page(end), 0, end % page_size());
+	}
+
+	void PagedMemory::store(const vmreg_t address, const vmreg_t value)
+	{
+		if (address % page_size() + sizeof(vmreg_t) <= page_size())
+		{
+			uint8_t* p = writable_page(address);
+			if (p != nullptr)
+				serialize_type(value, p + address % page_size());
+			return;
+		}
+
+		uint8_t serialized[sizeof(vmreg_t)];
+		serialize_type(value, serialized);
+		write(address, serialized, sizeof(serialized));
+	}
+
+	const uint8_t* PagedMemory::bytes(const vmreg_t address, const size_t size, uint8_t* scratch) const
+	{
+		const size_t offset = address % page_size();
+		const uint8_t* first = page(address);
+
+		if (offset + size <= page_size() && first != nullptr)
+			return first + offset;
+
+		// the range reads as zeroes or spans two pages, gather it
+		const size_t head = std::min(size, page_size() - offset);
+		if (first != nullptr)
+			std::memcpy(scratch, first + offset, head);
+		else
+			std::memset(scratch, 0, head);
+
+		if (head < size)
+		{
+			const uint8_t* second = page(static_cast<vmreg_t>(address + head));
+			if (second != nullptr && static_cast<vmreg_t>(address + head) != 0)
+				std::memcpy(scratch + head, second, size - head);
+			else
+				std::memset(scratch + head, 0, size - head);
+		}
+
+		return scratch;
+	}
+
+	void PagedMemory::write(const vmreg_t address, const uint8_t* data, const size_t size)
+	{
+		size_t done = 0;
+		while (done < size && address + done < _size)
+		{
+			const size_t current = address + done;
+			const size_t chunk = std::min(size - done, page_size() - current % page_size());
+
+			uint8_t* p = writable_page(static_cast<vmreg_t>(current));
+			std::memcpy(p + current % page_size(), data + done, std::min(chunk, _size - current));
+			done += chunk;
+		}
+	}
+
+	void PagedMemory::move(const vmreg_t dst, const vmreg_t src, const size_t size)
+	{
+		uint8_t chunk_data[page_size()];
+
+		// when the destination runs ahead of the source, copying backwards keeps the bytes left to read intact
+		const bool backwards = dst > src && dst < size_t(src) + size;
+
+		for (size_t done = 0; done < size; )
+		{
+			const size_t chunk = std::min(size - done, page_size());
+			const size_t offset = backwards ? size - done - chunk : done;
+
+			const uint8_t* p = bytes(static_cast<vmreg_t>(src + offset), chunk, chunk_data);
+			if (p != chunk_data)
+				std::memcpy(chunk_data, p, chunk);
+
+			write(static_cast<vmreg_t>(dst + offset), chunk_data, chunk);
+			done += chunk;
+		}
+	}
+
+	void PagedMemory::fill(const vmreg_t dst, const uint8_t value, const size_t size)
+	{
+		uint8_t chunk_data[page_size()];
+		std::memset(chunk_data, value, std::min(size, page_size()));
+
+		for (size_t done = 0; done < size; )
+		{
+			const size_t chunk = std::min(size - done, page_size());
+			write(static_cast<vmreg_t>(dst + done), chunk_data, chunk);
+			done += chunk;
+		}
+	}
+
+	size_t PagedMemory::compare(const vmreg_t a, const vmreg_t b, const size_t size) const
+	{
+		uint8_t scratch_a[page_size()], scratch_b[page_size()];
+
+		for (size_t done = 0; done < size; )
+		{
+			const size_t chunk = std::min(size - done, page_size());
+			const size_t offset = bulk_compare(bytes(static_cast<vmreg_t>(a + done), chunk, scratch_a),
+											   bytes(static_cast<vmreg_t>(b + done), chunk, scratch_b), chunk);
+			if (offset != chunk)
+				return done + offset;
+
+			done += chunk;
+		}
+
+		return size;
+	}
+
+	size_t PagedMemory::find(const vmreg_t address, const uint8_t value, const size_t size) const
+	{
+		uint8_t scratch[page_size()];
+
+		for (size_t done = 0; done < size; )
+		{
+			const size_t chunk = std::min(size - done, page_size());
+			const size_t offset = bulk_find(bytes(static_cast<vmreg_t>(address + done), chunk, scratch), value, chunk);
+			if (offset != chunk)
+				return done + offset;
+
+			done += chunk;
+		}
+
+		return size;
+	}
+
+	void PagedMemory::add(const vmreg_t dst, const vmreg_t src, const size_t words)
+	{
+		combine(dst, src, words, bulk_add);
+	}
+
+	void PagedMemory::exclusive_or(const vmreg_t dst, const vmreg_t src, const size_t words)
+	{
+		combine(dst, src, words, bulk_xor);
+	}
+
+	void PagedMemory::combine(const vmreg_t dst, const vmreg_t src, const size_t words,
+							  void (*kernel)(uint8_t*, const uint8_t*, size_t))
+	{
+		uint8_t chunk_data[page_size()], scratch[page_size()];
+
+		const size_t size = words * sizeof(vmreg_t);
+		const bool backwards = dst > src && dst < size_t(src) + size;
+
+		for (size_t done = 0; done < size; )
+		{
+			const size_t chunk = std::min(size - done, page_size());
+			const size_t offset = backwards ? size - done - chunk : done;
+
+			// every chunk reads its source before writing, so only the order of the chunks matters
+			const uint8_t* d = bytes(static_cast<vmreg_t>(dst + offset), chunk, chunk_data);
+			if (d != chunk_data)
+				std::memcpy(chunk_data, d, chunk);
+
+			kernel(chunk_data, bytes(static_cast<vmreg_t>(src + offset), chunk, scratch), chunk / sizeof(vmreg_t));
+			write(static_cast<vmreg_t>(dst + offset), chunk_data, chunk);
+			done += chunk;
+		}
+	}
+
+	vmreg_t PagedMemory::sum(const vmreg_t address, const size_t words) const
+	{
+		uint8_t scratch[page_size()];
+
+		const size_t size = words * sizeof(vmreg_t);
+		vmreg_t sum = 0;
+
+		for (size_t done = 0; done < size; )
+		{
+			const size_t chunk = std::min(size - done, page_size());
+			sum += bulk_sum(bytes(static_cast<vmreg_t>(address + done), chunk, scratch), chunk / sizeof(vmreg_t));
+			done += chunk;
+		}
+
+		return sum;
+	}
+
+	bool PagedMemory::guarded() const
+	{
+		return false;
+	}
+
+	size_t PagedMemory::reserved() const
+	{
+		return 0;
+	}
+
+	size_t PagedMemory::resident_pages() const
+	{
+		return _resident;
+	}
+
+	uint8_t* PagedMemory::writable_page(const vmreg_t address)
+	{
+		if (address >= _size)
+			return nullptr;
+
+		const size_t index = address / page_size();
+		auto& table = _tables[index / table_pages()];
+		if (!table)
+			table.reset(new Table);
+
+		const size_t slot = index % table_pages();
+		if (!table->owned[slot])
+		{
+			// first write to a zero page or to a page shared with the image
+			uint8_t* copy = new uint8_t[page_size()]();
+			if (table->pages[slot] != nullptr)
+				std::memcpy(copy, table->pages[slot], page_size());
+
+			table->pages[slot] = copy;
+			table->owned[slot] = true;
+			++_resident;
+		}
+
+		return const_cast<uint8_t*>(table->pages[slot]);
+	}
+
+	void PagedMemory::release(const size_t index)
+	{
+		auto& table = _tables[index / table_pages()];
+		const size_t slot = index % table_pages();
+
+		if (table->owned[slot])
+		{
+			delete[] table->pages[slot];
+			--_resident;
+		}
+
+		table->pages[slot] = nullptr;
+		table->owned[slot] = false;
+	}
+}
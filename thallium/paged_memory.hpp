@@ -0,0 +1,238 @@
+#ifndef THALLIUMVM_PAGED_MEMORY_HPP
+#define THALLIUMVM_PAGED_MEMORY_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "image.hpp"
+#include "memory.hpp"
+#include "register.hpp"
+#include "serializer.hpp"
+
+namespace thallium
+{
+	/**
+	 * Sparse VM memory behind a two-level page table, for platforms without anonymous mappings.
+	 *
+	 * Pages are allocated on the first write; reading a page which was never written to yields zeroes without
+	 * allocating it. Full pages of an imported ProgramImage are shared with the image until written to.<br>
+	 * The interface matches Memory, except that data() is null as the memory is not contiguous.<br>
+	 * Every access goes through the page table, so out of bounds accesses never fault whatever the MemoryMode:
+	 * reads past the end of memory yield zeroes and writes are dropped.
+	 */
+	class PagedMemory
+	{
+	public:
+		/**
+		 * PagedMemory constructor, which only allocates the first level of the page table.
+		 * \param size Memory size in bytes
+		 * \param mode Unused, bounds are always enforced
+		 */
+		PagedMemory(const size_t size, const MemoryMode mode = MemoryMode::Flat);
+
+		PagedMemory(const PagedMemory&) = delete;
+		PagedMemory& operator=(const PagedMemory&) = delete;
+
+		/**
+		 * \return nullptr, paged memory cannot be accessed directly
+		 */
+		uint8_t* data();
+
+		/**
+		 * \return Memory size in bytes
+		 */
+		size_t size() const;
+
+		/**
+		 * Shares the full pages of an image at address 0, copies its last partial page and zeroes the rest.
+		 * \param image Image to map, which must fit in memory and outlive the mapping
+		 */
+		void map(const ProgramImage& image);
+
+		/**
+		 * Zeroes a range of memory, releasing the pages it fully covers.
+		 * \param begin First address of the range
+		 * \param end Address past the range
+		 */
+		void zero(const size_t begin, const size_t end);
+
+		/**
+		 * Reads a register-sized value.
+		 * \param address Address to read from
+		 * \return Value in memory, 0 past the end of memory
+		 */
+		vmreg_t load(const vmreg_t address) const
+		{
+			const size_t offset = address & (page_size() - 1);
+			if (offset + sizeof(vmreg_t) <= page_size())
+			{
+				const uint8_t* p = page(address);
+				return p != nullptr ? deserialize_type<vmreg_t>(p + offset) : 0;
+			}
+
+			uint8_t scratch[sizeof(vmreg_t)];
+			return deserialize_type<vmreg_t>(bytes(address, sizeof(vmreg_t), scratch));
+		}
+
+		/**
+		 * Writes a register-sized value, allocating its page if needed.
+		 * \param address Address to write to, writes past the end of memory are dropped
+		 * \param value Value to write
+		 */
+		void store(const vmreg_t address, const vmreg_t value);
+
+		/**
+		 * Returns a range of memory as contiguous bytes.
+		 * \param address First address of the range
+		 * \param size Size of the range, at most the page size
+		 * \param scratch Buffer of at least size bytes, used when the range spans two pages
+		 * \return Pointer to the bytes, valid until the next write
+		 */
+		const uint8_t* bytes(const vmreg_t address, const size_t size, uint8_t* scratch) const;
+
+		/**
+		 * Copies bytes to memory.
+		 * \param address Destination address, writes past the end of memory are dropped
+		 * \param data Bytes to copy
+		 * \param size Number of bytes
+		 */
+		void write(const vmreg_t address, const uint8_t* data, const size_t size);
+
+		/**
+		 * Returns a word for the atomic instructions, allocating its page if needed. Words never span two pages
+		 * since they are aligned.
+		 * \param address Address of the word, aligned to its size and below size()
+		 * \return Pointer to the bytes of the word, valid until the page is released
+		 */
+		uint8_t* word(const vmreg_t address)
+		{
+			return writable_page(address) + (address & (page_size() - 1));
+		}
+
+		// Range operations of the bulk memory instructions, matching the ones of Memory.
+		// Ranges must fit in memory, and are processed a page worth of bytes at a time.
+
+		/**
+		 * Copies a range of memory, which may overlap the destination.
+		 */
+		void move(const vmreg_t dst, const vmreg_t src, const size_t size);
+
+		/**
+		 * Sets a range of memory to a byte value.
+		 */
+		void fill(const vmreg_t dst, const uint8_t value, const size_t size);
+
+		/**
+		 * \return Offset of the first byte differing between two ranges, or size if they are equal
+		 */
+		size_t compare(const vmreg_t a, const vmreg_t b, const size_t size) const;
+
+		/**
+		 * \return Offset of the first occurrence of value in a range, or size if there is none
+		 */
+		size_t find(const vmreg_t address, const uint8_t value, const size_t size) const;
+
+		/**
+		 * Adds a range of words to another one, see bulk_add.
+		 */
+		void add(const vmreg_t dst, const vmreg_t src, const size_t words);
+
+		/**
+		 * Exclusive-ors a range of words into another one, see bulk_xor.
+		 */
+		void exclusive_or(const vmreg_t dst, const vmreg_t src, const size_t words);
+
+		/**
+		 * \return Sum of a range of words
+		 */
+		vmreg_t sum(const vmreg_t address, const size_t words) const;
+
+		/**
+		 * \return false, out of bounds accesses never fault
+		 */
+		bool guarded() const;
+
+		/**
+		 * \return 0, no host address range is reserved
+		 */
+		size_t reserved() const;
+
+		/**
+		 * \return Number of pages allocated by this memory, pages shared with the image excluded
+		 */
+		size_t resident_pages() const;
+
+		/**
+		 * \return Size of a page
+		 */
+		constexpr static size_t page_size()
+		{
+			return 4096;
+		}
+
+	private:
+		/**
+		 * Second level of the page table, covering table_pages() pages
+		 */
+		struct Table
+		{
+			Table();
+			~Table();
+
+			/**
+			 * Page contents, nullptr for zero pages
+			 */
+			std::array<const uint8_t*, 1024> pages;
+
+			/**
+			 * Whether each page was allocated by this memory rather than shared with the image
+			 */
+			std::array<bool, 1024> owned;
+		};
+
+		constexpr static size_t table_pages()
+		{
+			return 1024;
+		}
+
+		/**
+		 * \return Page containing an address, nullptr if it reads as zeroes
+		 */
+		const uint8_t* page(const vmreg_t address) const
+		{
+			const size_t index = address / page_size();
+			const size_t table = index / table_pages();
+			if (table >= _tables.size() || !_tables[table])
+				return nullptr;
+
+			return _tables[table]->pages[index % table_pages()];
+		}
+
+		/**
+		 * \return Private copy of the page containing an address, allocated if needed, or nullptr past the end
+		 *         of memory
+		 */
+		uint8_t* writable_page(const vmreg_t address);
+
+		/**
+		 * Combines a range of words into another one, a page worth at a time.
+		 * \param kernel bulk_add or bulk_xor
+		 */
+		void combine(const vmreg_t dst, const vmreg_t src, const size_t words,
+					 void (*kernel)(uint8_t*, const uint8_t*, size_t));
+
+		/**
+		 * Releases a page, which then reads as zeroes.
+		 * \param index Page index
+		 */
+		void release(const size_t index);
+
+		size_t _size;
+		std::vector<std::unique_ptr<Table>> _tables;
+		size_t _resident;
+	};
+}
+
+#endif
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include "profiler.hpp"
+
+namespace thallium
+{
+	static std::string address_string(const vmreg_t address)
+	{
+		std::ostringstream ss;
+		ss << "0x" << std::hex << std::setw(8) << std::setfill('0') << address;
+		return ss.str();
+	}
+
+	Profiler::Profiler()
+	{
+		reset();
+	}
+
+	void Profiler::reset()
+	{
+		_opcodes.fill(0);
+		_program_stats.assign(_program_stats.size(), InstructionStats{0, Opcode::__PLACEHOLDER_EXIT});
+		_other_stats.clear();
+		_branches.clear();
+		_loops.clear();
+
+		// the root node stands for the code outside of any call
+		_nodes.clear();
+		_nodes.push_back(Node{0, 0, 0, {}});
+		_frames.clear();
+	}
+
+	void Profiler::attach(const size_t program_size)
+	{
+		if (_program_stats.size() != program_size)
+			_program_stats.resize(program_size, InstructionStats{0, Opcode::__PLACEHOLDER_EXIT});
+
+		_frames.clear();
+	}
+
+	void Profiler::instruction(const vmreg_t ip, const Opcode op, const vmreg_t sp)
+	{
+		while (!_frames.empty() && sp < _frames.back().return_slot)
+			_frames.pop_back();
+
+		++_opcodes[static_cast<uint8_t>(op)];
+
+		InstructionStats& s = stats(ip);
+		++s.hits;
+		s.op = op;
+
+		++_nodes[_frames.empty() ? 0 : _frames.back().node].samples;
+	}
+
+	void Profiler::branch(const vmreg_t ip, const vmreg_t target, const bool taken, const bool indirect)
+	{
+		BranchStats& b = _branches[ip];
+		if (taken)
+		{
+			++b.taken;
+
+			if (!indirect && target <= ip)
+				++_loops[(uint64_t(target) << 32) | ip];
+		}
+		else
+		{
+			++b.not_taken;
+		}
+	}
+
+	void Profiler::call(const vmreg_t target, const vmreg_t sp)
+	{
+		const size_t parent = _frames.empty() ? 0 : _frames.back().node;
+
+		const auto it = _nodes[parent].children.find(target);
+		size_t node;
+		if (it != end(_nodes[parent].children))
+		{
+			node = it->second;
+		}
+		else
+		{
+			node = _nodes.size();
+			_nodes[parent].children[target] = node;
+			_nodes.push_back(Node{parent, target, 0, {}});
+		}
+
+		_frames.push_back(Frame{node, sp});
+	}
+
+	uint64_t Profiler::opcode_count(const Opcode op) const
+	{
+		return _opcodes[static_cast<uint8_t>(op)];
+	}
+
+	uint64_t Profiler::instruction_count() const
+	{
+		uint64_t total = 0;
+		for (const uint64_t c : _opcodes)
+			total += c;
+
+		return total;
+	}
+
+	uint64_t Profiler::hits(const vmreg_t ip) const
+	{
+		const InstructionStats* s = find_stats(ip);
+		return s != nullptr ? s->hits : 0;
+	}
+
+	Profiler::BranchStats Profiler::branch_stats(const vmreg_t ip) const
+	{
+		const auto it = _branches.find(ip);
+		return it != end(_branches) ? it->second : BranchStats{0, 0};
+	}
+
+	std::vector<Profiler::Loop> Profiler::hot_loops() const
+	{
+		std::vector<Loop> loops;
+		for (const auto& l : _loops)
+		{
+			loops.push_back(Loop{static_cast<vmreg_t>(l.first >> 32), static_cast<vmreg_t>(l.first), l.second});
+		}
+
+		std::sort(begin(loops), end(loops), [](const Loop& a, const Loop& b) {
+			return a.iterations > b.iterations;
+		});
+
+		return loops;
+	}
+
+	void Profiler::report(std::ostream& out, const size_t top) const
+	{
+		const uint64_t total = instruction_count();
+		const auto percent = [total](const uint64_t count) {
+			return total != 0 ? 100.0 * count / total : 0.0;
+		};
+
+		out << "profile: " << total << " instructions executed\n";
+
+		// opcodes
+		std::vector<std::pair<uint64_t, Opcode>> opcodes;
+		for (size_t i = 0; i < _opcodes.size(); ++i)
+		{
+			if (_opcodes[i] != 0)
+				opcodes.emplace_back(_opcodes[i], static_cast<Opcode>(i));
+		}
+		std::sort(begin(opcodes), end(opcodes), [](const std::pair<uint64_t, Opcode>& a, const std::pair<uint64_t, Opcode>& b) {
+			return a.first > b.first;
+		});
+
+		out << "\nopcodes:\n";
+		for (const auto& o : opcodes)
+		{
+			out << "  " << std::left << std::setw(8) << opcode_string(o.second) << std::right
+				<< std::setw(16) << o.first << std::fixed << std::setprecision(2) << std::setw(9) << percent(o.first) << "%\n";
+		}
+
+		// instructions
+		std::vector<std::pair<vmreg_t, InstructionStats>> instructions;
+		for (size_t i = 0; i < _program_stats.size(); ++i)
+		{
+			if (_program_stats[i].hits != 0)
+				instructions.emplace_back(static_cast<vmreg_t>(i * Instruction::size()), _program_stats[i]);
+		}
+		for (const auto& s : _other_stats)
+		{
+			instructions.push_back(s);
+		}
+		std::sort(begin(instructions), end(instructions), [](const std::pair<vmreg_t, InstructionStats>& a, const std::pair<vmreg_t, InstructionStats>& b) {
+			return a.second.hits > b.second.hits;
+		});
+
+		out << "\nhottest instructions:\n";
+		for (size_t i = 0; i < std::min(top, instructions.size()); ++i)
+		{
+			const auto& s = instructions[i];
+			out << "  " << address_string(s.first) << "  " << std::left << std::setw(8) << opcode_string(s.second.op) << std::right
+				<< std::setw(16) << s.second.hits << std::fixed << std::setprecision(2) << std::setw(9) << percent(s.second.hits) << "%\n";
+		}
+
+		// branches
+		std::vector<std::pair<vmreg_t, BranchStats>> branches(begin(_branches), end(_branches));
+		std::sort(begin(branches), end(branches), [](const std::pair<vmreg_t, BranchStats>& a, const std::pair<vmreg_t, BranchStats>& b) {
+			return a.second.taken + a.second.not_taken > b.second.taken + b.second.not_taken;
+		});
+
+		out << "\nbranches:" << std::setw(29) << "taken" << std::setw(17) << "not taken" << '\n';
+		for (size_t i = 0; i < std::min(top, branches.size()); ++i)
+		{
+			const auto& b = branches[i];
+			const uint64_t count = b.second.taken + b.second.not_taken;
+			out << "  " << address_string(b.first) << "  " << std::left << std::setw(8) << opcode_string(find_stats(b.first)->op) << std::right
+				<< std::setw(16) << b.second.taken << std::setw(17) << b.second.not_taken
+				<< std::fixed << std::setprecision(2) << std::setw(9) << (100.0 * b.second.taken / count) << "% taken\n";
+		}
+
+		// loops
+		const std::vector<Loop> loops = hot_loops();
+		out << "\nhot loops (backward branches):\n";
+		for (size_t i = 0; i < std::min(top, loops.size()); ++i)
+		{
+			out << "  " << address_string(loops[i].head) << " .. " << address_string(loops[i].latch)
+				<< std::setw(16) << loops[i].iterations << " iterations\n";
+		}
+	}
+
+	void Profiler::write_collapsed(std::ostream& out) const
+	{
+		for (const Node& node : _nodes)
+		{
+			if (node.samples == 0)
+				continue;
+
+			std::vector<vmreg_t> path;
+			for (const Node* n = &node; n != &_nodes[0]; n = &_nodes[n->parent])
+			{
+				path.push_back(n->function);
+			}
+
+			out << "program";
+			for (auto it = path.rbegin(); it != path.rend(); ++it)
+			{
+				out << ';' << address_string(*it);
+			}
+			out << ' ' << node.samples << '\n';
+		}
+	}
+
+	Profiler::InstructionStats& Profiler::stats(const vmreg_t ip)
+	{
+		const size_t slot = ip / Instruction::size();
+		if (slot < _program_stats.size() && slot * Instruction::size() == ip)
+			return _program_stats[slot];
+
+		return _other_stats[ip];
+	}
+
+	const Profiler::InstructionStats* Profiler::find_stats(const vmreg_t ip) const
+	{
+		const size_t slot = ip / Instruction::size();
+		if (slot < _program_stats.size() && slot * Instruction::size() == ip)
+			return &_program_stats[slot];
+
+		const auto it = _other_stats.find(ip);
+		return it != end(_other_stats) ? &it->second : nullptr;
+	}
+}
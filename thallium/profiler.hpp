@@ -0,0 +1,185 @@
+#ifndef THALLIUMVM_PROFILER_HPP
+#define THALLIUMVM_PROFILER_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "instruction.hpp"
+#include "register.hpp"
+
+namespace thallium
+{
+	/**
+	 * Execution profiler for ThalliumVM programs.
+	 *
+	 * Fed by VM::run(Profiler&, Engine), which runs a separately instantiated interpreter loop so that
+	 * unprofiled runs do not pay for it. Counts accumulate over runs until reset() is called.<br>
+	 * Calls are tracked through a shadow call stack: a frame is left as soon as sp drops below the slot
+	 * holding its return address.
+	 */
+	class Profiler
+	{
+	public:
+		/**
+		 * Taken / not taken counts of a conditional jump
+		 */
+		struct BranchStats
+		{
+			uint64_t taken;
+			uint64_t not_taken;
+		};
+
+		/**
+		 * Loop detected through a taken backward direct branch
+		 */
+		struct Loop
+		{
+			/**
+			 * Target of the backward branch
+			 */
+			vmreg_t head;
+
+			/**
+			 * Address of the backward branch
+			 */
+			vmreg_t latch;
+
+			uint64_t iterations;
+		};
+
+		Profiler();
+
+		/**
+		 * Clears every counter.
+		 */
+		void reset();
+
+		/**
+		 * Prepares the per-instruction counters for a program.
+		 * \param program_size Number of instructions of the imported program
+		 */
+		void attach(const size_t program_size);
+
+		/**
+		 * Records the execution of an instruction.
+		 * \param ip Address of the instruction
+		 * \param op Opcode of the instruction
+		 * \param sp Value of sp before the instruction
+		 */
+		void instruction(const vmreg_t ip, const Opcode op, const vmreg_t sp);
+
+		/**
+		 * Records the outcome of a conditional jump.
+		 * \param ip Address of the jump
+		 * \param target Jump target
+		 * \param taken Whether the jump was taken
+		 * \param indirect Whether the target came from a register, in which case it is most likely a return
+		 *                 and is not considered for loop detection
+		 */
+		void branch(const vmreg_t ip, const vmreg_t target, const bool taken, const bool indirect = false);
+
+		/**
+		 * Records a function call.
+		 * \param target Called function
+		 * \param sp Value of sp after pushing the return address
+		 */
+		void call(const vmreg_t target, const vmreg_t sp);
+
+		/**
+		 * \return Execution count of an opcode
+		 */
+		uint64_t opcode_count(const Opcode op) const;
+
+		/**
+		 * \return Total number of executed instructions
+		 */
+		uint64_t instruction_count() const;
+
+		/**
+		 * \return Execution count of the instruction at a given address
+		 */
+		uint64_t hits(const vmreg_t ip) const;
+
+		/**
+		 * \return Branch statistics of the conditional jump at a given address
+		 */
+		BranchStats branch_stats(const vmreg_t ip) const;
+
+		/**
+		 * \return Loops detected through backward branches, hottest first
+		 */
+		std::vector<Loop> hot_loops() const;
+
+		/**
+		 * Writes a human readable report, sorted by execution counts.
+		 * \param out Output stream
+		 * \param top Maximum number of entries per section
+		 */
+		void report(std::ostream& out, const size_t top = 20) const;
+
+		/**
+		 * Writes the executed instruction counts per call stack in the collapsed stack format
+		 * (<code>frame;frame;frame count</code>), as read by flamegraph tools.
+		 * \param out Output stream
+		 */
+		void write_collapsed(std::ostream& out) const;
+
+	private:
+		/**
+		 * Node of the call tree, identified by its index in _nodes
+		 */
+		struct Node
+		{
+			size_t parent;
+			vmreg_t function;
+			uint64_t samples;
+			std::map<vmreg_t, size_t> children;
+		};
+
+		/**
+		 * Active call, left when sp drops below return_slot
+		 */
+		struct Frame
+		{
+			size_t node;
+			vmreg_t return_slot;
+		};
+
+		struct InstructionStats
+		{
+			uint64_t hits;
+			Opcode op;
+		};
+
+		InstructionStats& stats(const vmreg_t ip);
+		const InstructionStats* find_stats(const vmreg_t ip) const;
+
+		std::array<uint64_t, 256> _opcodes;
+
+		/**
+		 * Per-instruction counters of the imported program, indexed by instruction
+		 */
+		std::vector<InstructionStats> _program_stats;
+
+		/**
+		 * Per-instruction counters for code running outside the imported program
+		 */
+		std::unordered_map<vmreg_t, InstructionStats> _other_stats;
+
+		std::unordered_map<vmreg_t, BranchStats> _branches;
+
+		/**
+		 * Backward branch iterations, keyed by (head << 32 | latch)
+		 */
+		std::unordered_map<uint64_t, uint64_t> _loops;
+
+		std::vector<Node> _nodes;
+		std::vector<Frame> _frames;
+	};
+}
+
+#endif
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "program_cache.hpp"
+#include "memory.hpp"
+#include "program_file.hpp"
+
+#ifdef THALLIUM_HAS_MMAP
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace thallium
+{
+	const char cache_entry_magic[8] = {'T', 'H', 'L', 'C', 'A', 'C', 'H', 'E'};
+	const char cache_entry_suffix[] = ".thc";
+
+	/**
+	 * Header of a cache entry, stored as laid out in memory at the beginning of the file.
+	 *
+	 * Offsets are from the beginning of the file. The code starts at a page boundary and is followed by zeroes up
+	 * to the next one, then come the metadata: the pre-decoded program, the blocks, their successors and the
+	 * diagnostic, up to the end of the file.
+	 */
+	struct CacheEntryHeader
+	{
+		char magic[8];
+		uint32_t version;
+
+		/**
+		 * Layout of the records on the host which wrote the entry, see translation_layout()
+		 */
+		uint32_t layout;
+
+		uint64_t checksum;
+		vmreg_t entry;
+		uint32_t reserved;
+
+		uint64_t code_offset;
+		uint64_t code_size;
+
+		uint64_t decoded_offset;
+		uint64_t blocks_offset;
+		uint64_t block_count;
+		uint64_t successors_offset;
+		uint64_t successor_count;
+		uint64_t diagnostic_offset;
+		uint64_t diagnostic_size;
+
+		uint64_t fusions;
+		uint64_t register_span;
+
+		/**
+		 * Checksum of the header, this field being zero, and of the metadata, see entry_checksum()
+		 */
+		uint64_t metadata_checksum;
+	};
+
+	/**
+	 * \return Checksum of an entry: of its header, without the checksum itself, and of its metadata, so that a
+	 *         corrupted header field read back as is, such as the register span, is caught too
+	 */
+	static uint64_t entry_checksum(CacheEntryHeader header, const uint8_t* metadata, const size_t size)
+	{
+		header.metadata_checksum = 0;
+
+		const uint64_t prime = 0x9E3779B97F4A7C15ull;
+		return program_checksum(metadata, size)
+			   ^ program_checksum(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) * prime;
+	}
+
+	static uint64_t round_up(const uint64_t value, const uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	/**
+	 * \return Nanoseconds elapsed since begin
+	 */
+	static uint64_t elapsed_ns(const std::chrono::steady_clock::time_point begin)
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+	}
+
+	ProgramCache::ProgramCache(std::string directory, const uint64_t max_bytes, const size_t max_entries) :
+		_directory(std::move(directory)),
+		_trusted(false),
+		_max_bytes(max_bytes),
+		_max_entries(max_entries),
+		_hits(0),
+		_misses(0),
+		_evictions(0),
+		_hit_ns(0),
+		_miss_ns(0)
+	{
+		// a cache which cannot be written to, or which other users could write to, still translates every program
+		_trusted = make_directories(_directory) && owned_privately(_directory);
+	}
+
+	std::shared_ptr<const ProgramImage> ProgramCache::get(const std::vector<Instruction>& program)
+	{
+		const vmreg_t size = static_cast<vmreg_t>(program.size() * Instruction::size());
+		return get(program, 0, size);
+	}
+
+	std::shared_ptr<const ProgramImage> ProgramCache::get(const std::vector<Instruction>& program, const vmreg_t entry,
+														  const vmreg_t initial_sp)
+	{
+		// entries are trusted, so they are only used from a private directory
+		if (!_trusted)
+			return ProgramImage::create(program, entry, initial_sp);
+
+		const auto begin = std::chrono::steady_clock::now();
+
+		// entries are looked up by the serialized code, which is also what they are checked against
+		std::vector<uint8_t> code(program.size() * Instruction::size());
+		serialize_instructions(program.data(), program.size(), code.data());
+
+		std::ostringstream path;
+		path << _directory << '/' << std::hex << std::setfill('0') << std::setw(16)
+			 << program_checksum(code.data(), code.size()) << '-' << std::setw(8) << entry << "-v" << std::dec
+			 << version() << cache_entry_suffix;
+
+		std::shared_ptr<const ProgramImage> image = open(path.str(), code.data(), code.size(), entry, initial_sp);
+		if (image)
+		{
+			++_hits;
+			_hit_ns += elapsed_ns(begin);
+			return image;
+		}
+
+		image = ProgramImage::create(program, entry, initial_sp);
+		if (store(path.str(), *image))
+			evict();
+
+		++_misses;
+		_miss_ns += elapsed_ns(begin);
+		return image;
+	}
+
+	ProgramCacheStats ProgramCache::stats() const
+	{
+		return ProgramCacheStats{_hits, _misses, _evictions, _hit_ns, _miss_ns};
+	}
+
+	const std::string& ProgramCache::directory() const
+	{
+		return _directory;
+	}
+
+	std::string ProgramCache::default_directory()
+	{
+		if (const char* directory = std::getenv("THALLIUM_PROGRAM_CACHE"))
+			return directory;
+
+		const std::string root = cache_root();
+		return root.empty() ? root : root + "/programs";
+	}
+
+#ifdef THALLIUM_HAS_MMAP
+	std::shared_ptr<const ProgramImage> ProgramCache::open(const std::string& path, const uint8_t* code,
+														   const size_t size, const vmreg_t entry,
+														   const vmreg_t initial_sp) const
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return nullptr;
+
+		// the image owns the descriptor from now on, and closes it if the entry is rejected
+		std::shared_ptr<ProgramImage> image{new ProgramImage};
+		image->_fd = fd;
+
+		// the verification of the entry is trusted, so it has to have been written by this user
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0
+			|| static_cast<uint64_t>(st.st_size) < sizeof(CacheEntryHeader))
+			return nullptr;
+
+		const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+		void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED)
+			return nullptr;
+
+		// the image keeps the whole entry mapped, its pre-decoded program being used in place
+		image->_translation = static_cast<const uint8_t*>(mapping);
+		image->_translation_size = file_size;
+
+		const uint8_t* data = image->_translation;
+		CacheEntryHeader header;
+		std::memcpy(&header, data, sizeof(header));
+
+		const auto fits = [&](const uint64_t offset, const uint64_t count, const uint64_t record) {
+			return offset >= header.decoded_offset && offset <= file_size && count <= (file_size - offset) / record;
+		};
+
+		const uint64_t count = size / Instruction::size();
+		if (std::memcmp(header.magic, cache_entry_magic, sizeof(cache_entry_magic)) != 0
+			|| header.version != version() || header.layout != translation_layout(sizeof(header)) || header.entry != entry
+			|| header.code_size != size || header.code_offset < sizeof(header)
+			|| header.decoded_offset < header.code_offset + header.code_size || header.decoded_offset > file_size
+			|| header.decoded_offset % alignof(DecodedInstruction) != 0
+			|| !fits(header.decoded_offset, count, sizeof(DecodedInstruction))
+			|| !fits(header.blocks_offset, header.block_count, sizeof(StoredBlock))
+			|| !fits(header.successors_offset, header.successor_count, sizeof(uint64_t))
+			|| !fits(header.diagnostic_offset, header.diagnostic_size, 1)
+			|| entry_checksum(header, data + header.decoded_offset, file_size - header.decoded_offset) != header.metadata_checksum
+			|| std::memcmp(data + header.code_offset, code, size) != 0)
+			return nullptr;
+
+		image->_decoded = reinterpret_cast<const DecodedInstruction*>(data + header.decoded_offset);
+
+		const bool valid_ops = std::none_of(image->_decoded, image->_decoded + count, [](const DecodedInstruction& d) {
+			return d.op == DecodedOp::stale || d.op >= DecodedOp::_total;
+		});
+
+		std::vector<BasicBlock> blocks;
+		if (!valid_ops
+			|| !restore_blocks(data + header.blocks_offset, header.block_count, data + header.successors_offset,
+							   header.successor_count, count, blocks))
+			return nullptr;
+
+		// VMs map whole pages of the entry, so the code is only mapped if zeroes follow it up to the metadata
+		const uint64_t page = Memory::page_size();
+		const bool mappable = header.code_offset % page == 0
+							  && header.decoded_offset >= round_up(header.code_offset + header.code_size, page);
+
+		if (size != 0 && mappable)
+		{
+			void* code_mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(header.code_offset));
+			if (code_mapping == MAP_FAILED)
+				return nullptr;
+
+			image->_code = static_cast<const uint8_t*>(code_mapping);
+			image->_mapped_size = size;
+			image->_fd_offset = header.code_offset;
+		}
+		else
+		{
+			image->_copy.assign(code, code + size);
+			image->_code = image->_copy.data();
+
+			close(image->_fd);
+			image->_fd = -1;
+		}
+
+		image->_size = size;
+		image->_entry = entry;
+		image->_initial_sp = initial_sp;
+		image->_fusions = header.fusions;
+		image->_register_span = header.register_span;
+		image->_verification = Verification(std::move(blocks), entry,
+											std::string(reinterpret_cast<const char*>(data + header.diagnostic_offset), header.diagnostic_size));
+
+		// entries are evicted by last use
+		futimens(fd, nullptr);
+
+		return image;
+	}
+
+	bool ProgramCache::store(const std::string& path, const ProgramImage& image) const
+	{
+		const Verification& verification = image.verification();
+
+		std::vector<StoredBlock> blocks;
+		std::vector<uint64_t> successors;
+		store_blocks(verification, blocks, successors);
+
+		CacheEntryHeader header{};
+		std::memcpy(header.magic, cache_entry_magic, sizeof(cache_entry_magic));
+		header.version = version();
+		header.layout = translation_layout(sizeof(header));
+		header.checksum = program_checksum(image.code(), image.size());
+		header.entry = image.entry();
+		header.code_offset = round_up(sizeof(header), Memory::page_size());
+		header.code_size = image.size();
+		header.decoded_offset = round_up(header.code_offset + header.code_size, Memory::page_size());
+		header.blocks_offset = header.decoded_offset + round_up(image.count() * sizeof(DecodedInstruction), sizeof(uint64_t));
+		header.block_count = blocks.size();
+		header.successors_offset = header.blocks_offset + blocks.size() * sizeof(StoredBlock);
+		header.successor_count = successors.size();
+		header.diagnostic_offset = header.successors_offset + successors.size() * sizeof(uint64_t);
+		header.diagnostic_size = verification.diagnostic().size();
+		header.fusions = image.fusions();
+		header.register_span = image.register_span();
+
+		// an entry the cache cannot hold would only evict every other one before being evicted itself
+		if (header.diagnostic_offset + header.diagnostic_size > _max_bytes)
+			return false;
+
+		std::vector<uint8_t> metadata(header.diagnostic_offset + header.diagnostic_size - header.decoded_offset, 0);
+		std::memcpy(metadata.data(), image.decoded(), image.count() * sizeof(DecodedInstruction));
+		std::memcpy(metadata.data() + (header.blocks_offset - header.decoded_offset), blocks.data(), blocks.size() * sizeof(StoredBlock));
+		std::memcpy(metadata.data() + (header.successors_offset - header.decoded_offset), successors.data(), successors.size() * sizeof(uint64_t));
+		std::memcpy(metadata.data() + (header.diagnostic_offset - header.decoded_offset), verification.diagnostic().data(), header.diagnostic_size);
+		header.metadata_checksum = entry_checksum(header, metadata.data(), metadata.size());
+
+		// other processes and threads may store the same program, so the entry is moved in place once complete
+		static std::atomic<uint64_t> serial{0};
+		const std::string temporary = path + "." + std::to_string(getpid()) + "." + std::to_string(serial++) + ".tmp";
+
+		{
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			const std::vector<char> padding(header.code_offset - sizeof(header) + Memory::page_size());
+
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(padding.data(), header.code_offset - sizeof(header));
+			out.write(reinterpret_cast<const char*>(image.code()), image.size());
+			out.write(padding.data(), header.decoded_offset - header.code_offset - header.code_size);
+			out.write(reinterpret_cast<const char*>(metadata.data()), metadata.size());
+
+			if (!out.flush().good())
+			{
+				std::remove(temporary.c_str());
+				return false;
+			}
+		}
+
+		// open() rejects entries other users can write to, which the umask alone may allow
+		if (chmod(temporary.c_str(), S_IRUSR | S_IWUSR) != 0 || std::rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			std::remove(temporary.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	void ProgramCache::evict()
+	{
+		struct Entry
+		{
+			std::string path;
+			uint64_t size;
+			struct timespec used;
+		};
+
+		DIR* dir = opendir(_directory.c_str());
+		if (dir == nullptr)
+			return;
+
+		std::vector<Entry> entries;
+		uint64_t total = 0;
+		const size_t suffix = sizeof(cache_entry_suffix) - 1;
+
+		while (const dirent* e = readdir(dir))
+		{
+			const std::string name = e->d_name;
+			if (name.size() <= suffix || name.compare(name.size() - suffix, suffix, cache_entry_suffix) != 0)
+				continue;
+
+			const std::string path = _directory + '/' + name;
+			struct stat st;
+			if (stat(path.c_str(), &st) != 0)
+				continue;
+
+			entries.push_back(Entry{path, static_cast<uint64_t>(st.st_size), st.st_mtim});
+			total += static_cast<uint64_t>(st.st_size);
+		}
+
+		closedir(dir);
+
+		if (total <= _max_bytes && entries.size() <= _max_entries)
+			return;
+
+		std::sort(begin(entries), end(entries), [](const Entry& a, const Entry& b) {
+			return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+		});
+
+		// another process may be evicting the same entries
+		size_t left = entries.size();
+		for (const Entry& e : entries)
+		{
+			if (total <= _max_bytes && left <= _max_entries)
+				break;
+
+			const bool removed = unlink(e.path.c_str()) == 0;
+			if (removed || errno == ENOENT)
+			{
+				total -= e.size;
+				--left;
+			}
+
+			if (removed)
+				++_evictions;
+		}
+	}
+#else
+	std::shared_ptr<const ProgramImage> ProgramCache::open(const std::string&, const uint8_t*, const size_t,
+														   const vmreg_t, const vmreg_t) const
+	{
+		return nullptr;
+	}
+
+	bool ProgramCache::store(const std::string&, const ProgramImage&) const
+	{
+		return false;
+	}
+
+	void ProgramCache::evict() {}
+#endif
+}
@@ -0,0 +1,165 @@
+#ifndef THALLIUMVM_PROGRAM_CACHE_HPP
+#define THALLIUMVM_PROGRAM_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "image.hpp"
+#include "instruction.hpp"
+#include "register.hpp"
+
+namespace thallium
+{
+	/**
+	 * Counters of a ProgramCache
+	 */
+	struct ProgramCacheStats
+	{
+		/**
+		 * Programs found in the cache
+		 */
+		uint64_t hits;
+
+		/**
+		 * Programs translated and added to the cache
+		 */
+		uint64_t misses;
+
+		/**
+		 * Entries removed to stay within the limits of the cache
+		 */
+		uint64_t evictions;
+
+		/**
+		 * Time spent getting programs found in the cache, in nanoseconds
+		 */
+		uint64_t hit_ns;
+
+		/**
+		 * Time spent translating and storing the other programs, in nanoseconds
+		 */
+		uint64_t miss_ns;
+	};
+
+	/**
+	 * On-disk cache of translated programs, so that a process importing a program it already saw skips decoding,
+	 * fusion and verification.
+	 *
+	 * Entries are named after a checksum of the serialized code, the entry point and version(). They hold the code
+	 * at a page boundary followed by the pre-decoded program, the control flow graph and the diagnostic of its
+	 * Verification, as laid out in host memory. The code of a cached image is mapped from its entry, VMs mapping it
+	 * copy-on-write like the code of a program file, and its pre-decoded program is used in place, only the blocks
+	 * being copied.<br>
+	 * Entries are written to a temporary file then renamed, so processes sharing a directory only ever see complete
+	 * entries, and an entry removed while in use stays valid for the images mapping it. Entries which do not match
+	 * the requested code byte for byte, or which are corrupted, are translated again and replaced.<br>
+	 * The pre-decoded program and the verification of an entry are trusted rather than derived again, certified
+	 * programs then running without checks. The cache is therefore only used in a directory owned by the current
+	 * user and writable by no one else, and only reads entries with the same owner and permissions. The checksum of
+	 * an entry catches corruption, not tampering.<br>
+	 * Once an entry is added, the least recently used ones are removed until the cache is within its limits.
+	 * Entries are not locked, so limits are only enforced approximately when several processes add entries at
+	 * the same time.
+	 */
+	class ProgramCache
+	{
+	public:
+		/**
+		 * ProgramCache constructor, which creates the directory if needed. A directory other users could write to is
+		 * not used, every program being translated then.
+		 * \param directory Directory of the entries, shared by every cache of the current user using it
+		 * \param max_bytes Total size of the entries above which the oldest ones are removed, larger programs not being
+		 *        cached
+		 * \param max_entries Number of entries above which the oldest ones are removed
+		 */
+		ProgramCache(std::string directory = default_directory(), const uint64_t max_bytes = 256 * 1024 * 1024,
+					 const size_t max_entries = 1024);
+
+		/**
+		 * Returns the image of a program, from the cache if it holds it, translating and adding it otherwise.
+		 * \param program The ThalliumVM program
+		 * \return Shared image of the program
+		 */
+		std::shared_ptr<const ProgramImage> get(const std::vector<Instruction>& program);
+
+		/**
+		 * Returns the image of a program with a given initial state, see ProgramImage::create.
+		 * \param program The ThalliumVM program
+		 * \param entry Address of the first instruction to run
+		 * \param initial_sp Initial value of sp
+		 * \return Shared image of the program
+		 */
+		std::shared_ptr<const ProgramImage> get(const std::vector<Instruction>& program, const vmreg_t entry,
+												const vmreg_t initial_sp);
+
+		/**
+		 * \return Counters since the cache was constructed
+		 */
+		ProgramCacheStats stats() const;
+
+		/**
+		 * \return Directory of the entries
+		 */
+		const std::string& directory() const;
+
+		/**
+		 * \return Default directory: $THALLIUM_PROGRAM_CACHE, else programs in cache_root(), nothing being cached if
+		 *         it is empty
+		 */
+		static std::string default_directory();
+
+		/**
+		 * \return Version of the cached translation, to be increased whenever decoding, fusion or verification
+		 *         change, so that entries written by other versions are ignored
+		 */
+		constexpr static uint32_t version()
+		{
+			return 6;
+		}
+
+	private:
+		/**
+		 * Loads the image of a program from its entry.
+		 * \param path Path of the entry
+		 * \param code Serialized code the entry has to hold
+		 * \param size Size of the code
+		 * \param entry Entry point the entry has to be translated for
+		 * \param initial_sp Initial value of sp of the image
+		 * \return Image, or nullptr if the entry is missing, corrupted or holds another program
+		 */
+		std::shared_ptr<const ProgramImage> open(const std::string& path, const uint8_t* code, const size_t size,
+												 const vmreg_t entry, const vmreg_t initial_sp) const;
+
+		/**
+		 * Writes the entry of an image, replacing any previous one.
+		 * \return Whether the entry was written
+		 */
+		bool store(const std::string& path, const ProgramImage& image) const;
+
+		/**
+		 * Removes the least recently used entries until the cache is within its limits.
+		 */
+		void evict();
+
+		std::string _directory;
+
+		/**
+		 * Whether the directory is private to the current user, entries being neither read nor written otherwise
+		 */
+		bool _trusted;
+
+		uint64_t _max_bytes;
+		size_t _max_entries;
+
+		std::atomic<uint64_t> _hits;
+		std::atomic<uint64_t> _misses;
+		std::atomic<uint64_t> _evictions;
+		std::atomic<uint64_t> _hit_ns;
+		std::atomic<uint64_t> _miss_ns;
+	};
+}
+
+#endif
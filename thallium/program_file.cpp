@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "program_file.hpp"
+#include "instruction.hpp"
+#include "serializer.hpp"
+
+#if defined(__unix__)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace thallium
+{
+	const char program_file_magic[8] = {'T', 'H', 'A', 'L', 'L', 'I', 'U', 'M'};
+
+	std::array<uint8_t, 64> ProgramFileHeader::serialize() const
+	{
+		std::array<uint8_t, size()> serialized{};
+		std::copy(std::begin(program_file_magic), std::end(program_file_magic), begin(serialized));
+		serialize_type(version, begin(serialized) + 8);
+		serialize_type(header_size, begin(serialized) + 12);
+		serialize_type(entry, begin(serialized) + 16);
+		serialize_type(initial_sp, begin(serialized) + 20);
+		serialize_type(code_offset, begin(serialized) + 24);
+		serialize_type(code_size, begin(serialized) + 32);
+		serialize_type(checksum, begin(serialized) + 40);
+		serialize_type(instruction_count, begin(serialized) + 48);
+		serialize_type(translation_offset, begin(serialized) + 56);
+		return serialized;
+	}
+
+	bool ProgramFileHeader::deserialize(const uint8_t* data, ProgramFileHeader& header)
+	{
+		if (std::memcmp(data, program_file_magic, sizeof(program_file_magic)) != 0)
+			return false;
+
+		header.version = deserialize_type<uint32_t>(data + 8);
+		header.header_size = deserialize_type<uint32_t>(data + 12);
+		header.entry = deserialize_type<vmreg_t>(data + 16);
+		header.initial_sp = deserialize_type<vmreg_t>(data + 20);
+		header.code_offset = deserialize_type<uint64_t>(data + 24);
+		header.code_size = deserialize_type<uint64_t>(data + 32);
+		header.checksum = deserialize_type<uint64_t>(data + 40);
+		header.instruction_count = deserialize_type<uint64_t>(data + 48);
+		header.translation_offset = deserialize_type<uint64_t>(data + 56);
+		return true;
+	}
+
+	uint64_t program_checksum(const uint8_t* data, const size_t size)
+	{
+		const uint64_t prime = 0x9E3779B97F4A7C15ull;
+
+		// four independent lanes, so the multiplications of consecutive words overlap
+		uint64_t lanes[4] = {size, size ^ 1, size ^ 2, size ^ 3};
+
+		size_t i = 0;
+		for (; i + 4 * sizeof(uint64_t) <= size; i += 4 * sizeof(uint64_t))
+		{
+			for (size_t l = 0; l < 4; ++l)
+			{
+				uint64_t word;
+				std::memcpy(&word, data + i + l * sizeof(uint64_t), sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+				word = __builtin_bswap64(word);
+#endif
+				lanes[l] = (lanes[l] ^ word) * prime;
+				lanes[l] ^= lanes[l] >> 29;
+			}
+		}
+
+		uint64_t hash = lanes[0];
+		for (size_t l = 1; l < 4; ++l)
+		{
+			hash = (hash ^ lanes[l]) * prime;
+		}
+
+		for (; i < size; ++i)
+		{
+			hash = (hash ^ data[i]) * prime;
+		}
+
+		return hash ^ (hash >> 32);
+	}
+
+	/**
+	 * Opcode byte of the escape word of the aligned encoding
+	 */
+	const uint8_t aligned_escape = 0xFF;
+
+	/**
+	 * \return Whether a serialized instruction is encoded as an escape word and an argument word
+	 */
+	static bool escaped(const uint8_t* instruction)
+	{
+		return instruction[0] == aligned_escape || deserialize_type<uint64_t>(instruction + 1) >> 56 != 0;
+	}
+
+	std::vector<uint8_t> encode_aligned(const uint8_t* code, const size_t size)
+	{
+		const size_t count = size / Instruction::size();
+
+		size_t words = count;
+		for (size_t i = 0; i < count; ++i)
+		{
+			words += escaped(code + i * Instruction::size());
+		}
+
+		std::vector<uint8_t> encoded(words * sizeof(uint64_t));
+		uint8_t* out = encoded.data();
+
+		for (size_t i = 0; i < count; ++i, code += Instruction::size(), out += sizeof(uint64_t))
+		{
+			const uint64_t argument = deserialize_type<uint64_t>(code + 1);
+
+			if (!escaped(code))
+			{
+				serialize_type(code[0] | argument << 8, out);
+				continue;
+			}
+
+			serialize_type(aligned_escape | uint64_t(code[0]) << 8, out);
+			out += sizeof(uint64_t);
+			serialize_type(argument, out);
+		}
+
+		return encoded;
+	}
+
+	bool decode_aligned(const uint8_t* data, const size_t size, uint8_t* code, const size_t count)
+	{
+		size_t offset = 0;
+		for (size_t i = 0; i < count; ++i, code += Instruction::size())
+		{
+			if (size - offset < sizeof(uint64_t))
+				return false;
+
+			const uint64_t word = deserialize_type<uint64_t>(data + offset);
+			offset += sizeof(uint64_t);
+
+			if ((word & 0xFF) != aligned_escape)
+			{
+				code[0] = static_cast<uint8_t>(word);
+				serialize_type(word >> 8, code + 1);
+				continue;
+			}
+
+			if (word >> 16 != 0 || size - offset < sizeof(uint64_t))
+				return false;
+
+			code[0] = static_cast<uint8_t>(word >> 8);
+			std::memcpy(code + 1, data + offset, sizeof(uint64_t));
+			offset += sizeof(uint64_t);
+		}
+
+		return offset == size;
+	}
+
+	std::string cache_root()
+	{
+		if (const char* cache = std::getenv("XDG_CACHE_HOME"))
+			return std::string(cache) + "/thallium";
+
+		if (const char* home = std::getenv("HOME"))
+			return std::string(home) + "/.cache/thallium";
+
+		return "";
+	}
+
+	bool make_directories(const std::string& path)
+	{
+#if defined(__unix__)
+		if (path.empty())
+			return false;
+
+		for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+		{
+			const std::string prefix = path.substr(0, slash);
+			if (mkdir(prefix.c_str(), 0700) != 0 && errno != EEXIST)
+				return false;
+
+			if (slash == std::string::npos)
+				return true;
+		}
+#else
+		(void)path;
+		return false;
+#endif
+	}
+
+	bool owned_privately(const std::string& path)
+	{
+#if defined(__unix__)
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && st.st_uid == geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+#else
+		(void)path;
+		return false;
+#endif
+	}
+}
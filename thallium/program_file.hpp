@@ -0,0 +1,157 @@
+#ifndef THALLIUMVM_PROGRAM_FILE_HPP
+#define THALLIUMVM_PROGRAM_FILE_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "register.hpp"
+
+namespace thallium
+{
+	/**
+	 * Encoding of the code of a program file, which is also the version of its format
+	 */
+	enum class ProgramEncoding : uint32_t
+	{
+		/**
+		 * Serialized instructions, exactly as they appear in VM memory. The code is only mapped in place when
+		 * anything stored after it in the same page is zero.
+		 */
+		Packed = 1,
+
+		/**
+		 * 8-byte aligned little-endian words, see encode_aligned(), which are expanded to serialized instructions
+		 * when loaded.
+		 */
+		Aligned = 2,
+
+		/**
+		 * Packed code followed by its translation: the pre-decoded program, the control flow graph and the diagnostic
+		 * of its Verification, as laid out in host memory. The pre-decoded program is mapped in place when loaded
+		 * on a host with the same layout, other hosts translating the code again.
+		 */
+		Translated = 3
+	};
+
+	/**
+	 * Header of a ThalliumVM program file, as written by ProgramImage::save.
+	 *
+	 * Every field is little-endian:<br>
+	 * - 0..7 : magic, "THALLIUM"<br>
+	 * - 8..11 : format version, the ProgramEncoding of the code<br>
+	 * - 12..15 : header size<br>
+	 * - 16..19 : entry point, loaded into ip<br>
+	 * - 20..23 : initial stack pointer, loaded into sp<br>
+	 * - 24..31 : code offset in the file, a multiple of the page size so the code can be mapped in place<br>
+	 * - 32..39 : code size in bytes in the file, a multiple of Instruction::size() for packed code and of 8 for
+	 *            aligned code<br>
+	 * - 40..47 : checksum of the code as stored in the file, see program_checksum()<br>
+	 * - 48..55 : number of instructions of aligned and translated code, zero for packed code<br>
+	 * - 56..63 : offset of the translation in translated files, a multiple of the page size following the page of
+	 *            the end of the code, zero otherwise
+	 */
+	struct ProgramFileHeader
+	{
+		uint32_t version;
+		uint32_t header_size;
+		vmreg_t entry;
+		vmreg_t initial_sp;
+		uint64_t code_offset;
+		uint64_t code_size;
+		uint64_t checksum;
+		uint64_t instruction_count;
+		uint64_t translation_offset;
+
+		/**
+		 * \return Serialized header
+		 */
+		std::array<uint8_t, 64> serialize() const;
+
+		/**
+		 * Reads a serialized header.
+		 * \param data The size() bytes of the header
+		 * \param header Deserialized header
+		 * \return false if the magic does not match
+		 */
+		static bool deserialize(const uint8_t* data, ProgramFileHeader& header);
+
+		/**
+		 * \return Size of the serialized header
+		 */
+		constexpr static size_t size()
+		{
+			return 64;
+		}
+
+		/**
+		 * \return Latest version, the loader accepting every version from 1 up to it
+		 */
+		constexpr static uint32_t current_version()
+		{
+			return static_cast<uint32_t>(ProgramEncoding::Translated);
+		}
+
+		/**
+		 * \return Code offset used when writing, large enough for the common page sizes
+		 */
+		constexpr static uint64_t default_code_offset()
+		{
+			return 64 * 1024;
+		}
+	};
+
+	/**
+	 * Checksum of program file code: 64-bit multiply-xor hash over four interleaved lanes of little-endian words.
+	 * \param data Code
+	 * \param size Code size in bytes
+	 * \return Checksum
+	 */
+	uint64_t program_checksum(const uint8_t* data, const size_t size);
+
+	/**
+	 * Encodes serialized instructions as 8-byte aligned little-endian words.
+	 *
+	 * An instruction whose argument fits in 56 bits is one word, its opcode in bits 0..7 and its argument in bits
+	 * 8..63, which covers every valid instruction but the bulk ones naming a fourth register above 255. Any other
+	 * instruction, and any instruction with the opcode byte 0xFF, is the escape word 0xFF | opcode << 8 followed by
+	 * its whole argument.
+	 * \param code Serialized instructions
+	 * \param size Size of the code in bytes, a multiple of Instruction::size()
+	 * \return Encoded code
+	 */
+	std::vector<uint8_t> encode_aligned(const uint8_t* code, const size_t size);
+
+	/**
+	 * Expands code encoded by encode_aligned() to serialized instructions.
+	 * \param data Encoded code
+	 * \param size Size of the encoded code in bytes
+	 * \param code Destination of the serialized instructions
+	 * \param count Number of instructions
+	 * \return false if the encoded code does not hold exactly count well-formed instructions
+	 */
+	bool decode_aligned(const uint8_t* data, const size_t size, uint8_t* code, const size_t count);
+
+	/**
+	 * \return Directory under which compiled and pre-processed programs are cached: thallium in $XDG_CACHE_HOME or
+	 *         in $HOME/.cache, else an empty string, as a directory shared with other users could not be trusted
+	 */
+	std::string cache_root();
+
+	/**
+	 * Creates a directory and its parents, those created being only accessible to the current user.
+	 * \param path Path of the directory
+	 * \return Whether the directory exists
+	 */
+	bool make_directories(const std::string& path);
+
+	/**
+	 * Checks that a cached file, or the directory holding it, can only have been written by the current user.
+	 * \param path Path of the file or directory
+	 * \return Whether it exists, is owned by the current user and is neither group- nor world-writable
+	 */
+	bool owned_privately(const std::string& path);
+}
+
+#endif
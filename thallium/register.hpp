@@ -3,7 +3,7 @@
 
 #include <cstdint>
 #include <cstddef>
-#include <vector>
+#include <array>
 
 namespace thallium
 {
@@ -50,16 +50,20 @@ namespace thallium
 	};
 
 	/**
-	 * ThalliumVM Registers class, which holds the specific-purpose and general-purpose registers.
+	 * ThalliumVM register file, which holds the specific-purpose and general-purpose registers.
+	 *
+	 * The registers are stored inline, so that a register file living in a VM needs no allocation and the
+	 * compiler can see through accesses with constant indices.
+	 * \param GP Number of general purpose registers
 	 */
-	class Registers
+	template<uint16_t GP>
+	class BasicRegisters
 	{
 	public:
 		/**
-		 * Constructor for <code>Register</code>.
-		 * \param gp General purpose register count
+		 * Constructor for <code>BasicRegisters</code>, which zeroes every register.
 		 */
-		Registers(size_t gp = sp_count() + gp_count());
+		BasicRegisters();
 
 		/**
 		 * Subscript operator for specific-purpose registers
@@ -71,9 +75,8 @@ namespace thallium
 		/**
 		 * Subscript operator for both specific and special purpose.<br>
 		 * General-purpose registers begin at index SPRegisters::total.
-		 * \param index Thallium register index
+		 * \param index Thallium register index, below size()
 		 * \return Reference to a Thallium register
-		 * \throws std::out_of_range
 		 */
 		vmreg_t& operator[](const size_t index);
 
@@ -91,6 +94,20 @@ namespace thallium
 		 */
 		bool get_flag(const Flags flag);
 
+		/**
+		 * Returns the underlying register storage, indexed like operator[](size_t).
+		 * \return Pointer to the first register
+		 */
+		vmreg_t* data();
+
+		/**
+		 * \return Total number of registers
+		 */
+		constexpr static size_t size()
+		{
+			return sp_count() + gp_count();
+		}
+
 		/**
 		 * \return Thallium specific purpose registers available
 		 */
@@ -104,12 +121,85 @@ namespace thallium
 		 */
 		constexpr static uint16_t gp_count()
 		{
-			return 256;
+			return GP;
 		}
 
 	private:
-		std::vector<vmreg_t> _memory;
+		std::array<vmreg_t, sp_count() + GP> _memory;
+	};
+
+	/**
+	 * Register file of the default VM configuration
+	 */
+	using Registers = BasicRegisters<256>;
+
+	/**
+	 * Registers an executor runs with, which it does not own: those of its VM, or those of the fiber it runs.
+	 *
+	 * Switching fibers binds it to other registers, so that a switch neither copies registers nor allocates.
+	 */
+	class RegisterBinding
+	{
+	public:
+		/**
+		 * Constructor for <code>RegisterBinding</code>.
+		 * \param registers First register
+		 * \param size Number of registers
+		 */
+		RegisterBinding(vmreg_t* registers, const size_t size);
+
+		/**
+		 * Binds other registers.
+		 * \param registers First register
+		 * \param size Number of registers
+		 */
+		void bind(vmreg_t* registers, const size_t size);
+
+		/**
+		 * Subscript operator for specific-purpose registers
+		 * \param index Thallium specific-purpose register index
+		 * \return Reference to a Thallium specific-purpose register
+		 */
+		vmreg_t& operator[](const SPRegisters s);
+
+		/**
+		 * Subscript operator for both specific and special purpose.<br>
+		 * General-purpose registers begin at index SPRegisters::total.
+		 * \param index Thallium register index, below size()
+		 * \return Reference to a Thallium register
+		 */
+		vmreg_t& operator[](const size_t index);
+
+		/**
+		 * Sets a flag in the FL register to a given value.
+		 * \param flag Flag to set
+		 * \param value New state of the flag
+		 */
+		void set_flag(const Flags flag, const bool value);
+
+		/**
+		 * Returns a flag in the FL register.
+		 * \param flag Flag to get
+		 * \return Flag at given index
+		 */
+		bool get_flag(const Flags flag);
+
+		/**
+		 * \return Pointer to the first register
+		 */
+		vmreg_t* data();
+
+		/**
+		 * \return Number of registers
+		 */
+		size_t size() const;
+
+	private:
+		vmreg_t* _registers;
+		size_t _size;
 	};
 }
 
+#include "register.tpp"
+
 #endif
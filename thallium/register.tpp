@@ -0,0 +1,80 @@
+#ifndef THALLIUMVM_REGISTER_TPP
+#define THALLIUMVM_REGISTER_TPP
+
+#include "register.hpp"
+
+namespace thallium
+{
+	template<uint16_t GP>
+	BasicRegisters<GP>::BasicRegisters() : _memory{} {}
+
+	template<uint16_t GP>
+	inline vmreg_t& BasicRegisters<GP>::operator[](const SPRegisters s)
+	{
+		return _memory[static_cast<size_t>(s)];
+	}
+
+	template<uint16_t GP>
+	inline vmreg_t& BasicRegisters<GP>::operator[](const size_t index)
+	{
+		return _memory[index];
+	}
+
+	template<uint16_t GP>
+	inline vmreg_t* BasicRegisters<GP>::data()
+	{
+		return _memory.data();
+	}
+
+	template<uint16_t GP>
+	inline void BasicRegisters<GP>::set_flag(const Flags flag, const bool value)
+	{
+		_memory[static_cast<size_t>(SPRegisters::fl)] = static_cast<uint32_t>(value) << static_cast<uint32_t>(flag);
+	}
+
+	template<uint16_t GP>
+	inline bool BasicRegisters<GP>::get_flag(const Flags flag)
+	{
+		return (_memory[static_cast<size_t>(SPRegisters::fl)] >> static_cast<uint32_t>(flag)) & 0b1;
+	}
+
+	inline RegisterBinding::RegisterBinding(vmreg_t* registers, const size_t size) : _registers(registers), _size(size) {}
+
+	inline void RegisterBinding::bind(vmreg_t* registers, const size_t size)
+	{
+		_registers = registers;
+		_size = size;
+	}
+
+	inline vmreg_t& RegisterBinding::operator[](const SPRegisters s)
+	{
+		return _registers[static_cast<size_t>(s)];
+	}
+
+	inline vmreg_t& RegisterBinding::operator[](const size_t index)
+	{
+		return _registers[index];
+	}
+
+	inline vmreg_t* RegisterBinding::data()
+	{
+		return _registers;
+	}
+
+	inline size_t RegisterBinding::size() const
+	{
+		return _size;
+	}
+
+	inline void RegisterBinding::set_flag(const Flags flag, const bool value)
+	{
+		_registers[static_cast<size_t>(SPRegisters::fl)] = static_cast<uint32_t>(value) << static_cast<uint32_t>(flag);
+	}
+
+	inline bool RegisterBinding::get_flag(const Flags flag)
+	{
+		return (_registers[static_cast<size_t>(SPRegisters::fl)] >> static_cast<uint32_t>(flag)) & 0b1;
+	}
+}
+
+#endif
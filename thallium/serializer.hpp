@@ -3,10 +3,25 @@
 
 #include <type_traits>
 
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_IX86) || defined(_M_X64) \
+	|| defined(_M_ARM64)
+#define THALLIUM_LITTLE_ENDIAN 1
+#endif
+
 namespace thallium
 {
+	/**
+	 * Converts an integer between the host byte order and little-endian, which is the order of serialized values
+	 * \param t Value to convert
+	 * \return t on little-endian hosts, t with its bytes reversed otherwise
+	 */
+	template<typename T, std::enable_if_t<std::is_integral<T>::value>* = nullptr>
+	T little_endian(T t);
+
 	/**
 	 * Serialize an integer type and write to an iterator
+	 *
+	 * Pointers to bytes are written with a single store of the little-endian value, other iterators byte by byte.
 	 * \param t Value to serialize
 	 * \param i Iterator to uint8_t
 	 */
@@ -15,6 +30,8 @@ namespace thallium
 
 	/**
 	 * Deserialize from an iterator and write to an integer type
+	 *
+	 * Pointers to bytes are read with a single load, other iterators byte by byte.
 	 * \param i Iterator to uint8_t
 	 */
 	template<typename T, typename It, std::enable_if_t<std::is_integral<T>::value>* = nullptr>
@@ -1,13 +1,48 @@
 #ifndef THALLIUMVM_SERIALIZER_TPP
 #define THALLIUMVM_SERIALIZER_TPP
 
+#include <cstring>
+#include <iterator>
 #include "serializer.hpp"
 #include "instruction.hpp"
 
 namespace thallium
 {
-	template<typename T, typename It, std::enable_if_t<std::is_integral<T>::value>*>
-	void serialize_type(T t, It it)
+	/**
+	 * Whether an iterator is a pointer to bytes, which values can be copied to and from as a whole
+	 */
+	template<typename It>
+	using is_byte_pointer = std::integral_constant<bool, std::is_pointer<It>::value
+														 && sizeof(typename std::iterator_traits<It>::value_type) == 1>;
+
+	template<typename T, std::enable_if_t<std::is_integral<T>::value>*>
+	T little_endian(T t)
+	{
+#ifdef THALLIUM_LITTLE_ENDIAN
+		return t;
+#else
+		typedef std::make_unsigned_t<T> U;
+		const U u = static_cast<U>(t);
+		U result = 0;
+
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			result |= static_cast<U>((u >> (i * 8)) & 0xFF) << ((sizeof(T) - 1 - i) * 8);
+		}
+
+		return static_cast<T>(result);
+#endif
+	}
+
+	template<typename T, typename It>
+	void serialize_type(T t, It it, std::true_type)
+	{
+		t = little_endian(t);
+		std::memcpy(it, &t, sizeof(T));
+	}
+
+	template<typename T, typename It>
+	void serialize_type(T t, It it, std::false_type)
 	{
 		const size_t isz = sizeof(T);
 		for (size_t i = 0; i < isz; ++i)
@@ -16,8 +51,16 @@ namespace thallium
 		}
 	}
 
-	template<typename T, typename It, std::enable_if_t<std::is_integral<T>::value>*>
-	T deserialize_type(It it)
+	template<typename T, typename It>
+	T deserialize_type(It it, std::true_type)
+	{
+		T result;
+		std::memcpy(&result, it, sizeof(T));
+		return little_endian(result);
+	}
+
+	template<typename T, typename It>
+	T deserialize_type(It it, std::false_type)
 	{
 		T result = 0;
 		const size_t isz = sizeof(T);
@@ -29,6 +72,18 @@ namespace thallium
 
 		return result;
 	}
+
+	template<typename T, typename It, std::enable_if_t<std::is_integral<T>::value>*>
+	void serialize_type(T t, It it)
+	{
+		serialize_type(t, it, is_byte_pointer<It>{});
+	}
+
+	template<typename T, typename It, std::enable_if_t<std::is_integral<T>::value>*>
+	T deserialize_type(It it)
+	{
+		return deserialize_type<T>(it, is_byte_pointer<It>{});
+	}
 }
 
 #endif
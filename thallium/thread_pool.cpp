@@ -0,0 +1,150 @@
+#include <algorithm>
+#include "thread_pool.hpp"
+
+namespace thallium
+{
+	ThreadPool::ThreadPool(const size_t threads) :
+		_task(nullptr),
+		_generation(0),
+		_active(0),
+		_stop(false)
+	{
+		const size_t count = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+		_ranges.reset(new Range[count]);
+		for (size_t i = 0; i < count; ++i)
+		{
+			_ranges[i].begin = _ranges[i].end = 0;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			_threads.emplace_back(&ThreadPool::work, this, i);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+
+		_wake.notify_all();
+
+		for (std::thread& t : _threads)
+		{
+			t.join();
+		}
+	}
+
+	size_t ThreadPool::size() const
+	{
+		return _threads.size();
+	}
+
+	void ThreadPool::parallel_for(const size_t count, const std::function<void(size_t, size_t)>& task)
+	{
+		std::lock_guard<std::mutex> run_lock(_run_mutex);
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		// every worker is idle here, so the ranges can be set without their locks
+		const size_t workers = size();
+		for (size_t i = 0; i < workers; ++i)
+		{
+			_ranges[i].begin = count * i / workers;
+			_ranges[i].end = count * (i + 1) / workers;
+		}
+
+		_task = &task;
+		_active = workers;
+		_error = nullptr;
+		++_generation;
+
+		_wake.notify_all();
+		_done.wait(lock, [this]() { return _active == 0; });
+
+		_task = nullptr;
+
+		if (_error)
+			std::rethrow_exception(_error);
+	}
+
+	void ThreadPool::work(const size_t worker)
+	{
+		uint64_t generation = 0;
+
+		for (;;)
+		{
+			const std::function<void(size_t, size_t)>* task;
+
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [&]() { return _stop || _generation != generation; });
+
+				if (_stop)
+					return;
+
+				generation = _generation;
+				task = _task;
+			}
+
+			size_t index;
+			while (next(worker, index))
+			{
+				try {
+					(*task)(worker, index);
+				} catch (...)
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					if (!_error)
+						_error = std::current_exception();
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (--_active == 0)
+				_done.notify_one();
+		}
+	}
+
+	bool ThreadPool::next(const size_t worker, size_t& index)
+	{
+		Range& own = _ranges[worker];
+
+		{
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (own.begin < own.end)
+			{
+				index = own.begin++;
+				return true;
+			}
+		}
+
+		const size_t workers = size();
+		for (size_t i = 1; i < workers; ++i)
+		{
+			Range& victim = _ranges[(worker + i) % workers];
+
+			size_t begin, end;
+			{
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (victim.begin >= victim.end)
+					continue;
+
+				// steal the upper half, leaving the victim the indices it is about to run
+				begin = victim.begin + (victim.end - victim.begin) / 2;
+				end = victim.end;
+				victim.end = begin;
+			}
+
+			std::lock_guard<std::mutex> lock(own.mutex);
+			own.begin = begin + 1;
+			own.end = end;
+			index = begin;
+			return true;
+		}
+
+		return false;
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef THALLIUMVM_THREAD_POOL_HPP
+#define THALLIUMVM_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace thallium
+{
+	/**
+	 * Fixed set of worker threads running index ranges with work stealing.
+	 *
+	 * parallel_for splits its range evenly between the workers. A worker which runs out of indices steals the
+	 * upper half of what another worker has left, so uneven jobs still keep every core busy.
+	 */
+	class ThreadPool
+	{
+	public:
+		/**
+		 * Starts the worker threads.
+		 * \param threads Number of workers, 0 meaning one per hardware thread
+		 */
+		ThreadPool(const size_t threads = 0);
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		/**
+		 * Stops and joins the worker threads.
+		 */
+		~ThreadPool();
+
+		/**
+		 * \return Number of worker threads
+		 */
+		size_t size() const;
+
+		/**
+		 * Runs task(worker, index) for every index in [0, count) and waits for all of them.<br>
+		 * worker is the index of the worker thread running the task, below size().
+		 * \param count Number of indices
+		 * \param task Task to run, called concurrently from every worker
+		 * \throws The first exception thrown by a task, once every other index ran
+		 */
+		void parallel_for(const size_t count, const std::function<void(size_t, size_t)>& task);
+
+	private:
+		/**
+		 * Indices left to run by a worker, [begin, end)
+		 */
+		struct Range
+		{
+			std::mutex mutex;
+			size_t begin;
+			size_t end;
+		};
+
+		/**
+		 * Worker thread main loop.
+		 * \param worker Worker index
+		 */
+		void work(const size_t worker);
+
+		/**
+		 * Takes the next index to run, from the worker's own range or stolen from another one.
+		 * \param worker Worker index
+		 * \param index Index to run
+		 * \return false once every range is empty
+		 */
+		bool next(const size_t worker, size_t& index);
+
+		std::vector<std::thread> _threads;
+		std::unique_ptr<Range[]> _ranges;
+
+		/**
+		 * Serializes parallel_for calls
+		 */
+		std::mutex _run_mutex;
+
+		std::mutex _mutex;
+		std::condition_variable _wake;
+		std::condition_variable _done;
+
+		const std::function<void(size_t, size_t)>* _task;
+		uint64_t _generation;
+		size_t _active;
+		bool _stop;
+		std::exception_ptr _error;
+	};
+}
+
+#endif
@@ -0,0 +1,57 @@
+#include <array>
+#include "trap.hpp"
+
+namespace thallium
+{
+	const std::array<const char*, 11> trapcode_match =
+	{
+		{"program reached exit",
+		 "program tried to reach an invalid instruction",
+		 "program tried to reach an instruction out of memory",
+		 "program accessed memory out of bounds",
+		 "job aborted by the host",
+		 "program left its certified code in a VM without checks",
+		 "program ran out of its instruction budget",
+		 "program reached its deadline",
+		 "host function call failed",
+		 "fiber operation failed",
+		 "program accessed an unaligned word atomically"}
+	};
+
+	static_assert(trapcode_match.size() == static_cast<size_t>(TrapCode::_total), "TrapCode enum / string array size mismatch");
+
+	const char* trapcode_string(const TrapCode code)
+	{
+		return trapcode_match[static_cast<size_t>(code)];
+	}
+
+	std::string Trap::message() const
+	{
+		std::string m = trapcode_string(code);
+
+		if (code == TrapCode::None || code == TrapCode::Aborted)
+			return m + ".";
+
+		if (resumable())
+			return m + " at %ip = " + std::to_string(ip) + ".";
+
+		m += " with %ip = " + std::to_string(ip);
+
+		if (code == TrapCode::MemoryOutOfBounds || code == TrapCode::UnalignedAtomic)
+			m += " at address " + std::to_string(address);
+		else if (code == TrapCode::HostCallFailed)
+			m += " for id " + std::to_string(address);
+		else if (code == TrapCode::FiberFailed)
+			m += " for fiber " + std::to_string(address);
+		else if (code == TrapCode::InvalidInstruction)
+			m += " and opcode " + std::to_string(opcode);
+
+		return m + ".";
+	}
+
+	void Trap::report() const
+	{
+		if (*this)
+			error(TimeOfError::Runtime, ErrorType::Fatal, message(), true);
+	}
+}
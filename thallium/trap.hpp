@@ -0,0 +1,139 @@
+#ifndef THALLIUMVM_TRAP_HPP
+#define THALLIUMVM_TRAP_HPP
+
+#include <cstdint>
+#include <string>
+#include "error.hpp"
+#include "register.hpp"
+
+namespace thallium
+{
+	/**
+	 * Typed class enum of the reasons a program stops
+	 */
+	enum class TrapCode : uint8_t
+	{
+		/**
+		 * The program reached exit
+		 */
+		None,
+
+		/**
+		 * ip pointed to an instruction with an unknown opcode, or naming a register which does not exist
+		 */
+		InvalidInstruction,
+
+		/**
+		 * ip pointed to an instruction which does not fit in memory
+		 */
+		InstructionOutOfBounds,
+
+		/**
+		 * A load or store went past the end of memory, only detected in MemoryMode::Guarded, or the range of a bulk
+		 * memory instruction or of a host function view does not fit in memory, whatever the mode
+		 */
+		MemoryOutOfBounds,
+
+		/**
+		 * The host stopped the job with an exception, for instance because its input was rejected
+		 */
+		Aborted,
+
+		/**
+		 * ip left the certified code of the program in a VM configuration without checks, see VMConfig
+		 */
+		UncertifiedCode,
+
+		/**
+		 * VM::run_for spent its instruction budget, the program may be resumed
+		 */
+		BudgetExhausted,
+
+		/**
+		 * VM::run_for reached its deadline, the program may be resumed
+		 */
+		DeadlineReached,
+
+		/**
+		 * hcall named an id no host function is bound to, or a window of registers past the general purpose ones,
+		 * or the host function reported a failure
+		 */
+		HostCallFailed,
+
+		/**
+		 * fspawn found the table of fibers full, fjoin named a fiber which cannot be joined, or a fiber blocked or
+		 * exited while no other fiber could ever run again
+		 */
+		FiberFailed,
+
+		/**
+		 * An atomic instruction named an address which is not a multiple of the word size
+		 */
+		UnalignedAtomic,
+
+		_total
+	};
+
+	/**
+	 * Returns a description of a trap code.
+	 * \param code Trap code
+	 * \return Static string
+	 */
+	const char* trapcode_string(const TrapCode code);
+
+	/**
+	 * Outcome of VM::run: why the program stopped and where.
+	 *
+	 * Filling a trap allocates nothing and throws nothing, so failing programs cost as little as exiting ones.
+	 * Human-readable diagnostics are only built when message() or report() is called.
+	 */
+	struct Trap
+	{
+		TrapCode code = TrapCode::None;
+
+		/**
+		 * Opcode of the instruction at ip, if it fits in memory
+		 */
+		uint8_t opcode = 0;
+
+		/**
+		 * Address of the instruction which trapped
+		 */
+		vmreg_t ip = 0;
+
+		/**
+		 * First memory address which could not be accessed for TrapCode::MemoryOutOfBounds, id of the host function
+		 * for TrapCode::HostCallFailed, id of the joined fiber or else of the running one for TrapCode::FiberFailed,
+		 * address of the word for TrapCode::UnalignedAtomic, 0 otherwise
+		 */
+		uint64_t address = 0;
+
+		/**
+		 * \return Whether the program stopped before reaching exit, on an error or paused
+		 */
+		explicit operator bool() const
+		{
+			return code != TrapCode::None;
+		}
+
+		/**
+		 * \return Whether the program was only paused, and running the VM again resumes it
+		 */
+		bool resumable() const
+		{
+			return code == TrapCode::BudgetExhausted || code == TrapCode::DeadlineReached;
+		}
+
+		/**
+		 * \return Description of the trap, with its location
+		 */
+		std::string message() const;
+
+		/**
+		 * Writes the diagnostics of the trap to the log sink, without throwing.
+		 */
+		void report() const;
+	};
+}
+
+#endif
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cstring>
+#include "verifier.hpp"
+
+namespace thallium
+{
+	/**
+	 * \param d Instruction
+	 * \param index Index of the instruction in the program
+	 * \param jumps Whether the instruction is a conditional jump known to be taken
+	 * \return Whether control may reach the instruction following the given one
+	 */
+	static bool falls_through(const DecodedInstruction& d, const size_t index, const bool jumps)
+	{
+		const DecodedOp op = unfused(d.op);
+
+		// a jump or call to its own address leaves %ip unchanged, which the VM takes as falling through
+		if ((op == DecodedOp::cjmp || op == DecodedOp::call) && d.imm == index * Instruction::size())
+			return true;
+
+		return op != DecodedOp::call && op != DecodedOp::callr && op != DecodedOp::exit && !jumps;
+	}
+
+	/**
+	 * \return Whether an instruction with the given operation ends its basic block
+	 */
+	static bool ends_block(const DecodedOp op)
+	{
+		switch (op)
+		{
+		case DecodedOp::cjmp:
+		case DecodedOp::cjmpr:
+		case DecodedOp::call:
+		case DecodedOp::callr:
+		case DecodedOp::exit:
+		case DecodedOp::fyield:
+		case DecodedOp::fjoin:
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Reasons for an instruction not to be well-formed, recorded as one byte per instruction
+	 */
+	enum class Problem : uint8_t
+	{
+		none,
+		invalid_opcode,
+		invalid_register,
+		writes_ip,
+		invalid_jump,
+		falls_past_end
+	};
+
+	/**
+	 * \return End of the diagnostic of an instruction with the given problem
+	 */
+	static const char* describe(const Problem problem)
+	{
+		switch (problem)
+		{
+		case Problem::invalid_opcode: return "has an invalid opcode";
+		case Problem::invalid_register: return "names a register which does not exist";
+		case Problem::writes_ip: return "writes to %ip outside of a jump";
+		case Problem::invalid_jump: return "jumps outside of the program or into the middle of an instruction";
+		case Problem::falls_past_end: return "falls past the end of the program";
+		case Problem::none: break;
+		}
+
+		return "";
+	}
+
+	Verification::Verification() :
+		_certified(false),
+		_diagnostic("the program is empty")
+	{}
+
+	Verification::Verification(const DecodedInstruction* code, const size_t count, const vmreg_t entry,
+							   const size_t register_count) :
+		_certified(false)
+	{
+		const uint16_t ip = static_cast<uint16_t>(SPRegisters::ip);
+		const uint16_t fl = static_cast<uint16_t>(SPRegisters::fl);
+
+		const auto instruction_start = [count](const vmreg_t address) {
+			return address % Instruction::size() == 0 && address / Instruction::size() < count;
+		};
+
+		// superinstructions are checked as their two halves, the second one keeping its own entry
+		std::vector<Problem> problems(count, Problem::none);
+		std::vector<uint8_t> leaders(count + 1, 0);
+
+		if (count != 0)
+			leaders[0] = 1;
+
+		if (instruction_start(entry))
+			leaders[entry / Instruction::size()] = 1;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const DecodedInstruction& d = code[i];
+			const DecodedOp op = unfused(d.op);
+			const bool static_jump = op == DecodedOp::cjmp || op == DecodedOp::call;
+
+			// VM::decode_instruction also rejects valid opcodes naming registers which do not exist
+			if ((op == DecodedOp::invalid || op == DecodedOp::stale) && d.opcode >= static_cast<uint8_t>(Opcode::_total))
+				problems[i] = Problem::invalid_opcode;
+			else if (op == DecodedOp::invalid || op == DecodedOp::stale)
+				problems[i] = Problem::invalid_register;
+			else if (!registers_in_range(d, register_count))
+				problems[i] = Problem::invalid_register;
+			else if (writes_register(d, ip))
+				problems[i] = Problem::writes_ip;
+			else if (static_jump && !instruction_start(d.imm))
+				problems[i] = Problem::invalid_jump;
+
+			if (static_jump && instruction_start(d.imm))
+				leaders[d.imm / Instruction::size()] = 1;
+
+			if (ends_block(op))
+				leaders[i + 1] = 1;
+		}
+
+		// blocks, and the one each instruction belongs to, programs having fewer instructions than addresses
+		std::vector<uint32_t> block_of(count);
+		std::vector<uint8_t> jumps(count, 0);
+		bool test_set = false;
+
+		_blocks.reserve(static_cast<size_t>(std::count(begin(leaders), begin(leaders) + count, uint8_t(1))));
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (leaders[i])
+			{
+				_blocks.push_back(BasicBlock{i, i, {}, false, true, true});
+				test_set = false;
+			}
+
+			// "teq r r" sets the TEST flag, making the conditional jumps following it in the block unconditional
+			const DecodedInstruction& d = code[i];
+			const DecodedOp op = unfused(d.op);
+
+			if (op == DecodedOp::teq || op == DecodedOp::tgt || op == DecodedOp::tlt)
+				test_set = op == DecodedOp::teq && d.a == d.b;
+			else if (op == DecodedOp::mcmp || op == DecodedOp::mfind || op == DecodedOp::acas || writes_register(d, fl))
+				test_set = false;
+
+			jumps[i] = test_set && (op == DecodedOp::cjmp || op == DecodedOp::cjmpr);
+
+			if (problems[i] == Problem::none && falls_through(d, i, jumps[i]) && i + 1 == count)
+				problems[i] = Problem::falls_past_end;
+
+			BasicBlock& block = _blocks.back();
+			block.end = i + 1;
+			block.well_formed = block.well_formed && problems[i] == Problem::none;
+			block_of[i] = static_cast<uint32_t>(_blocks.size() - 1);
+		}
+
+		// predecessors of block b are predecessors[first_predecessor[b]] up to the first predecessor of block b + 1
+		std::vector<size_t> first_predecessor(_blocks.size() + 1, 0);
+		for (size_t b = 0; b < _blocks.size(); ++b)
+		{
+			BasicBlock& block = _blocks[b];
+			const size_t last = block.end - 1;
+			const DecodedInstruction& d = code[last];
+			const DecodedOp op = unfused(d.op);
+
+			// at most a jump target and the next block, so the successors are allocated once
+			size_t successors[2];
+			size_t successor_count = 0;
+
+			if ((op == DecodedOp::cjmp || op == DecodedOp::call) && instruction_start(d.imm))
+				successors[successor_count++] = block_of[d.imm / Instruction::size()];
+
+			if (falls_through(d, last, jumps[last]) && last + 1 < count
+				&& (successor_count == 0 || successors[0] != block_of[last + 1]))
+				successors[successor_count++] = block_of[last + 1];
+
+			if (successor_count == 2 && successors[1] < successors[0])
+				std::swap(successors[0], successors[1]);
+
+			block.successors.assign(successors, successors + successor_count);
+			block.dynamic_exit = op == DecodedOp::cjmpr || op == DecodedOp::callr;
+
+			for (const size_t s : block.successors)
+				++first_predecessor[s + 1];
+		}
+
+		for (size_t b = 0; b < _blocks.size(); ++b)
+			first_predecessor[b + 1] += first_predecessor[b];
+
+		std::vector<size_t> predecessors(first_predecessor.back());
+		{
+			std::vector<size_t> filled(begin(first_predecessor), end(first_predecessor) - 1);
+			for (size_t b = 0; b < _blocks.size(); ++b)
+			{
+				for (const size_t s : _blocks[b].successors)
+					predecessors[filled[s]++] = b;
+			}
+		}
+
+		// a block is unsafe if it is not well-formed, or if it leads to an unsafe block
+		std::vector<size_t> worklist;
+		for (size_t b = 0; b < _blocks.size(); ++b)
+		{
+			_blocks[b].safe = _blocks[b].well_formed;
+			if (!_blocks[b].safe)
+				worklist.push_back(b);
+		}
+
+		while (!worklist.empty())
+		{
+			const size_t b = worklist.back();
+			worklist.pop_back();
+
+			for (size_t i = first_predecessor[b]; i < first_predecessor[b + 1]; ++i)
+			{
+				const size_t p = predecessors[i];
+				if (_blocks[p].safe)
+				{
+					_blocks[p].safe = false;
+					worklist.push_back(p);
+				}
+			}
+		}
+
+		_safe.resize(count);
+		for (const BasicBlock& block : _blocks)
+			std::fill(begin(_safe) + block.first, begin(_safe) + block.end, block.safe ? 1 : 0);
+
+		if (count == 0)
+		{
+			_diagnostic = "the program is empty";
+			return;
+		}
+
+		if (!instruction_start(entry))
+		{
+			_diagnostic = "the entry point %ip = " + std::to_string(entry) + " is not an instruction of the program";
+			return;
+		}
+
+		const size_t entry_block = block_of[entry / Instruction::size()];
+		_certified = _blocks[entry_block].safe;
+		if (_certified)
+			return;
+
+		// the first faulty instruction, by address, among the blocks reachable from the entry point
+		std::vector<uint8_t> reached(_blocks.size(), 0);
+		worklist.assign(1, entry_block);
+		reached[entry_block] = 1;
+
+		size_t faulty = count;
+		while (!worklist.empty())
+		{
+			const size_t b = worklist.back();
+			worklist.pop_back();
+
+			for (size_t i = _blocks[b].first; i < _blocks[b].end; ++i)
+			{
+				if (problems[i] != Problem::none)
+				{
+					faulty = std::min(faulty, i);
+					break;
+				}
+			}
+
+			for (const size_t s : _blocks[b].successors)
+			{
+				if (!reached[s])
+				{
+					reached[s] = 1;
+					worklist.push_back(s);
+				}
+			}
+		}
+
+		_diagnostic = "the instruction at %ip = " + std::to_string(faulty * Instruction::size()) + " " + describe(problems[faulty]);
+	}
+
+	Verification::Verification(std::vector<BasicBlock> blocks, const vmreg_t entry, std::string diagnostic) :
+		_blocks(std::move(blocks)),
+		_certified(false),
+		_diagnostic(std::move(diagnostic))
+	{
+		for (const BasicBlock& block : _blocks)
+		{
+			_safe.resize(std::max(_safe.size(), block.end));
+			std::fill(begin(_safe) + block.first, begin(_safe) + block.end, block.safe ? 1 : 0);
+		}
+
+		_certified = safe_target(entry);
+	}
+
+	bool Verification::certified() const
+	{
+		return _certified;
+	}
+
+	const std::string& Verification::diagnostic() const
+	{
+		return _diagnostic;
+	}
+
+	const std::vector<BasicBlock>& Verification::blocks() const
+	{
+		return _blocks;
+	}
+
+	uint32_t translation_layout(const size_t header_size)
+	{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		const uint32_t order = 2;
+#else
+		const uint32_t order = 1;
+#endif
+		return order | uint32_t(sizeof(DecodedInstruction)) << 8 | uint32_t(sizeof(StoredBlock)) << 16
+			   | uint32_t(header_size) << 24;
+	}
+
+	void store_blocks(const Verification& verification, std::vector<StoredBlock>& blocks,
+					  std::vector<uint64_t>& successors)
+	{
+		blocks.reserve(verification.blocks().size());
+
+		for (const BasicBlock& block : verification.blocks())
+		{
+			StoredBlock stored{};
+			stored.first = block.first;
+			stored.end = block.end;
+			stored.successors = successors.size();
+			stored.successor_count = block.successors.size();
+			stored.dynamic_exit = block.dynamic_exit;
+			stored.well_formed = block.well_formed;
+			stored.safe = block.safe;
+			blocks.push_back(stored);
+
+			successors.insert(end(successors), begin(block.successors), end(block.successors));
+		}
+	}
+
+	bool restore_blocks(const uint8_t* blocks, const size_t block_count, const uint8_t* successors,
+						const size_t successor_count, const size_t count, std::vector<BasicBlock>& restored)
+	{
+		restored.resize(block_count);
+
+		for (size_t b = 0; b < block_count; ++b)
+		{
+			StoredBlock stored;
+			std::memcpy(&stored, blocks + b * sizeof(StoredBlock), sizeof(stored));
+
+			if (stored.first >= stored.end || stored.end > count || stored.successors > successor_count
+				|| stored.successor_count > successor_count - stored.successors)
+				return false;
+
+			restored[b].first = stored.first;
+			restored[b].end = stored.end;
+			restored[b].successors.resize(stored.successor_count);
+			if (stored.successor_count != 0)
+				std::memcpy(restored[b].successors.data(), successors + stored.successors * sizeof(uint64_t),
+							stored.successor_count * sizeof(uint64_t));
+			restored[b].dynamic_exit = stored.dynamic_exit != 0;
+			restored[b].well_formed = stored.well_formed != 0;
+			restored[b].safe = stored.safe != 0;
+		}
+
+		return true;
+	}
+}
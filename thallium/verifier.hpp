@@ -0,0 +1,173 @@
+#ifndef THALLIUMVM_VERIFIER_HPP
+#define THALLIUMVM_VERIFIER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "decoded.hpp"
+#include "instruction.hpp"
+#include "register.hpp"
+
+namespace thallium
+{
+	/**
+	 * Straight-line run of instructions of a program, only entered through its first instruction by static jumps
+	 */
+	struct BasicBlock
+	{
+		/**
+		 * Index of the first instruction of the block
+		 */
+		size_t first;
+
+		/**
+		 * Index following the last instruction of the block
+		 */
+		size_t end;
+
+		/**
+		 * Blocks control may flow to from this one, dynamic jumps aside
+		 */
+		std::vector<size_t> successors;
+
+		/**
+		 * Whether the block ends with cjmpr or callr, whose target is only known at runtime
+		 */
+		bool dynamic_exit;
+
+		/**
+		 * Whether every instruction of the block is well-formed, see Verification
+		 */
+		bool well_formed;
+
+		/**
+		 * Whether the block is well-formed and only leads to safe blocks
+		 */
+		bool safe;
+	};
+
+	/**
+	 * Load-time verification of a pre-decoded program.
+	 *
+	 * Builds the control flow graph of the program and finds the blocks from which no execution can reach an
+	 * instruction that is not well-formed, i.e. one with an invalid opcode or register operand, writing to ip outside
+	 * of jumps and calls, jumping statically outside the program or into the middle of an instruction, or falling
+	 * past the end of the program, conditional jumps following "teq r r" in their block being known to be taken.
+	 * Programs whose entry point is safe are certified: the VM runs them without checking what it fetches, dynamic
+	 * jumps being the only exits from safe code it has to check, through safe_target().<br>
+	 * Writing to the code region voids the verification, see VM::certified.
+	 */
+	class Verification
+	{
+	public:
+		/**
+		 * Verification of an empty program, which is never certified.
+		 */
+		Verification();
+
+		/**
+		 * Verifies a program.
+		 * \param code Pre-decoded program, indexed by instruction
+		 * \param count Number of instructions
+		 * \param entry Address of the first instruction to run
+		 * \param register_count Number of registers available
+		 */
+		Verification(const DecodedInstruction* code, const size_t count, const vmreg_t entry,
+					 const size_t register_count);
+
+		/**
+		 * Restores a verification from the blocks found by another one, without analyzing the program again. The blocks
+		 * are trusted, so they have to come from a verification of the same program, as in a private ProgramCache or a
+		 * translated program file loaded as trusted.
+		 * \param blocks Blocks of the program, see blocks()
+		 * \param entry Address of the first instruction to run
+		 * \param diagnostic Diagnostic of the original verification
+		 */
+		Verification(std::vector<BasicBlock> blocks, const vmreg_t entry, std::string diagnostic);
+
+		/**
+		 * \return Whether the program is safe from its entry point on
+		 */
+		bool certified() const;
+
+		/**
+		 * \return Description of the first problem reachable from the entry point, empty if the program is certified
+		 */
+		const std::string& diagnostic() const;
+
+		/**
+		 * \return Control flow graph of the program, blocks being sorted by address
+		 */
+		const std::vector<BasicBlock>& blocks() const;
+
+		/**
+		 * Checks the target of a dynamic jump leaving certified code.
+		 * \param address Target address
+		 * \return Whether address starts an instruction of a safe block
+		 */
+		bool safe_target(const vmreg_t address) const
+		{
+			const size_t slot = address / Instruction::size();
+			return slot < _safe.size() && slot * Instruction::size() == address && _safe[slot] != 0;
+		}
+
+	private:
+		std::vector<BasicBlock> _blocks;
+
+		/**
+		 * Per instruction, whether it belongs to a safe block
+		 */
+		std::vector<uint8_t> _safe;
+
+		bool _certified;
+		std::string _diagnostic;
+	};
+
+	/**
+	 * BasicBlock as stored with a translated program, in program cache entries and translated program files, its
+	 * successors being a range of a successor array
+	 */
+	struct StoredBlock
+	{
+		uint64_t first;
+		uint64_t end;
+		uint64_t successors;
+		uint64_t successor_count;
+		uint8_t dynamic_exit;
+		uint8_t well_formed;
+		uint8_t safe;
+		uint8_t reserved[5];
+	};
+
+	/**
+	 * \param header_size Size of the header describing the stored records
+	 * \return Tag of the byte order and record sizes of the host, translations being stored as laid out in memory
+	 *         and only read back on hosts with the same tag
+	 */
+	uint32_t translation_layout(const size_t header_size);
+
+	/**
+	 * Flattens the blocks of a verification to store them.
+	 * \param verification Verification to store
+	 * \param blocks Stored blocks
+	 * \param successors Successors of every block, one after the other
+	 */
+	void store_blocks(const Verification& verification, std::vector<StoredBlock>& blocks,
+					  std::vector<uint64_t>& successors);
+
+	/**
+	 * Reads back blocks stored by store_blocks().
+	 * \param blocks Stored blocks, which may not be aligned
+	 * \param block_count Number of stored blocks
+	 * \param successors Stored successors, which may not be aligned
+	 * \param successor_count Number of stored successors
+	 * \param count Number of instructions of the program
+	 * \param restored Blocks read back
+	 * \return false if a block lies outside of the program or of the successors
+	 */
+	bool restore_blocks(const uint8_t* blocks, const size_t block_count, const uint8_t* successors,
+						const size_t successor_count, const size_t count, std::vector<BasicBlock>& restored);
+}
+
+#endif
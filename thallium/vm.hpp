@@ -1,20 +1,138 @@
 #ifndef THALLIUMVM_VM_HPP
 #define THALLIUMVM_VM_HPP
 
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <string>
 #include <tuple>
+#include <type_traits>
 #include <vector>
+#include "aot.hpp"
+#include "atomic.hpp"
+#include "decoded.hpp"
+#include "fiber.hpp"
+#include "host.hpp"
+#include "image.hpp"
 #include "instruction.hpp"
+#include "jit.hpp"
+#include "memory.hpp"
+#include "paged_memory.hpp"
+#include "profiler.hpp"
 #include "register.hpp"
+#include "thread_pool.hpp"
+#include "trap.hpp"
 
 namespace thallium
 {
-	class VM
+	/**
+	 * Memory backend of the VM: the flat mapping where anonymous mappings exist, the page table elsewhere or
+	 * when THALLIUM_PAGED_MEMORY is defined
+	 */
+#if defined(THALLIUM_HAS_MMAP) && !defined(THALLIUM_PAGED_MEMORY)
+	using VMMemory = Memory;
+#else
+	using VMMemory = PagedMemory;
+#endif
+
+	/**
+	 * Typed class enum of the ThalliumVM execution engines
+	 */
+	enum class Engine
+	{
+		/**
+		 * Central switch over the decoded operation
+		 */
+		Switch,
+
+		/**
+		 * Threaded code: every handler dispatches the next instruction itself through a computed goto.<br>
+		 * Falls back to Engine::Switch on compilers without the labels as values extension.
+		 */
+		Threaded,
+
+		/**
+		 * x86-64 JIT compiling basic blocks to native code, with the interpreter handling the rest.<br>
+		 * Falls back to Engine::Switch on other platforms.
+		 */
+		Jit,
+
+		/**
+		 * Program translated ahead of time to C++ and loaded as a shared object, see AotModule, with the
+		 * interpreter handling the rest. The first run of a program compiles it unless it is in the cache.<br>
+		 * Falls back to Engine::Switch where modules cannot be built or loaded, and once the program wrote to
+		 * its code.
+		 */
+		Aot
+	};
+
+	/**
+	 * Compile-time configuration of a BasicVM.
+	 * \param MemoryT Memory backend, Memory or PagedMemory
+	 * \param GP Number of general purpose registers
+	 * \param Checked Whether the VM can run code the verifier did not certify. VMs without checks refuse to import
+	 *        programs which are not certified, and trap with TrapCode::UncertifiedCode when the program leaves its
+	 *        certified code, by writing to it or jumping dynamically out of it. Only the unchecked interpreter loops
+	 *        are compiled then.
+	 * \param Profiling Whether BasicVM::run(Profiler&, Engine) is available, the profiled loops being compiled
+	 * \param DefaultEngine Execution engine used when none is given to run() or run_for()
+	 * \param FixedEngine Whether DefaultEngine is picked at compile time: the engine given to run() or run_for() is
+	 *        then ignored, and the loops of the other engines are not compiled. Otherwise run() picks the engine
+	 *        it is given once per run.
+	 */
+	template<typename MemoryT = VMMemory, uint16_t GP = Registers::gp_count(), bool Checked = true,
+			 bool Profiling = true, Engine DefaultEngine = Engine::Switch, bool FixedEngine = false>
+	struct VMConfig
+	{
+		using MemoryBackend = MemoryT;
+
+		constexpr static uint16_t gp_count()
+		{
+			return GP;
+		}
+
+		constexpr static bool checked()
+		{
+			return Checked;
+		}
+
+		constexpr static bool profiling()
+		{
+			return Profiling;
+		}
+
+		constexpr static Engine engine()
+		{
+			return DefaultEngine;
+		}
+
+		constexpr static bool fixed_engine()
+		{
+			return FixedEngine;
+		}
+	};
+
+	/**
+	 * ThalliumVM virtual machine, specialized at compile time by a VMConfig.
+	 *
+	 * The register file is stored inline and the memory backend is a member, so that nothing is reached through
+	 * an indirection the configuration did not ask for. Registers are used through a RegisterBinding, which
+	 * fibers rebind to their own registers.
+	 * \param Config Configuration of the VM, see VMConfig
+	 */
+	template<typename Config>
+	class BasicVM
 	{
 	public:
+		using RegisterFile = BasicRegisters<Config::gp_count()>;
+		using MemoryBackend = typename Config::MemoryBackend;
+
 		/**
 		 * VM constructor, which initializes the memory size.
+		 * \param memory_size Memory size in bytes
+		 * \param memory_mode Handling of out of bounds memory accesses, see MemoryMode
 		 */
-		VM(const size_t memory_size = 0);
+		BasicVM(const size_t memory_size = 0, const MemoryMode memory_mode = MemoryMode::Flat);
 
 		/**
 		 * Decode instruction arguments into individual unsigned types
@@ -23,25 +141,210 @@ namespace thallium
 		 * \return Tuple of decoded arguments
 		 */
 		template<typename... Types>
-		std::tuple<Types...> decode(uint64_t argument);
+		static std::tuple<Types...> decode(uint64_t argument);
+
+		/**
+		 * Decodes a serialized instruction.
+		 * \param instruction Pointer to the Instruction::size() bytes of the instruction
+		 * \return Decoded instruction, with DecodedOp::invalid if it cannot be executed
+		 */
+		static DecodedInstruction decode_instruction(const uint8_t* instruction);
 
 		/**
 		 * Imports a program into the VM memory.
+		 *
+		 * The program is also translated once into its pre-decoded form, which is what run() executes.
 		 * \param program The ThalliumVM program to load
 		 */
-		void import_program(const std::vector<Instruction> program);
+		void import_program(const std::vector<Instruction>& program);
+
+		/**
+		 * Imports a shared program image into the VM memory.
+		 *
+		 * The program may not name more registers than the VM has, and has to be certified by the verifier if the
+		 * VM has no checks.
+		 * The code is mapped copy-on-write rather than copied where the platform allows it, and the pre-decoded
+		 * program is used in place until the program writes to its own code. The rest of memory is cleared, and
+		 * ip and sp are set to the entry point and initial stack pointer of the image.
+		 * \param image Image of the ThalliumVM program to load
+		 */
+		void import_program(std::shared_ptr<const ProgramImage> image);
+
+		/**
+		 * Imports a program file written by ProgramImage::save, mapping its code in place, and the pre-decoded program
+		 * of translated files.
+		 * \param path Path of the program file
+		 * \param trusted Whether to trust the verification stored in a translated file, see ProgramImage::load
+		 */
+		void import_program_file(const std::string& path, const bool trusted = false);
+
+		/**
+		 * Restores the state the VM was in right after import_program: registers are cleared, memory past the
+		 * program is zeroed, and code the program overwrote is restored.
+		 *
+		 * Lets one VM run many jobs with the same program without reallocating its memory.
+		 */
+		void reset();
+
+		/**
+		 * Copies bytes to memory, invalidating the affected code like a store from the program would.
+		 * \param address Destination address
+		 * \param data Bytes to copy
+		 * \param size Number of bytes
+		 */
+		void write_memory(const vmreg_t address, const uint8_t* data, const size_t size);
+
+		/**
+		 * Returns the registers of the running fiber, those of the VM until the program uses fibers.
+		 *
+		 * Fibers only have the registers the program names when the first one is created, size() of the registers
+		 * returned telling how many.
+		 * \return Reference to the VM registers
+		 */
+		RegisterBinding& registers();
+
+		/**
+		 * Binds a host function to an id, replacing the function bound to it if any.
+		 *
+		 * Functions are kept in a table indexed by id, so hcall finds them with a single lookup. Ids should thus be
+		 * small and dense.
+		 * \param id Id programs call the function with, below max_host_functions()
+		 * \param function Native function
+		 * \param registers Number of registers the function reads and writes, from the base register of hcall on
+		 * \param context Pointer handed to every call of the function
+		 */
+		void bind(const uint32_t id, const HostFunction function, const uint16_t registers, void* context = nullptr);
+
+		/**
+		 * Removes the function bound to an id, programs calling it trapping with TrapCode::HostCallFailed.
+		 * \param id Id of the function
+		 */
+		void unbind(const uint32_t id);
+
+		/**
+		 * \return Number of ids host functions can be bound to
+		 */
+		constexpr static uint32_t max_host_functions()
+		{
+			return 65536;
+		}
+
+		/**
+		 * Sets the number of host threads run() spreads the fibers of the program over.
+		 *
+		 * With more than one thread, run() starts with the fiber whose registers registers() returns and keeps
+		 * one executor per thread, each running a ready fiber until it yields, blocks or exits. Executors share the
+		 * memory and the pre-decoded program of the VM, and take fibers from a common ready queue, so the threads
+		 * stay busy while there are more ready fibers than threads. The first fiber to trap, or the exit of the
+		 * main fiber, stops every executor at its next block boundary; registers() then returns the registers of
+		 * that fiber.<br>
+		 * Fibers on different threads run at the same time: memory they share is ordered by fiber switches, see
+		 * FiberScheduler, and by atomic instructions, see Opcode::acas for the memory model. Code the program
+		 * writes while several threads run it is only seen by the thread which wrote it, until the run ends.
+		 * run_for(), profiled runs, programs which already wrote to their code and VMs over paged memory run their
+		 * fibers on the calling thread. The threads are started here, and kept until the number of threads changes.
+		 * \param threads Number of threads, 1 to run fibers on the calling thread only
+		 */
+		void set_fiber_threads(const size_t threads);
+
+		/**
+		 * \return Number of host threads run() spreads fibers over, always 1 over paged memory
+		 */
+		size_t fiber_threads() const;
+
+		/**
+		 * \return Id of the fiber whose registers registers() returns, 0 for the main fiber
+		 */
+		uint32_t fiber() const;
+
+		/**
+		 * \return Number of superinstructions created when importing the current program
+		 */
+		size_t fusions() const;
+
+		/**
+		 * \return Bytes of VM memory currently backed by physical memory
+		 */
+		size_t resident_memory() const;
+
+		/**
+		 * Checks whether the next run starts in certified code, see Verification.
+		 *
+		 * Certified code runs without checking the instructions it fetches, until it writes to the code region or
+		 * jumps dynamically out of it.
+		 * \return Whether ip is in a safe block of the imported program, and the program did not write to its code
+		 */
+		bool certified();
+
+		/**
+		 * Runs the program until it exits or traps.
+		 *
+		 * Runtime errors neither throw nor allocate: they stop the program, ip pointing to the faulting
+		 * instruction, and are described by the returned Trap. In MemoryMode::Guarded, out of bounds memory
+		 * accesses trap as well.
+		 * \param engine Execution engine to use
+		 * \return Why the program stopped
+		 */
+		Trap run(const Engine engine = Config::engine());
+
+		/**
+		 * Runs the program while recording an execution profile, in configurations with profiling.
+		 *
+		 * Profiling goes through its own instantiation of the interpreter loops, leaving run(Engine) untouched.
+		 * Engine::Jit and Engine::Aot are profiled through Engine::Switch, since compiled code cannot report what
+		 * it executes.
+		 * \param profiler Profiler accumulating the counts
+		 * \param engine Execution engine to use
+		 * \return Why the program stopped
+		 */
+		Trap run(Profiler& profiler, const Engine engine = Config::engine());
+
+		/**
+		 * Runs the program for a limited number of instructions.
+		 *
+		 * The budget is charged once per basic block, when control leaves it, and execution stops at the next
+		 * block boundary once it is spent, with TrapCode::BudgetExhausted. The budget may thus be exceeded by
+		 * up to one basic block. Every piece of state is kept, and running again resumes right where the program
+		 * stopped.
+		 * \param budget Number of instructions the program may execute
+		 * \param engine Execution engine to use
+		 * \return Why the program stopped
+		 */
+		Trap run_for(const uint64_t budget, const Engine engine = Config::engine());
+
+		/**
+		 * Runs the program for a limited number of instructions and until a wall-clock deadline.
+		 *
+		 * The clock is only read every deadline_slice() instructions, so the deadline may be overrun by the time
+		 * it takes to run that many. Past the deadline, the program stops at a block boundary with
+		 * TrapCode::DeadlineReached, and may be resumed.
+		 * \param budget Number of instructions the program may execute
+		 * \param deadline Time after which the program is stopped
+		 * \param engine Execution engine to use
+		 * \return Why the program stopped
+		 */
+		Trap run_for(const uint64_t budget, const std::chrono::steady_clock::time_point deadline,
+					 const Engine engine = Config::engine());
 
 		/**
-		 * Runs the program
+		 * \return Number of instructions charged by the last run, run_for or not
 		 */
-		void run();
+		uint64_t budget_used() const;
+
+		/**
+		 * \return Number of instructions run between two reads of the clock by run_for with a deadline
+		 */
+		constexpr static uint64_t deadline_slice()
+		{
+			return 64 * 1024;
+		}
 
 	private:
 		/**
 		 * Fallback for decode_consume when there aren't anything left in the tuple to consume
 		 */
 		template<size_t TupleIndex, size_t BinOffset, typename TupleT, std::enable_if_t<TupleIndex >= std::tuple_size<TupleT>::value>* = nullptr>
-		void decode_consume(TupleT&, const uint64_t);
+		static void decode_consume(TupleT&, const uint64_t);
 
 		/**
 		 * Consume-decode a part of the instruction into a single tuple entry, and consume the next one subsequently
@@ -52,11 +355,470 @@ namespace thallium
 		 * \param argument Argument to decode
 		 */
 		template<size_t TupleIndex, size_t BinOffset, typename TupleT, std::enable_if_t<TupleIndex < std::tuple_size<TupleT>::value>* = nullptr>
-		void decode_consume(TupleT& t, const uint64_t argument);
+		static void decode_consume(TupleT& t, const uint64_t argument);
+
+		/**
+		 * Runs the program with the given engine, turning memory faults into traps if memory is guarded.
+		 * \param budget Fuel given to the program, at most max_fuel()
+		 * \param engine Execution engine to use
+		 * \param profile Whether to report to _profiler
+		 * \return Why the program stopped
+		 */
+		Trap run_guarded(const uint64_t budget, const Engine engine, const bool profile);
+
+		/**
+		 * \return Fuel of an unlimited run, large enough to never run out
+		 */
+		constexpr static uint64_t max_fuel()
+		{
+			return std::numeric_limits<int64_t>::max();
+		}
+
+		/**
+		 * Runs the program with the given engine, or with the one of the configuration if it is fixed.
+		 */
+		void run_engine(const Engine engine, const bool profile);
+
+		template<Engine E>
+		using EngineTag = std::integral_constant<Engine, E>;
+
+		/**
+		 * Picks the loop of the engine given at run time.
+		 */
+		void run_engine(const Engine engine, const bool profile, std::false_type);
+
+		/**
+		 * Runs the loop of the engine of the configuration, the only one compiled.
+		 */
+		void run_engine(const Engine engine, const bool profile, std::true_type);
+
+		/**
+		 * Runs the loop of an engine, the profiled loops being those of the interpreters.
+		 */
+		void run_loop(const bool profile, EngineTag<Engine::Switch>);
+		void run_loop(const bool profile, EngineTag<Engine::Threaded>);
+		void run_loop(const bool profile, EngineTag<Engine::Jit>);
+		void run_loop(const bool profile, EngineTag<Engine::Aot>);
+
+		/**
+		 * Records the trap of an access violation at a host address.
+		 * \param address Faulting host address
+		 * \param pc Faulting host instruction pointer, or nullptr
+		 */
+		void memory_fault(const uint8_t* address, const void* pc);
+
+		/**
+		 * Runs the program through a central switch, certified code going through its unchecked variant.
+		 * \param Profile Whether to report to _profiler
+		 */
+		template<bool Profile>
+		void run_switch();
+
+		/**
+		 * Runs the program with threaded dispatch, certified code going through its unchecked variant.
+		 * \param Profile Whether to report to _profiler
+		 */
+		template<bool Profile>
+		void run_threaded();
+
+		/**
+		 * Runs the program with threaded dispatch.
+		 * \param Profile Whether to report to _profiler
+		 * \param Certified Whether to run certified code, stopping once it leaves it with _certified cleared
+		 */
+		template<bool Profile, bool Certified>
+		void dispatch_threaded();
+
+		/**
+		 * Runs the program through the JIT, interpreting what it cannot compile.
+		 */
+		void run_jit();
+
+		/**
+		 * Runs the program through its module compiled ahead of time, interpreting what it does not handle.
+		 */
+		void run_aot();
+
+		/**
+		 * Executes the instruction pointed by ip through the central switch and advances ip.
+		 * \param Profile Whether to report to _profiler
+		 * \param Certified Whether ip is in certified code, which is then fetched unchecked
+		 * \return false if the program reached its end, or left certified code with _certified cleared
+		 */
+		template<bool Profile, bool Certified = false>
+		bool step();
+
+		/**
+		 * Checks whether an instruction executed in certified code left it, by writing to the code region or by
+		 * jumping dynamically outside of the safe blocks.
+		 * \param op Operation of the executed instruction
+		 * \return Whether the next instruction has to be fetched with checks
+		 */
+		bool leaves_certified_code(const DecodedOp op);
+
+		/**
+		 * Reports an instruction about to be executed to _profiler.
+		 * \param ip Address of the instruction
+		 * \param d Decoded instruction
+		 */
+		void profile_before(const vmreg_t ip, const DecodedInstruction& d);
+
+		/**
+		 * Reports the control flow of an executed instruction to _profiler, as well as the second half of superinstructions.
+		 * \param ip Address of the instruction
+		 * \param d Decoded instruction
+		 * \param op Operation of d when it was fetched
+		 */
+		void profile_after(const vmreg_t ip, const DecodedInstruction& d, const DecodedOp op);
+
+		/**
+		 * Evaluates the comparison of a test instruction.
+		 * \param Op Operation of the test, teq, tgt or tlt
+		 * \param d Decoded instruction
+		 * \return Whether the TEST flag is to be set
+		 */
+		template<DecodedOp Op>
+		bool test(const DecodedInstruction& d);
+
+		/**
+		 * Executes a single decoded instruction, without advancing ip.
+		 * \param Op Operation to execute, which must match d.op
+		 * \param d Decoded instruction
+		 */
+		template<DecodedOp Op>
+		void execute(const DecodedInstruction& d);
+
+		/**
+		 * Executes a bulk memory instruction, without advancing ip.
+		 * \param Op Operation to execute, from mcpy to vsum, which must match d.op
+		 * \param d Decoded instruction
+		 * \return false if one of its ranges does not fit in memory, nothing being done and the trap recorded
+		 */
+		template<DecodedOp Op>
+		bool execute_bulk(const DecodedInstruction& d);
+
+		/**
+		 * Checks that a range of a bulk memory instruction fits in memory, recording the trap if it does not.
+		 * \param d Decoded instruction
+		 * \param address First address of the range
+		 * \param size Size of the range, empty ranges always fitting
+		 * \return Whether the range fits in memory
+		 */
+		bool bulk_range(const DecodedInstruction& d, const vmreg_t address, const uint64_t size);
+
+		/**
+		 * Executes an atomic instruction, without advancing ip.
+		 * \param Op Operation to execute, acas, aadd or axchg, which must match d.op
+		 * \param d Decoded instruction
+		 * \return false if its word is unaligned or does not fit in memory, nothing being done and the trap recorded
+		 */
+		template<DecodedOp Op>
+		bool execute_atomic(const DecodedInstruction& d);
+
+		/**
+		 * Calls the host function of an hcall instruction, without advancing ip.
+		 * \param d Decoded instruction
+		 * \return false if the call trapped, the trap being recorded
+		 */
+		bool execute_host(const DecodedInstruction& d);
+
+		/**
+		 * Records the trap of a failed host call.
+		 * \param d Decoded instruction
+		 * \param code TrapCode::HostCallFailed, or TrapCode::MemoryOutOfBounds for a view out of memory
+		 * \param address Id of the function, or first address out of memory
+		 */
+		void host_trap(const DecodedInstruction& d, const TrapCode code, const uint64_t address);
+
+		/**
+		 * Copies a range of memory to a buffer for a host function, when memory is not contiguous.
+		 * \param memory Memory backend of the VM
+		 */
+		static void host_copy_in(void* memory, const vmreg_t address, uint8_t* out, const size_t size);
+
+		/**
+		 * Copies a buffer of a host function back to memory, when memory is not contiguous.
+		 * \param memory Memory backend of the VM
+		 */
+		static void host_copy_out(void* memory, const vmreg_t address, const uint8_t* data, const size_t size);
+
+		/**
+		 * Creates a fiber for an fspawn instruction, without advancing ip.
+		 * \param d Decoded instruction
+		 * \return false if the table of fibers is full, the trap being recorded
+		 */
+		bool spawn_fiber(const DecodedInstruction& d);
+
+		/**
+		 * Executes an fyield, fjoin, or the exit of a fiber other than the main one, then advances ip to the next
+		 * instruction of the fiber running afterwards.
+		 * \param d Decoded instruction
+		 * \param init_ip Address of the instruction
+		 * \return false if the fuel ran out, if the operation trapped, or if no fiber was left to run on this
+		 *         executor, _fiber being FiberScheduler::none() then
+		 */
+		bool switch_fiber(const DecodedInstruction& d, const vmreg_t init_ip);
+
+		/**
+		 * Records the trap of a failed fiber operation.
+		 * \param d Decoded instruction
+		 * \param fiber Id of the fiber involved
+		 */
+		void fiber_trap(const DecodedInstruction& d, const uint32_t fiber);
+
+		/**
+		 * \return Scheduler of the fibers of the program, created with the running fiber as the main one
+		 */
+		FiberScheduler& fibers();
+
+		/**
+		 * Binds the registers of the fiber an operation of the scheduler loaded, or those of the VM if it is idle.
+		 * \param registers Registers of the fiber
+		 */
+		void bind_fiber(vmreg_t* registers);
+
+		/**
+		 * Drops the fibers of the program, the registers of the running one being copied back to those of the VM.
+		 */
+		void end_fibers();
+
+		/**
+		 * \return Number of registers of a fiber: those named by the program or by the windows of the host
+		 *         functions it calls, every register once the program wrote to its code
+		 */
+		size_t fiber_span() const;
+
+		/**
+		 * Runs the fibers of the program on fiber_threads() executors, this VM being the first one.
+		 * \param engine Execution engine to use
+		 * \return Why the program stopped
+		 */
+		Trap run_fibers(const Engine engine);
+
+		/**
+		 * Runs fibers on this executor until the run is stopped, in slices of deadline_slice() instructions.
+		 * \param engine Execution engine to use
+		 * \return Whether this executor stopped the run, its trap and fiber being the outcome of the run
+		 */
+		bool execute_fibers(const Engine engine);
+
+		/**
+		 * Makes the memory of an executor a view of the memory of the VM.
+		 * \param view Memory of the executor
+		 * \param memory Memory of the VM
+		 */
+		static void share_memory(Memory& view, Memory& memory);
+
+		/**
+		 * Paged memory commits its pages when they are first touched, which threads cannot do concurrently, see
+		 * parallel_fibers().
+		 */
+		static void share_memory(PagedMemory& view, PagedMemory& memory);
+
+		/**
+		 * \return Whether fibers may run on several threads, which the paged backend does not allow: its fibers
+		 *         all run on the calling thread
+		 */
+		constexpr static bool parallel_fibers()
+		{
+			return !std::is_same<MemoryBackend, PagedMemory>::value;
+		}
+
+		/**
+		 * Executes a superinstruction, then advances ip on its own.
+		 * \param First Operation of the first instruction, which must not write to ip
+		 * \param Second Operation of the second instruction, decoded in the entry following d
+		 * \param d Decoded superinstruction, which must be part of the pre-decoded program
+		 */
+		template<DecodedOp First, DecodedOp Second>
+		bool execute_fused(const DecodedInstruction& d);
+
+		/**
+		 * Executes a fused compare and cjmp, given the result of the comparison.
+		 * \param d Decoded superinstruction
+		 * \param test Result of the comparison
+		 * \return false if the fuel ran out
+		 */
+		bool execute_compare_branch(const DecodedInstruction& d, const bool test);
+
+		/**
+		 * Advances ip past an instruction which did not jump, or charges the block it ended if it did.
+		 *
+		 * ip is not checked against the memory size: fetching an instruction out of memory yields
+		 * DecodedOp::invalid, which traps with TrapCode::InstructionOutOfBounds.
+		 * \param init_ip Value of ip before the instruction was executed
+		 * \return false if the fuel ran out
+		 */
+		bool advance(const vmreg_t init_ip);
+
+		/**
+		 * Charges the basic block ending with a jump to the fuel, and starts the next one at ip.
+		 * \param last_ip Address of the jump, the block running straight from _block_start to it
+		 * \return false if the fuel ran out, the trap being recorded
+		 */
+		bool charge(const vmreg_t last_ip);
+
+		/**
+		 * Records the trap of a run stopped by its budget.
+		 */
+		void out_of_fuel();
+
+		/**
+		 * Charges the instructions run since the last block boundary, once the engine stopped.
+		 */
+		void finish_run();
+
+		/**
+		 * Records the trap of a VM without checks leaving certified code, the engine then stops.
+		 */
+		void uncertified_code();
+
+		/**
+		 * Records the trap of an attempt to execute an invalid instruction, the engine then stops.
+		 * \param d Decoded instruction
+		 */
+		void invalid_instruction(const DecodedInstruction& d);
+
+		/**
+		 * Maps the imported image to memory and uses its pre-decoded program.
+		 */
+		void load_code();
+
+		/**
+		 * Decodes the instruction located at a given address from memory.
+		 * \param address Address of the instruction
+		 * \return Decoded instruction, with DecodedOp::invalid if it cannot be executed
+		 */
+		DecodedInstruction decode_at(const vmreg_t address);
+
+		/**
+		 * Returns the pre-decoded instruction at a given address.
+		 *
+		 * Stale entries are decoded again. Addresses that do not match an instruction of the imported program
+		 * (e.g. jumps in the middle of an instruction, or code outside the program) are decoded on the fly.
+		 * \param address Address of the instruction
+		 * \return Reference to the decoded instruction, valid until the next fetch
+		 */
+		const DecodedInstruction& fetch(const vmreg_t address);
+
+		/**
+		 * Returns the pre-decoded instruction at a given address of certified code, without any check.
+		 * \param address Address of the instruction, in a safe block
+		 * \return Reference to the decoded instruction
+		 */
+		const DecodedInstruction& fetch_certified(const vmreg_t address) const;
+
+		/**
+		 * Marks the pre-decoded instructions overlapping a memory range as stale.
+		 * \param address Beginning of the modified range
+		 * \param size Size of the modified range
+		 */
+		void invalidate(const vmreg_t address, const size_t size);
+
+		/**
+		 * Reads a register-sized value from memory.
+		 * \param address Address to read from
+		 * \return Value in memory
+		 */
+		vmreg_t load(const vmreg_t address);
+
+		/**
+		 * Writes a register-sized value to memory, invalidating the affected code if needed.
+		 * \param address Address to write to
+		 * \param value Value to write
+		 */
+		void store(const vmreg_t address, const vmreg_t value);
+
+		MemoryBackend _memory;
+
+		/**
+		 * Registers of the VM, and the registers it runs with: these ones, or those of the running fiber
+		 */
+		RegisterFile _registers;
+		RegisterBinding _regs;
+
+		/**
+		 * Imported program, also used to restore the code region in reset()
+		 */
+		std::shared_ptr<const ProgramImage> _image;
+
+		/**
+		 * Whether the program wrote to its code region since it was loaded
+		 */
+		bool _code_modified;
 
-		std::vector<uint8_t> _memory;
-		Registers _regs;
+		/**
+		 * Pre-decoded program: the one of _image, or _decoded_private once the program wrote to its code
+		 */
+		const DecodedInstruction* _decoded;
+		size_t _decoded_size;
+		std::vector<DecodedInstruction> _decoded_private;
+
+		DecodedInstruction _decoded_scratch;
+
+		/**
+		 * Whether the running code is certified, see certified()
+		 */
+		bool _certified;
+
+		/**
+		 * Host functions, indexed by id
+		 */
+		std::vector<HostBinding> _host_functions;
+
+		/**
+		 * Fibers of the program, created by the first fiber operation or fiber run, and the fiber whose registers
+		 * _regs is bound to
+		 */
+		std::shared_ptr<FiberScheduler> _fibers;
+		uint32_t _fiber;
+
+		/**
+		 * Executors running fibers on other threads than this VM, and the threads they run on
+		 */
+		size_t _fiber_threads;
+		std::vector<std::unique_ptr<BasicVM>> _executors;
+		std::unique_ptr<ThreadPool> _fiber_pool;
+
+		std::unique_ptr<Jit> _jit;
+
+		/**
+		 * Module compiled from _image, loaded on the first run with Engine::Aot
+		 */
+		std::shared_ptr<const AotModule> _aot;
+
+		/**
+		 * Profiler of the current profiled run, if any
+		 */
+		Profiler* _profiler;
+
+		/**
+		 * Trap of the current run, set by the instruction that stops the program
+		 */
+		Trap _trap;
+
+		/**
+		 * Instructions left to the current run, charged by basic block
+		 */
+		int64_t _fuel;
+
+		/**
+		 * Address of the first instruction of the running basic block, not charged yet
+		 */
+		vmreg_t _block_start;
+
+		/**
+		 * Fuel given to the last run
+		 */
+		uint64_t _budget;
 	};
+
+	/**
+	 * VM of the default configuration
+	 */
+	using VM = BasicVM<VMConfig<>>;
+
+	extern template class BasicVM<VMConfig<>>;
 }
 
 #include "vm.tpp"
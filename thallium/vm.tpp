@@ -1,23 +1,36 @@
 #ifndef THALLIUM_VM_TPP
 #define THALLIUM_VM_TPP
 
+#include <algorithm>
+#include <string>
 #include "vm.hpp"
+#include "error.hpp"
+#include "fault.hpp"
+
+#if defined(__GNUC__)
+#define THALLIUM_UNREACHABLE() __builtin_unreachable()
+#else
+#define THALLIUM_UNREACHABLE() ((void)0)
+#endif
 
 namespace thallium
 {
+	template<typename Config>
 	template<typename... Types>
-	std::tuple<Types...> VM::decode(uint64_t argument)
+	std::tuple<Types...> BasicVM<Config>::decode(uint64_t argument)
 	{
 		std::tuple<Types...> ret;
 		decode_consume<0, 0>(ret, argument);
 		return ret;
 	}
 
+	template<typename Config>
 	template<size_t TupleIndex, size_t BinOffset, typename TupleT, std::enable_if_t<TupleIndex >= std::tuple_size<TupleT>::value>*>
-	void VM::decode_consume(TupleT&, const uint64_t) {}
+	void BasicVM<Config>::decode_consume(TupleT&, const uint64_t) {}
 
+	template<typename Config>
 	template<size_t TupleIndex, size_t BinOffset, typename TupleT, std::enable_if_t<TupleIndex < std::tuple_size<TupleT>::value>*>
-	void VM::decode_consume(TupleT& t, const uint64_t argument)
+	void BasicVM<Config>::decode_consume(TupleT& t, const uint64_t argument)
 	{
 		// Typedef the element type
 		typedef std::tuple_element_t<TupleIndex, TupleT> element_t;
@@ -41,6 +54,1865 @@ namespace thallium
 		// Consume the next index
 		decode_consume<next_index, next_offset, TupleT>(t, argument);
 	}
+
+	// Instruction handlers, shared by every execution engine
+
+	template<typename Config>
+	template<DecodedOp Op>
+	inline bool BasicVM<Config>::test(const DecodedInstruction& d)
+	{
+		switch (Op)
+		{
+		case DecodedOp::teq: return _regs[d.a] == _regs[d.b];
+		case DecodedOp::tgt: return _regs[d.a] > _regs[d.b];
+		case DecodedOp::tlt: return _regs[d.a] < _regs[d.b];
+		default: return false;
+		}
+	}
+
+	template<typename Config>
+	template<DecodedOp Op>
+	inline void BasicVM<Config>::execute(const DecodedInstruction& d)
+	{
+		vmreg_t& ip = _regs[SPRegisters::ip];
+		vmreg_t& sp = _regs[SPRegisters::sp];
+
+		// Op is a constant, so only its own case is kept
+		switch (Op)
+		{
+		case DecodedOp::mov:
+			_regs[d.b] = _regs[d.a];
+			break;
+
+		case DecodedOp::imm:
+			_regs[d.b] = d.imm;
+			break;
+
+		case DecodedOp::mget:
+			_regs[d.b] = load(_regs[d.a]);
+			break;
+
+		case DecodedOp::mset:
+			store(_regs[d.a], _regs[d.b]);
+			break;
+
+		case DecodedOp::teq:
+		case DecodedOp::tgt:
+		case DecodedOp::tlt:
+			_regs.set_flag(Flags::Test, test<Op>(d));
+			break;
+
+		case DecodedOp::cjmp:
+			if (_regs.get_flag(Flags::Test))
+				ip = d.imm;
+			break;
+
+		case DecodedOp::cjmpr:
+			if (_regs.get_flag(Flags::Test))
+				ip = _regs[d.a];
+			break;
+
+		case DecodedOp::call:
+			// push ip + 1 to the stack
+			sp += sizeof(vmreg_t);
+			store(sp, ip + Instruction::size());
+
+			ip = d.imm;
+			break;
+
+		case DecodedOp::callr:
+			// push ip + 1 to the stack
+			sp += sizeof(vmreg_t);
+			store(sp, ip + Instruction::size());
+
+			ip = _regs[d.a];
+			break;
+
+		case DecodedOp::sbit: {
+			vmreg_t& r = _regs[d.a];
+			const vmreg_t v = d.c ? 1 : 0;
+
+			r ^= (-v ^ r) & (1u << d.b);
+		} break;
+
+		case DecodedOp::gbit:
+			_regs[d.b] = (_regs[d.a] >> d.c) & 0b1;
+			break;
+
+		// shift amounts are taken modulo 32, shifting by the register width or more being undefined in C++
+		case DecodedOp::shr:
+			_regs[d.b] = _regs[d.a] >> (_regs[d.c] & 31);
+			break;
+
+		case DecodedOp::shl:
+			_regs[d.b] = _regs[d.a] << (_regs[d.c] & 31);
+			break;
+
+		case DecodedOp::inc:
+			++_regs[d.a];
+			break;
+
+		case DecodedOp::dec:
+			--_regs[d.a];
+			break;
+
+		case DecodedOp::uadd:
+			_regs[d.c] = _regs[d.a] + _regs[d.b];
+			break;
+
+		case DecodedOp::usub:
+			_regs[d.c] = _regs[d.a] - _regs[d.b];
+			break;
+
+		case DecodedOp::umul:
+			_regs[d.c] = _regs[d.a] * _regs[d.b];
+			break;
+
+		case DecodedOp::udiv:
+			if (_regs[d.b] != 0)
+				_regs[d.c] = _regs[d.a] / _regs[d.b];
+			break;
+
+		case DecodedOp::umod:
+			if (_regs[d.b] != 0)
+				_regs[d.c] = _regs[d.a] % _regs[d.b];
+			break;
+
+		case DecodedOp::push:
+			sp += sizeof(vmreg_t);
+			store(sp, _regs[d.a]);
+			break;
+
+		case DecodedOp::pop:
+			_regs[d.a] = load(sp);
+			sp -= sizeof(vmreg_t);
+			break;
+
+		case DecodedOp::fence:
+			atomic_fence();
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	template<typename Config>
+	template<DecodedOp Op>
+	bool BasicVM<Config>::execute_bulk(const DecodedInstruction& d)
+	{
+		// vsum takes its count from its second operand, the other instructions from their third one
+		const vmreg_t count = _regs[Op == DecodedOp::vsum ? d.b : d.c];
+		const bool words = Op == DecodedOp::vadd || Op == DecodedOp::vxor || Op == DecodedOp::vsum;
+		const uint64_t size = words ? uint64_t(count) * sizeof(vmreg_t) : count;
+
+		// the second operand of mcpy, mcmp, vadd and vxor is the address of another range
+		const bool second_range = Op == DecodedOp::mcpy || Op == DecodedOp::mcmp || Op == DecodedOp::vadd || Op == DecodedOp::vxor;
+
+		const vmreg_t first = _regs[d.a];
+		if (!bulk_range(d, first, size) || (second_range && !bulk_range(d, _regs[d.b], size)))
+			return false;
+
+		switch (Op)
+		{
+		case DecodedOp::mcpy:
+			_memory.move(first, _regs[d.b], size);
+			break;
+
+		case DecodedOp::mfill:
+			_memory.fill(first, static_cast<uint8_t>(_regs[d.b]), size);
+			break;
+
+		case DecodedOp::mcmp: {
+			const size_t offset = _memory.compare(first, _regs[d.b], size);
+			_regs[d.imm] = static_cast<vmreg_t>(offset);
+			_regs.set_flag(Flags::Test, offset == size);
+		} break;
+
+		case DecodedOp::mfind: {
+			const size_t offset = _memory.find(first, static_cast<uint8_t>(_regs[d.b]), size);
+			_regs[d.imm] = static_cast<vmreg_t>(offset);
+			_regs.set_flag(Flags::Test, offset != size);
+		} break;
+
+		case DecodedOp::vadd:
+			_memory.add(first, _regs[d.b], count);
+			break;
+
+		case DecodedOp::vxor:
+			_memory.exclusive_or(first, _regs[d.b], count);
+			break;
+
+		case DecodedOp::vsum:
+			_regs[d.c] = _memory.sum(first, count);
+			break;
+
+		default:
+			break;
+		}
+
+		const bool writes = Op == DecodedOp::mcpy || Op == DecodedOp::mfill || Op == DecodedOp::vadd || Op == DecodedOp::vxor;
+		if (writes && size != 0 && first < _decoded_size * Instruction::size())
+			invalidate(first, size);
+
+		return true;
+	}
+
+	template<typename Config>
+	bool BasicVM<Config>::bulk_range(const DecodedInstruction& d, const vmreg_t address, const uint64_t size)
+	{
+		if (size == 0 || address + size <= _memory.size())
+			return true;
+
+		_trap.code = TrapCode::MemoryOutOfBounds;
+		_trap.opcode = d.opcode;
+		_trap.ip = _regs[SPRegisters::ip];
+		_trap.address = std::max<uint64_t>(address, _memory.size());
+		return false;
+	}
+
+	template<typename Config>
+	template<DecodedOp Op>
+	bool BasicVM<Config>::execute_atomic(const DecodedInstruction& d)
+	{
+		const vmreg_t address = _regs[d.a];
+		if (address % sizeof(vmreg_t) != 0)
+		{
+			_trap.code = TrapCode::UnalignedAtomic;
+			_trap.opcode = d.opcode;
+			_trap.ip = _regs[SPRegisters::ip];
+			_trap.address = address;
+			return false;
+		}
+
+		if (!bulk_range(d, address, sizeof(vmreg_t)))
+			return false;
+
+		uint8_t* const word = _memory.word(address);
+		bool written = true;
+
+		switch (Op)
+		{
+		case DecodedOp::acas: {
+			const vmreg_t expected = _regs[d.b];
+			_regs[d.b] = atomic_compare_exchange(word, expected, _regs[d.c]);
+			written = _regs[d.b] == expected;
+			_regs.set_flag(Flags::Test, written);
+		} break;
+
+		case DecodedOp::aadd:
+			_regs[d.c] = atomic_fetch_add(word, _regs[d.b]);
+			break;
+
+		case DecodedOp::axchg:
+			_regs[d.c] = atomic_exchange(word, _regs[d.b]);
+			break;
+
+		default:
+			break;
+		}
+
+		if (written && address < _decoded_size * Instruction::size())
+			invalidate(address, sizeof(vmreg_t));
+
+		return true;
+	}
+
+	// Host calls
+
+	template<typename Config>
+	bool BasicVM<Config>::execute_host(const DecodedInstruction& d)
+	{
+		if (d.imm >= _host_functions.size() || _host_functions[d.imm].function == nullptr)
+		{
+			host_trap(d, TrapCode::HostCallFailed, d.imm);
+			return false;
+		}
+
+		// the window may not reach ip, sp nor fl, which the engines keep track of
+		const HostBinding& binding = _host_functions[d.imm];
+		if (d.b < Registers::sp_count() || size_t(d.b) + binding.registers > _regs.size())
+		{
+			host_trap(d, TrapCode::HostCallFailed, d.imm);
+			return false;
+		}
+
+		HostCall call(d.imm, _regs.data() + d.b, binding.registers, _memory.data(), _memory.size(), &_memory,
+					  &host_copy_in, &host_copy_out);
+
+		const bool succeeded = binding.function(call, binding.context);
+		call.finish();
+
+		if (call._written_begin < call._written_end && call._written_begin < _decoded_size * Instruction::size())
+			invalidate(static_cast<vmreg_t>(call._written_begin), call._written_end - call._written_begin);
+
+		if (call._fault)
+		{
+			host_trap(d, TrapCode::MemoryOutOfBounds, call._fault_address);
+			return false;
+		}
+
+		if (!succeeded)
+		{
+			host_trap(d, TrapCode::HostCallFailed, d.imm);
+			return false;
+		}
+
+		return true;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::host_trap(const DecodedInstruction& d, const TrapCode code, const uint64_t address)
+	{
+		_trap.code = code;
+		_trap.opcode = d.opcode;
+		_trap.ip = _regs[SPRegisters::ip];
+		_trap.address = address;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::host_copy_in(void* memory, const vmreg_t address, uint8_t* out, const size_t size)
+	{
+		const MemoryBackend& backend = *static_cast<const MemoryBackend*>(memory);
+
+		// bytes() only spans up to a page at a time
+		for (size_t done = 0; done < size;)
+		{
+			const size_t chunk = std::min(size - done, MemoryBackend::page_size());
+			const uint8_t* bytes = backend.bytes(static_cast<vmreg_t>(address + done), chunk, out + done);
+			if (bytes != out + done)
+				std::copy(bytes, bytes + chunk, out + done);
+
+			done += chunk;
+		}
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::host_copy_out(void* memory, const vmreg_t address, const uint8_t* data, const size_t size)
+	{
+		static_cast<MemoryBackend*>(memory)->write(address, data, size);
+	}
+
+	// Fibers
+
+	template<typename Config>
+	bool BasicVM<Config>::spawn_fiber(const DecodedInstruction& d)
+	{
+		FiberScheduler& scheduler = fibers();
+
+		uint32_t id;
+		if (!scheduler.spawn(_regs.data(), _regs[d.a], _regs[d.b], d.c, id))
+		{
+			fiber_trap(d, _fiber);
+			return false;
+		}
+
+		_regs[d.c] = id;
+		return true;
+	}
+
+	template<typename Config>
+	bool BasicVM<Config>::switch_fiber(const DecodedInstruction& d, const vmreg_t init_ip)
+	{
+		FiberScheduler& scheduler = fibers();
+
+		vmreg_t& ip = _regs[SPRegisters::ip];
+		const uint32_t fiber = _fiber;
+		const vmreg_t target = d.op == DecodedOp::fjoin ? _regs[d.a] : 0;
+
+		// the fiber resumes past the instruction
+		ip = init_ip + Instruction::size();
+
+		vmreg_t* registers = _regs.data();
+		FiberStatus status;
+		switch (d.op)
+		{
+		case DecodedOp::fyield: status = scheduler.yield(_fiber, registers); break;
+		case DecodedOp::fjoin: status = scheduler.join(_fiber, registers, target); break;
+		default: status = scheduler.exit(_fiber, registers); break;
+		}
+
+		if (status == FiberStatus::Failed)
+		{
+			ip = init_ip;
+			fiber_trap(d, d.op == DecodedOp::fjoin ? target : fiber);
+			return false;
+		}
+
+		bind_fiber(registers);
+
+		// the switch ends the block, the next one starting wherever the fiber switched to stopped
+		const bool running = charge(init_ip);
+		return running && status == FiberStatus::Continue;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::fiber_trap(const DecodedInstruction& d, const uint32_t fiber)
+	{
+		_trap.code = TrapCode::FiberFailed;
+		_trap.opcode = d.opcode;
+		_trap.ip = _regs[SPRegisters::ip];
+		_trap.address = fiber;
+	}
+
+	template<typename Config>
+	FiberScheduler& BasicVM<Config>::fibers()
+	{
+		if (!_fibers)
+		{
+			// the VM runs the main fiber in place from now on
+			_fibers = std::make_shared<FiberScheduler>(fiber_span(), _regs.data());
+			_regs.bind(_fibers->main_registers(), _fibers->span());
+		}
+
+		return *_fibers;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::bind_fiber(vmreg_t* registers)
+	{
+		// an idle executor keeps nothing of the fiber it left, whose id a spawn may reuse
+		if (_fiber == FiberScheduler::none())
+			_regs.bind(_registers.data(), RegisterFile::size());
+		else
+			_regs.bind(registers, _fibers->span());
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::end_fibers()
+	{
+		// the registers of the running fiber become those of the VM again
+		if (_regs.data() != _registers.data())
+			std::copy(_regs.data(), _regs.data() + _regs.size(), _registers.data());
+
+		_regs.bind(_registers.data(), RegisterFile::size());
+		_fibers.reset();
+		_fiber = 0;
+	}
+
+	template<typename Config>
+	size_t BasicVM<Config>::fiber_span() const
+	{
+		if (!_image || _code_modified)
+			return RegisterFile::size();
+
+		size_t span = _image->register_span();
+
+		// host functions reach past the base register of their window
+		for (size_t i = 0; i < _image->count(); ++i)
+		{
+			const DecodedInstruction& d = _image->decoded()[i];
+			if (d.op == DecodedOp::hcall && d.imm < _host_functions.size())
+				span = std::max<size_t>(span, size_t(d.b) + _host_functions[d.imm].registers);
+		}
+
+		return std::min(span, RegisterFile::size());
+	}
+
+	template<typename Config>
+	Trap BasicVM<Config>::run_fibers(const Engine engine)
+	{
+		FiberScheduler& scheduler = fibers();
+		scheduler.resume();
+
+		const size_t workers = _fiber_threads - 1;
+
+		while (_executors.size() < workers)
+		{
+			_executors.emplace_back(new BasicVM);
+			share_memory(_executors.back()->_memory, _memory);
+		}
+
+		for (size_t i = 0; i < workers; ++i)
+		{
+			BasicVM& executor = *_executors[i];
+
+			if (executor._image != _image)
+			{
+				executor._image = _image;
+				executor._aot = _aot;
+
+				if (executor._jit)
+					executor._jit->flush();
+			}
+
+			executor._decoded = _decoded;
+			executor._decoded_size = _decoded_size;
+			executor._decoded_private.clear();
+			executor._code_modified = false;
+			executor._host_functions = _host_functions;
+			executor._fibers = _fibers;
+			executor._fiber = FiberScheduler::none();
+		}
+
+		std::vector<uint8_t> stopped_by(_fiber_threads, 0);
+		try {
+			_fiber_pool->parallel_for(_fiber_threads, [this, engine, &stopped_by](const size_t, const size_t index) {
+				BasicVM& executor = index == 0 ? *this : *_executors[index - 1];
+
+				try {
+					stopped_by[index] = executor.execute_fibers(engine) ? 1 : 0;
+				} catch (...)
+				{
+					_fibers->stop();
+					throw;
+				}
+			});
+		} catch (...)
+		{
+			// the VM keeps a fiber to resume, even if it was idle when the exception was thrown
+			for (size_t i = 0; i < workers; ++i)
+			{
+				BasicVM& executor = *_executors[i];
+
+				if (executor._fiber != FiberScheduler::none() && _fiber == FiberScheduler::none())
+				{
+					_fiber = executor._fiber;
+					bind_fiber(executor._regs.data());
+				}
+				else if (executor._fiber != FiberScheduler::none())
+				{
+					scheduler.release(executor._fiber);
+				}
+
+				executor._fiber = FiberScheduler::none();
+				executor.bind_fiber(nullptr);
+			}
+
+			throw;
+		}
+
+		// every fiber but the one which stopped the run goes back to the ready queue
+		BasicVM* outcome = this;
+		uint64_t used = budget_used();
+		bool code_written = false;
+
+		for (size_t i = 0; i < workers; ++i)
+		{
+			BasicVM& executor = *_executors[i];
+			used += executor.budget_used();
+			code_written = code_written || executor._code_modified;
+
+			if (stopped_by[i + 1])
+				outcome = &executor;
+			else if (executor._fiber != FiberScheduler::none())
+				scheduler.release(executor._fiber);
+
+			if (outcome != &executor)
+			{
+				executor._fiber = FiberScheduler::none();
+				executor.bind_fiber(nullptr);
+			}
+		}
+
+		// the VM takes over the fiber which stopped the run, running it in place
+		if (outcome != this)
+		{
+			if (_fiber != FiberScheduler::none())
+				scheduler.release(_fiber);
+
+			_fiber = outcome->_fiber;
+			_trap = outcome->_trap;
+			bind_fiber(outcome->_regs.data());
+
+			outcome->_fiber = FiberScheduler::none();
+			outcome->bind_fiber(nullptr);
+		}
+
+		// code written by the executors is decoded again from memory
+		if (code_written && !_code_modified && _decoded_size != 0)
+			invalidate(0, _decoded_size * Instruction::size());
+
+		_budget = used;
+		_fuel = 0;
+		_block_start = _regs[SPRegisters::ip];
+		return _trap;
+	}
+
+	template<typename Config>
+	bool BasicVM<Config>::execute_fibers(const Engine engine)
+	{
+		uint64_t used = 0;
+		bool stopping = false;
+
+		for (;;)
+		{
+			if (_fiber == FiberScheduler::none())
+			{
+				vmreg_t* registers;
+				if (!_fibers->acquire(_fiber, registers))
+					break;
+
+				bind_fiber(registers);
+			}
+
+			const Trap trap = run_guarded(deadline_slice(), engine, false);
+			used += budget_used();
+
+			// slices let the executor notice that another one stopped the run
+			if (trap.code == TrapCode::BudgetExhausted)
+			{
+				if (_fibers->stopped())
+					break;
+
+				continue;
+			}
+
+			// the fiber blocked or exited, and no other one was ready
+			if (_fiber == FiberScheduler::none())
+				continue;
+
+			stopping = _fibers->stop();
+			break;
+		}
+
+		_budget = used;
+		_fuel = 0;
+		return stopping;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::share_memory(Memory& view, Memory& memory)
+	{
+		view.share(memory);
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::share_memory(PagedMemory&, PagedMemory&)
+	{
+		// never called, fibers over paged memory run on the calling thread
+	}
+
+	// Superinstructions
+
+	template<typename Config>
+	template<DecodedOp First, DecodedOp Second>
+	bool BasicVM<Config>::execute_fused(const DecodedInstruction& d)
+	{
+		// compare and branch pairs do not go through the TEST flag to decide the branch
+		if (Second == DecodedOp::cjmp)
+			return execute_compare_branch(d, test<First>(d));
+
+		vmreg_t& ip = _regs[SPRegisters::ip];
+		const size_t slot = ip / Instruction::size();
+
+		execute<First>(d);
+		ip += Instruction::size();
+
+		// the first instruction may have overwritten the second one, which then has to go through fetch(). The
+		// second one is read again from _decoded, as d is left in the shared program once it has been copied.
+		const DecodedInstruction& next = _decoded[slot + 1];
+		if (next.op == DecodedOp::stale)
+			return true;
+
+		const vmreg_t second_ip = ip;
+		execute<Second>(next);
+		return advance(second_ip);
+	}
+
+	template<typename Config>
+	inline bool BasicVM<Config>::execute_compare_branch(const DecodedInstruction& d, const bool test)
+	{
+		_regs.set_flag(Flags::Test, test);
+
+		vmreg_t& ip = _regs[SPRegisters::ip];
+		ip += Instruction::size();
+
+		const vmreg_t target = (&d + 1)->imm;
+		if (!test || target == ip)
+		{
+			ip += Instruction::size();
+			return true;
+		}
+
+		const vmreg_t branch_ip = ip;
+		ip = target;
+		return charge(branch_ip);
+	}
+
+	// Control flow and fuel
+
+	template<typename Config>
+	inline bool BasicVM<Config>::advance(const vmreg_t init_ip)
+	{
+		vmreg_t& ip = _regs[SPRegisters::ip];
+
+		if (ip == init_ip)
+		{
+			ip += Instruction::size();
+			return true;
+		}
+
+		return charge(init_ip);
+	}
+
+	template<typename Config>
+	inline bool BasicVM<Config>::charge(const vmreg_t last_ip)
+	{
+		// the block ran straight from _block_start, so its length follows from the addresses
+		_fuel -= (last_ip - _block_start) / Instruction::size() + 1;
+		_block_start = _regs[SPRegisters::ip];
+
+		if (_fuel > 0)
+			return true;
+
+		out_of_fuel();
+		return false;
+	}
+
+	// Certified code
+
+	template<typename Config>
+	inline const DecodedInstruction& BasicVM<Config>::fetch_certified(const vmreg_t address) const
+	{
+		return _decoded[address / Instruction::size()];
+	}
+
+	template<typename Config>
+	inline bool BasicVM<Config>::leaves_certified_code(const DecodedOp op)
+	{
+		switch (op)
+		{
+		case DecodedOp::cjmpr:
+		case DecodedOp::callr:
+		case DecodedOp::fyield:
+		case DecodedOp::fjoin:
+		case DecodedOp::exit:
+			return _code_modified || !_image->verification().safe_target(_regs[SPRegisters::ip]);
+
+		case DecodedOp::mset:
+		case DecodedOp::call:
+		case DecodedOp::push:
+		case DecodedOp::push_push:
+		case DecodedOp::mcpy:
+		case DecodedOp::mfill:
+		case DecodedOp::vadd:
+		case DecodedOp::vxor:
+		case DecodedOp::hcall:
+		case DecodedOp::acas:
+		case DecodedOp::aadd:
+		case DecodedOp::axchg:
+			return _code_modified;
+
+		default:
+			return false;
+		}
+	}
+
+	// Execution
+
+	template<typename Config>
+	BasicVM<Config>::BasicVM(const size_t memory_size, const MemoryMode memory_mode) :
+		_memory(memory_size, memory_mode),
+		_regs(_registers.data(), RegisterFile::size()),
+		_code_modified(false),
+		_decoded(nullptr),
+		_decoded_size(0),
+		_certified(false),
+		_fiber(0),
+		_fiber_threads(1),
+		_profiler(nullptr),
+		_fuel(0),
+		_block_start(0),
+		_budget(0)
+	{}
+
+	template<typename Config>
+	void BasicVM<Config>::import_program(const std::vector<Instruction>& program)
+	{
+		const size_t tprogram_size = program.size() * Instruction::size();
+
+		// make sure the program fits in memory
+		tassert(tprogram_size <= _memory.size(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program may not fit in memory.");
+
+		import_program(ProgramImage::create(program));
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::import_program(std::shared_ptr<const ProgramImage> image)
+	{
+		tassert(image->size() <= _memory.size(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program may not fit in memory.");
+
+		tassert(image->register_span() <= RegisterFile::size(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program uses " + std::to_string(image->register_span()) + " registers, the VM only has "
+				+ std::to_string(RegisterFile::size()) + ".");
+
+		tassert(Config::checked() || image->verification().certified(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the program cannot run without checks: " + image->verification().diagnostic() + ".");
+
+		_image = std::move(image);
+		_aot.reset();
+		end_fibers();
+		load_code();
+
+		_regs[SPRegisters::ip] = _image->entry();
+		_regs[SPRegisters::sp] = _image->initial_sp();
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::import_program_file(const std::string& path, const bool trusted)
+	{
+		import_program(ProgramImage::load(path, true, trusted));
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::reset()
+	{
+		if (_code_modified)
+			load_code();
+		else if (_image)
+			_memory.zero(_image->size(), _memory.size());
+		else
+			_memory.zero(0, _memory.size());
+
+		end_fibers();
+		std::fill(_regs.data(), _regs.data() + _regs.size(), 0);
+
+		if (_image)
+		{
+			_regs[SPRegisters::ip] = _image->entry();
+			_regs[SPRegisters::sp] = _image->initial_sp();
+		}
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::load_code()
+	{
+		_memory.map(*_image);
+
+		_decoded = _image->decoded();
+		_decoded_size = _image->count();
+		_decoded_private.clear();
+		_code_modified = false;
+
+		if (_jit)
+			_jit->flush();
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::write_memory(const vmreg_t address, const uint8_t* data, const size_t size)
+	{
+		tassert(size_t(address) + size <= _memory.size(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"the written data does not fit in memory.");
+
+		if (size == 0)
+			return;
+
+		_memory.write(address, data, size);
+
+		if (address < _decoded_size * Instruction::size())
+			invalidate(address, size);
+	}
+
+	template<typename Config>
+	RegisterBinding& BasicVM<Config>::registers()
+	{
+		return _regs;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::bind(const uint32_t id, const HostFunction function, const uint16_t registers, void* context)
+	{
+		tassert(id < max_host_functions(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"host function ids are below " + std::to_string(max_host_functions()) + ".");
+
+		tassert(function != nullptr,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"no host function given for id " + std::to_string(id) + ".");
+
+		if (id >= _host_functions.size())
+			_host_functions.resize(size_t(id) + 1, HostBinding{nullptr, nullptr, 0});
+
+		_host_functions[id] = HostBinding{function, context, registers};
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::unbind(const uint32_t id)
+	{
+		if (id < _host_functions.size())
+			_host_functions[id] = HostBinding{nullptr, nullptr, 0};
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::set_fiber_threads(const size_t threads)
+	{
+		tassert(threads != 0,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"fibers need at least one thread.");
+
+		// executors share the memory of the VM, which paged memory does not allow
+		_fiber_threads = parallel_fibers() ? threads : 1;
+		_fiber_pool.reset(_fiber_threads > 1 ? new ThreadPool(_fiber_threads) : nullptr);
+	}
+
+	template<typename Config>
+	size_t BasicVM<Config>::fiber_threads() const
+	{
+		return _fiber_threads;
+	}
+
+	template<typename Config>
+	uint32_t BasicVM<Config>::fiber() const
+	{
+		return _fiber;
+	}
+
+	template<typename Config>
+	size_t BasicVM<Config>::fusions() const
+	{
+		return _image ? _image->fusions() : 0;
+	}
+
+	template<typename Config>
+	size_t BasicVM<Config>::resident_memory() const
+	{
+		return _memory.resident_pages() * MemoryBackend::page_size();
+	}
+
+	template<typename Config>
+	bool BasicVM<Config>::certified()
+	{
+		return _image && !_code_modified && _image->verification().safe_target(_regs[SPRegisters::ip]);
+	}
+
+	template<typename Config>
+	Trap BasicVM<Config>::run(const Engine engine)
+	{
+		// executors share the memory and the pre-decoded program, which has to be the one of the image
+		if (parallel_fibers() && _fiber_threads > 1 && _image && !_code_modified)
+			return run_fibers(engine);
+
+		return run_guarded(max_fuel(), engine, false);
+	}
+
+	template<typename Config>
+	Trap BasicVM<Config>::run(Profiler& profiler, const Engine engine)
+	{
+		tassert(Config::profiling(),
+				TimeOfError::Preload, ErrorType::Fatal,
+				"profiling is disabled in this VM configuration.");
+
+		profiler.attach(_decoded_size);
+		_profiler = &profiler;
+
+		Trap trap;
+		try {
+			trap = run_guarded(max_fuel(), engine, true);
+		} catch (...)
+		{
+			_profiler = nullptr;
+			throw;
+		}
+
+		_profiler = nullptr;
+		return trap;
+	}
+
+	template<typename Config>
+	Trap BasicVM<Config>::run_for(const uint64_t budget, const Engine engine)
+	{
+		return run_guarded(std::min(budget, max_fuel()), engine, false);
+	}
+
+	template<typename Config>
+	Trap BasicVM<Config>::run_for(const uint64_t budget, const std::chrono::steady_clock::time_point deadline, const Engine engine)
+	{
+		uint64_t used = 0;
+
+		for (;;)
+		{
+			Trap trap = run_for(std::min(budget - used, deadline_slice()), engine);
+			used += budget_used();
+
+			if (trap.code == TrapCode::BudgetExhausted && used < budget && std::chrono::steady_clock::now() >= deadline)
+				trap.code = TrapCode::DeadlineReached;
+
+			if (trap.code != TrapCode::BudgetExhausted || used >= budget)
+			{
+				_budget = used;
+				_fuel = 0;
+				return trap;
+			}
+		}
+	}
+
+	template<typename Config>
+	uint64_t BasicVM<Config>::budget_used() const
+	{
+		return static_cast<uint64_t>(static_cast<int64_t>(_budget) - _fuel);
+	}
+
+	template<typename Config>
+	Trap BasicVM<Config>::run_guarded(const uint64_t budget, const Engine engine, const bool profile)
+	{
+		_trap = Trap{};
+		_budget = budget;
+		_fuel = static_cast<int64_t>(budget);
+		_block_start = _regs[SPRegisters::ip];
+		_certified = certified();
+
+		if (_fuel <= 0)
+		{
+			out_of_fuel();
+			return _trap;
+		}
+
+#ifdef THALLIUM_HAS_MMAP
+		if (_memory.guarded())
+		{
+			FaultRegion region;
+			region.begin = _memory.data();
+			region.end = _memory.data() + _memory.reserved();
+
+			// the engines hold nothing to destroy, so a fault may jump straight back here
+			if (sigsetjmp(region.env, 0) != 0)
+			{
+				leave_fault_region(region);
+				memory_fault(region.address, region.pc);
+				finish_run();
+				return _trap;
+			}
+
+			enter_fault_region(region);
+
+			try {
+				run_engine(engine, profile);
+			} catch (...)
+			{
+				leave_fault_region(region);
+				throw;
+			}
+
+			leave_fault_region(region);
+			finish_run();
+			return _trap;
+		}
+#endif
+
+		run_engine(engine, profile);
+		finish_run();
+		return _trap;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::finish_run()
+	{
+		// the block the program stopped in was not charged, up to the instruction that stopped it
+		_fuel -= (_regs[SPRegisters::ip] - _block_start) / Instruction::size();
+		_block_start = _regs[SPRegisters::ip];
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::out_of_fuel()
+	{
+		_trap.code = TrapCode::BudgetExhausted;
+		_trap.opcode = 0;
+		_trap.ip = _regs[SPRegisters::ip];
+		_trap.address = 0;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::run_engine(const Engine engine, const bool profile)
+	{
+		run_engine(engine, profile, std::integral_constant<bool, Config::fixed_engine()>{});
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::run_engine(const Engine engine, const bool profile, std::false_type)
+	{
+		switch (engine)
+		{
+		case Engine::Switch: run_loop(profile, EngineTag<Engine::Switch>{}); break;
+		case Engine::Threaded: run_loop(profile, EngineTag<Engine::Threaded>{}); break;
+		case Engine::Jit: run_loop(profile, EngineTag<Engine::Jit>{}); break;
+		case Engine::Aot: run_loop(profile, EngineTag<Engine::Aot>{}); break;
+		}
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::run_engine(const Engine, const bool profile, std::true_type)
+	{
+		run_loop(profile, EngineTag<Config::engine()>{});
+	}
+
+	// configurations without profiling do not compile the profiled loops
+
+	template<typename Config>
+	void BasicVM<Config>::run_loop(const bool profile, EngineTag<Engine::Switch>)
+	{
+		if (profile)
+			run_switch<Config::profiling()>();
+		else
+			run_switch<false>();
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::run_loop(const bool profile, EngineTag<Engine::Threaded>)
+	{
+		if (profile)
+			run_threaded<Config::profiling()>();
+		else
+			run_threaded<false>();
+	}
+
+	// compiled blocks cannot report what they execute, profiled runs go through the interpreter
+
+	template<typename Config>
+	void BasicVM<Config>::run_loop(const bool profile, EngineTag<Engine::Jit>)
+	{
+		if (profile)
+			run_switch<Config::profiling()>();
+		else
+			run_jit();
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::run_loop(const bool profile, EngineTag<Engine::Aot>)
+	{
+		if (profile)
+			run_switch<Config::profiling()>();
+		else
+			run_aot();
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::memory_fault(const uint8_t* address, const void* pc)
+	{
+		// compiled code only writes ip back on block exits, so it is recovered from the native instruction
+		vmreg_t ip = _regs[SPRegisters::ip];
+		if (_jit && pc != nullptr && _jit->guest_address(pc, ip))
+		{
+			// the whole compiled block was charged on entry
+			_block_start = ip;
+		}
+
+		_regs[SPRegisters::ip] = ip;
+
+		_trap.code = TrapCode::MemoryOutOfBounds;
+		_trap.opcode = fetch(ip).opcode;
+		_trap.ip = ip;
+		_trap.address = static_cast<uint64_t>(address - _memory.data());
+	}
+
+	template<typename Config>
+	template<bool Profile>
+	void BasicVM<Config>::run_switch()
+	{
+		if (_certified)
+		{
+			while (step<Profile, true>()) {}
+
+			// the program stopped rather than left certified code
+			if (_certified)
+				return;
+		}
+
+		if (!Config::checked())
+		{
+			uncertified_code();
+			return;
+		}
+
+		while (step<Profile, !Config::checked()>()) {}
+	}
+
+	template<typename Config>
+	template<bool Profile, bool Certified>
+	inline bool BasicVM<Config>::step()
+	{
+		const vmreg_t init_ip = _regs[SPRegisters::ip];
+		const DecodedInstruction& d = Certified ? fetch_certified(init_ip) : fetch(init_ip);
+		const DecodedOp op = d.op;
+
+		bool running;
+
+		if (Profile)
+			profile_before(init_ip, d);
+
+		switch (d.op)
+		{
+		case DecodedOp::mov: execute<DecodedOp::mov>(d); break;
+		case DecodedOp::imm: execute<DecodedOp::imm>(d); break;
+		case DecodedOp::mget: execute<DecodedOp::mget>(d); break;
+		case DecodedOp::mset: execute<DecodedOp::mset>(d); break;
+		case DecodedOp::teq: execute<DecodedOp::teq>(d); break;
+		case DecodedOp::tgt: execute<DecodedOp::tgt>(d); break;
+		case DecodedOp::tlt: execute<DecodedOp::tlt>(d); break;
+		case DecodedOp::cjmp: execute<DecodedOp::cjmp>(d); break;
+		case DecodedOp::cjmpr: execute<DecodedOp::cjmpr>(d); break;
+		case DecodedOp::call: execute<DecodedOp::call>(d); break;
+		case DecodedOp::callr: execute<DecodedOp::callr>(d); break;
+		case DecodedOp::sbit: execute<DecodedOp::sbit>(d); break;
+		case DecodedOp::gbit: execute<DecodedOp::gbit>(d); break;
+		case DecodedOp::shr: execute<DecodedOp::shr>(d); break;
+		case DecodedOp::shl: execute<DecodedOp::shl>(d); break;
+		case DecodedOp::inc: execute<DecodedOp::inc>(d); break;
+		case DecodedOp::dec: execute<DecodedOp::dec>(d); break;
+		case DecodedOp::uadd: execute<DecodedOp::uadd>(d); break;
+		case DecodedOp::usub: execute<DecodedOp::usub>(d); break;
+		case DecodedOp::umul: execute<DecodedOp::umul>(d); break;
+		case DecodedOp::udiv: execute<DecodedOp::udiv>(d); break;
+		case DecodedOp::umod: execute<DecodedOp::umod>(d); break;
+		case DecodedOp::push: execute<DecodedOp::push>(d); break;
+		case DecodedOp::pop: execute<DecodedOp::pop>(d); break;
+
+		// bulk memory instructions trap when their ranges do not fit in memory
+		case DecodedOp::mcpy: if (!execute_bulk<DecodedOp::mcpy>(d)) return false; break;
+		case DecodedOp::mfill: if (!execute_bulk<DecodedOp::mfill>(d)) return false; break;
+		case DecodedOp::mcmp: if (!execute_bulk<DecodedOp::mcmp>(d)) return false; break;
+		case DecodedOp::mfind: if (!execute_bulk<DecodedOp::mfind>(d)) return false; break;
+		case DecodedOp::vadd: if (!execute_bulk<DecodedOp::vadd>(d)) return false; break;
+		case DecodedOp::vxor: if (!execute_bulk<DecodedOp::vxor>(d)) return false; break;
+		case DecodedOp::vsum: if (!execute_bulk<DecodedOp::vsum>(d)) return false; break;
+
+		case DecodedOp::hcall: if (!execute_host(d)) return false; break;
+
+		// fiber switches advance ip on their own, to the next instruction of the fiber switched to
+		case DecodedOp::fspawn: if (!spawn_fiber(d)) return false; break;
+		case DecodedOp::fyield: running = switch_fiber(d, init_ip); goto executed;
+		case DecodedOp::fjoin: running = switch_fiber(d, init_ip); goto executed;
+
+		// atomic instructions trap when their word is unaligned or out of memory
+		case DecodedOp::acas: if (!execute_atomic<DecodedOp::acas>(d)) return false; break;
+		case DecodedOp::aadd: if (!execute_atomic<DecodedOp::aadd>(d)) return false; break;
+		case DecodedOp::axchg: if (!execute_atomic<DecodedOp::axchg>(d)) return false; break;
+		case DecodedOp::fence: execute<DecodedOp::fence>(d); break;
+
+		// superinstructions advance ip on their own
+		case DecodedOp::teq_cjmp: running = execute_fused<DecodedOp::teq, DecodedOp::cjmp>(d); goto executed;
+		case DecodedOp::tgt_cjmp: running = execute_fused<DecodedOp::tgt, DecodedOp::cjmp>(d); goto executed;
+		case DecodedOp::tlt_cjmp: running = execute_fused<DecodedOp::tlt, DecodedOp::cjmp>(d); goto executed;
+		case DecodedOp::imm_uadd: running = execute_fused<DecodedOp::imm, DecodedOp::uadd>(d); goto executed;
+		case DecodedOp::push_push: running = execute_fused<DecodedOp::push, DecodedOp::push>(d); goto executed;
+		case DecodedOp::pop_pop: running = execute_fused<DecodedOp::pop, DecodedOp::pop>(d); goto executed;
+
+		case DecodedOp::exit: {
+			// the exit of the main fiber ends the program
+			if (_fiber == 0)
+				return false;
+
+			running = switch_fiber(d, init_ip);
+			goto executed;
+		}
+
+		default: {
+			// certified code only holds valid instructions
+			if (Certified)
+				THALLIUM_UNREACHABLE();
+
+			invalid_instruction(d);
+			return false;
+		}
+		}
+
+		running = advance(init_ip);
+
+	executed:
+		if (Profile)
+			profile_after(init_ip, d, op);
+
+		if (Certified && running && leaves_certified_code(op))
+		{
+			_certified = false;
+			return false;
+		}
+
+		return running;
+	}
+
+#if defined(__GNUC__)
+	// Labels as values are a GNU extension, also provided by clang
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#ifdef __clang__
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#endif
+
+	template<typename Config>
+	template<bool Profile>
+	void BasicVM<Config>::run_threaded()
+	{
+		if (_certified)
+		{
+			dispatch_threaded<Profile, true>();
+
+			// the program stopped rather than left certified code
+			if (_certified)
+				return;
+		}
+
+		if (!Config::checked())
+		{
+			uncertified_code();
+			return;
+		}
+
+		dispatch_threaded<Profile, !Config::checked()>();
+	}
+
+	template<typename Config>
+	template<bool Profile, bool Certified>
+	void BasicVM<Config>::dispatch_threaded()
+	{
+		// Must follow the declaration order of DecodedOp
+		static void* const dispatch_table[] =
+		{
+			&&op_mov,
+			&&op_imm,
+			&&op_mget,
+			&&op_mset,
+			&&op_teq,
+			&&op_tgt,
+			&&op_tlt,
+			&&op_cjmp,
+			&&op_cjmpr,
+			&&op_call,
+			&&op_callr,
+			&&op_sbit,
+			&&op_gbit,
+			&&op_shr,
+			&&op_shl,
+			&&op_inc,
+			&&op_dec,
+			&&op_uadd,
+			&&op_usub,
+			&&op_umul,
+			&&op_udiv,
+			&&op_umod,
+			&&op_push,
+			&&op_pop,
+			&&op_exit,
+			&&op_mcpy,
+			&&op_mfill,
+			&&op_mcmp,
+			&&op_mfind,
+			&&op_vadd,
+			&&op_vxor,
+			&&op_vsum,
+			&&op_hcall,
+			&&op_fspawn,
+			&&op_fyield,
+			&&op_fjoin,
+			&&op_acas,
+			&&op_aadd,
+			&&op_axchg,
+			&&op_fence,
+			&&op_teq_cjmp,
+			&&op_tgt_cjmp,
+			&&op_tlt_cjmp,
+			&&op_imm_uadd,
+			&&op_push_push,
+			&&op_pop_pop,
+			&&op_invalid, // stale entries never leave fetch()
+			&&op_invalid
+		};
+
+		static_assert(sizeof(dispatch_table) / sizeof(*dispatch_table) == static_cast<size_t>(DecodedOp::_total),
+					  "DecodedOp enum / dispatch table size mismatch");
+
+		vmreg_t init_ip = _regs[SPRegisters::ip];
+		const DecodedInstruction* d = Certified ? &fetch_certified(init_ip) : &fetch(init_ip);
+		DecodedOp op = d->op;
+		bool running;
+
+		if (Profile)
+			profile_before(init_ip, *d);
+
+		// Every handler advances and dispatches the next instruction on its own, so each one gets its own
+		// indirect branch to predict. Handlers pass their operation, so that certified code only checks whether
+		// it is left after the few instructions which can leave it.
+#define THALLIUM_DISPATCH(Op) \
+		if (Profile) \
+			profile_after(init_ip, *d, op); \
+		if (!running) \
+			return; \
+		if (Certified && leaves_certified_code(Op)) \
+		{ \
+			_certified = false; \
+			return; \
+		} \
+		init_ip = _regs[SPRegisters::ip]; \
+		d = Certified ? &fetch_certified(init_ip) : &fetch(init_ip); \
+		if (Profile) \
+		{ \
+			op = d->op; \
+			profile_before(init_ip, *d); \
+		} \
+		goto *dispatch_table[static_cast<size_t>(d->op)]
+
+#define THALLIUM_DISPATCH_NEXT(Op) \
+		running = advance(init_ip); \
+		THALLIUM_DISPATCH(Op)
+
+		goto *dispatch_table[static_cast<size_t>(d->op)];
+
+		op_mov: execute<DecodedOp::mov>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::mov);
+		op_imm: execute<DecodedOp::imm>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::imm);
+		op_mget: execute<DecodedOp::mget>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::mget);
+		op_mset: execute<DecodedOp::mset>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::mset);
+		op_teq: execute<DecodedOp::teq>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::teq);
+		op_tgt: execute<DecodedOp::tgt>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::tgt);
+		op_tlt: execute<DecodedOp::tlt>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::tlt);
+		op_cjmp: execute<DecodedOp::cjmp>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::cjmp);
+		op_cjmpr: execute<DecodedOp::cjmpr>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::cjmpr);
+		op_call: execute<DecodedOp::call>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::call);
+		op_callr: execute<DecodedOp::callr>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::callr);
+		op_sbit: execute<DecodedOp::sbit>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::sbit);
+		op_gbit: execute<DecodedOp::gbit>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::gbit);
+		op_shr: execute<DecodedOp::shr>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::shr);
+		op_shl: execute<DecodedOp::shl>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::shl);
+		op_inc: execute<DecodedOp::inc>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::inc);
+		op_dec: execute<DecodedOp::dec>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::dec);
+		op_uadd: execute<DecodedOp::uadd>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::uadd);
+		op_usub: execute<DecodedOp::usub>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::usub);
+		op_umul: execute<DecodedOp::umul>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::umul);
+		op_udiv: execute<DecodedOp::udiv>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::udiv);
+		op_umod: execute<DecodedOp::umod>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::umod);
+		op_push: execute<DecodedOp::push>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::push);
+		op_pop: execute<DecodedOp::pop>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::pop);
+
+		op_mcpy: if (!execute_bulk<DecodedOp::mcpy>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::mcpy);
+		op_mfill: if (!execute_bulk<DecodedOp::mfill>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::mfill);
+		op_mcmp: if (!execute_bulk<DecodedOp::mcmp>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::mcmp);
+		op_mfind: if (!execute_bulk<DecodedOp::mfind>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::mfind);
+		op_vadd: if (!execute_bulk<DecodedOp::vadd>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::vadd);
+		op_vxor: if (!execute_bulk<DecodedOp::vxor>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::vxor);
+		op_vsum: if (!execute_bulk<DecodedOp::vsum>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::vsum);
+
+		op_hcall: if (!execute_host(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::hcall);
+
+		op_fspawn: if (!spawn_fiber(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::fspawn);
+		op_fyield: running = switch_fiber(*d, init_ip); THALLIUM_DISPATCH(DecodedOp::fyield);
+		op_fjoin: running = switch_fiber(*d, init_ip); THALLIUM_DISPATCH(DecodedOp::fjoin);
+
+		op_acas: if (!execute_atomic<DecodedOp::acas>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::acas);
+		op_aadd: if (!execute_atomic<DecodedOp::aadd>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::aadd);
+		op_axchg: if (!execute_atomic<DecodedOp::axchg>(*d)) return; THALLIUM_DISPATCH_NEXT(DecodedOp::axchg);
+		op_fence: execute<DecodedOp::fence>(*d); THALLIUM_DISPATCH_NEXT(DecodedOp::fence);
+
+		op_teq_cjmp: running = execute_fused<DecodedOp::teq, DecodedOp::cjmp>(*d); THALLIUM_DISPATCH(DecodedOp::teq_cjmp);
+		op_tgt_cjmp: running = execute_fused<DecodedOp::tgt, DecodedOp::cjmp>(*d); THALLIUM_DISPATCH(DecodedOp::tgt_cjmp);
+		op_tlt_cjmp: running = execute_fused<DecodedOp::tlt, DecodedOp::cjmp>(*d); THALLIUM_DISPATCH(DecodedOp::tlt_cjmp);
+		op_imm_uadd: running = execute_fused<DecodedOp::imm, DecodedOp::uadd>(*d); THALLIUM_DISPATCH(DecodedOp::imm_uadd);
+		op_push_push: running = execute_fused<DecodedOp::push, DecodedOp::push>(*d); THALLIUM_DISPATCH(DecodedOp::push_push);
+		op_pop_pop: running = execute_fused<DecodedOp::pop, DecodedOp::pop>(*d); THALLIUM_DISPATCH(DecodedOp::pop_pop);
+
+		op_exit:
+			if (_fiber == 0)
+				return;
+
+			running = switch_fiber(*d, init_ip);
+			THALLIUM_DISPATCH(DecodedOp::exit);
+
+		op_invalid:
+			invalid_instruction(*d);
+			return;
+
+#undef THALLIUM_DISPATCH_NEXT
+#undef THALLIUM_DISPATCH
+	}
+
+#pragma GCC diagnostic pop
+#else
+	template<typename Config>
+	template<bool Profile>
+	void BasicVM<Config>::run_threaded()
+	{
+		run_switch<Profile>();
+	}
+#endif
+
+	template<typename Config>
+	void BasicVM<Config>::run_jit()
+	{
+		// compiled blocks address memory directly, which the paged backend does not allow
+		if (!Jit::available() || _memory.data() == nullptr)
+		{
+			run_switch<false>();
+			return;
+		}
+
+		if (!_jit)
+			_jit.reset(new Jit);
+
+		for (;;)
+		{
+			// without checks, ip has to stay in certified code, compiled or not
+			if (!Config::checked() && !certified())
+			{
+				uncertified_code();
+				return;
+			}
+
+			const Jit::Block block = _jit->block(_regs[SPRegisters::ip], _decoded, _decoded_size, _regs.size());
+			if (block != nullptr)
+			{
+				const Jit::Exit exit = block(_regs.data(), _memory.data(), &_fuel);
+
+				// compiled blocks charge themselves
+				_block_start = _regs[SPRegisters::ip];
+
+				if (exit == Jit::Exit::Continue)
+					continue;
+
+				if (exit == Jit::Exit::OutOfFuel)
+				{
+					out_of_fuel();
+					return;
+				}
+			}
+
+			// the instruction at ip is interpreted as a block of its own, charged here unless it jumped
+			const vmreg_t interpreted_ip = _regs[SPRegisters::ip];
+			if (!step<false, !Config::checked()>())
+			{
+				// certified steps also stop when they leave certified code, which the next iteration reports
+				if (Config::checked() || _certified)
+					return;
+
+				continue;
+			}
+
+			if (_block_start == interpreted_ip && !charge(_regs[SPRegisters::ip] - Instruction::size()))
+				return;
+		}
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::run_aot()
+	{
+		// modules address memory directly, which the paged backend does not allow
+		if (!AotModule::available() || _memory.data() == nullptr || !_image)
+		{
+			run_switch<false>();
+			return;
+		}
+
+		if (!_aot)
+			_aot = AotModule::get(*_image);
+
+		for (;;)
+		{
+			// without checks, ip has to stay in certified code, compiled or not
+			if (!Config::checked() && !certified())
+			{
+				uncertified_code();
+				return;
+			}
+
+			// the module only knows the code it was translated from
+			if (!_aot || _code_modified)
+			{
+				_certified = certified();
+				run_switch<false>();
+				return;
+			}
+
+			const Jit::Exit exit = _aot->entry()(_regs.data(), _memory.data(), &_fuel, _memory.size());
+
+			// modules charge every block they enter, and refund what they hand back
+			_block_start = _regs[SPRegisters::ip];
+
+			if (exit == Jit::Exit::Continue)
+				continue;
+
+			if (exit == Jit::Exit::OutOfFuel)
+			{
+				out_of_fuel();
+				return;
+			}
+
+			// modules hand back dynamic jumps they have no block for, which may land outside of certified code
+			if (!Config::checked() && !certified())
+			{
+				uncertified_code();
+				return;
+			}
+
+			// the instruction at ip is interpreted as a block of its own, charged here unless it jumped
+			const vmreg_t interpreted_ip = _regs[SPRegisters::ip];
+			if (!step<false, !Config::checked()>())
+			{
+				// certified steps also stop when they leave certified code, which the next iteration reports
+				if (Config::checked() || _certified)
+					return;
+
+				continue;
+			}
+
+			if (_block_start == interpreted_ip && !charge(_regs[SPRegisters::ip] - Instruction::size()))
+				return;
+		}
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::profile_before(const vmreg_t ip, const DecodedInstruction& d)
+	{
+		_profiler->instruction(ip, static_cast<Opcode>(d.opcode), _regs[SPRegisters::sp]);
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::profile_after(const vmreg_t ip, const DecodedInstruction& d, const DecodedOp op)
+	{
+		const vmreg_t next_ip = ip + static_cast<vmreg_t>(Instruction::size());
+
+		// the second half of a superinstruction is read from _decoded, where a code write marks it stale, rather
+		// than next to d, which may be left in the shared program
+		const size_t second_slot = ip / Instruction::size() + 1;
+
+		switch (op)
+		{
+		case DecodedOp::cjmp:
+			_profiler->branch(ip, d.imm, _regs.get_flag(Flags::Test));
+			break;
+
+		case DecodedOp::cjmpr:
+			_profiler->branch(ip, _regs[d.a], _regs.get_flag(Flags::Test), true);
+			break;
+
+		case DecodedOp::call:
+		case DecodedOp::callr:
+			_profiler->call(_regs[SPRegisters::ip], _regs[SPRegisters::sp]);
+			break;
+
+		case DecodedOp::teq_cjmp:
+		case DecodedOp::tgt_cjmp:
+		case DecodedOp::tlt_cjmp:
+			_profiler->instruction(next_ip, Opcode::cjmp, _regs[SPRegisters::sp]);
+			_profiler->branch(next_ip, _decoded[second_slot].imm, _regs.get_flag(Flags::Test));
+			break;
+
+		case DecodedOp::imm_uadd:
+		case DecodedOp::push_push:
+		case DecodedOp::pop_pop: {
+			// a stale second half was not executed, and goes through the next fetch instead
+			const DecodedInstruction& next = _decoded[second_slot];
+			if (next.op != DecodedOp::stale)
+				_profiler->instruction(next_ip, static_cast<Opcode>(next.opcode), _regs[SPRegisters::sp]);
+		} break;
+
+		default:
+			break;
+		}
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::uncertified_code()
+	{
+		const vmreg_t ip = _regs[SPRegisters::ip];
+
+		_trap.code = TrapCode::UncertifiedCode;
+		_trap.opcode = fetch(ip).opcode;
+		_trap.ip = ip;
+		_trap.address = 0;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::invalid_instruction(const DecodedInstruction& d)
+	{
+		const vmreg_t ip = _regs[SPRegisters::ip];
+
+		_trap.code = size_t(ip) + Instruction::size() > _memory.size() ? TrapCode::InstructionOutOfBounds : TrapCode::InvalidInstruction;
+		_trap.opcode = d.opcode;
+		_trap.ip = ip;
+		_trap.address = 0;
+	}
+
+	template<typename Config>
+	DecodedInstruction BasicVM<Config>::decode_at(const vmreg_t address)
+	{
+		if (size_t(address) + Instruction::size() > _memory.size())
+			return DecodedInstruction{DecodedOp::invalid, 0, 0, 0, 0, 0};
+
+		uint8_t scratch[Instruction::size()];
+		DecodedInstruction d = decode_instruction(_memory.bytes(address, Instruction::size(), scratch));
+
+		// decode_instruction checks operands against the register file of the default configuration, while
+		// fibers only have the registers the program named when they were created
+		if (_regs.size() < Registers::size() && !registers_in_range(d, _regs.size()))
+			d.op = DecodedOp::invalid;
+
+		return d;
+	}
+
+	template<typename Config>
+	DecodedInstruction BasicVM<Config>::decode_instruction(const uint8_t* instruction)
+	{
+		DecodedInstruction d{DecodedOp::invalid, 0, 0, 0, 0, 0};
+
+		d.opcode = instruction[0];
+		const uint64_t argument = deserialize_type<uint64_t>(instruction + 1);
+
+		// @TODO Use C++17's structured bindings for the operand tuples
+
+		switch (static_cast<Opcode>(d.opcode))
+		{
+		case Opcode::imm:
+		case Opcode::hcall: {
+			const auto darg = decode<uint32_t, uint16_t>(argument);
+			d.imm = std::get<0>(darg);
+			d.b = std::get<1>(darg);
+		} break;
+
+		case Opcode::mov:
+		case Opcode::mget:
+		case Opcode::mset:
+		case Opcode::teq:
+		case Opcode::tgt:
+		case Opcode::tlt: {
+			const auto darg = decode<uint16_t, uint16_t>(argument);
+			d.a = std::get<0>(darg);
+			d.b = std::get<1>(darg);
+		} break;
+
+		case Opcode::cjmp:
+		case Opcode::call: {
+			const auto darg = decode<uint32_t>(argument);
+			d.imm = std::get<0>(darg);
+		} break;
+
+		case Opcode::cjmpr:
+		case Opcode::callr:
+		case Opcode::fjoin:
+		case Opcode::inc:
+		case Opcode::dec:
+		case Opcode::push:
+		case Opcode::pop: {
+			const auto darg = decode<uint16_t>(argument);
+			d.a = std::get<0>(darg);
+		} break;
+
+		case Opcode::sbit: {
+			const auto darg = decode<uint16_t, uint8_t, uint8_t>(argument);
+			d.a = std::get<0>(darg);
+			d.b = std::get<1>(darg) & 0b11111;
+			d.c = std::get<2>(darg) & 0b1;
+		} break;
+
+		case Opcode::gbit: {
+			const auto darg = decode<uint16_t, uint16_t, uint8_t>(argument);
+			d.a = std::get<0>(darg);
+			d.b = std::get<1>(darg);
+			d.c = std::get<2>(darg) & 0b11111;
+		} break;
+
+		case Opcode::shr:
+		case Opcode::shl:
+		case Opcode::uadd:
+		case Opcode::usub:
+		case Opcode::umul:
+		case Opcode::udiv:
+		case Opcode::umod:
+		case Opcode::mcpy:
+		case Opcode::mfill:
+		case Opcode::vadd:
+		case Opcode::vxor:
+		case Opcode::vsum:
+		case Opcode::fspawn:
+		case Opcode::acas:
+		case Opcode::aadd:
+		case Opcode::axchg: {
+			const auto darg = decode<uint16_t, uint16_t, uint16_t>(argument);
+			d.a = std::get<0>(darg);
+			d.b = std::get<1>(darg);
+			d.c = std::get<2>(darg);
+		} break;
+
+		case Opcode::mcmp:
+		case Opcode::mfind: {
+			const auto darg = decode<uint16_t, uint16_t, uint16_t, uint16_t>(argument);
+			d.a = std::get<0>(darg);
+			d.b = std::get<1>(darg);
+			d.c = std::get<2>(darg);
+			d.imm = std::get<3>(darg);
+		} break;
+
+		case Opcode::__PLACEHOLDER_EXIT:
+		case Opcode::fyield:
+		case Opcode::fence:
+			break;
+
+		default:
+			return d;
+		}
+
+		d.op = static_cast<DecodedOp>(d.opcode);
+
+		// operands past the register file would address host memory
+		if (!registers_in_range(d, Registers::sp_count() + Registers::gp_count()))
+			d.op = DecodedOp::invalid;
+
+		return d;
+	}
+
+	template<typename Config>
+	const DecodedInstruction& BasicVM<Config>::fetch(const vmreg_t address)
+	{
+		const size_t slot = address / Instruction::size();
+		if (slot < _decoded_size && slot * Instruction::size() == address)
+		{
+			// stale entries only exist once the pre-decoded program is private
+			const DecodedInstruction& d = _decoded[slot];
+			if (d.op == DecodedOp::stale)
+				_decoded_private[slot] = decode_at(address);
+
+			return d;
+		}
+
+		_decoded_scratch = decode_at(address);
+		return _decoded_scratch;
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::invalidate(const vmreg_t address, const size_t size)
+	{
+		// the image is shared with other VMs, so the pre-decoded program is copied on the first code write
+		if (_decoded_private.empty())
+		{
+			_decoded_private.assign(_decoded, _decoded + _decoded_size);
+			_decoded = _decoded_private.data();
+		}
+
+		size_t first = address / Instruction::size();
+		const size_t last = std::min((size_t(address) + size - 1) / Instruction::size() + 1, _decoded_size);
+
+		// a superinstruction right before the range also executes its first instruction
+		if (first > 0 && first <= _decoded_size && unfused(_decoded[first - 1].op) != _decoded[first - 1].op)
+			--first;
+
+		for (size_t i = first; i < last; ++i)
+		{
+			_decoded_private[i].op = DecodedOp::stale;
+		}
+
+		_code_modified = true;
+
+		if (_jit)
+			_jit->flush();
+	}
+
+	template<typename Config>
+	vmreg_t BasicVM<Config>::load(const vmreg_t address)
+	{
+		return _memory.load(address);
+	}
+
+	template<typename Config>
+	void BasicVM<Config>::store(const vmreg_t address, const vmreg_t value)
+	{
+		_memory.store(address, value);
+
+		if (address < _decoded_size * Instruction::size())
+			invalidate(address, sizeof(vmreg_t));
+	}
 }
 
 #endif
@@ -0,0 +1,81 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "thallium/aot.hpp"
+#include "thallium/image.hpp"
+#include "thallium/error.hpp"
+
+using namespace thallium;
+
+void usage()
+{
+	std::cout << "usage: thalliumvm_aot PROGRAM [options]\n"
+				 "  compiles a program file written by ProgramImage::save ahead of time, so that VMs running it\n"
+				 "  with Engine::Aot load it from the cache\n"
+				 "  --source FILE       only write the C++ translation unit to FILE\n"
+				 "  --output FILE       build the shared object to FILE rather than to the cache\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 2;
+	}
+
+	const std::string program = argv[1];
+	std::string source, output;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (arg == "--source" && has_value)
+			source = argv[++i];
+		else if (arg == "--output" && has_value)
+			output = argv[++i];
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+
+	try {
+		const std::shared_ptr<const ProgramImage> image = ProgramImage::load(program);
+
+		if (!source.empty())
+		{
+			std::ofstream out(source);
+			out << AotModule::translate(*image);
+
+			tassert(static_cast<bool>(out),
+					TimeOfError::Preload, ErrorType::Fatal,
+					"could not write " + source + ".");
+
+			return 0;
+		}
+
+		if (!output.empty())
+		{
+			tassert(AotModule::build(*image, output),
+					TimeOfError::Preload, ErrorType::Fatal,
+					"could not compile " + program + " with " + AotModule::compiler() + ".");
+
+			return 0;
+		}
+
+		tassert(AotModule::get(*image) != nullptr,
+				TimeOfError::Preload, ErrorType::Fatal,
+				"could not compile " + program + " with " + AotModule::compiler() + ".");
+
+		std::cout << AotModule::cache_path(*image) << '\n';
+	} catch (const VMException& e)
+	{
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+#include "thallium/image.hpp"
+#include "thallium/error.hpp"
+
+using namespace thallium;
+
+void usage()
+{
+	std::cout << "usage: thalliumvm_convert INPUT OUTPUT [options]\n"
+				 "  rewrites a program file written by ProgramImage::save in another encoding, any version being\n"
+				 "  accepted as input\n"
+				 "  --encoding ENCODING packed, mapped in place when loaded (default)\n"
+				 "                      aligned, 8-byte words, smaller but expanded when loaded\n"
+				 "                      translated, packed followed by the pre-decoded program, mapped as well\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		usage();
+		return 2;
+	}
+
+	const std::string input = argv[1];
+	const std::string output = argv[2];
+	ProgramEncoding encoding = ProgramEncoding::Packed;
+
+	for (int i = 3; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		const std::string value = has_value ? argv[i + 1] : "";
+
+		if (arg == "--encoding" && value == "packed")
+			encoding = ProgramEncoding::Packed;
+		else if (arg == "--encoding" && value == "aligned")
+			encoding = ProgramEncoding::Aligned;
+		else if (arg == "--encoding" && value == "translated")
+			encoding = ProgramEncoding::Translated;
+		else
+		{
+			usage();
+			return 2;
+		}
+
+		++i;
+	}
+
+	try {
+		ProgramImage::load(input)->save(output, encoding);
+	} catch (const VMException& e)
+	{
+		return 1;
+	}
+
+	return 0;
+}
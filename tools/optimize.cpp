@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "thallium/image.hpp"
+#include "thallium/optimizer.hpp"
+#include "thallium/error.hpp"
+
+using namespace thallium;
+
+void usage()
+{
+	std::cout << "usage: thalliumvm_optimize INPUT OUTPUT [options]\n"
+				 "  optimizes a program file written by ProgramImage::save, see thallium/optimizer.hpp for the rules\n"
+				 "  the program has to follow, and prints what was done\n"
+				 "  --outputs R1,R2,... registers read by the host after exit (default: all of them)\n"
+				 "  --encoding ENCODING packed, mapped in place when loaded (default)\n"
+				 "                      aligned, 8-byte words, smaller but expanded when loaded\n"
+				 "                      translated, packed followed by the pre-decoded program, mapped as well\n";
+}
+
+bool parse_registers(const std::string& list, std::vector<uint16_t>& registers)
+{
+	std::istringstream in(list);
+	std::string item;
+
+	while (std::getline(in, item, ','))
+	{
+		if (item.size() > 1 && item[0] == 'r')
+			item.erase(0, 1);
+
+		if (item.empty() || item.find_first_not_of("0123456789") != std::string::npos || item.size() > 5)
+			return false;
+
+		registers.push_back(static_cast<uint16_t>(std::stoul(item)));
+	}
+
+	return !registers.empty();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		usage();
+		return 2;
+	}
+
+	const std::string input = argv[1];
+	const std::string output = argv[2];
+	ProgramEncoding encoding = ProgramEncoding::Packed;
+	std::vector<uint16_t> outputs;
+
+	for (int i = 3; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		const std::string value = has_value ? argv[i + 1] : "";
+
+		if (arg == "--encoding" && value == "packed")
+			encoding = ProgramEncoding::Packed;
+		else if (arg == "--encoding" && value == "aligned")
+			encoding = ProgramEncoding::Aligned;
+		else if (arg == "--encoding" && value == "translated")
+			encoding = ProgramEncoding::Translated;
+		else if (!(arg == "--outputs" && parse_registers(value, outputs)))
+		{
+			usage();
+			return 2;
+		}
+
+		++i;
+	}
+
+	try {
+		const OptimizedProgram optimized = optimize(*ProgramImage::load(input), outputs);
+		const OptimizerStats& stats = optimized.stats;
+
+		if (!stats.diagnostic.empty())
+			std::cerr << input << " left as is: " << stats.diagnostic << '\n';
+
+		std::cout << "instructions " << stats.instructions_before << " -> " << stats.instructions_after << '\n'
+				  << "  folded       " << stats.folded << '\n'
+				  << "  propagated   " << stats.propagated << '\n'
+				  << "  dead         " << stats.dead << '\n'
+				  << "  unreachable  " << stats.unreachable << '\n'
+				  << "  threaded     " << stats.threaded << '\n'
+				  << "  jumps        " << stats.jumps << '\n'
+				  << "  push/pop     " << stats.pairs << '\n';
+
+		ProgramImage::create(optimized.program, optimized.entry, optimized.initial_sp)->save(output, encoding);
+	} catch (const VMException& e)
+	{
+		return 1;
+	}
+
+	return 0;
+}